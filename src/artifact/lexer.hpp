@@ -60,7 +60,7 @@ public:
 			}
 			return this->current;
 		}
-		log::Trace("Entry name: " + entry.value().Name());
+		log::Trace([&entry]() { return "Entry name: " + entry.value().Name(); });
 		this->current = Token {entry.value().Name(), entry.value()};
 		return current;
 	}
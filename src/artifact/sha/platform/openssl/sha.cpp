@@ -19,12 +19,14 @@
 #include <vector>
 #include <sstream>
 #include <algorithm>
+#include <chrono>
 
 #include <openssl/evp.h>
 #include <artifact/sha/sha.hpp>
 
 #include <common/common.hpp>
 #include <common/io.hpp>
+#include <common/metrics.hpp>
 
 
 namespace mender {
@@ -34,6 +36,7 @@ static const size_t SHA_256_digest_length = 32;
 
 namespace log = mender::common::log;
 namespace io = mender::common::io;
+namespace metrics = mender::common::metrics;
 
 
 Reader::Reader(io::Reader &reader, const std::string &expected_sha) :
@@ -78,9 +81,12 @@ expected::ExpectedSize Reader::Read(
 		return 0;
 	}
 
+	static metrics::Stage stage("sha");
+	auto digest_start = std::chrono::steady_clock::now();
 	if (EVP_DigestUpdate(sha_handle_.get(), &start[0], bytes_read.value()) != 1) {
 		return expected::unexpected(MakeError(ShasumCreationError, "Failed to create the shasum"));
 	}
+	stage.Record(bytes_read.value(), std::chrono::steady_clock::now() - digest_start);
 
 	return bytes_read.value();
 }
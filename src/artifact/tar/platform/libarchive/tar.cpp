@@ -45,6 +45,7 @@ Reader::Reader(mender::common::io::Reader &reader) :
 // Read the next Tar header, and populate the meta-data:
 // * name
 // * Archive size
+// * File system attributes
 ExpectedEntry Reader::Next() {
 	struct archive_entry *current_entry;
 
@@ -79,7 +80,36 @@ ExpectedEntry Reader::Next() {
 			MakeError(TarReaderError, "Failed to get the size of the archive"));
 	}
 
-	return Entry(archive_name, archive_entry_size_, *this);
+	EntryMetadata metadata;
+	switch (archive_entry_filetype(current_entry)) {
+	case AE_IFREG:
+		metadata.type = EntryType::Regular;
+		break;
+	case AE_IFDIR:
+		metadata.type = EntryType::Directory;
+		break;
+	case AE_IFLNK:
+		metadata.type = EntryType::Symlink;
+		break;
+	default:
+		metadata.type = EntryType::Other;
+		break;
+	}
+	// Hardlinks are stored as regular files without data, which refer to an earlier entry.
+	const char *hardlink = archive_entry_hardlink(current_entry);
+	const char *symlink = archive_entry_symlink(current_entry);
+	if (hardlink != nullptr) {
+		metadata.type = EntryType::Hardlink;
+		metadata.link_target = hardlink;
+	} else if (metadata.type == EntryType::Symlink && symlink != nullptr) {
+		metadata.link_target = symlink;
+	}
+	metadata.mode = static_cast<uint32_t>(archive_entry_perm(current_entry));
+	metadata.uid = archive_entry_uid(current_entry);
+	metadata.gid = archive_entry_gid(current_entry);
+	metadata.mtime = archive_entry_mtime(current_entry);
+
+	return Entry(archive_name, archive_entry_size_, *this, metadata);
 }
 
 } // namespace tar
@@ -17,6 +17,7 @@
 #include <archive.h>
 
 #include <common/log.hpp>
+#include <common/metrics.hpp>
 
 #include <artifact/tar/tar_errors.hpp>
 
@@ -27,6 +28,7 @@ namespace wrapper {
 size_t libarchive_read_buffer_size {MENDER_BUFSIZE};
 
 namespace expected = mender::common::expected;
+namespace metrics = mender::common::metrics;
 
 using ExpectedSize = expected::ExpectedSize;
 
@@ -42,8 +44,10 @@ using ExpectedSize = expected::ExpectedSize;
 ssize_t reader_callback(archive *archive, void *in_reader_container, const void **buff) {
 	ReaderContainer *p_reader_container = static_cast<ReaderContainer *>(in_reader_container);
 
+	auto read_start = chrono::steady_clock::now();
 	auto ret = p_reader_container->reader_.Read(
 		p_reader_container->buff_.begin(), p_reader_container->buff_.end());
+	p_reader_container->upstream_time_ += chrono::steady_clock::now() - read_start;
 	if (!ret) {
 		archive_set_error(archive, ret.error().code.value(), "%s", ret.error().message.c_str());
 		return -1;
@@ -118,8 +122,18 @@ ExpectedSize Handle::Read(vector<uint8_t>::iterator start, vector<uint8_t>::iter
 			common::error::GenericError,
 			"Unable to read from a tar reader which is not initialized properly"));
 	}
+	static metrics::Stage stage("tar");
+
 	size_t iterator_size {static_cast<size_t>(end - start)};
+	auto upstream_time_before = reader_container_.upstream_time_;
+	auto read_start = chrono::steady_clock::now();
 	ssize_t read_bytes {archive_read_data(archive_.get(), &start[0], iterator_size)};
+	if (read_bytes > 0) {
+		stage.Record(
+			static_cast<size_t>(read_bytes),
+			chrono::steady_clock::now() - read_start
+				- (reader_container_.upstream_time_ - upstream_time_before));
+	}
 
 	switch (read_bytes) {
 	/* Fallthroughs */
@@ -20,6 +20,7 @@
 #include <archive.h>
 #include <archive_entry.h>
 
+#include <chrono>
 #include <memory>
 #include <vector>
 
@@ -44,6 +45,9 @@ namespace log = mender::common::log;
 struct ReaderContainer {
 	mender::common::io::Reader &reader_;
 	std::vector<uint8_t> buff_;
+	// Time spent waiting for the upstream reader, so that it can be left out of the time
+	// attributed to unpacking.
+	std::chrono::steady_clock::duration upstream_time_ {0};
 
 	ReaderContainer(mender::common::io::Reader &reader, size_t block_size) :
 		reader_ {reader},
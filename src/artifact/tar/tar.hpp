@@ -42,10 +42,31 @@ namespace io = mender::common::io;
 using Error = error::Error;
 using ExpectedSize = expected::ExpectedSize;
 
+enum class EntryType {
+	Regular,
+	Directory,
+	Symlink,
+	Hardlink,
+	Other,
+};
+
+// File system attributes of an entry. Artifacts only contain regular files, so these only matter
+// when unpacking arbitrary archives, such as the payload of the `directory` Update Module.
+struct EntryMetadata {
+	EntryType type {EntryType::Regular};
+	uint32_t mode {0644};
+	int64_t uid {0};
+	int64_t gid {0};
+	int64_t mtime {0};
+	// Target of symlinks and hardlinks.
+	string link_target;
+};
+
 class Entry : public io::Reader {
 private:
 	string name_;
 	int64_t total_size_;
+	EntryMetadata metadata_;
 
 	Reader &reader_;
 
@@ -53,9 +74,14 @@ private:
 	int64_t nr_bytes_read_ {0};
 
 public:
-	Entry(const string &name, int64_t archive_size, Reader &reader) :
+	Entry(
+		const string &name,
+		int64_t archive_size,
+		Reader &reader,
+		const EntryMetadata &metadata = EntryMetadata()) :
 		name_ {name},
 		total_size_ {archive_size},
+		metadata_ {metadata},
 		reader_ {reader} {
 	}
 
@@ -67,6 +93,10 @@ public:
 		return total_size_;
 	}
 
+	const EntryMetadata &Metadata() {
+		return metadata_;
+	}
+
 	ExpectedSize Read(vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) override;
 };
 
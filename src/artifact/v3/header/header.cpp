@@ -85,6 +85,8 @@ ExpectedHeader Parse(io::Reader &reader, ParserConfig conf) {
 
 	tok = lexer.Next();
 	vector<ArtifactScript> state_scripts {};
+	// Everything is written first, and then synced in one go.
+	path::SyncBatch sync_batch;
 	if (tok.type == token::Type::ArtifactScripts) {
 		if (conf.artifact_scripts_filesystem_path == "") {
 			return expected::unexpected(
@@ -133,6 +135,7 @@ ExpectedHeader Parse(io::Reader &reader, ParserConfig conf) {
 		}
 
 		state_scripts.push_back(artifact_script_path);
+		sync_batch.Add(artifact_script_path);
 
 		// Set the permissions on the installed Artifact scripts
 		err = path::Permissions(
@@ -160,15 +163,18 @@ ExpectedHeader Parse(io::Reader &reader, ParserConfig conf) {
 					+ artifact_script_version_file));
 		}
 		myfile << to_string(conf.artifact_scripts_version);
+		myfile.close();
 		if (!myfile.good()) {
 			auto io_errno = errno;
 			return expected::unexpected(error::Error(
 				std::generic_category().default_error_condition(io_errno),
 				"I/O error writing the Artifact scripts version file"));
 		}
+		sync_batch.Add(artifact_script_version_file);
+		sync_batch.Add(conf.artifact_scripts_filesystem_path);
 
-		// Sync the directory so we know it is permanent.
-		auto err = path::DataSyncRecursively(conf.artifact_scripts_filesystem_path);
+		// Sync the scripts so we know they are permanent.
+		auto err = sync_batch.Sync();
 		if (err != error::NoError) {
 			return expected::unexpected(err.WithContext("While syncing artifact script directory"));
 		}
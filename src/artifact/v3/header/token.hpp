@@ -102,7 +102,7 @@ public:
 
 private:
 	Type StringToType(const string &type_name) {
-		log::Trace("StringToType: " + type_name);
+		log::Trace([&type_name]() { return "StringToType: " + type_name; });
 		if (type_name == "header-info") {
 			return Type::HeaderInfo;
 		}
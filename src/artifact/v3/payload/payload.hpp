@@ -46,7 +46,8 @@ class Reader : virtual public io::Reader {
 public:
 	Reader(tar::Entry &&entry, const string &checksum) :
 		entry_ {make_shared<tar::Entry>(entry)},
-		reader_ {make_shared<sha::Reader>(sha::Reader {*entry_, checksum})} {};
+		reader_ {make_shared<sha::Reader>(sha::Reader {*entry_, checksum})},
+		checksum_ {checksum} {};
 
 
 	ExpectedSize Read(vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) override;
@@ -57,10 +58,15 @@ public:
 	int64_t Size() {
 		return this->entry_->Size();
 	}
+	// The checksum from the manifest, which the data is verified against while reading.
+	string Checksum() {
+		return this->checksum_;
+	}
 
 private:
 	shared_ptr<tar::Entry> entry_;
 	shared_ptr<sha::Reader> reader_;
+	string checksum_;
 };
 
 using ExpectedPayloadReader = expected::expected<Reader, error::Error>;
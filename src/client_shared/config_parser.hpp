@@ -47,6 +47,38 @@ struct ClientSecurity {
 	string ssl_engine;
 };
 
+/** Settings for the rootfs-image writer which is built into the client. When enabled, the
+	client writes rootfs-image payloads to the inactive partition itself, instead of passing them
+	to the rootfs-image Update Module. The other states are still handled by the module. */
+struct RootfsImageWriter {
+	bool enabled = false;
+
+	/** Write with O_DIRECT, bypassing the page cache. */
+	bool direct_io = true;
+
+	/** How many bytes to write before pushing them to the device. Without direct I/O, this is
+		the size of the write-behind window used with sync_file_range(). With direct I/O, it is
+		how often fdatasync() is called. 0 means that data is only synced at the end. */
+	int64_t sync_interval_bytes = 8 * 1024 * 1024;
+
+	/** Read the partition back after writing, and compare it with the payload checksum. */
+	bool verify = true;
+
+	/** Don't write blocks which are all zeros. Instead they are zeroed out on the device with
+		BLKZEROOUT, which is usually much faster, and doesn't wear the flash. */
+	bool skip_zero_blocks = false;
+
+	/** The inactive partition is known to read back as zeros, for instance because it was
+		discarded when it was provisioned. With `skip_zero_blocks`, zero blocks are then not
+		touched at all. */
+	bool target_pre_discarded = false;
+
+	/** How often to record how far the write has come, so that it can continue from there if
+		it is interrupted, for instance by a power loss, and the same payload is installed
+		again. 0 disables checkpoints. */
+	int64_t checkpoint_interval_bytes = 64 * 1024 * 1024;
+};
+
 /** Connectivity parameters. This option was removed in Mender 	v4.0.0, where we don't make use
 	of HTTP Keep-Alive so there is no need to disable it or configure it. */
 // struct ClientConnectivity {
@@ -93,11 +125,14 @@ public:
 		of HTTP Keep-Alive so there is no need to disable it or configure it. */
 	// ClientConnectivity connectivity;
 
-	/** Rootfs device paths. These are not parsed by the client anymore, since rootfs updates
-		are now handled by an update module. But for historical reasons, they still share config
-		files, so these options can still be in the file. */
-	// string rootfs_part_A;
-	// string rootfs_part_B;
+	/** Rootfs device paths. These are normally only used by the rootfs-image Update Module,
+		which reads them from the same config files, but the client needs them when
+		`rootfs_image_writer` is enabled. */
+	string rootfs_part_A;
+	string rootfs_part_B;
+
+	/** Built-in rootfs-image writer */
+	RootfsImageWriter rootfs_image_writer;
 
 	/** Command to set active partition. These are not parsed by the client anymore, since
 		rootfs updates are now handled by an update module, which doesn't care about these
@@ -127,9 +162,20 @@ public:
 	/** Poll interval for checking for new updates */
 	int update_poll_interval_seconds = 1800;
 
+	/** Longest time the server may hold a deployment check open, waiting for a deployment to
+		appear, before answering that there is none. When the server supports this, the next
+		check is made right away instead of after `update_poll_interval_seconds`. 0 disables
+		long polling. */
+	int deployment_long_poll_seconds = 0;
+
 	/** Poll interval for periodically sending inventory data */
 	int inventory_poll_interval_seconds = 28800;
 
+	/** Interval for submitting the complete inventory, even if only some of it, or none of it,
+		has changed. In between, only changed attributes are submitted. 0 disables the periodic
+		full submission. */
+	int inventory_full_sync_interval_seconds = 86400; // 24 hours
+
 	/** Skip CA certificate validation */
 	bool skip_verify = false;
 
@@ -151,6 +197,24 @@ public:
 		be killed. */
 	int module_timeout_seconds = 14400; // 4 hours
 
+	/** Start Update Modules which support it only once per deployment, and pass the states
+		to them over a FIFO, instead of executing them once for each state. */
+	bool update_module_sessions = false;
+
+	/** Payload types which are handled by the Update Modules built into the client, instead of
+		by the ones installed on the device. Supported types are `directory` and `single-file`. */
+	vector<string> builtin_update_modules;
+
+	/** Let writes of data which is cheap to lose, such as download checkpoints and inventory
+		data, skip part of the waiting for storage. A power loss may undo the latest of them, but
+		not any other data. They are made durable by the next write of critical data, such as
+		the deployment state. */
+	bool database_deferred_sync = false;
+
+	/** Keep the values of the most frequently read keys of the database, such as the provides
+		of the installed Artifact, in memory. */
+	bool database_cache = true;
+
 	/** Path to server SSL certificate */
 	string server_certificate;
 
@@ -162,6 +226,14 @@ public:
 	/** Path to deployment log file */
 	string update_log_path;
 
+	/** Largest size of a deployment log, uncompressed, in KiB. Beyond that, only the start and
+		the end of the log are kept. 0 means no limit. */
+	int deployment_log_max_size_kib = 1024;
+
+	/** Write a timeline of each deployment in the Chrome trace format, next to the deployment
+		logs, and rotate it together with them. */
+	bool deployment_tracing = false;
+
 	/** Server JWT TenantToken */
 	string tenant_token;
 
@@ -174,6 +246,18 @@ public:
 	/** Log level which takes effect right before daemon startup */
 	string daemon_log_level;
 
+	/** Number of log records the daemon may queue up for its background log writer. 0 makes
+		the daemon format and write log records synchronously, as they are logged. */
+	int daemon_log_queue_size = 0;
+
+	/** What the daemon does with a log record when the log queue is full: "drop" it, or
+		"block" until there is room. Empty means "drop". */
+	string daemon_log_overflow_policy;
+
+	/** Log the event loop callbacks of the daemon which run for longer than this, blocking all
+		other work, and record the run time of every callback in the metrics. 0 disables both. */
+	int daemon_stall_threshold_milliseconds = 0;
+
 	/**
 	 * Loads values from the given file and overrides the current values of the
 	 * respective above fields with them.
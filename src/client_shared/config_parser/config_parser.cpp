@@ -95,6 +95,16 @@ ExpectedBool MenderConfigFromFile::LoadFile(const string &path) {
 		}
 	}
 
+	e_cfg_value = cfg_json.Get("DeploymentLogMaxSizeKiB");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const auto e_cfg_int = value_json.Get<int>();
+		if (e_cfg_int) {
+			this->deployment_log_max_size_kib = e_cfg_int.value();
+			applied = true;
+		}
+	}
+
 	e_cfg_value = cfg_json.Get("TenantToken");
 	if (e_cfg_value) {
 		const json::Json value_json = e_cfg_value.value();
@@ -131,6 +141,16 @@ ExpectedBool MenderConfigFromFile::LoadFile(const string &path) {
 		}
 	}
 
+	e_cfg_value = cfg_json.Get("DaemonLogOverflowPolicy");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const json::ExpectedString e_cfg_string = value_json.GetString();
+		if (e_cfg_string) {
+			this->daemon_log_overflow_policy = e_cfg_string.value();
+			applied = true;
+		}
+	}
+
 	/* Boolean values now */
 	e_cfg_value = cfg_json.Get("SkipVerify");
 	if (e_cfg_value) {
@@ -142,6 +162,56 @@ ExpectedBool MenderConfigFromFile::LoadFile(const string &path) {
 		}
 	}
 
+	e_cfg_value = cfg_json.Get("UpdateModuleSessions");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const json::ExpectedBool e_cfg_bool = value_json.GetBool();
+		if (e_cfg_bool) {
+			this->update_module_sessions = e_cfg_bool.value();
+			applied = true;
+		}
+	}
+
+	e_cfg_value = cfg_json.Get("DeploymentTracing");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const json::ExpectedBool e_cfg_bool = value_json.GetBool();
+		if (e_cfg_bool) {
+			this->deployment_tracing = e_cfg_bool.value();
+			applied = true;
+		}
+	}
+
+	e_cfg_value = cfg_json.Get("BuiltinUpdateModules");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const auto e_cfg_vector = value_json.Get<vector<string>>();
+		if (e_cfg_vector) {
+			this->builtin_update_modules = e_cfg_vector.value();
+			applied = true;
+		}
+	}
+
+	e_cfg_value = cfg_json.Get("DatabaseDeferredSync");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const json::ExpectedBool e_cfg_bool = value_json.GetBool();
+		if (e_cfg_bool) {
+			this->database_deferred_sync = e_cfg_bool.value();
+			applied = true;
+		}
+	}
+
+	e_cfg_value = cfg_json.Get("DatabaseCache");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const json::ExpectedBool e_cfg_bool = value_json.GetBool();
+		if (e_cfg_bool) {
+			this->database_cache = e_cfg_bool.value();
+			applied = true;
+		}
+	}
+
 	e_cfg_value = cfg_json.Get("UpdatePollIntervalSeconds");
 	if (e_cfg_value) {
 		const json::Json value_json = e_cfg_value.value();
@@ -152,6 +222,36 @@ ExpectedBool MenderConfigFromFile::LoadFile(const string &path) {
 		}
 	}
 
+	e_cfg_value = cfg_json.Get("DeploymentLongPollSeconds");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const auto e_cfg_int = value_json.Get<int>();
+		if (e_cfg_int) {
+			this->deployment_long_poll_seconds = e_cfg_int.value();
+			applied = true;
+		}
+	}
+
+	e_cfg_value = cfg_json.Get("DaemonLogQueueSize");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const auto e_cfg_int = value_json.Get<int>();
+		if (e_cfg_int) {
+			this->daemon_log_queue_size = e_cfg_int.value();
+			applied = true;
+		}
+	}
+
+	e_cfg_value = cfg_json.Get("DaemonStallThresholdMilliseconds");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const auto e_cfg_int = value_json.Get<int>();
+		if (e_cfg_int) {
+			this->daemon_stall_threshold_milliseconds = e_cfg_int.value();
+			applied = true;
+		}
+	}
+
 	e_cfg_value = cfg_json.Get("InventoryPollIntervalSeconds");
 	if (e_cfg_value) {
 		const json::Json value_json = e_cfg_value.value();
@@ -162,6 +262,16 @@ ExpectedBool MenderConfigFromFile::LoadFile(const string &path) {
 		}
 	}
 
+	e_cfg_value = cfg_json.Get("InventoryFullSyncIntervalSeconds");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const auto e_cfg_int = value_json.Get<int>();
+		if (e_cfg_int) {
+			this->inventory_full_sync_interval_seconds = e_cfg_int.value();
+			applied = true;
+		}
+	}
+
 	e_cfg_value = cfg_json.Get("RetryPollIntervalSeconds");
 	if (e_cfg_value) {
 		const json::Json value_json = e_cfg_value.value();
@@ -348,6 +458,93 @@ ExpectedBool MenderConfigFromFile::LoadFile(const string &path) {
 		}
 	}
 
+	e_cfg_value = cfg_json.Get("RootfsPartA");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const json::ExpectedString e_cfg_string = value_json.GetString();
+		if (e_cfg_string) {
+			this->rootfs_part_A = e_cfg_string.value();
+			applied = true;
+		}
+	}
+
+	e_cfg_value = cfg_json.Get("RootfsPartB");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		const json::ExpectedString e_cfg_string = value_json.GetString();
+		if (e_cfg_string) {
+			this->rootfs_part_B = e_cfg_string.value();
+			applied = true;
+		}
+	}
+
+	e_cfg_value = cfg_json.Get("RootfsImageWriter");
+	if (e_cfg_value) {
+		const json::Json value_json = e_cfg_value.value();
+		json::ExpectedJson e_cfg_subval = value_json.Get("Enabled");
+		if (e_cfg_subval) {
+			const json::ExpectedBool e_cfg_bool = e_cfg_subval.value().GetBool();
+			if (e_cfg_bool) {
+				this->rootfs_image_writer.enabled = e_cfg_bool.value();
+				applied = true;
+			}
+		}
+
+		e_cfg_subval = value_json.Get("DirectIO");
+		if (e_cfg_subval) {
+			const json::ExpectedBool e_cfg_bool = e_cfg_subval.value().GetBool();
+			if (e_cfg_bool) {
+				this->rootfs_image_writer.direct_io = e_cfg_bool.value();
+				applied = true;
+			}
+		}
+
+		e_cfg_subval = value_json.Get("SyncIntervalBytes");
+		if (e_cfg_subval) {
+			const auto e_cfg_int = e_cfg_subval.value().Get<int64_t>();
+			if (e_cfg_int) {
+				this->rootfs_image_writer.sync_interval_bytes = e_cfg_int.value();
+				applied = true;
+			}
+		}
+
+		e_cfg_subval = value_json.Get("Verify");
+		if (e_cfg_subval) {
+			const json::ExpectedBool e_cfg_bool = e_cfg_subval.value().GetBool();
+			if (e_cfg_bool) {
+				this->rootfs_image_writer.verify = e_cfg_bool.value();
+				applied = true;
+			}
+		}
+
+		e_cfg_subval = value_json.Get("SkipZeroBlocks");
+		if (e_cfg_subval) {
+			const json::ExpectedBool e_cfg_bool = e_cfg_subval.value().GetBool();
+			if (e_cfg_bool) {
+				this->rootfs_image_writer.skip_zero_blocks = e_cfg_bool.value();
+				applied = true;
+			}
+		}
+
+		e_cfg_subval = value_json.Get("TargetPreDiscarded");
+		if (e_cfg_subval) {
+			const json::ExpectedBool e_cfg_bool = e_cfg_subval.value().GetBool();
+			if (e_cfg_bool) {
+				this->rootfs_image_writer.target_pre_discarded = e_cfg_bool.value();
+				applied = true;
+			}
+		}
+
+		e_cfg_subval = value_json.Get("CheckpointIntervalBytes");
+		if (e_cfg_subval) {
+			const auto e_cfg_int = e_cfg_subval.value().Get<int64_t>();
+			if (e_cfg_int) {
+				this->rootfs_image_writer.checkpoint_interval_bytes = e_cfg_int.value();
+				applied = true;
+			}
+		}
+	}
+
 	e_cfg_value = cfg_json.Get("Security");
 	if (e_cfg_value) {
 		const json::Json value_json = e_cfg_value.value();
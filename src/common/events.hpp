@@ -17,12 +17,15 @@
 
 #include <common/config.h>
 
+#include <chrono>
 #include <functional>
+#include <string>
 #include <system_error>
 #include <vector>
 
 #include <common/error.hpp>
 #include <common/io.hpp>
+#include <common/metrics.hpp>
 
 #ifdef MENDER_USE_BOOST_ASIO
 #include <boost/asio.hpp>
@@ -42,6 +45,7 @@ namespace asio = boost::asio;
 
 namespace error = mender::common::error;
 namespace mio = mender::common::io;
+namespace metrics = mender::common::metrics;
 
 class EventLoop {
 public:
@@ -55,14 +59,69 @@ public:
 	// cancellation condition before doing its work.
 	//
 	// Thread-safe.
-	void Post(function<void()> func);
+	//
+	// `tag` says what the function does, and the location of the caller is filled in
+	// automatically. Both are only used to report stalls. Code which posts on behalf of others,
+	// such as the state machine, should set the tag, since its own location says little.
+	void Post(
+		function<void()> func,
+		const string &tag = "",
+		const char *caller_file = __builtin_FILE(),
+		int caller_line = __builtin_LINE());
+
+	// Measures how long each callback registered with `Post()` or `Timer::AsyncWait()` runs,
+	// and thereby blocks everything else on the loop, into the
+	// `mender_event_loop_callback_seconds` histogram, and logs the callbacks which run for
+	// longer than `threshold`, together with their tag and where they were registered. Time spent in
+	// recursive invocations of `Run()` is not counted against the callback which started them.
+	//
+	// Completion handlers of other I/O operations are not measured, since the loop can't tell
+	// how long they ran apart from how long it waited for the operation before running them.
+	//
+	// Must be called before any callbacks are registered.
+	void EnableStallDetection(chrono::steady_clock::duration threshold);
 
 private:
+	// Returns `func`, wrapped so that its run time is measured if stall detection is enabled.
+	template <typename... Args>
+	function<void(Args...)> Measured(
+		function<void(Args...)> func,
+		const string &tag,
+		const char *caller_file,
+		int caller_line) {
+		if (callback_seconds_ == nullptr) {
+			return func;
+		}
+		return [this, func, tag, caller_file, caller_line](Args... args) {
+			auto start = chrono::steady_clock::now();
+			auto recursive_before = recursive_run_time_;
+			func(args...);
+			RecordCallback(
+				chrono::steady_clock::now() - start - (recursive_run_time_ - recursive_before),
+				tag,
+				caller_file,
+				caller_line);
+		};
+	}
+
+	void RecordCallback(
+		chrono::steady_clock::duration spent,
+		const string &tag,
+		const char *caller_file,
+		int caller_line);
+
 #ifdef MENDER_USE_BOOST_ASIO
 	asio::io_context ctx_;
 #endif // MENDER_USE_BOOST_ASIO
 
+	chrono::steady_clock::duration stall_threshold_ {0};
+	metrics::Histogram *callback_seconds_ {nullptr};
+	metrics::Counter *stalls_ {nullptr};
+	// Total time spent in recursive invocations of `Run()`, only kept with stall detection.
+	chrono::steady_clock::duration recursive_run_time_ {0};
+
 	friend class EventLoopObject;
+	friend class Timer;
 };
 
 class EventLoopObject {
@@ -98,8 +157,14 @@ public:
 		*active_ = false;
 	}
 
+	// The location of the caller is filled in automatically, see `EventLoop::Post()`.
 	template <typename Duration>
-	void AsyncWait(Duration duration, EventHandler handler) {
+	void AsyncWait(
+		Duration duration,
+		EventHandler handler,
+		const char *caller_file = __builtin_FILE(),
+		int caller_line = __builtin_LINE()) {
+		handler = loop_->Measured(handler, "", caller_file, caller_line);
 		*active_ = true;
 		timer_.expires_after(duration);
 		auto &destroying = destroying_;
@@ -131,6 +196,7 @@ public:
 	};
 
 private:
+	EventLoop *loop_;
 #ifdef MENDER_USE_BOOST_ASIO
 	asio::steady_timer timer_;
 	shared_ptr<bool> destroying_;
@@ -14,6 +14,8 @@
 
 #include <common/events_io.hpp>
 
+#include <common/common.hpp>
+
 namespace mender {
 namespace common {
 namespace events {
@@ -21,7 +23,8 @@ namespace io {
 
 AsyncReaderFromReader::AsyncReaderFromReader(EventLoop &loop, mio::ReaderPtr reader) :
 	reader_ {reader},
-	loop_ {loop} {
+	loop_ {loop},
+	tag_ {"read from " + common::BestAvailableTypeName(*reader)} {
 }
 
 AsyncReaderFromReader::~AsyncReaderFromReader() {
@@ -32,15 +35,17 @@ error::Error AsyncReaderFromReader::AsyncRead(
 	vector<uint8_t>::iterator start, vector<uint8_t>::iterator end, mio::AsyncIoHandler handler) {
 	cancelled_ = make_shared<bool>(false);
 	auto &cancelled = cancelled_;
-	loop_.Post([this, cancelled, start, end, handler]() {
-		if (!*cancelled) {
-			in_progress_ = true;
-			// Simple, "cheating" implementation, we just do it synchronously.
-			auto result = reader_->Read(start, end);
-			in_progress_ = false;
-			handler(result);
-		}
-	});
+	loop_.Post(
+		[this, cancelled, start, end, handler]() {
+			if (!*cancelled) {
+				in_progress_ = true;
+				// Simple, "cheating" implementation, we just do it synchronously.
+				auto result = reader_->Read(start, end);
+				in_progress_ = false;
+				handler(result);
+			}
+		},
+		tag_);
 
 	return error::NoError;
 }
@@ -56,7 +61,8 @@ void AsyncReaderFromReader::Cancel() {
 
 AsyncWriterFromWriter::AsyncWriterFromWriter(EventLoop &loop, mio::WriterPtr writer) :
 	writer_ {writer},
-	loop_ {loop} {
+	loop_ {loop},
+	tag_ {"write to " + common::BestAvailableTypeName(*writer)} {
 }
 
 AsyncWriterFromWriter::~AsyncWriterFromWriter() {
@@ -69,15 +75,17 @@ error::Error AsyncWriterFromWriter::AsyncWrite(
 	mio::AsyncIoHandler handler) {
 	cancelled_ = make_shared<bool>(false);
 	auto &cancelled = cancelled_;
-	loop_.Post([this, cancelled, start, end, handler]() {
-		if (!*cancelled) {
-			in_progress_ = true;
-			// Simple, "cheating" implementation, we just do it synchronously.
-			auto result = writer_->Write(start, end);
-			in_progress_ = false;
-			handler(result);
-		}
-	});
+	loop_.Post(
+		[this, cancelled, start, end, handler]() {
+			if (!*cancelled) {
+				in_progress_ = true;
+				// Simple, "cheating" implementation, we just do it synchronously.
+				auto result = writer_->Write(start, end);
+				in_progress_ = false;
+				handler(result);
+			}
+		},
+		tag_);
 
 	return error::NoError;
 }
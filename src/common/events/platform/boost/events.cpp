@@ -14,6 +14,8 @@
 
 #include <common/events.hpp>
 
+#include <cstring>
+
 #include <boost/asio.hpp>
 
 #include <common/error.hpp>
@@ -28,6 +30,9 @@ namespace error = mender::common::error;
 namespace log = mender::common::log;
 
 void EventLoop::Run() {
+	auto start = chrono::steady_clock::now();
+	auto recursive_at_start = recursive_run_time_;
+
 	bool stopped = ctx_.stopped();
 	if (stopped) {
 		ctx_.restart();
@@ -38,17 +43,60 @@ void EventLoop::Run() {
 		// exited this level, then keep the running state of the previous recursive level.
 		ctx_.restart();
 	}
+
+	if (callback_seconds_ != nullptr) {
+		// Deeper recursive invocations have already been added.
+		recursive_run_time_ += chrono::steady_clock::now() - start
+							   - (recursive_run_time_ - recursive_at_start);
+	}
 }
 
 void EventLoop::Stop() {
 	ctx_.stop();
 }
 
-void EventLoop::Post(std::function<void()> func) {
-	asio::post(ctx_, func);
+void EventLoop::Post(
+	std::function<void()> func, const string &tag, const char *caller_file, int caller_line) {
+	asio::post(ctx_, Measured(func, tag, caller_file, caller_line));
+}
+
+void EventLoop::EnableStallDetection(chrono::steady_clock::duration threshold) {
+	stall_threshold_ = threshold;
+	callback_seconds_ = &metrics::DefaultRegistry().GetHistogram(
+		"mender_event_loop_callback_seconds",
+		"Time spent running each measured callback on the event loop, during which nothing "
+		"else runs.",
+		{},
+		{0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10});
+	stalls_ = &metrics::DefaultRegistry().GetCounter(
+		"mender_event_loop_stalls_total",
+		"Number of event loop callbacks which ran for longer than the stall threshold.");
+}
+
+// Only the part of the path below the source tree is interesting.
+static const char *ShortSourcePath(const char *file) {
+	const char *src = strstr(file, "src/");
+	return src != nullptr ? src + 4 : file;
+}
+
+void EventLoop::RecordCallback(
+	chrono::steady_clock::duration spent,
+	const string &tag,
+	const char *caller_file,
+	int caller_line) {
+	callback_seconds_->ObserveDuration(spent);
+	if (spent > stall_threshold_) {
+		stalls_->Increment();
+		log::Warning(
+			"Event loop was blocked for "
+			+ to_string(chrono::duration_cast<chrono::milliseconds>(spent).count())
+			+ " ms by a callback" + (tag.empty() ? "" : " for " + tag) + " registered at "
+			+ ShortSourcePath(caller_file) + ":" + to_string(caller_line));
+	}
 }
 
 Timer::Timer(EventLoop &loop) :
+	loop_ {&loop},
 	timer_(GetAsioIoContext(loop)),
 	destroying_(make_shared<bool>(false)),
 	active_ {make_shared<bool>(false)} {
@@ -14,19 +14,392 @@
 
 #include <common/events_io.hpp>
 
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/asio/thread_pool.hpp>
+#ifdef MENDER_USE_IO_URING
+#include <boost/asio/stream_file.hpp>
+#endif // MENDER_USE_IO_URING
+
 namespace mender {
 namespace common {
 namespace events {
 namespace io {
 
+// Operations on different files run in parallel, up to this many at a time.
+const size_t kFileIoThreads {4};
+
+static asio::thread_pool &FileIoThreadPool() {
+	static asio::thread_pool pool(kFileIoThreads);
+	return pool;
+}
+
+#ifdef __linux__
+// How far behind the end of the written data pages are dropped from the cache, when that is
+// enabled. Writeback is started right away, but only waited for this far behind, so that the
+// device always has something to do.
+const off_t kDropCacheDistance {8 * 1024 * 1024};
+#endif // __linux__
+
+static bool IsFile(int fd) {
+	struct stat st;
+	return fstat(fd, &st) == 0 && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode));
+}
+
+// epoll doesn't work with regular files, so Asio performs operations on them synchronously, which
+// blocks the event loop, including timers and D-Bus, for as long as the storage takes. On slow SD
+// cards that can be seconds. This runs them outside of the loop instead, and calls the handler
+// from the loop when they have finished. Each file has at most one operation in progress, since
+// the readers and writers only allow one at a time anyway, see `AsyncFileDescriptorWriter`.
+//
+// The data goes through an internal buffer, so that an operation which is cancelled, or whose
+// reader or writer is destroyed, never touches the caller's buffer after that.
+class FileOperations : public EventLoopObject, public enable_shared_from_this<FileOperations> {
+public:
+	FileOperations(EventLoop &loop, int fd) :
+#ifdef MENDER_USE_IO_URING
+		file_(GetAsioIoContext(loop), fd),
+#endif // MENDER_USE_IO_URING
+		ctx_ {GetAsioIoContext(loop)},
+		fd_ {fd} {
+	}
+
+	~FileOperations() {
+#ifndef MENDER_USE_IO_URING
+		close(fd_);
+#endif // MENDER_USE_IO_URING
+	}
+
+	void AsyncRead(
+		vector<uint8_t>::iterator start,
+		vector<uint8_t>::iterator end,
+		mio::AsyncIoHandler handler,
+		shared_ptr<bool> destroying) {
+		Wait();
+		buffer_.resize(end - start);
+		auto self = shared_from_this();
+		auto done = [self, start, handler, destroying](error_code ec, size_t n) {
+			if (*destroying) {
+				return;
+			} else if (self->cancelled_ || ec == make_error_code(asio::error::operation_aborted)) {
+				handler(expected::unexpected(error::Error(
+					make_error_condition(errc::operation_canceled), "AsyncRead cancelled")));
+			} else if (ec == make_error_code(asio::error::eof)) {
+				handler(0);
+			} else if (ec) {
+				handler(expected::unexpected(
+					error::Error(ec.default_error_condition(), "AsyncRead failed")));
+			} else {
+				copy_n(self->buffer_.begin(), n, start);
+				handler(n);
+			}
+		};
+#ifdef MENDER_USE_IO_URING
+		cancelled_ = false;
+		file_.async_read_some(asio::buffer(buffer_), done);
+#else
+		Submit([this]() { return read(fd_, buffer_.data(), buffer_.size()); }, done);
+#endif // MENDER_USE_IO_URING
+	}
+
+	void AsyncWrite(
+		vector<uint8_t>::const_iterator start,
+		vector<uint8_t>::const_iterator end,
+		mio::AsyncIoHandler handler,
+		shared_ptr<bool> destroying) {
+		Wait();
+		buffer_.assign(start, end);
+		auto self = shared_from_this();
+		auto done = [self, handler, destroying](error_code ec, size_t n) {
+#ifdef MENDER_USE_IO_URING
+			if (!ec && self->drop_cache_behind_) {
+				error_code seek_ec;
+				auto end = self->file_.seek(0, asio::file_base::seek_cur, seek_ec);
+				if (!seek_ec) {
+					// Can't wait for writeback here, since this is the event loop.
+					self->DropWrittenPages(static_cast<off_t>(end), false);
+				}
+			}
+#endif // MENDER_USE_IO_URING
+			if (*destroying) {
+				return;
+			} else if (self->cancelled_ || ec == make_error_code(asio::error::operation_aborted)) {
+				handler(expected::unexpected(error::Error(
+					make_error_condition(errc::operation_canceled), "AsyncWrite cancelled")));
+			} else if (ec) {
+				handler(expected::unexpected(
+					error::Error(ec.default_error_condition(), "AsyncWrite failed")));
+			} else {
+				handler(n);
+			}
+		};
+#ifdef MENDER_USE_IO_URING
+		cancelled_ = false;
+		file_.async_write_some(asio::buffer(buffer_), done);
+#else
+		Submit(
+			[this]() {
+				auto result = write(fd_, buffer_.data(), buffer_.size());
+				if (result > 0 && drop_cache_behind_) {
+					DropWrittenPages(lseek(fd_, 0, SEEK_CUR), true);
+				}
+				return result;
+			},
+			done);
+#endif // MENDER_USE_IO_URING
+	}
+
+	error::Error Preallocate(int64_t size) {
+#ifdef __linux__
+		Wait();
+		if (size <= 0 || fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, size) == 0) {
+			return error::NoError;
+		}
+		int err = errno;
+		if (err == EOPNOTSUPP || err == ENOSYS) {
+			return error::NoError;
+		}
+		return error::Error(
+			generic_category().default_error_condition(err),
+			"Could not preallocate " + to_string(size) + " bytes");
+#else
+		return error::NoError;
+#endif // __linux__
+	}
+
+	void EnableDropCacheBehind() {
+		Wait();
+		drop_cache_behind_ = true;
+	}
+
+	// A read or write which has already started can't be interrupted, but its handler is called
+	// with `operation_canceled`, as soon as it has finished.
+	void Cancel() {
+		cancelled_ = true;
+#ifdef MENDER_USE_IO_URING
+		file_.cancel();
+#endif // MENDER_USE_IO_URING
+	}
+
+	// Waits until no operation is using the file, the buffer or the event loop anymore.
+	void Wait() {
+#ifndef MENDER_USE_IO_URING
+		unique_lock<mutex> lock(mutex_);
+		cond_.wait(lock, [this]() { return !running_; });
+#endif // MENDER_USE_IO_URING
+	}
+
+private:
+	// `end` is where the last write ended. With `wait`, this blocks until the pages to drop have
+	// been written back, otherwise only the pages which already have been are dropped.
+	void DropWrittenPages(off_t end, bool wait) {
+#ifdef __linux__
+		if (end <= writeback_start_) {
+			return;
+		}
+		sync_file_range(fd_, writeback_start_, end - writeback_start_, SYNC_FILE_RANGE_WRITE);
+		writeback_start_ = end;
+
+		if (end - dropped_until_ < 2 * kDropCacheDistance) {
+			return;
+		}
+		off_t until = end - kDropCacheDistance;
+		if (wait) {
+			sync_file_range(
+				fd_,
+				dropped_until_,
+				until - dropped_until_,
+				SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		}
+		posix_fadvise(fd_, dropped_until_, until - dropped_until_, POSIX_FADV_DONTNEED);
+		dropped_until_ = until;
+#endif // __linux__
+	}
+
+#ifndef MENDER_USE_IO_URING
+	using Operation = function<ssize_t()>;
+	using Completion = function<void(error_code ec, size_t n)>;
+
+	void Submit(Operation op, Completion done) {
+		cancelled_ = false;
+		{
+			unique_lock<mutex> lock(mutex_);
+			running_ = true;
+		}
+		auto self = shared_from_this();
+		// Keeps the event loop from running out of work while the operation is in progress.
+		auto work =
+			make_shared<asio::executor_work_guard<asio::io_context::executor_type>>(
+				ctx_.get_executor());
+		asio::post(FileIoThreadPool(), [self, work, op, done]() mutable {
+			ssize_t result;
+			do {
+				result = op();
+			} while (result < 0 && errno == EINTR);
+
+			error_code ec;
+			size_t n {0};
+			if (result < 0) {
+				ec = error_code(errno, generic_category());
+			} else if (result == 0 && self->buffer_.size() > 0) {
+				ec = make_error_code(asio::error::eof);
+			} else {
+				n = static_cast<size_t>(result);
+			}
+			// Marked as finished before the handler can run, since it will usually start the
+			// next operation, which would otherwise wait for this thread in `Wait()`.
+			{
+				unique_lock<mutex> lock(self->mutex_);
+				self->running_ = false;
+				self->cond_.notify_all();
+			}
+
+			// Everything which belongs to the event loop is moved there, so that it is not
+			// destroyed in this thread.
+			asio::post(self->ctx_, [work = std::move(work), done = std::move(done), ec, n]() {
+				done(ec, n);
+			});
+		});
+	}
+
+	mutex mutex_;
+	condition_variable cond_;
+	bool running_ {false};
+#else
+	asio::stream_file file_;
+#endif // MENDER_USE_IO_URING
+
+	asio::io_context &ctx_;
+	int fd_;
+	vector<uint8_t> buffer_;
+	// Only accessed from the event loop.
+	bool cancelled_ {false};
+
+	// Only accessed by the operation in progress, or while there is none.
+	bool drop_cache_behind_ {false};
+	off_t writeback_start_ {0};
+	off_t dropped_until_ {0};
+};
+
+// Only event loop objects have access to the Asio context.
+class BlockingOperationRunner : public EventLoopObject {
+public:
+	static void Run(
+		EventLoop &loop, BlockingOperation operation, BlockingOperationHandler handler) {
+		// Keeps the event loop from running out of work while the operation is in progress.
+		auto work = make_shared<asio::executor_work_guard<asio::io_context::executor_type>>(
+			GetAsioIoContext(loop).get_executor());
+		asio::post(FileIoThreadPool(), [&loop, work, operation, handler]() {
+			auto err = operation();
+			// Everything which belongs to the event loop is moved there, so that it is not
+			// destroyed in this thread.
+			loop.Post([work, handler, err]() { handler(err); });
+		});
+	}
+};
+
+void AsyncRunBlocking(
+	EventLoop &loop, BlockingOperation operation, BlockingOperationHandler handler) {
+	BlockingOperationRunner::Run(loop, std::move(operation), std::move(handler));
+}
+
+struct BlockingOperationQueue::Shared {
+	using WorkGuard = asio::executor_work_guard<asio::io_context::executor_type>;
+
+	struct Entry {
+		EventLoop *loop;
+		BlockingOperation operation;
+		BlockingOperationHandler handler;
+		// Keeps the event loop from running out of work while the operation is queued or in
+		// progress.
+		shared_ptr<WorkGuard> work;
+	};
+
+	mutex mutex_;
+	condition_variable cond_;
+	// The first one is in progress, if the thread has picked it up. Everything which belongs to
+	// the event loop stays here, so that the destructor can take it back if the operation never
+	// finishes.
+	deque<Entry> entries_;
+	bool stopped_ {false};
+	function<void()> final_;
+};
+
+BlockingOperationQueue::BlockingOperationQueue(function<void()> final) :
+	shared_ {make_shared<Shared>()} {
+	shared_->final_ = std::move(final);
+	thread(Work, shared_).detach();
+}
+
+BlockingOperationQueue::~BlockingOperationQueue() {
+	deque<Shared::Entry> dropped;
+	unique_lock<mutex> lock(shared_->mutex_);
+	shared_->stopped_ = true;
+	dropped.swap(shared_->entries_);
+	shared_->cond_.notify_all();
+}
+
+void BlockingOperationQueue::AsyncRun(
+	EventLoop &loop, BlockingOperation operation, BlockingOperationHandler handler) {
+	auto work = make_shared<Shared::WorkGuard>(GetAsioIoContext(loop).get_executor());
+	unique_lock<mutex> lock(shared_->mutex_);
+	shared_->entries_.push_back({&loop, std::move(operation), std::move(handler), work});
+	shared_->cond_.notify_all();
+}
+
+void BlockingOperationQueue::Work(shared_ptr<Shared> shared) {
+	unique_lock<mutex> lock(shared->mutex_);
+	while (true) {
+		shared->cond_.wait(lock, [&shared]() {
+			return shared->stopped_ || shared->entries_.size() > 0;
+		});
+		if (shared->stopped_) {
+			break;
+		}
+
+		auto operation = std::move(shared->entries_.front().operation);
+		lock.unlock();
+		auto err = operation();
+		operation = nullptr;
+		lock.lock();
+
+		if (shared->stopped_) {
+			break;
+		}
+		// Posting while holding the lock makes sure that the event loop, which has to outlive
+		// the queue, is still there.
+		auto entry = std::move(shared->entries_.front());
+		shared->entries_.pop_front();
+		auto &loop = *entry.loop;
+		loop.Post([entry = std::move(entry), err]() { entry.handler(err); });
+	}
+
+	auto final = std::move(shared->final_);
+	lock.unlock();
+	if (final) {
+		final();
+	}
+}
+
 AsyncFileDescriptorReader::AsyncFileDescriptorReader(events::EventLoop &loop, int fd) :
-	pipe_(GetAsioIoContext(loop), fd),
+	loop_ {loop},
+	pipe_(GetAsioIoContext(loop)),
 	destroying_ {make_shared<bool>(false)} {
+	Assign(fd);
 }
 
 AsyncFileDescriptorReader::AsyncFileDescriptorReader(events::EventLoop &loop) :
+	loop_ {loop},
 	pipe_(GetAsioIoContext(loop)),
 	destroying_ {make_shared<bool>(false)} {
 }
@@ -34,6 +407,22 @@ AsyncFileDescriptorReader::AsyncFileDescriptorReader(events::EventLoop &loop) :
 AsyncFileDescriptorReader::~AsyncFileDescriptorReader() {
 	*destroying_ = true;
 	Cancel();
+	if (file_) {
+		file_->Wait();
+	}
+}
+
+void AsyncFileDescriptorReader::Assign(int fd) {
+	pipe_.close();
+	if (file_) {
+		file_->Cancel();
+		file_.reset();
+	}
+	if (IsFile(fd)) {
+		file_ = make_shared<FileOperations>(loop_, fd);
+	} else {
+		pipe_.assign(fd);
+	}
 }
 
 error::Error AsyncFileDescriptorReader::Open(const string &path) {
@@ -42,8 +431,7 @@ error::Error AsyncFileDescriptorReader::Open(const string &path) {
 		int err = errno;
 		return error::Error(generic_category().default_error_condition(err), "Cannot open " + path);
 	}
-	pipe_.close();
-	pipe_.assign(fd);
+	Assign(fd);
 	return error::NoError;
 }
 
@@ -62,6 +450,11 @@ error::Error AsyncFileDescriptorReader::AsyncRead(
 
 	auto destroying {destroying_};
 
+	if (file_) {
+		file_->AsyncRead(start, end, handler, destroying);
+		return error::NoError;
+	}
+
 	asio::mutable_buffer buf {&start[0], size_t(end - start)};
 	pipe_.async_read_some(buf, [destroying, handler](error_code ec, size_t n) {
 		if (*destroying) {
@@ -89,14 +482,20 @@ void AsyncFileDescriptorReader::Cancel() {
 	if (pipe_.is_open()) {
 		pipe_.cancel();
 	}
+	if (file_) {
+		file_->Cancel();
+	}
 }
 
 AsyncFileDescriptorWriter::AsyncFileDescriptorWriter(events::EventLoop &loop, int fd) :
-	pipe_(GetAsioIoContext(loop), fd),
+	loop_ {loop},
+	pipe_(GetAsioIoContext(loop)),
 	destroying_ {make_shared<bool>(false)} {
+	Assign(fd);
 }
 
 AsyncFileDescriptorWriter::AsyncFileDescriptorWriter(events::EventLoop &loop) :
+	loop_ {loop},
 	pipe_(GetAsioIoContext(loop)),
 	destroying_ {make_shared<bool>(false)} {
 }
@@ -104,6 +503,22 @@ AsyncFileDescriptorWriter::AsyncFileDescriptorWriter(events::EventLoop &loop) :
 AsyncFileDescriptorWriter::~AsyncFileDescriptorWriter() {
 	*destroying_ = true;
 	Cancel();
+	if (file_) {
+		file_->Wait();
+	}
+}
+
+void AsyncFileDescriptorWriter::Assign(int fd) {
+	pipe_.close();
+	if (file_) {
+		file_->Cancel();
+		file_.reset();
+	}
+	if (IsFile(fd)) {
+		file_ = make_shared<FileOperations>(loop_, fd);
+	} else {
+		pipe_.assign(fd);
+	}
 }
 
 error::Error AsyncFileDescriptorWriter::Open(const string &path, Append append) {
@@ -121,11 +536,23 @@ error::Error AsyncFileDescriptorWriter::Open(const string &path, Append append)
 		int err = errno;
 		return error::Error(generic_category().default_error_condition(err), "Cannot open " + path);
 	}
-	pipe_.close();
-	pipe_.assign(fd);
+	Assign(fd);
 	return error::NoError;
 }
 
+error::Error AsyncFileDescriptorWriter::Preallocate(int64_t size) {
+	if (!file_) {
+		return error::NoError;
+	}
+	return file_->Preallocate(size);
+}
+
+void AsyncFileDescriptorWriter::DropCacheBehind() {
+	if (file_) {
+		file_->EnableDropCacheBehind();
+	}
+}
+
 error::Error AsyncFileDescriptorWriter::AsyncWrite(
 	vector<uint8_t>::const_iterator start,
 	vector<uint8_t>::const_iterator end,
@@ -141,6 +568,11 @@ error::Error AsyncFileDescriptorWriter::AsyncWrite(
 
 	auto destroying {destroying_};
 
+	if (file_) {
+		file_->AsyncWrite(start, end, handler, destroying);
+		return error::NoError;
+	}
+
 	asio::const_buffer buf {&start[0], size_t(end - start)};
 	pipe_.async_write_some(buf, [destroying, handler](error_code ec, size_t n) {
 		if (*destroying) {
@@ -168,6 +600,9 @@ void AsyncFileDescriptorWriter::Cancel() {
 	if (pipe_.is_open()) {
 		pipe_.cancel();
 	}
+	if (file_) {
+		file_->Cancel();
+	}
 }
 
 } // namespace io
@@ -39,6 +39,19 @@ enum class Append {
 	Enabled,
 };
 
+#ifdef MENDER_USE_BOOST_ASIO
+class FileOperations;
+#endif // MENDER_USE_BOOST_ASIO
+
+// Regular files and block devices can't be waited on by the event loop, so the file descriptor
+// readers and writers hand those off to a thread pool, or to io_uring when built with
+// `MENDER_USE_IO_URING`, instead of blocking the loop while the storage is busy. Other file
+// descriptors, such as pipes and FIFOs, are handled by the event loop itself.
+//
+// Only one read or write may be in progress at a time for each reader or writer, and so for each
+// file: the next one can be started from the handler of the previous one. There is no queue for
+// several writes to the same file, so a writer which needs more than one thread's worth of
+// throughput has to be split over several files.
 class AsyncFileDescriptorReader : public EventLoopObject, virtual public mio::AsyncReader {
 public:
 	// Takes ownership of fd.
@@ -56,7 +69,12 @@ public:
 
 private:
 #ifdef MENDER_USE_BOOST_ASIO
+	void Assign(int fd);
+
+	EventLoop &loop_;
 	asio::posix::stream_descriptor pipe_;
+	// Used instead of `pipe_` for regular files and block devices.
+	shared_ptr<FileOperations> file_;
 	shared_ptr<bool> destroying_;
 #endif // MENDER_USE_BOOST_ASIO
 };
@@ -71,6 +89,15 @@ public:
 
 	error::Error Open(const string &path, Append append = Append::Disabled);
 
+	// Reserves storage for `size` bytes, so that the file is allocated in as few pieces as
+	// possible, and so that running out of space is noticed before anything is written. The size
+	// of the file doesn't change. Does nothing for pipes, or if the file system doesn't support
+	// it.
+	error::Error Preallocate(int64_t size);
+	// Drops written data from the page cache once it has reached storage, so that writing a large
+	// file doesn't push everything else out of the cache. Does nothing for pipes.
+	void DropCacheBehind();
+
 	error::Error AsyncWrite(
 		vector<uint8_t>::const_iterator start,
 		vector<uint8_t>::const_iterator end,
@@ -79,12 +106,50 @@ public:
 
 private:
 #ifdef MENDER_USE_BOOST_ASIO
+	void Assign(int fd);
+
+	EventLoop &loop_;
 	asio::posix::stream_descriptor pipe_;
+	// Used instead of `pipe_` for regular files and block devices.
+	shared_ptr<FileOperations> file_;
 	shared_ptr<bool> destroying_;
 #endif // MENDER_USE_BOOST_ASIO
 };
 using AsyncFileDescriptorWriterPtr = shared_ptr<AsyncFileDescriptorWriter>;
 
+using BlockingOperation = function<error::Error()>;
+using BlockingOperationHandler = function<void(error::Error)>;
+
+// Runs `operation`, which may block on storage for a long time, on the same threads as the file
+// readers and writers above, and calls `handler` with its result from the event loop. The
+// operation can't be cancelled, so it must not use anything which may be destroyed before it has
+// finished.
+void AsyncRunBlocking(
+	EventLoop &loop, BlockingOperation operation, BlockingOperationHandler handler);
+
+// Like `AsyncRunBlocking()`, but runs the operations one at a time, in the order they were
+// submitted, on a thread of its own. For code which may block on anything, not only storage, or
+// which expects to be called from one thread only.
+//
+// An operation can't be interrupted. If one never returns, the ones after it never run, but the
+// event loop carries on. The destructor doesn't wait for the operation in progress either: it
+// drops the ones which haven't started, and leaves the thread to finish the current one, and then
+// `final`, on its own. No handlers are called after that. So neither the operations nor `final`
+// may use anything which may be destroyed before they have finished.
+class BlockingOperationQueue : public EventLoopObject {
+public:
+	BlockingOperationQueue(function<void()> final = nullptr);
+	~BlockingOperationQueue();
+
+	void AsyncRun(EventLoop &loop, BlockingOperation operation, BlockingOperationHandler handler);
+
+private:
+	struct Shared;
+	static void Work(shared_ptr<Shared> shared);
+
+	shared_ptr<Shared> shared_;
+};
+
 class AsyncReaderFromReader : virtual public mio::AsyncReader {
 public:
 	AsyncReaderFromReader(EventLoop &loop, mio::ReaderPtr reader);
@@ -103,6 +168,8 @@ private:
 	shared_ptr<bool> cancelled_;
 	mio::ReaderPtr reader_;
 	EventLoop &loop_;
+	// The reads run on the event loop, so they are named after the reader, for stall reports.
+	string tag_;
 };
 
 class AsyncWriterFromWriter : virtual public mio::AsyncWriter {
@@ -123,6 +190,8 @@ private:
 	shared_ptr<bool> cancelled_;
 	mio::WriterPtr writer_;
 	EventLoop &loop_;
+	// See `AsyncReaderFromReader`.
+	string tag_;
 };
 
 using AsyncReaderFromEventLoopFunc = function<mio::ExpectedAsyncReaderPtr(EventLoop &loop)>;
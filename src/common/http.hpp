@@ -15,6 +15,7 @@
 #ifndef MENDER_COMMON_HTTP_HPP
 #define MENDER_COMMON_HTTP_HPP
 
+#include <chrono>
 #include <functional>
 #include <string>
 #include <memory>
@@ -38,6 +39,7 @@
 #include <common/expected.hpp>
 #include <common/io.hpp>
 #include <common/log.hpp>
+#include <common/tracing.hpp>
 
 namespace mender {
 namespace common {
@@ -65,6 +67,7 @@ namespace events = mender::common::events;
 namespace expected = mender::common::expected;
 namespace io = mender::common::io;
 namespace log = mender::common::log;
+namespace tracing = mender::common::tracing;
 
 class Client;
 class ClientInterface;
@@ -111,10 +114,13 @@ enum StatusCode {
 	StatusNoContent = 204,
 	StatusPartialContent = 206,
 
+	StatusNotModified = 304,
+
 	StatusBadRequest = 400,
 	StatusUnauthorized = 401,
 	StatusNotFound = 404,
 	StatusConflict = 409,
+	StatusPreconditionFailed = 412,
 
 	StatusInternalServerError = 500,
 	StatusNotImplemented = 501,
@@ -527,6 +533,16 @@ private:
 	// Timer for read timeouts to prevent hanging on connection loss
 	events::Timer read_timeout_timer_;
 
+	// Start of the connection phase currently in progress, for the timing metrics.
+	chrono::steady_clock::time_point phase_start_;
+	bool header_bytes_read_ {false};
+
+	// Traces of the current transaction, and of the phase of it in progress.
+	uint64_t trace_id_ {0};
+	tracing::Span transaction_span_;
+	tracing::Span phase_span_;
+	int64_t body_bytes_read_ {0};
+
 	asio::ip::tcp::resolver::results_type resolver_results_;
 
 	// The reason that these are inside a struct is a bit complicated. We need to deal with what
@@ -567,6 +583,7 @@ private:
 
 	error::Error Initialize();
 	void DoCancel();
+	void TracePhase(const string &phase);
 
 	void CallHandler(ResponseHandler handler);
 	void CallErrorHandler(
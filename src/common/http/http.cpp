@@ -21,12 +21,14 @@
 #include <string>
 
 #include <common/common.hpp>
+#include <common/metrics.hpp>
 
 namespace mender {
 namespace common {
 namespace http {
 
 namespace common = mender::common;
+namespace metrics = mender::common::metrics;
 
 const HttpErrorCategoryClass HttpErrorCategory;
 
@@ -160,11 +162,12 @@ error::Error BreakDownUrl(const string &url, BrokenDownUrl &address, bool with_a
 		}
 	}
 
-	log::Trace(
-		"URL broken down into (protocol: " + address.protocol + "), (host: " + address.host
-		+ "), (port: " + to_string(address.port) + "), (path: " + address.path + "),"
-		+ "(username: " + address.username
-		+ "), (password: " + (address.password == "" ? "" : "OMITTED") + ")");
+	log::Trace([&address]() {
+		return "URL broken down into (protocol: " + address.protocol + "), (host: "
+			   + address.host + "), (port: " + to_string(address.port) + "), (path: "
+			   + address.path + ")," + "(username: " + address.username
+			   + "), (password: " + (address.password == "" ? "" : "OMITTED") + ")";
+	});
 
 	return error::NoError;
 }
@@ -433,9 +436,15 @@ error::Error OutgoingResponse::AsyncSwitchProtocol(SwitchProtocolHandler handler
 }
 
 ExponentialBackoff::ExpectedInterval ExponentialBackoff::NextInterval() {
+	static auto &retries = metrics::DefaultRegistry().GetCounter(
+		"mender_retries_total", "Retries scheduled with exponential backoff.");
+	static auto &exhausted = metrics::DefaultRegistry().GetCounter(
+		"mender_retries_exhausted_total", "Operations given up after running out of retries.");
+
 	iteration_++;
 
 	if (try_count_ > 0 && iteration_ > try_count_) {
+		exhausted.Increment();
 		return expected::unexpected(MakeError(MaxRetryError, "Exponential backoff"));
 	}
 
@@ -452,11 +461,13 @@ ExponentialBackoff::ExpectedInterval ExponentialBackoff::NextInterval() {
 			new_interval = max_interval_;
 		}
 		if (try_count_ <= 0 && new_interval == current_interval) {
+			exhausted.Increment();
 			return expected::unexpected(MakeError(MaxRetryError, "Exponential backoff"));
 		}
 		current_interval = new_interval;
 	}
 
+	retries.Increment();
 	return current_interval;
 }
 
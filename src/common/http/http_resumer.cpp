@@ -346,7 +346,8 @@ error::Error DownloadResumerAsyncReader::AsyncReadResume() {
 					eof_ = true;
 				}
 				resumer_state_->offset += result.value();
-				logger_.Debug("read " + to_string(result.value()) + " bytes");
+				logger_.Debug(
+					[&result]() { return "read " + to_string(result.value()) + " bytes"; });
 				auto resumer_client = resumer_client_.lock();
 				if (resumer_client) {
 					resumer_client->last_read_.handler(result);
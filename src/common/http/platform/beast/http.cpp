@@ -23,6 +23,7 @@
 
 #include <common/common.hpp>
 #include <common/crypto.hpp>
+#include <common/metrics.hpp>
 
 #include <mender-version.h>
 
@@ -32,6 +33,7 @@ namespace http {
 
 namespace common = mender::common;
 namespace crypto = mender::common::crypto;
+namespace metrics = mender::common::metrics;
 
 // At the time of writing, Beast only supports HTTP/1.1, and is unlikely to support HTTP/2
 // according to this discussion: https://github.com/boostorg/beast/issues/1302.
@@ -42,6 +44,25 @@ namespace http = boost::beast::http;
 
 const int HTTP_BEAST_BUFFER_SIZE = MENDER_BUFSIZE;
 
+static metrics::Histogram &ConnectDuration() {
+	static auto &histogram = metrics::DefaultRegistry().GetHistogram(
+		"mender_http_connect_seconds", "Time taken to establish TCP connections.");
+	return histogram;
+}
+
+static metrics::Histogram &TlsHandshakeDuration() {
+	static auto &histogram = metrics::DefaultRegistry().GetHistogram(
+		"mender_http_tls_handshake_seconds", "Time taken by TLS handshakes.");
+	return histogram;
+}
+
+static metrics::Histogram &FirstByteDuration() {
+	static auto &histogram = metrics::DefaultRegistry().GetHistogram(
+		"mender_http_first_byte_seconds",
+		"Time from sending a request until the first byte of the response arrives.");
+	return histogram;
+}
+
 static http::verb MethodToBeastVerb(Method method) {
 	switch (method) {
 	case Method::GET:
@@ -426,7 +447,7 @@ error::Error Client::AsyncCall(
 	const string header_url = CreateHOSTAddress(req);
 	req->SetHeader("HOST", header_url);
 
-	log::Trace("Setting HOST address: " + header_url);
+	log::Trace([&header_url]() { return "Setting HOST address: " + header_url; });
 
 	// Add User-Agent header for all requests
 	req->SetHeader("User-Agent", "Mender/" MENDER_VERSION);
@@ -437,6 +458,20 @@ error::Error Client::AsyncCall(
 
 	cancelled_ = make_shared<bool>(false);
 
+	if (tracing::Enabled()) {
+		// Leave out the query, it may hold credentials, such as in pre-signed URLs.
+		auto path = request_->GetPath();
+		path = path.substr(0, path.find('?'));
+		trace_id_ = tracing::NewId();
+		transaction_span_ = tracing::Span(
+			"http",
+			MethodToString(request_->GetMethod()) + " " + path,
+			trace_id_,
+			tracing::Args().Add("host", request_->GetHost()));
+		body_bytes_read_ = 0;
+		TracePhase("dns");
+	}
+
 	auto &cancelled = cancelled_;
 
 	resolver_.async_resolve(
@@ -643,7 +678,7 @@ void Client::ResolveHandler(
 		return;
 	}
 
-	if (logger_.Level() >= log::LogLevel::Debug) {
+	if (logger_.Enabled(log::LogLevel::Debug)) {
 		string ips = "[";
 		string sep;
 		for (auto r : results) {
@@ -670,9 +705,10 @@ void Client::ResolveHandler(
 		// there is nothing they could do about it. However, for
 		// testing/debugging/CI, it can be useful to have this information.
 		if (response_data_.response_buffer_->size() > 0) {
-			logger_.Debug(
-				"Leftover data from the previous response! ("
-				+ to_string(response_data_.response_buffer_->size()) + " bytes)");
+			logger_.Debug([this]() {
+				return "Leftover data from the previous response! ("
+					   + to_string(response_data_.response_buffer_->size()) + " bytes)";
+			});
 		}
 		response_data_.response_buffer_->clear();
 	} else {
@@ -687,11 +723,17 @@ void Client::ResolveHandler(
 
 	auto &cancelled = cancelled_;
 
+	header_bytes_read_ = false;
+	phase_start_ = chrono::steady_clock::now();
+	TracePhase("connect");
 	asio::async_connect(
 		stream_->lowest_layer(),
 		resolver_results_,
 		[this, cancelled](const error_code &ec, const asio::ip::tcp::endpoint &endpoint) {
 			if (!*cancelled) {
+				if (!ec) {
+					ConnectDuration().ObserveDuration(chrono::steady_clock::now() - phase_start_);
+				}
 				switch (socket_mode_) {
 				case SocketMode::TlsTls:
 					// Should never happen because we always need to handshake
@@ -760,6 +802,8 @@ void Client::HandshakeHandler(
 
 	auto &cancelled = cancelled_;
 
+	phase_start_ = chrono::steady_clock::now();
+	TracePhase("tls handshake");
 	stream.async_handshake(
 		ssl::stream_base::client, [this, cancelled, endpoint](const error_code &ec) {
 			if (*cancelled) {
@@ -770,6 +814,7 @@ void Client::HandshakeHandler(
 				CallErrorHandler(ec, request_, header_handler_);
 				return;
 			}
+			TlsHandshakeDuration().ObserveDuration(chrono::steady_clock::now() - phase_start_);
 			logger_.Debug("https: Successful SSL handshake");
 			ConnectHandler(ec, endpoint);
 		});
@@ -786,7 +831,9 @@ void Client::ConnectHandler(const error_code &ec, const asio::ip::tcp::endpoint
 	boost::asio::socket_base::keep_alive option(true);
 	stream_->lowest_layer().set_option(option);
 
-	logger_.Debug("Connected to " + endpoint.address().to_string());
+	logger_.Debug([&endpoint]() { return "Connected to " + endpoint.address().to_string(); });
+
+	TracePhase("send request");
 
 	request_data_.http_request_ = make_shared<http::request<http::buffer_body>>(
 		MethodToBeastVerb(request_->method_), request_->address_.path, BeastHttpVersion);
@@ -835,7 +882,9 @@ void Client::ConnectHandler(const error_code &ec, const asio::ip::tcp::endpoint
 
 void Client::WriteHeaderHandler(const error_code &ec, size_t num_written) {
 	if (num_written > 0) {
-		logger_.Trace("Wrote " + to_string(num_written) + " bytes of header data to stream.");
+		logger_.Trace([num_written]() {
+			return "Wrote " + to_string(num_written) + " bytes of header data to stream.";
+		});
 	}
 
 	if (ec) {
@@ -883,7 +932,9 @@ void Client::WriteHeaderHandler(const error_code &ec, size_t num_written) {
 
 void Client::WriteBodyHandler(const error_code &ec, size_t num_written) {
 	if (num_written > 0) {
-		logger_.Trace("Wrote " + to_string(num_written) + " bytes of body data to stream.");
+		logger_.Trace([num_written]() {
+			return "Wrote " + to_string(num_written) + " bytes of body data to stream.";
+		});
 	}
 
 	if (ec == http::make_error_code(http::error::need_buffer)) {
@@ -974,6 +1025,11 @@ void Client::ReadHeader() {
 	auto &cancelled = cancelled_;
 	auto &response_data = response_data_;
 
+	if (!header_bytes_read_) {
+		phase_start_ = chrono::steady_clock::now();
+		TracePhase("wait for response");
+	}
+
 	auto handler = [this, cancelled, response_data](const error_code &ec, size_t num_read) {
 		if (!*cancelled) {
 			ReadHeaderHandler(ec, num_read);
@@ -1007,7 +1063,13 @@ void Client::ReadHeader() {
 
 void Client::ReadHeaderHandler(const error_code &ec, size_t num_read) {
 	if (num_read > 0) {
-		logger_.Trace("Read " + to_string(num_read) + " bytes of header data from stream.");
+		logger_.Trace([num_read]() {
+			return "Read " + to_string(num_read) + " bytes of header data from stream.";
+		});
+		if (!header_bytes_read_) {
+			header_bytes_read_ = true;
+			FirstByteDuration().ObserveDuration(chrono::steady_clock::now() - phase_start_);
+		}
 	}
 
 	if (ec) {
@@ -1020,6 +1082,10 @@ void Client::ReadHeaderHandler(const error_code &ec, size_t num_read) {
 		return;
 	}
 
+	// A proxy response may be followed by the real one on the same connection.
+	header_bytes_read_ = false;
+	TracePhase("read body");
+
 	if (secondary_req_) {
 		HandleSecondaryRequest();
 		return;
@@ -1029,16 +1095,17 @@ void Client::ReadHeaderHandler(const error_code &ec, size_t num_read) {
 	response_->status_code_ = response_data_.http_response_parser_->get().result_int();
 	response_->status_message_ = string {response_data_.http_response_parser_->get().reason()};
 
-	logger_.Debug(
-		"Received response: " + to_string(response_->status_code_) + " "
-		+ response_->status_message_);
+	logger_.Debug([this]() {
+		return "Received response: " + to_string(response_->status_code_) + " "
+			   + response_->status_message_;
+	});
 
 	string debug_str;
 	for (auto header = response_data_.http_response_parser_->get().cbegin();
 		 header != response_data_.http_response_parser_->get().cend();
 		 header++) {
 		response_->headers_[string {header->name_string()}] = string {header->value()};
-		if (logger_.Level() >= log::LogLevel::Debug) {
+		if (logger_.Enabled(log::LogLevel::Debug)) {
 			debug_str += string {header->name_string()};
 			debug_str += ": ";
 			debug_str += string {header->value()};
@@ -1046,7 +1113,7 @@ void Client::ReadHeaderHandler(const error_code &ec, size_t num_read) {
 		}
 	}
 
-	logger_.Debug("Received headers:\n" + debug_str);
+	logger_.Debug([&debug_str]() { return "Received headers:\n" + debug_str; });
 	debug_str.clear();
 
 	if (GetContentLength(*response_data_.http_response_parser_) == 0
@@ -1080,10 +1147,11 @@ void Client::ReadHeaderHandler(const error_code &ec, size_t num_read) {
 }
 
 void Client::HandleSecondaryRequest() {
-	logger_.Debug(
-		"Received proxy response: "
-		+ to_string(response_data_.http_response_parser_->get().result_int()) + " "
-		+ string {response_data_.http_response_parser_->get().reason()});
+	logger_.Debug([this]() {
+		return "Received proxy response: "
+			   + to_string(response_data_.http_response_parser_->get().result_int()) + " "
+			   + string {response_data_.http_response_parser_->get().reason()};
+	});
 
 	request_ = std::move(secondary_req_);
 
@@ -1193,6 +1261,8 @@ void Client::AsyncReadNextBodyPart(
 		}
 	};
 
+	phase_start_ = chrono::steady_clock::now();
+
 	switch (socket_mode_) {
 	case SocketMode::TlsTls:
 		http::async_read_some(
@@ -1220,7 +1290,9 @@ void Client::AsyncReadNextBodyPart(
 
 void Client::ReadBodyHandler(error_code ec, size_t num_read) {
 	if (num_read > 0) {
-		logger_.Trace("Read " + to_string(num_read) + " bytes of body data from stream.");
+		logger_.Trace([num_read]() {
+			return "Read " + to_string(num_read) + " bytes of body data from stream.";
+		});
 	}
 
 	if (ec == http::make_error_code(http::error::need_buffer)) {
@@ -1251,6 +1323,11 @@ void Client::ReadBodyHandler(error_code ec, size_t num_read) {
 	size_t payload_read =
 		response_data_.last_buffer_size_ - response_data_.http_response_parser_->get().body().size;
 
+	static metrics::Stage stage("http_body");
+	stage.Record(payload_read, chrono::steady_clock::now() - phase_start_);
+	body_bytes_read_ += static_cast<int64_t>(payload_read);
+	phase_span_.AddArg("bytes", body_bytes_read_);
+
 	size_t buf_size = reader_buf_end_ - reader_buf_start_;
 	size_t smallest = min(payload_read, buf_size);
 
@@ -1297,7 +1374,17 @@ void Client::Cancel() {
 	}
 }
 
+void Client::TracePhase(const string &phase) {
+	phase_span_.End();
+	if (transaction_span_.Active()) {
+		phase_span_ = tracing::Span("http", phase, trace_id_);
+	}
+}
+
 void Client::DoCancel() {
+	phase_span_.End();
+	transaction_span_.End();
+
 	resolver_.cancel();
 	read_timeout_timer_.Cancel();
 	if (stream_) {
@@ -1494,7 +1581,9 @@ void Stream::ReadHeader() {
 
 void Stream::ReadHeaderHandler(const error_code &ec, size_t num_read) {
 	if (num_read > 0) {
-		logger_.Trace("Read " + to_string(num_read) + " bytes of header data from stream.");
+		logger_.Trace([num_read]() {
+			return "Read " + to_string(num_read) + " bytes of header data from stream.";
+		});
 	}
 
 	if (ec) {
@@ -1524,7 +1613,7 @@ void Stream::ReadHeaderHandler(const error_code &ec, size_t num_read) {
 		 header != request_data_.http_request_parser_->get().cend();
 		 header++) {
 		request_->headers_[string {header->name_string()}] = string {header->value()};
-		if (logger_.Level() >= log::LogLevel::Debug) {
+		if (logger_.Enabled(log::LogLevel::Debug)) {
 			debug_str += string {header->name_string()};
 			debug_str += ": ";
 			debug_str += string {header->value()};
@@ -1532,7 +1621,7 @@ void Stream::ReadHeaderHandler(const error_code &ec, size_t num_read) {
 		}
 	}
 
-	logger_.Debug("Received headers:\n" + debug_str);
+	logger_.Debug([&debug_str]() { return "Received headers:\n" + debug_str; });
 	debug_str.clear();
 
 	if (GetContentLength(*request_data_.http_request_parser_) == 0
@@ -1606,7 +1695,9 @@ void Stream::AsyncReadNextBodyPart(
 
 void Stream::ReadBodyHandler(error_code ec, size_t num_read) {
 	if (num_read > 0) {
-		logger_.Trace("Read " + to_string(num_read) + " bytes of body data from stream.");
+		logger_.Trace([num_read]() {
+			return "Read " + to_string(num_read) + " bytes of body data from stream.";
+		});
 	}
 
 	if (ec == http::make_error_code(http::error::need_buffer)) {
@@ -1695,7 +1786,9 @@ void Stream::SetupResponse() {
 
 void Stream::WriteHeaderHandler(const error_code &ec, size_t num_written) {
 	if (num_written > 0) {
-		logger_.Trace("Wrote " + to_string(num_written) + " bytes of header data to stream.");
+		logger_.Trace([num_written]() {
+			return "Wrote " + to_string(num_written) + " bytes of header data to stream.";
+		});
 	}
 
 	if (ec) {
@@ -1777,7 +1870,9 @@ void Stream::WriteBody() {
 
 void Stream::WriteBodyHandler(const error_code &ec, size_t num_written) {
 	if (num_written > 0) {
-		logger_.Trace("Wrote " + to_string(num_written) + " bytes of body data to stream.");
+		logger_.Trace([num_written]() {
+			return "Wrote " + to_string(num_written) + " bytes of body data to stream.";
+		});
 	}
 
 	if (ec == http::make_error_code(http::error::need_buffer)) {
@@ -1828,7 +1923,9 @@ error::Error Stream::AsyncSwitchProtocol(SwitchProtocolHandler handler) {
 
 void Stream::SwitchingProtocolHandler(error_code ec, size_t num_written) {
 	if (num_written > 0) {
-		logger_.Trace("Wrote " + to_string(num_written) + " bytes of header data to stream.");
+		logger_.Trace([num_written]() {
+			return "Wrote " + to_string(num_written) + " bytes of header data to stream.";
+		});
 	}
 
 	if (ec) {
@@ -60,6 +60,81 @@ Error ReadString(Transaction &txn, const string &key, string &value_str, bool mi
 	return error::NoError;
 }
 
+ExpectedKeyValueMap Transaction::ReadMany(const vector<string> &keys) {
+	KeyValueMap values;
+	for (const auto &key : keys) {
+		auto value = Read(key);
+		if (value) {
+			values[key] = std::move(value.value());
+		} else if (value.error().code != MakeError(KeyError, "").code) {
+			return expected::unexpected(value.error());
+		}
+	}
+	return values;
+}
+
+Error Transaction::WriteMany(const KeyValueMap &values) {
+	for (const auto &entry : values) {
+		auto err = Write(entry.first, entry.second);
+		if (err != error::NoError) {
+			return err;
+		}
+	}
+	return error::NoError;
+}
+
+Error KeyValueDatabase::Scan(const string &prefix, ScanFunc func) {
+	return ReadTransaction(
+		[&prefix, &func](Transaction &txn) -> Error { return txn.Scan(prefix, func); });
+}
+
+ExpectedKeyValueMap KeyValueDatabase::ReadMany(const vector<string> &keys) {
+	KeyValueMap values;
+	auto err = ReadTransaction([&keys, &values](Transaction &txn) -> Error {
+		auto result = txn.ReadMany(keys);
+		if (!result) {
+			return result.error();
+		}
+		values = std::move(result.value());
+		return error::NoError;
+	});
+	if (err != error::NoError) {
+		return expected::unexpected(err);
+	}
+	return values;
+}
+
+Error KeyValueDatabase::WriteMany(const KeyValueMap &values) {
+	return WriteTransaction([&values](Transaction &txn) { return txn.WriteMany(values); });
+}
+
+expected::ExpectedStringVector ListKeys(Transaction &txn, const string &prefix) {
+	vector<string> keys;
+	auto err = txn.Scan(prefix, [&keys](const string &key, const vector<uint8_t> &) {
+		keys.push_back(key);
+		return error::NoError;
+	});
+	if (err != error::NoError) {
+		return expected::unexpected(err);
+	}
+	return keys;
+}
+
+Error RemovePrefix(Transaction &txn, const string &prefix) {
+	// Collect the keys first, since the database can't be modified during the scan.
+	auto keys = ListKeys(txn, prefix);
+	if (!keys) {
+		return keys.error();
+	}
+	for (const auto &key : keys.value()) {
+		auto err = txn.Remove(key);
+		if (err != error::NoError) {
+			return err;
+		}
+	}
+	return error::NoError;
+}
+
 } // namespace key_value_database
 } // namespace common
 } // namespace mender
@@ -17,7 +17,9 @@
 
 #include <common/config.h>
 
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -55,6 +57,14 @@ using Error = mender::common::error::Error;
 
 using ExpectedBytes = expected::ExpectedBytes;
 
+// Ordered by key.
+using KeyValueMap = map<string, vector<uint8_t>>;
+using ExpectedKeyValueMap = expected::Expected<KeyValueMap>;
+
+// Called for each entry of a scan, in key order. Returning an error stops the scan, which then
+// returns that error. Must not modify the database.
+using ScanFunc = function<Error(const string &key, const vector<uint8_t> &value)>;
+
 class Transaction {
 public:
 	virtual ~Transaction() {};
@@ -62,6 +72,14 @@ public:
 	virtual ExpectedBytes Read(const string &key) = 0;
 	virtual Error Write(const string &key, const vector<uint8_t> &value) = 0;
 	virtual Error Remove(const string &key) = 0;
+
+	// Calls `func` for every key which starts with `prefix`. With an empty prefix, that is
+	// every key in the database.
+	virtual Error Scan(const string &prefix, ScanFunc func) = 0;
+
+	// Reads several keys in one go. Keys which don't exist are left out of the result.
+	virtual ExpectedKeyValueMap ReadMany(const vector<string> &keys);
+	virtual Error WriteMany(const KeyValueMap &values);
 };
 
 // Works as a transaction interface as well, which auto-creates a transaction
@@ -70,12 +88,43 @@ class KeyValueDatabase : virtual public Transaction {
 public:
 	virtual Error WriteTransaction(function<Error(Transaction &)> txnFunc) = 0;
 	virtual Error ReadTransaction(function<Error(Transaction &)> txnFunc) = 0;
+
+	Error Scan(const string &prefix, ScanFunc func) override;
+	ExpectedKeyValueMap ReadMany(const vector<string> &keys) override;
+	Error WriteMany(const KeyValueMap &values) override;
+
+	// For data which is cheap to lose, such as progress markers and caches. If the database
+	// allows it, the commit does less waiting for storage. It is visible to readers right away,
+	// but a crash of the system, such as a power loss, may undo it, though never earlier
+	// commits. It is durable once followed by a `WriteTransaction`, or by `Sync()`.
+	virtual Error WriteTransactionDeferredSync(function<Error(Transaction &)> txnFunc) {
+		return WriteTransaction(txnFunc);
+	}
+	// Makes all writes so far durable.
+	virtual Error Sync() {
+		return error::NoError;
+	}
+
+	// Identifies the last committed write transaction, including those made by other processes
+	// or other instances. It goes up by one with each commit which changes the database. Not
+	// supported by default, in which case nothing can tell whether the database has changed.
+	virtual expected::Expected<uint64_t> LastTransactionId() {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::operation_not_supported),
+			"Database doesn't track transaction IDs"));
+	}
 };
 
 Error MakeError(ErrorCode code, const string &msg);
 
 Error ReadString(Transaction &txn, const string &key, string &value_str, bool missing_ok = true);
 
+// All keys which start with `prefix`, in order.
+expected::ExpectedStringVector ListKeys(Transaction &txn, const string &prefix);
+
+// Removes all keys which start with `prefix`.
+Error RemovePrefix(Transaction &txn, const string &prefix);
+
 } // namespace key_value_database
 } // namespace common
 } // namespace mender
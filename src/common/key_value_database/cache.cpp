@@ -0,0 +1,276 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <common/key_value_database_cache.hpp>
+
+namespace mender {
+namespace common {
+namespace key_value_database {
+
+// Passes everything on to the real transaction, and remembers what was written to the cached
+// keys, so that the cache can be updated once the transaction has been committed.
+class KeyValueDatabaseCache::RecordingTransaction : public Transaction {
+public:
+	RecordingTransaction(Transaction &txn, const set<string> &keys) :
+		txn_ {txn},
+		keys_ {keys} {
+	}
+
+	expected::ExpectedBytes Read(const string &key) override {
+		return txn_.Read(key);
+	}
+
+	error::Error Write(const string &key, const vector<uint8_t> &value) override {
+		auto err = txn_.Write(key, value);
+		if (err == error::NoError) {
+			wrote_ = true;
+			if (keys_.count(key) != 0) {
+				changes_[key] = {true, value};
+			}
+		}
+		return err;
+	}
+
+	error::Error Remove(const string &key) override {
+		auto err = txn_.Remove(key);
+		if (err == error::NoError && keys_.count(key) != 0) {
+			changes_[key] = {false, {}};
+		}
+		return err;
+	}
+
+	error::Error Scan(const string &prefix, ScanFunc func) override {
+		return txn_.Scan(prefix, func);
+	}
+
+	ExpectedKeyValueMap ReadMany(const vector<string> &keys) override {
+		return txn_.ReadMany(keys);
+	}
+
+	error::Error WriteMany(const KeyValueMap &values) override {
+		auto err = txn_.WriteMany(values);
+		if (err != error::NoError) {
+			return err;
+		}
+		wrote_ = wrote_ || !values.empty();
+		for (const auto &kv : values) {
+			if (keys_.count(kv.first) != 0) {
+				changes_[kv.first] = {true, kv.second};
+			}
+		}
+		return error::NoError;
+	}
+
+	Changes &RecordedChanges() {
+		return changes_;
+	}
+
+	// Whether a value was written, which means that committing the transaction gives it an ID of
+	// its own. Removing keys which don't exist may not, so removals don't count.
+	bool Wrote() const {
+		return wrote_;
+	}
+
+private:
+	Transaction &txn_;
+	const set<string> &keys_;
+	Changes changes_;
+	bool wrote_ {false};
+};
+
+KeyValueDatabaseCache::KeyValueDatabaseCache(KeyValueDatabase &db, const vector<string> &keys) :
+	db_ {db},
+	keys_ {keys.begin(), keys.end()} {
+}
+
+void KeyValueDatabaseCache::Clear() {
+	entries_.clear();
+}
+
+void KeyValueDatabaseCache::SetEnabled(bool enabled) {
+	enabled_ = enabled;
+	entries_.clear();
+}
+
+bool KeyValueDatabaseCache::Validate() {
+	if (!enabled_) {
+		return false;
+	}
+	auto txn_id = db_.LastTransactionId();
+	if (!txn_id) {
+		entries_.clear();
+		return false;
+	}
+	if (txn_id.value() != txn_id_) {
+		entries_.clear();
+		txn_id_ = txn_id.value();
+	}
+	return true;
+}
+
+expected::ExpectedBytes KeyValueDatabaseCache::Read(const string &key) {
+	if (keys_.count(key) == 0 || !Validate()) {
+		return db_.Read(key);
+	}
+
+	auto it = entries_.find(key);
+	if (it != entries_.end()) {
+		if (!it->second.exists) {
+			return expected::unexpected(
+				MakeError(KeyError, "Key " + key + " not found in database"));
+		}
+		return it->second.value;
+	}
+
+	// If someone writes in between `Validate()` and this, the value may be newer than `txn_id_`.
+	// That's fine, the next `Validate()` will see the new ID and drop it.
+	auto result = db_.Read(key);
+	if (result) {
+		entries_[key] = {true, result.value()};
+	} else if (result.error().code == MakeError(KeyError, "").code) {
+		entries_[key] = {false, {}};
+	}
+	return result;
+}
+
+ExpectedKeyValueMap KeyValueDatabaseCache::ReadMany(const vector<string> &keys) {
+	if (!Validate()) {
+		return db_.ReadMany(keys);
+	}
+
+	KeyValueMap values;
+	vector<string> to_read;
+	for (const auto &key : keys) {
+		auto it = entries_.find(key);
+		if (it == entries_.end()) {
+			to_read.push_back(key);
+		} else if (it->second.exists) {
+			values[key] = it->second.value;
+		}
+	}
+	if (to_read.empty()) {
+		return values;
+	}
+
+	auto result = db_.ReadMany(to_read);
+	if (!result) {
+		return result;
+	}
+	if (to_read.size() != keys.size()) {
+		// Some values came from the cache. If someone wrote in the meantime, they may not go
+		// together with the ones just read, so read all of them again in one transaction.
+		auto txn_id = db_.LastTransactionId();
+		if (!txn_id || txn_id.value() != txn_id_) {
+			entries_.clear();
+			return db_.ReadMany(keys);
+		}
+	}
+	for (const auto &key : to_read) {
+		if (keys_.count(key) == 0) {
+			continue;
+		}
+		auto it = result.value().find(key);
+		if (it == result.value().end()) {
+			entries_[key] = {false, {}};
+		} else {
+			entries_[key] = {true, it->second};
+		}
+	}
+	values.insert(result.value().begin(), result.value().end());
+	return values;
+}
+
+error::Error KeyValueDatabaseCache::Write(const string &key, const vector<uint8_t> &value) {
+	return WriteTransaction(
+		[&key, &value](Transaction &txn) -> error::Error { return txn.Write(key, value); });
+}
+
+error::Error KeyValueDatabaseCache::Remove(const string &key) {
+	return WriteTransaction([&key](Transaction &txn) -> error::Error { return txn.Remove(key); });
+}
+
+error::Error KeyValueDatabaseCache::WriteTransaction(
+	function<error::Error(Transaction &)> txnFunc) {
+	return DoWriteTransaction(txnFunc, false);
+}
+
+error::Error KeyValueDatabaseCache::WriteTransactionDeferredSync(
+	function<error::Error(Transaction &)> txnFunc) {
+	return DoWriteTransaction(txnFunc, true);
+}
+
+error::Error KeyValueDatabaseCache::DoWriteTransaction(
+	function<error::Error(Transaction &)> txnFunc, bool deferred_sync) {
+	bool valid = Validate();
+
+	Changes changes;
+	bool wrote = false;
+	// Nobody else can commit while the write transaction is open, so this is the ID it starts
+	// from.
+	expected::Expected<uint64_t> txn_id_before;
+	auto recordingFunc =
+		[this, &txnFunc, &changes, &wrote, &txn_id_before](Transaction &txn) -> error::Error {
+		txn_id_before = db_.LastTransactionId();
+		RecordingTransaction recording(txn, keys_);
+		auto err = txnFunc(recording);
+		changes = std::move(recording.RecordedChanges());
+		wrote = recording.Wrote();
+		return err;
+	};
+	auto err = deferred_sync ? db_.WriteTransactionDeferredSync(recordingFunc)
+							 : db_.WriteTransaction(recordingFunc);
+	if (err != error::NoError || !valid) {
+		// Nothing was committed, or there is nothing to update.
+		return err;
+	}
+
+	if (!txn_id_before || txn_id_before.value() != txn_id_) {
+		// Someone else wrote before our transaction started.
+		entries_.clear();
+		return error::NoError;
+	}
+
+	// A commit which wrote something gets the next ID, and one which changed nothing may not get
+	// one. Anything else means that someone else wrote after our transaction, and it's unknown
+	// what. When nothing was written, the next ID may be someone else's, so the cache is only
+	// kept if there is none.
+	auto txn_id = db_.LastTransactionId();
+	uint64_t expected_txn_id = wrote ? txn_id_ + 1 : txn_id_;
+	if (!txn_id || txn_id.value() != expected_txn_id) {
+		entries_.clear();
+		return error::NoError;
+	}
+	for (auto &change : changes) {
+		entries_[change.first] = std::move(change.second);
+	}
+	txn_id_ = txn_id.value();
+	return error::NoError;
+}
+
+error::Error KeyValueDatabaseCache::ReadTransaction(
+	function<error::Error(Transaction &)> txnFunc) {
+	return db_.ReadTransaction(txnFunc);
+}
+
+error::Error KeyValueDatabaseCache::Sync() {
+	return db_.Sync();
+}
+
+expected::Expected<uint64_t> KeyValueDatabaseCache::LastTransactionId() {
+	return db_.LastTransactionId();
+}
+
+} // namespace key_value_database
+} // namespace common
+} // namespace mender
@@ -15,6 +15,7 @@
 #include <common/key_value_database_lmdb.hpp>
 
 #include <filesystem>
+#include <set>
 
 #include <lmdbxx/lmdb++.h>
 
@@ -38,6 +39,8 @@ public:
 	expected::ExpectedBytes Read(const string &key) override;
 	error::Error Write(const string &key, const vector<uint8_t> &value) override;
 	error::Error Remove(const string &key) override;
+	error::Error Scan(const string &prefix, ScanFunc func) override;
+	ExpectedKeyValueMap ReadMany(const vector<string> &keys) override;
 
 private:
 	lmdb::txn &txn_;
@@ -89,6 +92,47 @@ error::Error LmdbTransaction::Remove(const string &key) {
 	}
 }
 
+error::Error LmdbTransaction::Scan(const string &prefix, ScanFunc func) {
+	try {
+		auto cursor = lmdb::cursor::open(txn_, dbi_);
+		// Keys are sorted, so the matching ones start at the first key which is not less than
+		// the prefix, and are all next to each other.
+		std::string_view key {prefix};
+		std::string_view value;
+		bool found = cursor.get(key, value, prefix.empty() ? MDB_FIRST : MDB_SET_RANGE);
+		while (found && key.substr(0, prefix.size()) == prefix) {
+			auto err = func(string(key), common::ByteVectorFromString(value));
+			if (err != error::NoError) {
+				return err;
+			}
+			found = cursor.get(key, value, MDB_NEXT);
+		}
+		return error::NoError;
+	} catch (std::runtime_error &e) {
+		return MakeError(LmdbError, e.what());
+	}
+}
+
+ExpectedKeyValueMap LmdbTransaction::ReadMany(const vector<string> &keys) {
+	try {
+		// Looking the keys up in order, with the same cursor, lets LMDB skip the search from the
+		// root when the next key is on the same page as the previous one.
+		set<string> sorted(keys.begin(), keys.end());
+		auto cursor = lmdb::cursor::open(txn_, dbi_);
+		KeyValueMap values;
+		for (const auto &key : sorted) {
+			std::string_view key_view {key};
+			std::string_view value;
+			if (cursor.get(key_view, value, MDB_SET_KEY)) {
+				values[key] = common::ByteVectorFromString(value);
+			}
+		}
+		return values;
+	} catch (std::runtime_error &e) {
+		return expected::unexpected(MakeError(LmdbError, e.what()));
+	}
+}
+
 KeyValueDatabaseLmdb::KeyValueDatabaseLmdb() {
 }
 
@@ -147,7 +191,18 @@ error::Error KeyValueDatabaseLmdb::OpenInternal(const string &path, bool try_rec
 }
 
 void KeyValueDatabaseLmdb::Close() {
+	if (env_ && unsynced_) {
+		auto err = Sync();
+		if (err != error::NoError) {
+			log::Error("Could not sync database when closing it: " + err.String());
+		}
+	}
 	env_.reset();
+	unsynced_ = false;
+}
+
+void KeyValueDatabaseLmdb::SetDeferredSync(bool enabled) {
+	deferred_sync_ = enabled;
 }
 
 expected::ExpectedBytes KeyValueDatabaseLmdb::Read(const string &key) {
@@ -178,6 +233,16 @@ error::Error KeyValueDatabaseLmdb::Remove(const string &key) {
 }
 
 error::Error KeyValueDatabaseLmdb::WriteTransaction(function<error::Error(Transaction &)> txnFunc) {
+	return DoWriteTransaction(txnFunc, true);
+}
+
+error::Error KeyValueDatabaseLmdb::WriteTransactionDeferredSync(
+	function<error::Error(Transaction &)> txnFunc) {
+	return DoWriteTransaction(txnFunc, !deferred_sync_);
+}
+
+error::Error KeyValueDatabaseLmdb::DoWriteTransaction(
+	function<error::Error(Transaction &)> txnFunc, bool sync) {
 	AssertOrReturnError(env_);
 
 	try {
@@ -187,15 +252,63 @@ error::Error KeyValueDatabaseLmdb::WriteTransaction(function<error::Error(Transa
 		auto error = txnFunc(txn);
 		if (error::NoError != error) {
 			lmdb_txn.abort();
-		} else {
+			return error;
+		}
+
+		// MDB_NOMETASYNC can be changed at any time, and only affects the commits made while
+		// it is set. The data pages are still synced, only the meta page which points to them
+		// isn't, so a crash can at most roll the database back to an earlier, intact, commit.
+		// MDB_NOSYNC would also skip syncing the data pages, which can corrupt the whole
+		// database, including the deployment state, if the storage reorders writes. A synced
+		// commit also syncs the meta pages committed before it.
+		if (!sync) {
+			env_->set_flags(MDB_NOMETASYNC, true);
+		}
+		try {
 			lmdb_txn.commit();
+		} catch (std::runtime_error &e) {
+			if (!sync) {
+				env_->set_flags(MDB_NOMETASYNC, false);
+			}
+			throw;
+		}
+		if (!sync) {
+			env_->set_flags(MDB_NOMETASYNC, false);
 		}
-		return error;
+		unsynced_ = !sync;
+		return error::NoError;
 	} catch (std::runtime_error &e) {
 		return MakeError(LmdbError, e.what());
 	}
 }
 
+error::Error KeyValueDatabaseLmdb::Sync() {
+	AssertOrReturnError(env_);
+
+	try {
+		env_->sync(true);
+		unsynced_ = false;
+		return error::NoError;
+	} catch (std::runtime_error &e) {
+		return MakeError(LmdbError, e.what());
+	}
+}
+
+expected::Expected<uint64_t> KeyValueDatabaseLmdb::LastTransactionId() {
+	if (!env_) {
+		return expected::unexpected(MakeError(LmdbError, "Database is not open"));
+	}
+
+	// Only reads the newest meta page from the shared map, so this is much cheaper than a read
+	// transaction.
+	MDB_envinfo info;
+	int ret = mdb_env_info(env_->handle(), &info);
+	if (ret != MDB_SUCCESS) {
+		return expected::unexpected(MakeError(LmdbError, mdb_strerror(ret)));
+	}
+	return static_cast<uint64_t>(info.me_last_txnid);
+}
+
 error::Error KeyValueDatabaseLmdb::ReadTransaction(function<error::Error(Transaction &)> txnFunc) {
 	AssertOrReturnError(env_);
 
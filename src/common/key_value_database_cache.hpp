@@ -0,0 +1,97 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#ifndef MENDER_COMMON_KEY_VALUE_DATABASE_CACHE_HPP
+#define MENDER_COMMON_KEY_VALUE_DATABASE_CACHE_HPP
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <common/error.hpp>
+#include <common/expected.hpp>
+#include <common/key_value_database.hpp>
+
+namespace mender {
+namespace common {
+namespace key_value_database {
+
+namespace error = mender::common::error;
+namespace expected = mender::common::expected;
+
+// Keeps the values of a few frequently read keys of another database in memory, so that reading
+// them again doesn't need a database transaction. Writes go through to the database, and update
+// the cached values when they commit.
+//
+// Writes made by anyone else, including other processes, are detected by checking
+// `LastTransactionId()` before using the cached values, and drop all of them. If the database
+// doesn't support that, nothing is cached.
+//
+// Reads inside `ReadTransaction` and `WriteTransaction` always go to the database, so that they
+// see a consistent snapshot. Like the databases, an instance must not be used from several
+// threads.
+class KeyValueDatabaseCache : public KeyValueDatabase {
+public:
+	// `db` must outlive the cache. Only `keys` are cached.
+	KeyValueDatabaseCache(KeyValueDatabase &db, const vector<string> &keys);
+
+	expected::ExpectedBytes Read(const string &key) override;
+	error::Error Write(const string &key, const vector<uint8_t> &value) override;
+	error::Error Remove(const string &key) override;
+	ExpectedKeyValueMap ReadMany(const vector<string> &keys) override;
+	error::Error WriteTransaction(function<error::Error(Transaction &)> txnFunc) override;
+	error::Error ReadTransaction(function<error::Error(Transaction &)> txnFunc) override;
+	error::Error WriteTransactionDeferredSync(
+		function<error::Error(Transaction &)> txnFunc) override;
+	error::Error Sync() override;
+	expected::Expected<uint64_t> LastTransactionId() override;
+
+	// Drops all cached values.
+	void Clear();
+	// When disabled, everything goes straight to the database. Enabled by default.
+	void SetEnabled(bool enabled);
+
+	KeyValueDatabase &GetDatabase() {
+		return db_;
+	}
+
+private:
+	struct Entry {
+		bool exists;
+		vector<uint8_t> value;
+	};
+	using Changes = map<string, Entry>;
+	class RecordingTransaction;
+
+	// Drops the cached values if the database has been changed since they were read. Returns
+	// false if the database can't tell, in which case the cache must not be used.
+	bool Validate();
+	error::Error DoWriteTransaction(
+		function<error::Error(Transaction &)> txnFunc, bool deferred_sync);
+
+	KeyValueDatabase &db_;
+	set<string> keys_;
+	// Keys which don't exist are cached too, with `exists` set to false.
+	Changes entries_;
+	// The transaction ID which `entries_` are valid for.
+	uint64_t txn_id_ {0};
+	bool enabled_ {true};
+};
+
+} // namespace key_value_database
+} // namespace common
+} // namespace mender
+
+#endif // MENDER_COMMON_KEY_VALUE_DATABASE_CACHE_HPP
@@ -48,11 +48,24 @@ public:
 	error::Error Remove(const string &key) override;
 	error::Error WriteTransaction(function<error::Error(Transaction &)> txnFunc) override;
 	error::Error ReadTransaction(function<error::Error(Transaction &)> txnFunc) override;
+	error::Error WriteTransactionDeferredSync(
+		function<error::Error(Transaction &)> txnFunc) override;
+	error::Error Sync() override;
+	expected::Expected<uint64_t> LastTransactionId() override;
+
+	// Off by default, in which case `WriteTransactionDeferredSync` syncs every commit, like
+	// `WriteTransaction`. Otherwise those commits use MDB_NOMETASYNC: a crash or power loss may
+	// lose the most recent of them, but leaves the database intact.
+	void SetDeferredSync(bool enabled);
 
 private:
 	error::Error OpenInternal(const string &path, bool try_recovery);
+	error::Error DoWriteTransaction(function<error::Error(Transaction &)> txnFunc, bool sync);
 
 	unique_ptr<lmdb::env> env_;
+	bool deferred_sync_ {false};
+	// Whether there are commits which haven't been synced yet.
+	bool unsynced_ {false};
 };
 
 } // namespace key_value_database
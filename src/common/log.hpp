@@ -20,10 +20,19 @@
 #ifdef MENDER_LOG_BOOST
 #include <boost/log/common.hpp>
 #include <boost/log/sources/logger.hpp>
+#include <boost/log/core/record_view.hpp>
+#include <boost/log/sinks/sink.hpp>
+#include <boost/log/utility/formatting_ostream.hpp>
+#include <boost/smart_ptr/shared_ptr.hpp>
 #endif
 
+#include <cstddef>
+#include <ostream>
+
 #include <string>
 #include <cassert>
+#include <type_traits>
+#include <utility>
 
 #include <common/error.hpp>
 #include <common/expected.hpp>
@@ -41,6 +50,7 @@ enum LogErrorCode {
 	NoError = 0,
 	InvalidLogLevelError,
 	LogFileError,
+	InvalidOverflowPolicyError,
 };
 
 class LogErrorCategoryClass : public std::error_category {
@@ -95,8 +105,39 @@ inline string ToStringLogLevel(LogLevel lvl) {
 
 const LogLevel kDefaultLogLevel = LogLevel::Info;
 
+#ifdef MENDER_LOG_COMPILE_OUT_DEBUG
+const LogLevel kMaxCompiledLogLevel = LogLevel::Info;
+#else
+const LogLevel kMaxCompiledLogLevel = LogLevel::Trace;
+#endif
+
+// Matches callables which build a log message, see `Logger::Log()`.
+template <typename MessageFunc>
+using EnableIfMessageFunc = typename enable_if<
+	is_convertible<decltype(declval<MessageFunc &>()()), string>::value>::type;
+
 ExpectedLogLevel StringToLogLevel(const string &level_str);
 
+// What to do with a log record when the queue of the asynchronous log writer is full.
+enum class LogOverflowPolicy {
+	// Discard the record. Logging never waits for the writer, which logs the number of
+	// discarded records when it has caught up.
+	Drop,
+	// Wait until the writer has made room for the record.
+	Block,
+};
+
+using ExpectedLogOverflowPolicy = expected::expected<LogOverflowPolicy, error::Error>;
+
+ExpectedLogOverflowPolicy StringToLogOverflowPolicy(const string &policy_str);
+
+struct AsyncLogOptions {
+	// Maximum number of records waiting to be written. 0 means that records are formatted and
+	// written synchronously by the thread which logs them.
+	size_t queue_size {0};
+	LogOverflowPolicy overflow_policy {LogOverflowPolicy::Drop};
+};
+
 class Logger {
 private:
 #ifdef MENDER_LOG_BOOST
@@ -129,12 +170,32 @@ public:
 		return l;
 	}
 
+	static bool Compiled(LogLevel level) {
+		return level <= kMaxCompiledLogLevel;
+	}
+
+	bool Enabled(LogLevel level) {
+		return Compiled(level) && level <= this->level_;
+	}
+
 	void Log(LogLevel level, const string &message) {
-		if (level <= this->level_) {
+		if (Enabled(level)) {
 			Log_(level, message);
 		}
 	}
 
+	// Only calls `message_func` to build the message if it is going to be logged. Use this when
+	// building the message is not cheap, and the level is often disabled. With
+	// MENDER_LOG_COMPILE_OUT_DEBUG, Debug and Trace messages are not even compiled in. Messages
+	// passed as strings are never logged then either, but they are still built by the caller,
+	// so code which runs often should use this form for them.
+	template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+	void Log(LogLevel level, MessageFunc message_func) {
+		if (Enabled(level)) {
+			Log_(level, message_func());
+		}
+	}
+
 	void Fatal(const string &message) {
 		Log(LogLevel::Fatal, message);
 	}
@@ -143,21 +204,46 @@ public:
 		Log(LogLevel::Error, message);
 	}
 
+	template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+	void Error(MessageFunc message_func) {
+		Log(LogLevel::Error, message_func);
+	}
+
 	void Warning(const string &message) {
 		Log(LogLevel::Warning, message);
 	}
 
+	template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+	void Warning(MessageFunc message_func) {
+		Log(LogLevel::Warning, message_func);
+	}
+
 	void Info(const string &message) {
 		Log(LogLevel::Info, message);
 	}
 
+	template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+	void Info(MessageFunc message_func) {
+		Log(LogLevel::Info, message_func);
+	}
+
 	void Debug(const string &message) {
 		Log(LogLevel::Debug, message);
 	}
 
+	template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+	void Debug(MessageFunc message_func) {
+		Log(LogLevel::Debug, message_func);
+	}
+
 	void Trace(const string &message) {
 		Log(LogLevel::Trace, message);
 	}
+
+	template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+	void Trace(MessageFunc message_func) {
+		Log(LogLevel::Trace, message_func);
+	}
 };
 
 
@@ -177,6 +263,24 @@ void SetLevel(LogLevel level);
 
 error::Error SetupFileLogging(const string &log_file_path, bool exclusive = true);
 
+// Switches all log sinks, both the current ones and the ones set up later, between writing
+// synchronously and handing the records over to a background thread, which formats them and
+// writes them out in batches. Records queued by the previous sinks are written out first.
+void SetupAsyncLogging(const AsyncLogOptions &options);
+
+// Blocks until all queued log records have been written out.
+void Flush();
+
+#ifdef MENDER_LOG_BOOST
+using Formatter = void (*)(
+	const boost::log::record_view &rec, boost::log::formatting_ostream &strm);
+
+// Creates a text sink which writes to `stream`, synchronously or asynchronously according to
+// the current `SetupAsyncLogging()` options. The caller is responsible for registering it.
+boost::shared_ptr<boost::log::sinks::sink> MakeTextSink(
+	boost::shared_ptr<std::ostream> stream, Formatter formatter);
+#endif // MENDER_LOG_BOOST
+
 LogLevel Level();
 
 template <typename... Fields>
@@ -192,6 +296,33 @@ void Info(const string &message);
 void Debug(const string &message);
 void Trace(const string &message);
 
+bool Enabled(LogLevel level);
+
+template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+void Log(LogLevel level, MessageFunc message_func) {
+	global_logger_.Log(level, message_func);
+}
+template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+void Error(MessageFunc message_func) {
+	global_logger_.Log(LogLevel::Error, message_func);
+}
+template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+void Warning(MessageFunc message_func) {
+	global_logger_.Log(LogLevel::Warning, message_func);
+}
+template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+void Info(MessageFunc message_func) {
+	global_logger_.Log(LogLevel::Info, message_func);
+}
+template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+void Debug(MessageFunc message_func) {
+	global_logger_.Log(LogLevel::Debug, message_func);
+}
+template <typename MessageFunc, typename = EnableIfMessageFunc<MessageFunc>>
+void Trace(MessageFunc message_func) {
+	global_logger_.Log(LogLevel::Trace, message_func);
+}
+
 } // namespace log
 } // namespace common
 } // namespace mender
@@ -26,9 +26,17 @@
 #include <boost/log/utility/manipulators/add_value.hpp>
 #include <boost/log/attributes/scoped_attribute.hpp>
 #include <boost/log/support/date_time.hpp>
-
+#include <boost/log/keywords/capacity.hpp>
+#include <boost/log/keywords/overflow_policy.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <fstream>
+#include <vector>
 #include <common/error.hpp>
 #include <common/expected.hpp>
 
@@ -62,6 +70,8 @@ string LogErrorCategoryClass::message(int code) const {
 		return "Invalid log level given";
 	case LogFileError:
 		return "Bad log file";
+	case InvalidOverflowPolicyError:
+		return "Invalid log overflow policy given";
 	default:
 		return "Unknown";
 	}
@@ -90,6 +100,242 @@ ExpectedLogLevel StringToLogLevel(const string &level_str) {
 	}
 }
 
+ExpectedLogOverflowPolicy StringToLogOverflowPolicy(const string &policy_str) {
+	if (policy_str == "drop") {
+		return ExpectedLogOverflowPolicy(LogOverflowPolicy::Drop);
+	} else if (policy_str == "block") {
+		return ExpectedLogOverflowPolicy(LogOverflowPolicy::Block);
+	} else {
+		return ExpectedLogOverflowPolicy(expected::unexpected(MakeError(
+			LogErrorCode::InvalidOverflowPolicyError,
+			"'" + policy_str + "' is not a valid log overflow policy")));
+	}
+}
+
+// Queueing strategy for `sinks::asynchronous_sink`, see `bounded_fifo_queue` for the
+// interface. It is a bounded ring buffer where the logging threads claim slots with a single
+// compare-and-swap, so they never take a lock, and never wait for each other or for the writer
+// thread, unless the writer is asleep and needs a wake up call, or the queue is full and the
+// policy is to block. Only one thread at a time dequeues, which `asynchronous_sink` guarantees.
+class RecordRing {
+public:
+	template <typename ArgsT>
+	explicit RecordRing(const ArgsT &args) :
+		RecordRing(
+			args[logging::keywords::capacity | 1024],
+			args[logging::keywords::overflow_policy | LogOverflowPolicy::Drop]) {
+	}
+
+	RecordRing(size_t capacity, LogOverflowPolicy policy) :
+		policy_ {policy} {
+		size_t size = 1;
+		while (size < capacity) {
+			size <<= 1;
+		}
+		slots_.reset(new Slot[size]);
+		mask_ = size - 1;
+		for (size_t i = 0; i < size; i++) {
+			slots_[i].sequence.store(i, memory_order_relaxed);
+		}
+	}
+
+	// Called by the writer thread each time it has emptied the queue, before going to sleep.
+	void SetDrainedHandler(function<void(uint64_t dropped)> handler) {
+		lock_guard<mutex> lock(mutex_);
+		drained_handler_ = handler;
+	}
+
+protected:
+	void enqueue(const logging::record_view &rec) {
+		if (Push(rec)) {
+			WakeConsumer();
+			return;
+		}
+		if (policy_ == LogOverflowPolicy::Drop) {
+			dropped_.fetch_add(1, memory_order_relaxed);
+			return;
+		}
+
+		unique_lock<mutex> lock(mutex_);
+		producers_waiting_.fetch_add(1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		while (!Push(rec)) {
+			space_cond_.wait(lock);
+		}
+		producers_waiting_.fetch_sub(1, memory_order_relaxed);
+		consumer_cond_.notify_one();
+	}
+
+	bool try_enqueue(const logging::record_view &rec) {
+		if (Push(rec)) {
+			WakeConsumer();
+			return true;
+		}
+		return false;
+	}
+
+	bool try_dequeue_ready(logging::record_view &rec) {
+		return try_dequeue(rec);
+	}
+
+	bool try_dequeue(logging::record_view &rec) {
+		if (Pop(rec)) {
+			WakeProducers();
+			return true;
+		}
+		return false;
+	}
+
+	bool dequeue_ready(logging::record_view &rec) {
+		bool drained_handled = false;
+		while (true) {
+			if (try_dequeue(rec)) {
+				return true;
+			}
+
+			unique_lock<mutex> lock(mutex_);
+			if (interrupted_) {
+				interrupted_ = false;
+				return false;
+			}
+			if (!drained_handled && drained_handler_) {
+				auto handler = drained_handler_;
+				lock.unlock();
+				handler(dropped_.exchange(0, memory_order_relaxed));
+				drained_handled = true;
+				continue;
+			}
+
+			consumer_waiting_.store(true, memory_order_relaxed);
+			atomic_thread_fence(memory_order_seq_cst);
+			if (Pop(rec)) {
+				consumer_waiting_.store(false, memory_order_relaxed);
+				space_cond_.notify_all();
+				return true;
+			}
+			consumer_cond_.wait(lock);
+			consumer_waiting_.store(false, memory_order_relaxed);
+		}
+	}
+
+	void interrupt_dequeue() {
+		lock_guard<mutex> lock(mutex_);
+		interrupted_ = true;
+		consumer_cond_.notify_one();
+	}
+
+private:
+	struct Slot {
+		atomic<size_t> sequence;
+		logging::record_view record;
+	};
+
+	bool Push(const logging::record_view &rec) {
+		size_t pos = head_.load(memory_order_relaxed);
+		while (true) {
+			Slot &slot = slots_[pos & mask_];
+			const size_t seq = slot.sequence.load(memory_order_acquire);
+			if (seq == pos) {
+				if (head_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+					slot.record = rec;
+					slot.sequence.store(pos + 1, memory_order_release);
+					return true;
+				}
+			} else if (static_cast<ptrdiff_t>(seq - pos) < 0) {
+				// The writer has not consumed the record a full lap behind us yet.
+				return false;
+			} else {
+				pos = head_.load(memory_order_relaxed);
+			}
+		}
+	}
+
+	void WakeConsumer() {
+		atomic_thread_fence(memory_order_seq_cst);
+		if (consumer_waiting_.load(memory_order_relaxed)) {
+			lock_guard<mutex> lock(mutex_);
+			consumer_cond_.notify_one();
+		}
+	}
+
+	bool Pop(logging::record_view &rec) {
+		Slot &slot = slots_[tail_ & mask_];
+		if (slot.sequence.load(memory_order_acquire) != tail_ + 1) {
+			return false;
+		}
+		rec.swap(slot.record);
+		slot.record = logging::record_view();
+		slot.sequence.store(tail_ + mask_ + 1, memory_order_release);
+		tail_++;
+		return true;
+	}
+
+	void WakeProducers() {
+		atomic_thread_fence(memory_order_seq_cst);
+		if (producers_waiting_.load(memory_order_relaxed) > 0) {
+			lock_guard<mutex> lock(mutex_);
+			space_cond_.notify_all();
+		}
+	}
+
+	const LogOverflowPolicy policy_;
+
+	unique_ptr<Slot[]> slots_;
+	size_t mask_;
+	atomic<size_t> head_ {0};
+	size_t tail_ {0};
+
+	atomic<uint64_t> dropped_ {0};
+
+	// Only used for putting threads to sleep and waking them up.
+	mutex mutex_;
+	condition_variable consumer_cond_;
+	condition_variable space_cond_;
+	atomic<bool> consumer_waiting_ {false};
+	atomic<int> producers_waiting_ {0};
+	bool interrupted_ {false};
+	function<void(uint64_t dropped)> drained_handler_;
+};
+
+// Collects formatted records and writes them to the stream in one go, either when enough of
+// them have accumulated, or when the sink flushes the backend.
+class BatchingOstreamBackend :
+	public sinks::basic_formatted_sink_backend<
+		char,
+		sinks::combine_requirements<sinks::synchronized_feeding, sinks::flushing>::type> {
+public:
+	explicit BatchingOstreamBackend(boost::shared_ptr<std::ostream> stream) :
+		stream_ {stream} {
+	}
+
+	~BatchingOstreamBackend() {
+		flush();
+	}
+
+	void consume(const logging::record_view &rec, const string_type &formatted) {
+		buffer_ += formatted;
+		buffer_ += '\n';
+		if (buffer_.size() >= kMaxBatchSize) {
+			flush();
+		}
+	}
+
+	void flush() {
+		if (buffer_.empty()) {
+			return;
+		}
+		stream_->write(buffer_.data(), static_cast<streamsize>(buffer_.size()));
+		stream_->flush();
+		buffer_.clear();
+	}
+
+private:
+	static const size_t kMaxBatchSize = 64 * 1024;
+
+	boost::shared_ptr<std::ostream> stream_;
+	string buffer_;
+};
+
 static void LogfmtFormatter(logging::record_view const &rec, logging::formatting_ostream &strm) {
 	strm << "record_id=" << logging::extract<unsigned int>("RecordID", rec) << " ";
 
@@ -119,21 +365,54 @@ static void LogfmtFormatter(logging::record_view const &rec, logging::formatting
 	strm << "msg=\"" << rec[expr::smessage] << "\" ";
 }
 
-static void SetupLoggerSinks() {
-	typedef sinks::synchronous_sink<sinks::text_ostream_backend> text_sink;
-	boost::shared_ptr<text_sink> sink(new text_sink);
-
-	{
-		text_sink::locked_backend_ptr pBackend = sink->locked_backend();
-		boost::shared_ptr<std::ostream> pStream(&std::cerr, boost::null_deleter());
-		pBackend->add_stream(pStream);
+static AsyncLogOptions async_options_;
+
+// The streams of the main log, and the sinks which currently write to them.
+static vector<boost::shared_ptr<std::ostream>> main_streams_;
+static vector<boost::shared_ptr<sinks::sink>> main_sinks_;
+
+boost::shared_ptr<sinks::sink> MakeTextSink(
+	boost::shared_ptr<std::ostream> stream, Formatter formatter) {
+	if (async_options_.queue_size == 0) {
+		typedef sinks::synchronous_sink<sinks::text_ostream_backend> text_sink;
+		auto sink = boost::make_shared<text_sink>();
+		sink->set_formatter(formatter);
+		sink->locked_backend()->add_stream(stream);
+		sink->locked_backend()->auto_flush(true);
+		return sink;
 	}
 
-	sink->set_formatter(&LogfmtFormatter);
+	typedef sinks::asynchronous_sink<BatchingOstreamBackend, RecordRing> async_text_sink;
+	auto sink = boost::make_shared<async_text_sink>(
+		boost::make_shared<BatchingOstreamBackend>(stream),
+		logging::keywords::capacity = async_options_.queue_size,
+		logging::keywords::overflow_policy = async_options_.overflow_policy);
+	sink->set_formatter(formatter);
+	// The sink outlives its queue, so the raw pointer is safe here.
+	auto sink_ptr = sink.get();
+	sink->SetDrainedHandler([sink_ptr](uint64_t dropped) {
+		if (dropped > 0) {
+			src::severity_logger<LogLevel> logger;
+			logger.add_attribute("Name", attrs::constant<std::string>("Global"));
+			BOOST_LOG_SEV(logger, LogLevel::Warning)
+				<< "Log queue overflowed, " << dropped << " log records were dropped";
+		}
+		sink_ptr->locked_backend()->flush();
+	});
+	return sink;
+}
 
+static void AddMainSink(boost::shared_ptr<std::ostream> stream) {
+	auto sink = MakeTextSink(stream, &LogfmtFormatter);
+	main_streams_.push_back(stream);
+	main_sinks_.push_back(sink);
 	logging::core::get()->add_sink(sink);
 }
 
+static void SetupLoggerSinks() {
+	AddMainSink(boost::shared_ptr<std::ostream>(&std::cerr, boost::null_deleter()));
+}
+
 static void SetupLoggerAttributes() {
 	attrs::counter<unsigned int> RecordID(1);
 	logging::core::get()->add_global_attribute("RecordID", RecordID);
@@ -162,7 +441,8 @@ void Logger::SetLevel(LogLevel level) {
 }
 
 LogLevel Logger::Level() {
-	return this->level_;
+	// Messages above the compiled in level are dropped regardless of what was requested.
+	return Compiled(this->level_) ? this->level_ : kMaxCompiledLogLevel;
 }
 
 void Logger::AddField(const LogField &field) {
@@ -187,9 +467,6 @@ void SetLevel(LogLevel level) {
 }
 
 error::Error SetupFileLogging(const string &log_file_path, bool exclusive) {
-	typedef sinks::synchronous_sink<sinks::text_ostream_backend> text_sink;
-	boost::shared_ptr<text_sink> sink = boost::make_shared<text_sink>();
-
 	// Add a stream to write log to
 	auto log_stream = boost::make_shared<std::ofstream>();
 	errno = 0;
@@ -200,31 +477,63 @@ error::Error SetupFileLogging(const string &log_file_path, bool exclusive) {
 			LogErrorCode::LogFileError,
 			"Failed to open '" + log_file_path + "' for logging: " + strerror(io_errno));
 	}
-	sink->set_formatter(&LogfmtFormatter);
-
-	sink->locked_backend()->add_stream(log_stream);
-	sink->locked_backend()->auto_flush(true);
 
 	if (exclusive) {
+		logging::core::get()->flush();
 		logging::core::get()->remove_all_sinks();
+		main_streams_.clear();
+		main_sinks_.clear();
 	}
 
-	// Register the sink in the logging core
-	logging::core::get()->add_sink(sink);
+	AddMainSink(log_stream);
 
 	return error::NoError;
 }
 
+void SetupAsyncLogging(const AsyncLogOptions &options) {
+	// Write out what the current sinks have queued before the new ones take over, so that the
+	// records stay in order.
+	for (auto &sink : main_sinks_) {
+		sink->flush();
+	}
+
+	async_options_ = options;
+
+	auto old_sinks = std::move(main_sinks_);
+	main_sinks_.clear();
+	auto streams = std::move(main_streams_);
+	main_streams_.clear();
+	for (auto &stream : streams) {
+		AddMainSink(stream);
+	}
+
+	auto core = logging::core::get();
+	for (auto &sink : old_sinks) {
+		core->remove_sink(sink);
+		sink->flush();
+	}
+	// Destroying the old sinks stops their writer threads.
+}
+
+void Flush() {
+	logging::core::get()->flush();
+}
+
 LogLevel Level() {
 	return global_logger_.Level();
 }
 
+bool Enabled(LogLevel level) {
+	return global_logger_.Enabled(level);
+}
+
 void Log_(LogLevel level, const string message) {
 	global_logger_.Log(level, message);
 }
 
 void Fatal(const string &message) {
 	global_logger_.Log(LogLevel::Fatal, message);
+	Flush();
 	std::abort();
 }
 void Error(const string &message) {
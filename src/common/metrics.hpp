@@ -0,0 +1,151 @@
+// Copyright 2024 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#ifndef MENDER_COMMON_METRICS_HPP
+#define MENDER_COMMON_METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mender {
+namespace common {
+namespace metrics {
+
+using namespace std;
+
+using Labels = map<string, string>;
+
+// Converts a duration to the fractional seconds that all time based metrics are recorded in.
+double Seconds(chrono::steady_clock::duration duration);
+
+// A value which only ever goes up. All metric types are safe to update from several threads.
+class Counter {
+public:
+	void Increment(double by = 1.0);
+	double Value() const;
+
+private:
+	atomic<double> value_ {0.0};
+};
+
+// A value which can go up and down.
+class Gauge {
+public:
+	void Set(double value);
+	void Add(double by);
+	double Value() const;
+
+private:
+	atomic<double> value_ {0.0};
+};
+
+// Counts observations into buckets with fixed upper bounds, and keeps their sum and count.
+class Histogram {
+public:
+	// `bounds` must be sorted in increasing order. The implicit `+Inf` bucket is added
+	// automatically.
+	Histogram(const vector<double> &bounds);
+
+	void Observe(double value);
+	void ObserveDuration(chrono::steady_clock::duration duration) {
+		Observe(Seconds(duration));
+	}
+
+	const vector<double> &Bounds() const {
+		return bounds_;
+	}
+	// Non-cumulative count of each bucket, the last one being the `+Inf` bucket.
+	vector<uint64_t> BucketCounts() const;
+	double Sum() const;
+
+private:
+	vector<double> bounds_;
+	unique_ptr<atomic<uint64_t>[]> counts_;
+	atomic<double> sum_ {0.0};
+};
+
+// Buckets suitable for durations from a millisecond up to an hour.
+const vector<double> &DurationBuckets();
+
+// Holds all metrics of the process, keyed by name and labels. The returned references stay
+// valid for the lifetime of the registry, so callers on hot paths should look a metric up once
+// and keep the reference.
+class Registry {
+public:
+	Counter &GetCounter(const string &name, const string &help, const Labels &labels = {});
+	Gauge &GetGauge(const string &name, const string &help, const Labels &labels = {});
+	Histogram &GetHistogram(
+		const string &name,
+		const string &help,
+		const Labels &labels = {},
+		const vector<double> &bounds = DurationBuckets());
+
+	// Renders all metrics in the Prometheus text exposition format, version 0.0.4.
+	string PrometheusText() const;
+
+private:
+	enum class Type {
+		Counter,
+		Gauge,
+		Histogram,
+	};
+
+	struct Family {
+		Type type;
+		string help;
+		map<Labels, unique_ptr<Counter>> counters;
+		map<Labels, unique_ptr<Gauge>> gauges;
+		map<Labels, unique_ptr<Histogram>> histograms;
+	};
+
+	Family &GetFamily(const string &name, const string &help, Type type);
+
+	mutable mutex mutex_;
+	map<string, Family> families_;
+};
+
+// The registry that all built-in instrumentation records into.
+Registry &DefaultRegistry();
+
+// Records bytes moved through, and time spent in, one stage of the Artifact pipeline, as
+// `mender_pipeline_bytes_total` and `mender_pipeline_seconds_total` labeled with the stage.
+class Stage {
+public:
+	Stage(const string &name);
+
+	void Record(size_t bytes, chrono::steady_clock::duration spent);
+
+	double BytesTotal() const {
+		return bytes_.Value();
+	}
+	double SecondsTotal() const {
+		return seconds_.Value();
+	}
+
+private:
+	Counter &bytes_;
+	Counter &seconds_;
+};
+
+} // namespace metrics
+} // namespace common
+} // namespace mender
+
+#endif // MENDER_COMMON_METRICS_HPP
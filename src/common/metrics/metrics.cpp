@@ -0,0 +1,262 @@
+// Copyright 2024 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <common/metrics.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+namespace mender {
+namespace common {
+namespace metrics {
+
+using namespace std;
+
+// `fetch_add` is only available for floating point atomics from C++20 onwards.
+static void AtomicAdd(atomic<double> &value, double by) {
+	double current = value.load(memory_order_relaxed);
+	while (!value.compare_exchange_weak(current, current + by, memory_order_relaxed)) {
+	}
+}
+
+double Seconds(chrono::steady_clock::duration duration) {
+	return chrono::duration<double>(duration).count();
+}
+
+void Counter::Increment(double by) {
+	assert(by >= 0.0);
+	AtomicAdd(value_, by);
+}
+
+double Counter::Value() const {
+	return value_.load(memory_order_relaxed);
+}
+
+void Gauge::Set(double value) {
+	value_.store(value, memory_order_relaxed);
+}
+
+void Gauge::Add(double by) {
+	AtomicAdd(value_, by);
+}
+
+double Gauge::Value() const {
+	return value_.load(memory_order_relaxed);
+}
+
+Histogram::Histogram(const vector<double> &bounds) :
+	bounds_ {bounds},
+	counts_ {new atomic<uint64_t>[bounds.size() + 1]} {
+	assert(is_sorted(bounds_.begin(), bounds_.end()));
+	for (size_t i = 0; i <= bounds_.size(); i++) {
+		counts_[i].store(0, memory_order_relaxed);
+	}
+}
+
+void Histogram::Observe(double value) {
+	auto bucket = lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+	counts_[static_cast<size_t>(bucket)].fetch_add(1, memory_order_relaxed);
+	AtomicAdd(sum_, value);
+}
+
+vector<uint64_t> Histogram::BucketCounts() const {
+	vector<uint64_t> counts(bounds_.size() + 1);
+	for (size_t i = 0; i < counts.size(); i++) {
+		counts[i] = counts_[i].load(memory_order_relaxed);
+	}
+	return counts;
+}
+
+double Histogram::Sum() const {
+	return sum_.load(memory_order_relaxed);
+}
+
+const vector<double> &DurationBuckets() {
+	static const vector<double> buckets {
+		0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300, 900, 3600};
+	return buckets;
+}
+
+Registry::Family &Registry::GetFamily(const string &name, const string &help, Type type) {
+	auto found = families_.find(name);
+	if (found != families_.end()) {
+		// Registering the same name as two different types is a programming error.
+		assert(found->second.type == type);
+		return found->second;
+	}
+	auto &family = families_[name];
+	family.type = type;
+	family.help = help;
+	return family;
+}
+
+Counter &Registry::GetCounter(const string &name, const string &help, const Labels &labels) {
+	lock_guard<mutex> lock(mutex_);
+	auto &metric = GetFamily(name, help, Type::Counter).counters[labels];
+	if (!metric) {
+		metric.reset(new Counter);
+	}
+	return *metric;
+}
+
+Gauge &Registry::GetGauge(const string &name, const string &help, const Labels &labels) {
+	lock_guard<mutex> lock(mutex_);
+	auto &metric = GetFamily(name, help, Type::Gauge).gauges[labels];
+	if (!metric) {
+		metric.reset(new Gauge);
+	}
+	return *metric;
+}
+
+Histogram &Registry::GetHistogram(
+	const string &name, const string &help, const Labels &labels, const vector<double> &bounds) {
+	lock_guard<mutex> lock(mutex_);
+	auto &metric = GetFamily(name, help, Type::Histogram).histograms[labels];
+	if (!metric) {
+		metric.reset(new Histogram(bounds));
+	}
+	return *metric;
+}
+
+static string FormatValue(double value) {
+	if (isinf(value)) {
+		return value > 0 ? "+Inf" : "-Inf";
+	} else if (isnan(value)) {
+		return "NaN";
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.15g", value);
+	return buf;
+}
+
+static string EscapeLabelValue(const string &value) {
+	string escaped;
+	escaped.reserve(value.size());
+	for (auto c : value) {
+		switch (c) {
+		case '\\':
+			escaped += "\\\\";
+			break;
+		case '"':
+			escaped += "\\\"";
+			break;
+		case '\n':
+			escaped += "\\n";
+			break;
+		default:
+			escaped += c;
+			break;
+		}
+	}
+	return escaped;
+}
+
+static string FormatLabels(const Labels &labels, const string &le = "") {
+	if (labels.empty() && le.empty()) {
+		return "";
+	}
+	string formatted = "{";
+	for (const auto &label : labels) {
+		if (formatted.size() > 1) {
+			formatted += ",";
+		}
+		formatted += label.first + "=\"" + EscapeLabelValue(label.second) + "\"";
+	}
+	if (!le.empty()) {
+		if (formatted.size() > 1) {
+			formatted += ",";
+		}
+		formatted += "le=\"" + le + "\"";
+	}
+	return formatted + "}";
+}
+
+string Registry::PrometheusText() const {
+	lock_guard<mutex> lock(mutex_);
+
+	stringstream out;
+	for (const auto &entry : families_) {
+		const auto &name = entry.first;
+		const auto &family = entry.second;
+
+		out << "# HELP " << name << " " << family.help << "\n";
+		switch (family.type) {
+		case Type::Counter:
+			out << "# TYPE " << name << " counter\n";
+			for (const auto &metric : family.counters) {
+				out << name << FormatLabels(metric.first) << " "
+					<< FormatValue(metric.second->Value()) << "\n";
+			}
+			break;
+		case Type::Gauge:
+			out << "# TYPE " << name << " gauge\n";
+			for (const auto &metric : family.gauges) {
+				out << name << FormatLabels(metric.first) << " "
+					<< FormatValue(metric.second->Value()) << "\n";
+			}
+			break;
+		case Type::Histogram:
+			out << "# TYPE " << name << " histogram\n";
+			for (const auto &metric : family.histograms) {
+				const auto &bounds = metric.second->Bounds();
+				auto counts = metric.second->BucketCounts();
+				// Buckets are cumulative in the exposition format. The total count is
+				// derived from the buckets so that it always agrees with the `+Inf` bucket,
+				// even when observations happen while rendering.
+				uint64_t cumulative = 0;
+				for (size_t i = 0; i < counts.size(); i++) {
+					cumulative += counts[i];
+					auto le = i < bounds.size() ? FormatValue(bounds[i]) : "+Inf";
+					out << name << "_bucket" << FormatLabels(metric.first, le) << " "
+						<< cumulative << "\n";
+				}
+				out << name << "_sum" << FormatLabels(metric.first) << " "
+					<< FormatValue(metric.second->Sum()) << "\n";
+				out << name << "_count" << FormatLabels(metric.first) << " " << cumulative
+					<< "\n";
+			}
+			break;
+		}
+	}
+	return out.str();
+}
+
+Registry &DefaultRegistry() {
+	static Registry registry;
+	return registry;
+}
+
+Stage::Stage(const string &name) :
+	bytes_ {DefaultRegistry().GetCounter(
+		"mender_pipeline_bytes_total",
+		"Bytes processed by each stage of the Artifact pipeline.",
+		{{"stage", name}})},
+	seconds_ {DefaultRegistry().GetCounter(
+		"mender_pipeline_seconds_total",
+		"Time spent in each stage of the Artifact pipeline, excluding the stages it reads "
+		"from where that can be measured.",
+		{{"stage", name}})} {
+}
+
+void Stage::Record(size_t bytes, chrono::steady_clock::duration spent) {
+	bytes_.Increment(static_cast<double>(bytes));
+	seconds_.Increment(Seconds(spent));
+}
+
+} // namespace metrics
+} // namespace common
+} // namespace mender
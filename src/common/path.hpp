@@ -16,6 +16,7 @@
 #define MENDER_COMMON_PATH_HPP
 
 #include <functional>
+#include <set>
 #include <string>
 
 #include <common/error.hpp>
@@ -87,6 +88,26 @@ error::Error CreateDirectories(const string &dir);
 
 error::Error DataSyncRecursively(const string &dir);
 
+// Collects the paths which have been written during a phase, so that they can be made durable
+// together, instead of syncing them one by one while they are written. The files are synced in
+// parallel, and every directory which contains one of them is synced once, so that new entries are
+// durable too. When many paths on the same file system are dirty, the whole file system is synced
+// with one call instead.
+class SyncBatch {
+public:
+	// Adds a file or directory which has been created or written to.
+	void Add(const string &path);
+	// Adds a directory and everything below it.
+	error::Error AddRecursively(const string &dir);
+
+	// Syncs everything which has been added since the last call.
+	error::Error Sync();
+
+private:
+	set<string> files_;
+	set<string> dirs_;
+};
+
 error::Error Rename(const string &oldname, const string &newname);
 error::Error FileCopy(const string &what, const string &where);
 
@@ -21,7 +21,10 @@
 #include <string>
 #include <vector>
 
-#ifdef MENDER_USE_TINY_PROC_LIB
+#if defined(MENDER_USE_POSIX_SPAWN)
+#include <thread>
+#include <sys/types.h>
+#elif defined(MENDER_USE_TINY_PROC_LIB)
 #include <process.hpp>
 #endif
 
@@ -81,6 +84,46 @@ public:
 	string prefix;
 };
 
+#if defined(MENDER_USE_POSIX_SPAWN)
+// Launches the child using posix_spawn(), which avoids duplicating the page tables of the parent
+// the way fork() does, and therefore works even when the parent's address space is large
+// compared to the memory available. It implements the subset of the tiny-process-library
+// interface that `Process` uses, so that `Process` works on top of either of them.
+class SpawnedProcess {
+public:
+	SpawnedProcess(
+		const vector<string> &args,
+		const string &work_dir,
+		OutputCallback read_stdout = nullptr,
+		OutputCallback read_stderr = nullptr);
+	~SpawnedProcess();
+
+	// -1 if the process could not be launched. 0 if it could not be executed, for example because
+	// the executable doesn't exist, in which case it behaves as if it had exited with status 1.
+	pid_t get_id() const {
+		return pid_;
+	}
+
+	// Blocks until the process has exited and all its output has been delivered.
+	int get_exit_status();
+
+private:
+	void ReadOutput(int stdout_fd, int stderr_fd);
+
+	pid_t pid_ {-1};
+	int exit_status_ {-1};
+	bool waited_ {false};
+
+	OutputCallback read_stdout_;
+	OutputCallback read_stderr_;
+	thread output_thread_;
+};
+
+using NativeProcess = SpawnedProcess;
+#elif defined(MENDER_USE_TINY_PROC_LIB)
+using NativeProcess = tpl::Process;
+#endif
+
 class Process : virtual public io::Canceller {
 public:
 	Process(const vector<string> &args);
@@ -127,8 +170,8 @@ public:
 private:
 	friend class ::ProcessesTestsHelper;
 
-#ifdef MENDER_USE_TINY_PROC_LIB
-	unique_ptr<tpl::Process> proc_;
+#if defined(MENDER_USE_TINY_PROC_LIB) || defined(MENDER_USE_POSIX_SPAWN)
+	unique_ptr<NativeProcess> proc_;
 
 	int stdout_pipe_ {-1};
 	int stderr_pipe_ {-1};
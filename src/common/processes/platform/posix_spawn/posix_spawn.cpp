@@ -0,0 +1,244 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <common/processes.hpp>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <common/log.hpp>
+
+namespace mender {
+namespace common {
+namespace processes {
+
+namespace log = mender::common::log;
+
+static void ClosePipe(int fds[2]) {
+	for (int i = 0; i < 2; i++) {
+		if (fds[i] >= 0) {
+			close(fds[i]);
+			fds[i] = -1;
+		}
+	}
+}
+
+SpawnedProcess::SpawnedProcess(
+	const vector<string> &args,
+	const string &work_dir,
+	OutputCallback read_stdout,
+	OutputCallback read_stderr) :
+	read_stdout_ {read_stdout},
+	read_stderr_ {read_stderr} {
+	if (args.size() == 0) {
+		return;
+	}
+
+	// The parent's ends are close-on-exec so that other processes spawned concurrently don't
+	// inherit them, which would prevent us from seeing EOF.
+	int stdout_pipe[2] {-1, -1};
+	int stderr_pipe[2] {-1, -1};
+	if ((read_stdout_ && pipe2(stdout_pipe, O_CLOEXEC) != 0)
+		|| (read_stderr_ && pipe2(stderr_pipe, O_CLOEXEC) != 0)) {
+		int err = errno;
+		log::Error(string {"Could not create process output pipe: "} + strerror(err));
+		ClosePipe(stdout_pipe);
+		ClosePipe(stderr_pipe);
+		return;
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	int err = posix_spawn_file_actions_init(&actions);
+	if (err != 0) {
+		log::Error(string {"Could not spawn process: "} + strerror(err));
+		ClosePipe(stdout_pipe);
+		ClosePipe(stderr_pipe);
+		return;
+	}
+	err = posix_spawnattr_init(&attr);
+	if (err != 0) {
+		log::Error(string {"Could not spawn process: "} + strerror(err));
+		posix_spawn_file_actions_destroy(&actions);
+		ClosePipe(stdout_pipe);
+		ClosePipe(stderr_pipe);
+		return;
+	}
+
+	// dup2() clears the close-on-exec flag on the target descriptor.
+	if (err == 0 && stdout_pipe[1] >= 0) {
+		err = posix_spawn_file_actions_adddup2(&actions, stdout_pipe[1], STDOUT_FILENO);
+	}
+	if (err == 0 && stderr_pipe[1] >= 0) {
+		err = posix_spawn_file_actions_adddup2(&actions, stderr_pipe[1], STDERR_FILENO);
+	}
+	// Like tiny-process-library, don't leak any of our other descriptors into the child.
+	if (err == 0) {
+		err = posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+	}
+	if (err == 0 && work_dir != "") {
+		err = posix_spawn_file_actions_addchdir_np(&actions, work_dir.c_str());
+	}
+	// Put the child in its own process group, so that Terminate() and Kill() reach its
+	// children as well.
+	if (err == 0) {
+		err = posix_spawnattr_setflags(&attr, static_cast<short>(POSIX_SPAWN_SETPGROUP));
+	}
+	if (err == 0) {
+		err = posix_spawnattr_setpgroup(&attr, 0);
+	}
+
+	bool spawned = false;
+	if (err == 0) {
+		spawned = true;
+		vector<char *> argv;
+		argv.reserve(args.size() + 1);
+		for (auto &arg : args) {
+			argv.push_back(const_cast<char *>(arg.c_str()));
+		}
+		argv.push_back(nullptr);
+
+		pid_t pid;
+		err = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+		if (err == 0) {
+			pid_ = pid;
+		}
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (err != 0) {
+		log::Error("Could not spawn '" + args[0] + "': " + strerror(err));
+		ClosePipe(stdout_pipe);
+		ClosePipe(stderr_pipe);
+		if (spawned && err != ENOMEM && err != EAGAIN) {
+			// Failed in the child, after the point where fork() would have succeeded, for
+			// example because the executable is missing. tiny-process-library can only report
+			// that as exit status 1 from the child, and callers rely on that.
+			pid_ = 0;
+			exit_status_ = 1;
+			waited_ = true;
+		}
+		return;
+	}
+
+	// The write ends belong to the child now.
+	close(stdout_pipe[1]);
+	stdout_pipe[1] = -1;
+	close(stderr_pipe[1]);
+	stderr_pipe[1] = -1;
+
+	if (stdout_pipe[0] >= 0 || stderr_pipe[0] >= 0) {
+		output_thread_ = thread([this, stdout_pipe, stderr_pipe]() {
+			ReadOutput(stdout_pipe[0], stderr_pipe[0]);
+		});
+	}
+}
+
+SpawnedProcess::~SpawnedProcess() {
+	if (output_thread_.joinable()) {
+		output_thread_.join();
+	}
+}
+
+int SpawnedProcess::get_exit_status() {
+	if (waited_) {
+		return exit_status_;
+	}
+
+	if (pid_ <= 0) {
+		return -1;
+	}
+
+	int status;
+	pid_t ret;
+	do {
+		ret = waitpid(pid_, &status, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		int err = errno;
+		log::Error("Could not wait for PID " + to_string(pid_) + ": " + strerror(err));
+		exit_status_ = -1;
+	} else if (WIFEXITED(status)) {
+		exit_status_ = WEXITSTATUS(status);
+	} else if (WIFSIGNALED(status)) {
+		// Same as tiny-process-library: A process killed by a signal returns the signal
+		// number.
+		exit_status_ = WTERMSIG(status);
+	}
+	waited_ = true;
+
+	// Make sure all output has been delivered before reporting the exit status.
+	if (output_thread_.joinable()) {
+		output_thread_.join();
+	}
+
+	return exit_status_;
+}
+
+void SpawnedProcess::ReadOutput(int stdout_fd, int stderr_fd) {
+	vector<char> buf(MENDER_BUFSIZE);
+
+	// poll() ignores negative descriptors, which is what we use for closed or unused ones.
+	pollfd fds[2] {{stdout_fd, POLLIN, 0}, {stderr_fd, POLLIN, 0}};
+	OutputCallback *callbacks[2] {&read_stdout_, &read_stderr_};
+
+	while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+		int ret = poll(fds, 2, -1);
+		if (ret < 0) {
+			int err = errno;
+			if (err == EINTR) {
+				continue;
+			}
+			log::Error(string {"Error while polling process output: "} + strerror(err));
+			break;
+		}
+
+		for (int i = 0; i < 2; i++) {
+			if (fds[i].fd < 0 || fds[i].revents == 0) {
+				continue;
+			}
+
+			auto n = read(fds[i].fd, buf.data(), buf.size());
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				continue;
+			}
+
+			(*callbacks[i])(buf.data(), static_cast<size_t>(n));
+		}
+	}
+
+	for (auto &pfd : fds) {
+		if (pfd.fd >= 0) {
+			close(pfd.fd);
+		}
+	}
+}
+
+} // namespace processes
+} // namespace common
+} // namespace mender
@@ -20,6 +20,7 @@
 #include <common/events_io.hpp>
 #include <common/io.hpp>
 #include <common/log.hpp>
+#include <common/metrics.hpp>
 #include <common/path.hpp>
 
 using namespace std;
@@ -32,8 +33,15 @@ const chrono::seconds MAX_TERMINATION_TIME(10);
 
 namespace io = mender::common::io;
 namespace log = mender::common::log;
+namespace metrics = mender::common::metrics;
 namespace path = mender::common::path;
 
+static metrics::Histogram &SpawnDuration() {
+	static auto &histogram = metrics::DefaultRegistry().GetHistogram(
+		"mender_process_spawn_seconds", "Time taken to spawn child processes.");
+	return histogram;
+}
+
 class ProcessReaderFunctor {
 public:
 	void operator()(const char *bytes, size_t n);
@@ -94,8 +102,10 @@ error::Error Process::Start(OutputCallback stdout_callback, OutputCallback stder
 		maybe_stderr_callback = ProcessReaderFunctor {stderr_pipe_, stderr_callback};
 	}
 
+	auto spawn_start = chrono::steady_clock::now();
 	proc_ =
-		make_unique<tpl::Process>(args_, work_dir_, maybe_stdout_callback, maybe_stderr_callback);
+		make_unique<NativeProcess>(args_, work_dir_, maybe_stdout_callback, maybe_stderr_callback);
+	SpawnDuration().ObserveDuration(chrono::steady_clock::now() - spawn_start);
 
 	if (proc_->get_id() == -1) {
 		proc_.reset();
@@ -337,10 +347,12 @@ ExpectedLineData Process::GenerateLineData(chrono::nanoseconds timeout) {
 
 	string trailing_line;
 	vector<string> ret;
-	proc_ = make_unique<tpl::Process>(
+	auto spawn_start = chrono::steady_clock::now();
+	proc_ = make_unique<NativeProcess>(
 		args_, work_dir_, [&trailing_line, &ret](const char *bytes, size_t len) {
 			CollectLineData(trailing_line, ret, bytes, len);
 		});
+	SpawnDuration().ObserveDuration(chrono::steady_clock::now() - spawn_start);
 
 	if (proc_->get_id() == -1) {
 		proc_.reset();
@@ -429,7 +441,8 @@ int Process::EnsureTerminated() {
 }
 
 void Process::Terminate() {
-	if (proc_) {
+	// No PID if the process never got to execute, see `SpawnedProcess::get_id()`.
+	if (proc_ && proc_->get_id() > 0) {
 		// At the time of writing, tiny-process-library kills using SIGINT and SIGTERM, for
 		// `force = false/true`, respectively. But we want to kill with SIGTERM and SIGKILL,
 		// because:
@@ -448,7 +461,7 @@ void Process::Terminate() {
 }
 
 void Process::Kill() {
-	if (proc_) {
+	if (proc_ && proc_->get_id() > 0) {
 		// See comment in Terminate().
 		// proc_->kill(true);
 
@@ -15,6 +15,7 @@
 #ifndef MENDER_COMMON_STATE_MACHINE_HPP
 #define MENDER_COMMON_STATE_MACHINE_HPP
 
+#include <chrono>
 #include <queue>
 #include <unordered_map>
 #include <unordered_set>
@@ -22,6 +23,8 @@
 #include <common/common.hpp>
 #include <common/events.hpp>
 #include <common/log.hpp>
+#include <common/metrics.hpp>
+#include <common/tracing.hpp>
 
 namespace mender {
 namespace common {
@@ -32,6 +35,8 @@ using namespace std;
 namespace common = mender::common;
 namespace events = mender::common::events;
 namespace log = mender::common::log;
+namespace metrics = mender::common::metrics;
+namespace tracing = mender::common::tracing;
 
 template <typename ContextType, typename EventType>
 class StateMachineRunner;
@@ -95,6 +100,10 @@ private:
 
 	State<ContextType, EventType> *current_state_;
 	bool state_entered_ {false};
+	chrono::steady_clock::time_point state_entered_at_;
+	// All states of one machine are traced on the same track.
+	uint64_t trace_id_ {tracing::NewId()};
+	tracing::Span state_span_;
 
 	unordered_map<TransitionCondition, State<ContextType, EventType> *, Hasher> transitions_;
 	unordered_set<EventType> deferred_events_;
@@ -171,6 +180,10 @@ private:
 			if (!machine->state_entered_) {
 				to_run.push_back(machine->current_state_);
 				machine->state_entered_ = true;
+				machine->state_entered_at_ = chrono::steady_clock::now();
+				machine->state_span_.End();
+				machine->state_span_ = tracing::Span(
+					"state", StateName(*machine->current_state_), machine->trace_id_);
 			}
 		}
 
@@ -196,7 +209,13 @@ private:
 
 				auto &target = match->second;
 				to_run.push_back(target);
+				auto now = chrono::steady_clock::now();
+				RecordStateDuration(*machine->current_state_, now - machine->state_entered_at_);
 				machine->current_state_ = target;
+				machine->state_entered_at_ = now;
+				machine->state_span_.End();
+				machine->state_span_ =
+					tracing::Span("state", StateName(*target), machine->trace_id_);
 			}
 
 			if (to_run.empty()) {
@@ -222,7 +241,9 @@ private:
 
 		if (!to_run.empty()) {
 			for (auto &state : to_run) {
-				log::Trace("Entering state " + common::BestAvailableTypeName(*state));
+				log::Trace([state]() {
+					return "Entering state " + common::BestAvailableTypeName(*state);
+				});
 				state->OnEnter(ctx_, *this);
 			}
 			// Since we ran something, there may be more events waiting to
@@ -233,17 +254,46 @@ private:
 		}
 	}
 
+	// The type name without namespaces.
+	static string StateName(const State<ContextType, EventType> &state) {
+		auto name = common::BestAvailableTypeName(state);
+		auto pos = name.rfind("::");
+		if (pos != string::npos) {
+			name = name.substr(pos + 2);
+		}
+		return name;
+	}
+
+	static void RecordStateDuration(
+		const State<ContextType, EventType> &state, chrono::steady_clock::duration duration) {
+		metrics::DefaultRegistry()
+			.GetHistogram(
+				"mender_state_duration_seconds",
+				"Time spent in each state of the state machines.",
+				{{"state", StateName(state)}})
+			.ObserveDuration(duration);
+	}
+
 	void PostToEventLoop() {
 		if (!event_loop_) {
 			return;
 		}
 
+		// Which states run next is only decided once the events have been handled, so the
+		// stall reports name the ones the machines are in now.
+		string tag = "state machine in";
+		for (size_t i = 0; i < machines_.size(); i++) {
+			tag += (i == 0 ? " " : ", ") + StateName(*machines_[i]->current_state_);
+		}
+
 		auto cancelled = cancelled_;
-		event_loop_->Post([cancelled, this]() {
-			if (!*cancelled) {
-				RunOne();
-			}
-		});
+		event_loop_->Post(
+			[cancelled, this]() {
+				if (!*cancelled) {
+					RunOne();
+				}
+			},
+			tag);
 	}
 
 	ContextType &ctx_;
@@ -0,0 +1,120 @@
+// Copyright 2024 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#ifndef MENDER_COMMON_TRACING_HPP
+#define MENDER_COMMON_TRACING_HPP
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <common/error.hpp>
+
+// Writes timelines in the Chrome trace event format, which can be opened in Perfetto
+// (https://ui.perfetto.dev) or in chrome://tracing. Tracing is off until `Start()` is called, and
+// everything below is a cheap no-op while it is off.
+//
+// All events are "nestable async" begin/end pairs, because most of the work is done on the event
+// loop, where operations overlap instead of nesting like function calls. Events sharing the same
+// category and id are shown on the same track.
+
+namespace mender {
+namespace common {
+namespace tracing {
+
+using namespace std;
+
+namespace error = mender::common::error;
+
+// Arguments shown with an event in the trace viewers.
+class Args {
+public:
+	Args &Add(const string &key, const string &value);
+	Args &Add(const string &key, int64_t value);
+
+	bool Empty() const {
+		return args_.empty();
+	}
+
+private:
+	friend string FormatArgs(const Args &args);
+
+	Args &Set(const string &key, string json_value);
+
+	// Values are stored already encoded as JSON.
+	vector<pair<string, string>> args_;
+};
+
+// Starts writing events to `path`, replacing the file, or adding to it if `append` is true, so
+// that a trace can continue after a restart. Stops any earlier trace first.
+//
+// The closing bracket of the event array is never written, which the format allows, so that the
+// file stays valid when events are added later, or when the trace is cut short by a crash.
+// Timestamps are wall clock based for the same reason.
+error::Error Start(const string &path, bool append = false);
+void Stop();
+bool Enabled();
+
+// Returns an id which no other track in this process uses.
+uint64_t NewId();
+
+void AsyncBegin(const string &category, const string &name, uint64_t id, const Args &args = {});
+void AsyncEnd(const string &category, const string &name, uint64_t id, const Args &args = {});
+
+// Begins an event when created, and ends it when `End()` is called or when destroyed, whichever
+// comes first. Does nothing if tracing is off when it is created.
+class Span {
+public:
+	Span() {
+	}
+	Span(const string &category, const string &name, const Args &args = {}) :
+		Span(category, name, NewId(), args) {
+	}
+	Span(const string &category, const string &name, uint64_t id, const Args &args = {});
+	~Span() {
+		End();
+	}
+
+	Span(Span &&other);
+	Span &operator=(Span &&other);
+	Span(const Span &) = delete;
+	Span &operator=(const Span &) = delete;
+
+	// Arguments added here are attached to the end event.
+	void AddArg(const string &key, int64_t value) {
+		if (active_) {
+			end_args_.Add(key, value);
+		}
+	}
+
+	// Whether the begin event went into the trace which is currently being written.
+	bool Active() const;
+
+	void End();
+
+private:
+	bool active_ {false};
+	uint64_t generation_ {0};
+	string category_;
+	string name_;
+	uint64_t id_ {0};
+	Args end_args_;
+};
+
+} // namespace tracing
+} // namespace common
+} // namespace mender
+
+#endif // MENDER_COMMON_TRACING_HPP
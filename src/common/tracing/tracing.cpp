@@ -0,0 +1,267 @@
+// Copyright 2024 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <common/tracing.hpp>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <unistd.h>
+
+namespace mender {
+namespace common {
+namespace tracing {
+
+using namespace std;
+
+struct Trace {
+	mutex lock;
+	unique_ptr<ofstream> out;
+	chrono::steady_clock::time_point start;
+	chrono::microseconds start_since_epoch;
+	bool first_event {true};
+	// Small, stable numbers for the threads, which are easier to read than native ids.
+	map<thread::id, int> tids;
+};
+
+static Trace &GlobalTrace() {
+	static Trace trace;
+	return trace;
+}
+
+static atomic<bool> enabled {false};
+static atomic<uint64_t> next_id {1};
+// Incremented for each new trace, so that spans from an earlier one don't end up in it.
+static atomic<uint64_t> generation {0};
+
+static string JsonString(const string &str) {
+	string escaped = "\"";
+	for (auto c : str) {
+		switch (c) {
+		case '"':
+			escaped += "\\\"";
+			break;
+		case '\\':
+			escaped += "\\\\";
+			break;
+		case '\n':
+			escaped += "\\n";
+			break;
+		case '\r':
+			escaped += "\\r";
+			break;
+		case '\t':
+			escaped += "\\t";
+			break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				escaped += buf;
+			} else {
+				escaped += c;
+			}
+			break;
+		}
+	}
+	return escaped + "\"";
+}
+
+Args &Args::Set(const string &key, string json_value) {
+	for (auto &arg : args_) {
+		if (arg.first == key) {
+			arg.second = std::move(json_value);
+			return *this;
+		}
+	}
+	args_.emplace_back(key, std::move(json_value));
+	return *this;
+}
+
+Args &Args::Add(const string &key, const string &value) {
+	return Set(key, JsonString(value));
+}
+
+Args &Args::Add(const string &key, int64_t value) {
+	return Set(key, to_string(value));
+}
+
+string FormatArgs(const Args &args) {
+	string formatted = "{";
+	for (const auto &arg : args.args_) {
+		if (formatted.size() > 1) {
+			formatted += ",";
+		}
+		formatted += JsonString(arg.first) + ":" + arg.second;
+	}
+	return formatted + "}";
+}
+
+error::Error Start(const string &path, bool append) {
+	Stop();
+
+	auto &trace = GlobalTrace();
+	lock_guard<mutex> guard(trace.lock);
+
+	bool has_events = false;
+	if (append) {
+		ifstream existing(path, ios::ate);
+		has_events = existing.good() && existing.tellg() > 0;
+	}
+
+	errno = 0;
+	unique_ptr<ofstream> out(new ofstream(path, has_events ? ios::app : ios::trunc));
+	if (!out->good()) {
+		int err = errno;
+		return error::Error(
+			generic_category().default_error_condition(err),
+			"Could not open trace file " + path);
+	}
+	if (!has_events) {
+		*out << "[";
+	}
+
+	trace.out = std::move(out);
+	trace.start = chrono::steady_clock::now();
+	trace.start_since_epoch = chrono::duration_cast<chrono::microseconds>(
+		chrono::system_clock::now().time_since_epoch());
+	trace.first_event = !has_events;
+	trace.tids.clear();
+	generation++;
+	enabled = true;
+	return error::NoError;
+}
+
+void Stop() {
+	auto &trace = GlobalTrace();
+	lock_guard<mutex> guard(trace.lock);
+
+	enabled = false;
+	if (trace.out) {
+		*trace.out << "\n";
+		trace.out.reset();
+	}
+}
+
+bool Enabled() {
+	return enabled.load(memory_order_relaxed);
+}
+
+uint64_t NewId() {
+	return next_id.fetch_add(1, memory_order_relaxed);
+}
+
+static void WriteEvent(
+	char phase, const string &category, const string &name, uint64_t id, const Args &args) {
+	auto now = chrono::steady_clock::now();
+
+	auto &trace = GlobalTrace();
+	lock_guard<mutex> guard(trace.lock);
+	if (!trace.out) {
+		return;
+	}
+
+	auto tid_insert =
+		trace.tids.insert({this_thread::get_id(), static_cast<int>(trace.tids.size()) + 1});
+	auto ts = (trace.start_since_epoch
+			   + chrono::duration_cast<chrono::microseconds>(now - trace.start))
+				  .count();
+
+	// Several processes may append to the same trace, so the events are put under the real pid,
+	// which also keeps the ids of one process from being matched with those of another.
+	*trace.out << (trace.first_event ? "\n" : ",\n");
+	trace.first_event = false;
+	*trace.out << "{\"ph\":\"" << phase << "\",\"cat\":" << JsonString(category)
+			   << ",\"name\":" << JsonString(name) << ",\"id\":" << id << ",\"ts\":" << ts
+			   << ",\"pid\":" << getpid() << ",\"tid\":" << tid_insert.first->second;
+	if (!args.Empty()) {
+		*trace.out << ",\"args\":" << FormatArgs(args);
+	}
+	// Events are few and far between, so flush them right away, not to lose any when the device
+	// reboots during the deployment.
+	*trace.out << "}" << flush;
+}
+
+void AsyncBegin(const string &category, const string &name, uint64_t id, const Args &args) {
+	if (Enabled()) {
+		WriteEvent('b', category, name, id, args);
+	}
+}
+
+void AsyncEnd(const string &category, const string &name, uint64_t id, const Args &args) {
+	if (Enabled()) {
+		WriteEvent('e', category, name, id, args);
+	}
+}
+
+Span::Span(const string &category, const string &name, uint64_t id, const Args &args) {
+	if (!Enabled()) {
+		return;
+	}
+	active_ = true;
+	generation_ = generation;
+	category_ = category;
+	name_ = name;
+	id_ = id;
+	AsyncBegin(category_, name_, id_, args);
+}
+
+Span::Span(Span &&other) :
+	active_ {other.active_},
+	generation_ {other.generation_},
+	category_ {std::move(other.category_)},
+	name_ {std::move(other.name_)},
+	id_ {other.id_},
+	end_args_ {std::move(other.end_args_)} {
+	other.active_ = false;
+}
+
+Span &Span::operator=(Span &&other) {
+	if (this != &other) {
+		End();
+		active_ = other.active_;
+		generation_ = other.generation_;
+		category_ = std::move(other.category_);
+		name_ = std::move(other.name_);
+		id_ = other.id_;
+		end_args_ = std::move(other.end_args_);
+		other.active_ = false;
+	}
+	return *this;
+}
+
+bool Span::Active() const {
+	return active_ && generation_ == generation;
+}
+
+void Span::End() {
+	if (!active_) {
+		return;
+	}
+	active_ = false;
+	if (generation_ == generation) {
+		AsyncEnd(category_, name_, id_, end_args_);
+	}
+}
+
+} // namespace tracing
+} // namespace common
+} // namespace mender
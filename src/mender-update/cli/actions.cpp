@@ -15,6 +15,8 @@
 #include <mender-update/cli/actions.hpp>
 
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <string>
 
@@ -275,6 +277,69 @@ error::Error InstallAction::Execute(context::MenderContext &main_context) {
 	return err;
 }
 
+static string FormatMiB(double bytes) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.1f MiB", bytes / (1024 * 1024));
+	return buf;
+}
+
+static string FormatSeconds(double seconds) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.3f s", seconds);
+	return buf;
+}
+
+static string FormatThroughput(double bytes, double seconds) {
+	if (seconds <= 0) {
+		return "-";
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.1f MiB/s", bytes / (1024 * 1024) / seconds);
+	return buf;
+}
+
+error::Error BenchmarkAction::Execute(context::MenderContext &main_context) {
+	events::EventLoop loop;
+	standalone::Context ctx {main_context, loop};
+	auto exp_result = standalone::Benchmark(
+		ctx,
+		src_,
+		update_module_ ? standalone::BenchmarkSink::UpdateModule
+					   : standalone::BenchmarkSink::Discard);
+	if (!exp_result) {
+		return exp_result.error();
+	}
+	auto &result = exp_result.value();
+
+	auto seconds = [](chrono::steady_clock::duration duration) {
+		return chrono::duration<double>(duration).count();
+	};
+	auto total_seconds = seconds(result.total_time);
+	auto artifact_bytes = static_cast<double>(result.artifact_bytes);
+
+	cout << "Artifact:      " << result.artifact_name;
+	if (result.payload_type != "") {
+		cout << " (" << result.payload_type << ")";
+	}
+	cout << endl;
+	cout << "Size:          " << FormatMiB(artifact_bytes) << endl;
+	cout << "Header:        " << FormatSeconds(seconds(result.header_time))
+		 << " to download, parse and verify" << endl;
+	cout << "Total:         " << FormatSeconds(total_seconds) << ", "
+		 << FormatThroughput(artifact_bytes, total_seconds) << endl;
+	for (const auto &stage : result.stages) {
+		// Each stage's time excludes the stages it reads from, see `metrics::Stage`.
+		cout << "Stage " << stage.name << ": " << FormatMiB(stage.bytes) << " in "
+			 << FormatSeconds(stage.seconds) << ", "
+			 << FormatThroughput(stage.bytes, stage.seconds) << endl;
+	}
+	cout << "CPU time:      " << FormatSeconds(seconds(result.user_cpu_time)) << " user, "
+		 << FormatSeconds(seconds(result.system_cpu_time)) << " system" << endl;
+	cout << "Peak RSS:      " << result.peak_rss_kib << " KiB" << endl;
+
+	return error::NoError;
+}
+
 error::Error ResumeAction::Execute(context::MenderContext &main_context) {
 	events::EventLoop loop;
 	standalone::Context ctx {main_context, loop};
@@ -308,8 +373,31 @@ error::Error RollbackAction::Execute(context::MenderContext &main_context) {
 	return ResultHandler(result);
 }
 
-error::Error DaemonAction::Execute(context::MenderContext &main_context) {
+static error::Error SetupDaemonLogging(const conf::MenderConfig &config) {
+	if (config.daemon_log_queue_size <= 0) {
+		return error::NoError;
+	}
+
+	log::AsyncLogOptions options;
+	options.queue_size = static_cast<size_t>(config.daemon_log_queue_size);
+	if (config.daemon_log_overflow_policy != "") {
+		auto ex_policy = log::StringToLogOverflowPolicy(config.daemon_log_overflow_policy);
+		if (!ex_policy) {
+			return ex_policy.error();
+		}
+		options.overflow_policy = ex_policy.value();
+	}
+	log::SetupAsyncLogging(options);
+	return error::NoError;
+}
+
+static error::Error RunDaemon(context::MenderContext &main_context) {
 	events::EventLoop event_loop;
+	const auto &config = main_context.GetConfig();
+	if (config.daemon_stall_threshold_milliseconds > 0) {
+		event_loop.EnableStallDetection(
+			chrono::milliseconds(config.daemon_stall_threshold_milliseconds));
+	}
 	daemon::Context ctx(main_context, event_loop);
 
 #if not defined(MENDER_USE_DBUS) and defined(MENDER_EMBED_MENDER_AUTH)
@@ -333,6 +421,20 @@ error::Error DaemonAction::Execute(context::MenderContext &main_context) {
 	return state_machine.Run();
 }
 
+error::Error DaemonAction::Execute(context::MenderContext &main_context) {
+	auto err = SetupDaemonLogging(main_context.GetConfig());
+	if (err != error::NoError) {
+		return err;
+	}
+
+	err = RunDaemon(main_context);
+
+	// Switch back to synchronous logging, which writes out everything still queued.
+	log::SetupAsyncLogging({});
+
+	return err;
+}
+
 static expected::ExpectedString GetPID() {
 	processes::Process proc({"systemctl", "show", "--property=MainPID", "mender-updated"});
 	auto exp_line_data = proc.GenerateLineData();
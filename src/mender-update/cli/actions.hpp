@@ -77,6 +77,20 @@ private:
 	string src_;
 };
 
+class BenchmarkAction : virtual public Action {
+public:
+	BenchmarkAction(const string &src, bool update_module) :
+		src_ {src},
+		update_module_ {update_module} {
+	}
+
+	error::Error Execute(context::MenderContext &main_context) override;
+
+private:
+	string src_;
+	bool update_module_;
+};
+
 class ResumeAction : public BaseInstallAction {
 public:
 	error::Error Execute(context::MenderContext &main_context) override;
@@ -42,6 +42,27 @@ const conf::CliCommand cmd_auth {
 };
 #endif
 
+const conf::CliCommand cmd_benchmark {
+	.name = "benchmark",
+	.description =
+		"Measure the throughput of downloading, verifying and streaming a Mender Artifact - "
+		"local file or a URL - without installing it",
+	.argument =
+		conf::CliArgument {
+			.name = "artifact",
+			.mandatory = true,
+		},
+	.options =
+		{
+			conf::CliOption {
+				.long_option = "update-module",
+				.description =
+					"Stream the payload to the Update Module, stopping after its Download state, "
+					"instead of discarding it.",
+			},
+		},
+};
+
 const conf::CliCommand cmd_check_update {
 	.name = "check-update",
 	.description = "Force update check",
@@ -145,6 +166,7 @@ const conf::CliApp cli_mender_update = {
 #ifdef MENDER_EMBED_MENDER_AUTH
 			cmd_auth,
 #endif
+			cmd_benchmark,
 			cmd_check_update,
 			cmd_commit,
 			cmd_daemon,
@@ -246,6 +268,40 @@ ExpectedActionPtr ParseUpdateArguments(
 		install_action->SetRebootExitCode(reboot_exit_code);
 		install_action->SetStopBefore(std::move(stop_before));
 		return install_action;
+	} else if (start[0] == "benchmark") {
+		conf::CmdlineOptionsIterator iter(start + 1, end, cmd_benchmark.options);
+		iter.SetArgumentsMode(conf::ArgumentsMode::AcceptBareArguments);
+
+		string filename;
+		bool update_module = false;
+		while (true) {
+			auto arg = iter.Next();
+			if (!arg) {
+				return expected::unexpected(arg.error());
+			}
+
+			auto value = arg.value();
+			if (value.option == "--update-module") {
+				update_module = true;
+			} else if (value.option != "") {
+				return expected::unexpected(
+					conf::MakeError(conf::InvalidOptionsError, "No such option: " + value.option));
+			} else if (value.value != "") {
+				if (filename != "") {
+					return expected::unexpected(conf::MakeError(
+						conf::InvalidOptionsError, "Too many arguments: " + value.value));
+				}
+				filename = value.value;
+			} else {
+				break;
+			}
+		}
+		if (filename == "") {
+			return expected::unexpected(
+				conf::MakeError(conf::InvalidOptionsError, "Need a path to an artifact"));
+		}
+
+		return make_shared<BenchmarkAction>(filename, update_module);
 	} else if (start[0] == "resume") {
 		conf::CmdlineOptionsIterator iter(start + 1, end, cmd_resume.options);
 
@@ -23,6 +23,7 @@
 #include <common/error.hpp>
 #include <common/expected.hpp>
 #include <common/key_value_database.hpp>
+#include <common/key_value_database_cache.hpp>
 #include <common/optional.hpp>
 
 #ifdef MENDER_USE_LMDB
@@ -159,6 +160,13 @@ private:
 #ifdef MENDER_USE_LMDB
 	kv_db::KeyValueDatabaseLmdb mender_store_;
 #endif // MENDER_USE_LMDB
+	// All access to the store goes through this, so that our own writes keep it up to date. Only
+	// caches anything if enabled in the configuration.
+	kv_db::KeyValueDatabaseCache mender_store_cache_ {
+		mender_store_, {artifact_name_key, artifact_group_key, artifact_provides_key}};
+	// The provides last decoded by `LoadProvides()`, and the stored values they came from.
+	kv_db::KeyValueMap provides_values_;
+	optional<ProvidesData> provides_;
 	conf::MenderConfig &config_;
 };
 
@@ -112,60 +112,66 @@ error::Error MenderContext::Initialize() {
 	if (error::NoError != err) {
 		return err;
 	}
-	err = mender_store_.Remove(auth_token_name);
-	if (error::NoError != err) {
+	mender_store_.SetDeferredSync(config_.database_deferred_sync);
+	mender_store_cache_.SetEnabled(config_.database_cache);
+
+	// One transaction, so that there is only one sync.
+	return mender_store_.WriteTransaction([](kv_db::Transaction &txn) {
 		// key not existing in the DB is not treated as an error so this must be
 		// a real error
-		return err;
-	}
-	err = mender_store_.Remove(auth_token_cache_invalidator_name);
-	if (error::NoError != err) {
-		// same as above -- a real error
-		return err;
-	}
-
-	return error::NoError;
+		auto err = txn.Remove(auth_token_name);
+		if (error::NoError != err) {
+			return err;
+		}
+		return txn.Remove(auth_token_cache_invalidator_name);
+	});
 #else
 	return error::NoError;
 #endif
 }
 
 kv_db::KeyValueDatabase &MenderContext::GetMenderStoreDB() {
-	return mender_store_;
+	return mender_store_cache_;
 }
 
+static ExpectedProvidesData DecodeProvides(const kv_db::KeyValueMap &values);
+
 ExpectedProvidesData MenderContext::LoadProvides() {
-	ExpectedProvidesData data;
-	auto err = mender_store_.ReadTransaction([this, &data](kv_db::Transaction &txn) {
-		data = LoadProvides(txn);
-		if (!data) {
-			return data.error();
-		}
-		return error::NoError;
-	});
-	if (err != error::NoError) {
-		return expected::unexpected(err);
+	// Usually comes from the cache, and then only needs decoding if the values have changed.
+	auto exp_values = mender_store_cache_.ReadMany(
+		{artifact_name_key, artifact_group_key, artifact_provides_key});
+	if (!exp_values) {
+		return expected::unexpected(exp_values.error());
+	}
+	if (provides_ && exp_values.value() == provides_values_) {
+		return provides_.value();
+	}
+
+	auto data = DecodeProvides(exp_values.value());
+	if (data) {
+		provides_values_ = std::move(exp_values.value());
+		provides_ = data.value();
 	}
 	return data;
 }
 
 ExpectedProvidesData MenderContext::LoadProvides(kv_db::Transaction &txn) {
-	string artifact_name;
-	string artifact_group;
-	string artifact_provides_str;
-
-	auto err = kv_db::ReadString(txn, artifact_name_key, artifact_name, true);
-	if (err != error::NoError) {
-		return expected::unexpected(err);
-	}
-	err = kv_db::ReadString(txn, artifact_group_key, artifact_group, true);
-	if (err != error::NoError) {
-		return expected::unexpected(err);
-	}
-	err = kv_db::ReadString(txn, artifact_provides_key, artifact_provides_str, true);
-	if (err != error::NoError) {
-		return expected::unexpected(err);
+	auto exp_values =
+		txn.ReadMany({artifact_name_key, artifact_group_key, artifact_provides_key});
+	if (!exp_values) {
+		return expected::unexpected(exp_values.error());
 	}
+	return DecodeProvides(exp_values.value());
+}
+
+static ExpectedProvidesData DecodeProvides(const kv_db::KeyValueMap &values) {
+	auto value_string = [&values](const string &key) {
+		auto it = values.find(key);
+		return it == values.end() ? string() : common::StringFromByteVector(it->second);
+	};
+	string artifact_name = value_string(MenderContext::artifact_name_key);
+	string artifact_group = value_string(MenderContext::artifact_group_key);
+	string artifact_provides_str = value_string(MenderContext::artifact_provides_key);
 
 	ProvidesData ret {};
 	if (artifact_name != "") {
@@ -383,7 +389,7 @@ error::Error MenderContext::CommitArtifactData(
 	const optional<ProvidesData> &new_provides,
 	const optional<ClearsProvidesData> &clears_provides,
 	function<error::Error(kv_db::Transaction &)> txn_func) {
-	return mender_store_.WriteTransaction([&](kv_db::Transaction &txn) {
+	return mender_store_cache_.WriteTransaction([&](kv_db::Transaction &txn) {
 		auto exp_existing = LoadProvides(txn);
 		if (!exp_existing) {
 			return exp_existing.error();
@@ -14,10 +14,13 @@
 
 #include <mender-update/daemon/context.hpp>
 
+#include <algorithm>
+
 #include <common/common.hpp>
 #include <client_shared/conf.hpp>
 #include <common/log.hpp>
 #include <common/http_resumer.hpp>
+#include <common/tracing.hpp>
 
 namespace mender {
 namespace update {
@@ -26,6 +29,8 @@ namespace daemon {
 namespace common = mender::common;
 namespace conf = mender::client_shared::conf;
 namespace log = mender::common::log;
+namespace path = mender::common::path;
+namespace tracing = mender::common::tracing;
 namespace http_resumer = mender::common::http::resumer;
 
 namespace main_context = mender::update::context;
@@ -160,7 +165,13 @@ Context::Context(
 	download_client(make_shared<http_resumer::DownloadResumerClient>(
 		mender_context.GetConfig().GetHttpClientConfig(), event_loop)),
 	deployment_client(make_shared<deployments::DeploymentClient>()),
-	inventory_client(make_shared<inventory::InventoryClient>()),
+	inventory_client(make_shared<inventory::InventoryClient>(
+		mender_context.GetMenderStoreDB(),
+		inventory::SubmissionTarget {
+			common::JoinStrings(mender_context.GetConfig().servers, ","),
+			mender_context.GetConfig().tenant_token,
+		},
+		chrono::seconds(mender_context.GetConfig().inventory_full_sync_interval_seconds))),
 	deployment_timer(event_loop),
 	inventory_timer(event_loop) {
 }
@@ -664,10 +675,12 @@ expected::ExpectedBool Context::LoadDeploymentStateData(StateData &state_data) {
 	}
 }
 
-void Context::BeginDeploymentLogging() {
+void Context::BeginDeploymentLogging(bool resuming) {
+	const auto &config = mender_context.GetConfig();
 	deployment.logger.reset(new deployments::DeploymentLog(
-		mender_context.GetConfig().paths.GetUpdateLogPath(),
-		deployment.state_data->update_info.id));
+		config.paths.GetUpdateLogPath(),
+		deployment.state_data->update_info.id,
+		static_cast<size_t>(max(config.deployment_log_max_size_kib, 0)) * 1024));
 	auto err = deployment.logger->BeginLogging();
 	if (err != error::NoError) {
 		log::Error(
@@ -675,6 +688,18 @@ void Context::BeginDeploymentLogging() {
 			+ deployment.state_data->update_info.id + ": " + err.String());
 		// It's not a fatal error, so continue.
 	}
+
+	if (config.deployment_tracing) {
+		err = tracing::Start(deployment.logger->TraceFilePath(), resuming);
+		if (err != error::NoError) {
+			log::Error("Was not able to start the deployment trace: " + err.String());
+		} else {
+			deployment.trace_span = tracing::Span(
+				"deployment",
+				resuming ? "deployment (resumed)" : "deployment",
+				tracing::Args().Add("id", deployment.state_data->update_info.id));
+		}
+	}
 }
 
 void Context::FinishDeploymentLogging() {
@@ -685,6 +710,9 @@ void Context::FinishDeploymentLogging() {
 			+ deployment.state_data->update_info.id + ": " + err.String());
 		// We need to continue regardless
 	}
+
+	deployment.trace_span.End();
+	tracing::Stop();
 }
 
 } // namespace daemon
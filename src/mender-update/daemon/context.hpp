@@ -24,6 +24,7 @@
 #include <common/io.hpp>
 #include <common/json.hpp>
 #include <common/key_value_database.hpp>
+#include <common/tracing.hpp>
 
 #include <artifact/artifact.hpp>
 
@@ -52,6 +53,7 @@ namespace http = mender::common::http;
 namespace io = mender::common::io;
 namespace json = mender::common::json;
 namespace kv_db = mender::common::key_value_database;
+namespace tracing = mender::common::tracing;
 
 namespace artifact = mender::artifact;
 
@@ -154,7 +156,9 @@ public:
 	// then the state_data is still filled in and valid.
 	expected::ExpectedBool LoadDeploymentStateData(StateData &state_data);
 
-	void BeginDeploymentLogging();
+	// `resuming` is true when continuing a deployment after a restart, so that the trace is
+	// continued instead of replaced.
+	void BeginDeploymentLogging(bool resuming = false);
 	void FinishDeploymentLogging();
 
 	mender::update::context::MenderContext &mender_context;
@@ -191,6 +195,7 @@ public:
 		bool download_with_sizes {false};
 
 		unique_ptr<deployments::DeploymentLog> logger;
+		tracing::Span trace_span;
 	} deployment;
 
 	// Database values for the `StateData::state` member above.
@@ -15,10 +15,16 @@
 #ifndef MENDER_UPDATE_STATE_MACHINE_HPP
 #define MENDER_UPDATE_STATE_MACHINE_HPP
 
+#include <common/config.h>
+
 #include <common/error.hpp>
 #include <common/events.hpp>
 #include <common/state_machine.hpp>
 
+#ifdef MENDER_USE_DBUS
+#include <common/platform/dbus.hpp>
+#endif
+
 #include <mender-update/context.hpp>
 
 #include <mender-update/daemon/context.hpp>
@@ -31,6 +37,9 @@ namespace daemon {
 
 namespace error = mender::common::error;
 namespace events = mender::common::events;
+#ifdef MENDER_USE_DBUS
+namespace dbus = mender::common::dbus;
+#endif
 namespace sm = mender::common::state_machine;
 
 namespace context = mender::update::context;
@@ -53,6 +62,8 @@ public:
 #endif
 
 private:
+	bool CanResumeDownload();
+
 	Context &ctx_;
 	events::EventLoop &event_loop_;
 	events::SignalHandler check_update_handler_;
@@ -61,6 +72,14 @@ private:
 
 	error::Error RegisterSignalHandlers();
 
+#ifdef MENDER_USE_DBUS
+	dbus::DBusServer dbus_server_;
+
+	// Lets other programs trigger the same things as the signals, and read the metrics, over
+	// D-Bus.
+	error::Error RegisterDBusMethods();
+#endif
+
 	///////////////////////////////////////////////////////////////////////////////////////////
 	// Main states
 	///////////////////////////////////////////////////////////////////////////////////////////
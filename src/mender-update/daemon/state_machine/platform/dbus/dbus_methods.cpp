@@ -0,0 +1,57 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/daemon/state_machine.hpp>
+
+#include <common/error.hpp>
+#include <common/expected.hpp>
+#include <common/log.hpp>
+#include <common/metrics.hpp>
+#include <common/platform/dbus.hpp>
+
+namespace mender {
+namespace update {
+namespace daemon {
+
+namespace dbus = mender::common::dbus;
+namespace error = mender::common::error;
+namespace expected = mender::common::expected;
+namespace log = mender::common::log;
+namespace metrics = mender::common::metrics;
+
+error::Error StateMachine::RegisterDBusMethods() {
+	auto dbus_obj = make_shared<dbus::DBusObject>("/io/mender/UpdateManager");
+	dbus_obj->AddMethodHandler<expected::ExpectedBool>(
+		"io.mender.Update2", "CheckUpdate", [this]() {
+			log::Info("Deployments check triggered over D-Bus");
+			runner_.PostEvent(StateEvent::DeploymentPollingTriggered);
+			return true;
+		});
+	dbus_obj->AddMethodHandler<expected::ExpectedBool>(
+		"io.mender.Update2", "SendInventory", [this]() {
+			log::Info("Inventory update triggered over D-Bus");
+			runner_.PostEvent(StateEvent::InventoryPollingTriggered);
+			return true;
+		});
+	dbus_obj->AddMethodHandler<expected::ExpectedString>(
+		"io.mender.Update2", "GetMetrics", []() {
+			return metrics::DefaultRegistry().PrometheusText();
+		});
+
+	return dbus_server_.AdvertiseObject(dbus_obj);
+}
+
+} // namespace daemon
+} // namespace update
+} // namespace mender
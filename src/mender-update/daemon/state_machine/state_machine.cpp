@@ -19,6 +19,7 @@
 #include <common/log.hpp>
 
 #include <mender-update/daemon/states.hpp>
+#include <mender-update/rootfs_writer/rootfs_writer.hpp>
 
 namespace mender {
 namespace update {
@@ -27,6 +28,7 @@ namespace daemon {
 namespace conf = mender::client_shared::conf;
 namespace kvdb = mender::common::key_value_database;
 namespace log = mender::common::log;
+namespace rootfs_writer = mender::update::rootfs_writer;
 
 StateMachine::StateMachine(Context &ctx, events::EventLoop &event_loop) :
 	ctx_(ctx),
@@ -34,6 +36,9 @@ StateMachine::StateMachine(Context &ctx, events::EventLoop &event_loop) :
 	check_update_handler_(event_loop),
 	inventory_update_handler_(event_loop),
 	termination_handler_(event_loop),
+#ifdef MENDER_USE_DBUS
+	dbus_server_(event_loop, "io.mender.UpdateManager"),
+#endif
 	schedule_submit_inventory_state_(
 		ctx.inventory_timer,
 		"inventory submission",
@@ -337,6 +342,19 @@ StateMachine::DeploymentTracking::DeploymentTracking() :
 	states_(idle_state_) {
 }
 
+bool StateMachine::CanResumeDownload() {
+	auto &config = ctx_.mender_context.GetConfig();
+	auto &payload_types = ctx_.deployment.state_data->update_info.artifact.payload_types;
+	if (!config.rootfs_image_writer.enabled or payload_types.size() != 1
+		or payload_types[0] != "rootfs-image") {
+		return false;
+	}
+	// Whether the checkpoint matches the payload can only be checked once the artifact is
+	// being downloaded. If it doesn't, the payload is written from the start.
+	auto &store = ctx_.mender_context.GetMenderStoreDB();
+	return store.Read(rootfs_writer::kCheckpointKey).has_value();
+}
+
 void StateMachine::LoadStateFromDb() {
 	unique_ptr<StateData> state_data(new StateData);
 	auto exp_loaded = ctx_.LoadDeploymentStateData(*state_data);
@@ -348,7 +366,7 @@ void StateMachine::LoadStateFromDb() {
 			// This particular error code also fills in state_data.
 			ctx_.deployment.state_data = std::move(state_data);
 
-			ctx_.BeginDeploymentLogging();
+			ctx_.BeginDeploymentLogging(true);
 
 			main_states_.SetState(state_loop_state_);
 			deployment_tracking_.states_.SetState(deployment_tracking_.rollback_failed_state_);
@@ -379,7 +397,7 @@ void StateMachine::LoadStateFromDb() {
 	// We have state data, move it to the context.
 	ctx_.deployment.state_data = std::move(state_data);
 
-	ctx_.BeginDeploymentLogging();
+	ctx_.BeginDeploymentLogging(true);
 
 	bool update_control_enabled = false;
 	auto exp_update_control_data = store.Read(ctx_.mender_context.update_control_maps);
@@ -395,7 +413,14 @@ void StateMachine::LoadStateFromDb() {
 
 	auto &state = ctx_.deployment.state_data->state;
 
-	if (state == ctx_.kUpdateStateDownload) {
+	if (state == ctx_.kUpdateStateDownload and CanResumeDownload()) {
+		// The built-in rootfs-image writer was interrupted, but left a checkpoint. Download
+		// the artifact again, and let the writer continue where it was.
+		log::Info("Download was interrupted, retrying it from the last checkpoint");
+		main_states_.SetState(state_scripts_.download_enter_);
+		deployment_tracking_.states_.SetState(deployment_tracking_.no_failures_state_);
+
+	} else if (state == ctx_.kUpdateStateDownload) {
 		main_states_.SetState(update_cleanup_state_);
 		// "rollback_attempted_state" because Download in its nature makes no system
 		// changes, so a rollback is a no-op.
@@ -484,6 +509,14 @@ error::Error StateMachine::Run() {
 		return err;
 	}
 
+#ifdef MENDER_USE_DBUS
+	err = RegisterDBusMethods();
+	if (err != error::NoError) {
+		// Not fatal, polling and signals still work.
+		log::Warning("Could not register the D-Bus methods: " + err.String());
+	}
+#endif
+
 	log::Info("Running mender-update " + conf::kMenderVersion);
 
 	event_loop_.Run();
@@ -17,10 +17,12 @@
 #include <client_shared/conf.hpp>
 #include <common/events_io.hpp>
 #include <common/log.hpp>
+#include <common/metrics.hpp>
 #include <common/path.hpp>
 
 #include <mender-update/daemon/context.hpp>
 #include <mender-update/inventory.hpp>
+#include <mender-update/rootfs_writer/rootfs_writer.hpp>
 
 namespace mender {
 namespace update {
@@ -32,9 +34,11 @@ namespace events = mender::common::events;
 namespace kv_db = mender::common::key_value_database;
 namespace path = mender::common::path;
 namespace log = mender::common::log;
+namespace metrics = mender::common::metrics;
 
 namespace main_context = mender::update::context;
 namespace inventory = mender::update::inventory;
+namespace rootfs_writer = mender::update::rootfs_writer;
 
 class DefaultStateHandler {
 public:
@@ -57,6 +61,13 @@ static void DefaultAsyncErrorHandler(sm::EventPoster<StateEvent> &poster, const
 	}
 }
 
+// Only at Debug level, since it is long, and mostly of use when looking into a deployment.
+static void LogMetricsSnapshot() {
+	log::Debug(
+		"Client metrics at the end of the deployment, counted since the client started:\n"
+		+ metrics::DefaultRegistry().PrometheusText());
+}
+
 void EmptyState::OnEnter(Context &ctx, sm::EventPoster<StateEvent> &poster) {
 	// Keep this state truly empty.
 }
@@ -229,8 +240,33 @@ void PollForDeploymentState::HandlePollingError(Context &ctx, sm::EventPoster<St
 	});
 }
 
+// A server which answers a long poll faster than this is not really holding the request, so
+// polling again right away would just hammer it.
+const chrono::seconds kMinimumHeldPollDuration {5};
+
+void PollForDeploymentState::PollAgainNow(Context &ctx, sm::EventPoster<StateEvent> &poster) {
+	auto held_for = chrono::steady_clock::now() - poll_started_;
+	if (held_for < kMinimumHeldPollDuration) {
+		log::Debug("Server answered the long poll too soon, using UpdatePollIntervalSeconds");
+		return;
+	}
+	log::Debug("Server held the deployment check until it timed out, checking again right away");
+
+	ctx.deployment_timer.Cancel();
+	ctx.deployment_timer.AsyncWait(chrono::seconds(0), [&poster](error::Error err) {
+		if (err != error::NoError) {
+			if (err.code != make_error_condition(errc::operation_canceled)) {
+				log::Error("Poll timer caused error: " + err.String());
+			}
+		} else {
+			poster.PostEvent(StateEvent::DeploymentPollingTriggered);
+		}
+	});
+}
+
 void PollForDeploymentState::OnEnter(Context &ctx, sm::EventPoster<StateEvent> &poster) {
 	log::Debug("Polling for update");
+	poll_started_ = chrono::steady_clock::now();
 
 	auto err = ctx.deployment_client->CheckNewDeployments(
 		ctx.mender_context,
@@ -256,6 +292,9 @@ void PollForDeploymentState::OnEnter(Context &ctx, sm::EventPoster<StateEvent> &
 				}
 
 				backoff_.Reset();
+				if (ctx.deployment_client->LastCheckWasHeld()) {
+					PollAgainNow(ctx, poster);
+				}
 				return;
 			}
 			backoff_.Reset();
@@ -293,7 +332,9 @@ void SaveState::OnEnter(Context &ctx, sm::EventPoster<StateEvent> &poster) {
 
 	ctx.deployment.state_data->state = DatabaseStateString();
 
-	log::Trace("Storing deployment state in the DB (database-string): " + DatabaseStateString());
+	log::Trace([this]() {
+		return "Storing deployment state in the DB (database-string): " + DatabaseStateString();
+	});
 
 	auto err = ctx.SaveDeploymentStateData(*ctx.deployment.state_data);
 	if (err != error::NoError) {
@@ -646,7 +687,10 @@ void SendStatusUpdateState::DoStatusUpdate(Context &ctx, sm::EventPoster<StateEv
 				return;
 			}
 
-			// Push logs.
+			// Push logs, with the metrics so far when logging at Debug level, to help find out where
+			// time was spent.
+			LogMetricsSnapshot();
+			ctx.deployment.logger->Flush();
 			err = ctx.deployment_client->PushLogs(
 				ctx.deployment.state_data->update_info.id,
 				ctx.deployment.logger->LogFilePath(),
@@ -975,11 +1019,17 @@ void UpdateCleanupState::OnEnterSaveState(Context &ctx, sm::EventPoster<StateEve
 
 void ClearArtifactDataState::OnEnter(Context &ctx, sm::EventPoster<StateEvent> &poster) {
 	auto err = ctx.mender_context.GetMenderStoreDB().WriteTransaction([](kv_db::Transaction &txn) {
-		// Remove state data, since we're done now.
+		// Remove state data, since we're done now. This includes the checkpoint of the
+		// rootfs-image writer, which Cleanup doesn't get to if the deployment failed before an
+		// Update Module was created.
 		auto err = txn.Remove(main_context::MenderContext::state_data_key);
 		if (err != error::NoError) {
 			return err;
 		}
+		err = txn.Remove(rootfs_writer::kCheckpointKey);
+		if (err != error::NoError) {
+			return err;
+		}
 		return txn.Remove(main_context::MenderContext::state_data_key_uncommitted);
 	});
 	if (err != error::NoError) {
@@ -1018,6 +1068,10 @@ void EndOfDeploymentState::OnEnter(Context &ctx, sm::EventPoster<StateEvent> &po
 		"Deployment with ID " + ctx.deployment.state_data->update_info.id
 		+ " finished with status: " + string(ctx.deployment.failed ? "Failure" : "Success"));
 
+	if (!ctx.deployment.failed) {
+		// Failed deployments have already had it logged before the logs were submitted.
+		LogMetricsSnapshot();
+	}
 	ctx.FinishDeploymentLogging();
 
 	ctx.deployment = {};
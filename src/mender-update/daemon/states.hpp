@@ -78,7 +78,9 @@ public:
 
 private:
 	void HandlePollingError(Context &ctx, sm::EventPoster<StateEvent> &poster);
+	void PollAgainNow(Context &ctx, sm::EventPoster<StateEvent> &poster);
 	http::ExponentialBackoff backoff_;
+	chrono::steady_clock::time_point poll_started_;
 };
 
 class SubmitInventoryState : virtual public StateType {
@@ -18,12 +18,13 @@
 #include <common/config.h>
 
 #ifdef MENDER_LOG_BOOST
-#include <boost/log/sinks/sync_frontend.hpp>
-#include <boost/log/sinks/text_ostream_backend.hpp>
+#include <boost/log/sinks/sink.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 #endif // MENDER_LOG_BOOST
 
+#include <memory>
 #include <string>
+#include <system_error>
 #include <vector>
 
 #include <api/client.hpp>
@@ -106,6 +107,12 @@ public:
 		context::MenderContext &ctx,
 		api::Client &client,
 		CheckUpdatesAPIResponseHandler api_handler) = 0;
+	// Whether the server held the last deployment check open until a deployment appeared or
+	// its own timeout passed (see `DeploymentLongPollSeconds`). If it did, and there was no
+	// deployment, the next check can be made right away.
+	virtual bool LastCheckWasHeld() {
+		return false;
+	}
 	virtual error::Error PushStatus(
 		const string &deployment_id,
 		DeploymentStatus status,
@@ -119,12 +126,30 @@ public:
 		LogsAPIResponseHandler api_handler) = 0;
 };
 
+// Kept from one deployment check to the next.
+struct DeploymentCheckState {
+	// See `DeploymentAPI::LastCheckWasHeld()`.
+	bool held {false};
+
+	// The v2 request body, and what it was made from. It is only made again when they change.
+	string compatible_type;
+	context::ProvidesData provides;
+	string v2_payload;
+
+	// ETag of the last answer that there is no deployment for `v2_payload`. The ETags of other
+	// answers aren't kept, so that 304 Not Modified always means that there still is none.
+	string no_deployment_etag;
+};
+
 class DeploymentClient : virtual public DeploymentAPI {
 public:
 	error::Error CheckNewDeployments(
 		context::MenderContext &ctx,
 		api::Client &client,
 		CheckUpdatesAPIResponseHandler api_handler) override;
+	bool LastCheckWasHeld() override {
+		return check_state_->held;
+	}
 	error::Error PushStatus(
 		const string &deployment_id,
 		DeploymentStatus status,
@@ -136,6 +161,10 @@ public:
 		const string &log_file_path,
 		api::Client &client,
 		LogsAPIResponseHandler api_handler) override;
+
+private:
+	// Shared with the response handlers, which may outlive this object.
+	shared_ptr<DeploymentCheckState> check_state_ {make_shared<DeploymentCheckState>()};
 };
 
 /**
@@ -149,17 +178,32 @@ public:
 	 */
 	JsonLogMessagesReader(shared_ptr<io::FileReader> raw_data_reader, int64_t data_size) :
 		reader_ {raw_data_reader},
+		file_reader_ {raw_data_reader},
 		raw_data_size_ {data_size},
 		rem_raw_data_size_ {data_size} {};
 
+	/**
+	 * Reads all the data from #raw_data_reader, the size of which is not known
+	 * in advance. A trailing newline is left out. Cannot be rewound, and needs
+	 * buffers of at least 2 bytes.
+	 */
+	JsonLogMessagesReader(shared_ptr<io::Reader> raw_data_reader) :
+		reader_ {raw_data_reader},
+		raw_data_size_ {-1},
+		rem_raw_data_size_ {-1} {};
+
 	expected::ExpectedSize Read(
 		vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) override;
 
 	error::Error Rewind() {
+		if (!file_reader_) {
+			return error::Error(
+				make_error_condition(errc::not_supported), "Cannot rewind a log data stream");
+		}
 		header_rem_ = header_.size();
 		closing_rem_ = closing_.size();
 		rem_raw_data_size_ = raw_data_size_;
-		return reader_->Rewind();
+		return file_reader_->Rewind();
 	}
 
 	static int64_t TotalDataSize(int64_t raw_data_size) {
@@ -167,22 +211,114 @@ public:
 	}
 
 private:
-	shared_ptr<io::FileReader> reader_;
+	expected::ExpectedSize ReadStream(
+		vector<uint8_t>::iterator start, vector<uint8_t>::iterator end);
+
+	shared_ptr<io::Reader> reader_;
+	shared_ptr<io::FileReader> file_reader_;
 	int64_t raw_data_size_;
 	int64_t rem_raw_data_size_;
+	bool stream_done_ {false};
+	bool separator_pending_ {false};
 	static const vector<uint8_t> header_;
 	static const vector<uint8_t> closing_;
 	io::Vsize header_rem_ = header_.size();
 	io::Vsize closing_rem_ = closing_.size();
 };
 
+// Default limit for the size of a deployment log, before compression.
+const size_t kDefaultMaxLogFileSize = 1024 * 1024; // 1 MiB
+
+/**
+ * Whether the deployment log at #path is stored compressed. Logs written by
+ * older clients, or with compression disabled, are plain JSON lines.
+ */
+expected::ExpectedBool IsCompressedLogFile(const string &path);
+
+/**
+ * Reads the JSON lines of a deployment log, decompressing them if needed.
+ */
+class LogFileReader : virtual public io::Reader {
+public:
+	LogFileReader(const string &path);
+	~LogFileReader();
+
+	expected::ExpectedSize Read(
+		vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) override;
+
+	// Only valid once Read() has been called.
+	bool Compressed() const {
+		return decompressor_ != nullptr;
+	}
+
+	// Whether the log ended in the middle of a compressed frame, for example
+	// because of a power loss. Only valid once Read() has returned 0, and
+	// everything before the cut has been returned anyway.
+	bool Truncated() const {
+		return truncated_;
+	}
+
+private:
+	class Decompressor;
+
+	io::FileReader file_reader_;
+	bool started_ {false};
+	bool truncated_ {false};
+	unique_ptr<Decompressor> decompressor_;
+	// The start of the file, read to detect the format.
+	vector<uint8_t> head_;
+	size_t head_pos_ {0};
+};
+
+/**
+ * Writes the JSON lines of a deployment log, compressing them if support for
+ * it is compiled in. Once the log grows beyond its maximum size (uncompressed),
+ * it is cut down to its first and last quarter, with a line in between saying
+ * how many lines were left out. Those are usually the most useful parts: what
+ * the deployment was doing, and how it failed.
+ */
+class LogFileWriter {
+public:
+	// A #max_size of 0 means no limit.
+	LogFileWriter(const string &path, size_t max_size);
+	~LogFileWriter();
+
+	// Continues an existing log, if there is one.
+	error::Error Open();
+	// #lines must be complete lines, each ending with a newline. They are in
+	// the file (but not necessarily on disk) once this returns.
+	error::Error Append(const string &lines);
+	error::Error Close();
+
+	// Size of the log, uncompressed.
+	size_t Size() const {
+		return size_;
+	}
+
+private:
+	class Output;
+
+	error::Error Rewrite(bool compact);
+
+	const string path_;
+	const size_t max_size_;
+	size_t size_ {0};
+	unique_ptr<Output> out_;
+};
+
 class DeploymentLog {
 public:
-	DeploymentLog(const string &data_store_dir, const string &deployment_id) :
+	DeploymentLog(
+		const string &data_store_dir,
+		const string &deployment_id,
+		size_t max_size = kDefaultMaxLogFileSize) :
 		data_store_dir_ {data_store_dir},
-		id_ {deployment_id} {};
+		id_ {deployment_id},
+		max_size_ {max_size} {};
 	error::Error BeginLogging();
 	error::Error FinishLogging();
+	// Makes sure everything logged so far is in the log file.
+	void Flush();
 	~DeploymentLog() {
 		if (sink_) {
 			FinishLogging();
@@ -191,13 +327,16 @@ public:
 
 	string LogFileName();
 	string LogFilePath();
+	// Where the timeline of the deployment goes, if tracing is enabled. It is kept and rotated
+	// together with the log.
+	string TraceFilePath();
 
 private:
 	const string data_store_dir_;
 	const string id_;
+	const size_t max_size_;
 #ifdef MENDER_LOG_BOOST
-	typedef sinks::synchronous_sink<sinks::text_ostream_backend> text_sink;
-	boost::shared_ptr<text_sink> sink_;
+	boost::shared_ptr<sinks::sink> sink_;
 #endif // MENDER_LOG_BOOST
 	error::Error PrepareLogDirectory();
 	error::Error DoPrepareLogDirectory();
@@ -15,6 +15,7 @@
 #include <mender-update/deployments.hpp>
 
 #include <algorithm>
+#include <cstring>
 #include <sstream>
 #include <string>
 
@@ -76,6 +77,13 @@ error::Error MakeError(DeploymentsErrorCode code, const string &msg) {
 static const string check_updates_v1_uri = "/api/devices/v1/deployments/device/deployments/next";
 static const string check_updates_v2_uri = "/api/devices/v2/deployments/device/deployments/next";
 
+// A long poll is requested with the `wait` preference from RFC 7240, and servers which honor it
+// say so in the `Preference-Applied` header. Other servers just answer right away.
+static bool ServerHeldRequest(const http::IncomingResponse &resp) {
+	auto exp_applied = resp.GetHeader("Preference-Applied");
+	return exp_applied && exp_applied.value().find("wait") != string::npos;
+}
+
 error::Error DeploymentClient::CheckNewDeployments(
 	context::MenderContext &ctx, api::Client &client, CheckUpdatesAPIResponseHandler api_handler) {
 	auto ex_compatible_type = ctx.GetCompatibleType();
@@ -93,20 +101,30 @@ error::Error DeploymentClient::CheckNewDeployments(
 		return MakeError(InvalidDataError, "Missing artifact name data");
 	}
 
-	stringstream ss;
-	ss << R"({"device_provides":{)";
-	ss << R"("device_type":")";
-	ss << json::EscapeString(compatible_type);
+	auto state = check_state_;
+	if (state->v2_payload.empty() || compatible_type != state->compatible_type
+		|| provides != state->provides) {
+		stringstream ss;
+		ss << R"({"device_provides":{)";
+		ss << R"("device_type":")";
+		ss << json::EscapeString(compatible_type);
+
+		for (const auto &kv : provides) {
+			ss << "\",\"" + json::EscapeString(kv.first) + "\":\"";
+			ss << json::EscapeString(kv.second);
+		}
+
+		ss << R"("}})";
 
-	for (const auto &kv : provides) {
-		ss << "\",\"" + json::EscapeString(kv.first) + "\":\"";
-		ss << json::EscapeString(kv.second);
+		state->compatible_type = compatible_type;
+		state->provides = provides;
+		state->v2_payload = ss.str();
+		// The server's answer was for a different request.
+		state->no_deployment_etag.clear();
 	}
 
-	ss << R"("}})";
-
-	string v2_payload = ss.str();
-	log::Debug("deployments/next v2 payload " + v2_payload);
+	string v2_payload = state->v2_payload;
+	log::Debug([&v2_payload]() { return "deployments/next v2 payload " + v2_payload; });
 	http::BodyGenerator payload_gen = [v2_payload]() {
 		return make_shared<io::StringReader>(v2_payload);
 	};
@@ -126,8 +144,42 @@ error::Error DeploymentClient::CheckNewDeployments(
 	v1_req->SetMethod(http::Method::GET);
 	v1_req->SetHeader("Accept", "application/json");
 
+	int long_poll_seconds = ctx.GetConfig().deployment_long_poll_seconds;
+	if (long_poll_seconds > 0) {
+		v2_req->SetHeader("Prefer", "wait=" + to_string(long_poll_seconds));
+		v1_req->SetHeader("Prefer", "wait=" + to_string(long_poll_seconds));
+	}
+	bool conditional = state->no_deployment_etag != "";
+	if (conditional) {
+		// Lets the server answer 304 Not Modified without working out the answer again.
+		v2_req->SetHeader("If-None-Match", state->no_deployment_etag);
+		v1_req->SetHeader("If-None-Match", state->no_deployment_etag);
+	}
+	state->held = false;
+
+	// For methods other than GET and HEAD, such as the v2 POST, a matching `If-None-Match` is
+	// answered with 412 Precondition Failed instead, see RFC 9110, section 13.1.2.
+	auto not_modified = [conditional](unsigned status) {
+		return status == http::StatusNotModified
+			   || (conditional && status == http::StatusPreconditionFailed);
+	};
+	auto is_data = [not_modified](unsigned status) {
+		return status == http::StatusOK || status == http::StatusNoContent
+			   || not_modified(status);
+	};
+
 	auto received_body = make_shared<vector<uint8_t>>();
-	auto handle_data = [received_body, api_handler](unsigned status) {
+	auto handle_data = [received_body, api_handler, state, not_modified](
+						   const http::IncomingResponse &resp) {
+		auto status = resp.GetStatusCode();
+		state->held = ServerHeldRequest(resp);
+		if (status == http::StatusNoContent) {
+			auto exp_etag = resp.GetHeader("ETag");
+			state->no_deployment_etag = exp_etag ? exp_etag.value() : "";
+		} else if (!not_modified(status)) {
+			state->no_deployment_etag.clear();
+		}
+
 		if (status == http::StatusOK) {
 			auto ex_j = json::Load(common::StringFromByteVector(*received_body));
 			if (ex_j) {
@@ -136,7 +188,7 @@ error::Error DeploymentClient::CheckNewDeployments(
 			} else {
 				api_handler(expected::unexpected(ex_j.error()));
 			}
-		} else if (status == http::StatusNoContent) {
+		} else if (status == http::StatusNoContent || not_modified(status)) {
 			api_handler(CheckUpdatesAPIResponse {nullopt});
 		} else {
 			log::Warning(
@@ -164,7 +216,8 @@ error::Error DeploymentClient::CheckNewDeployments(
 		};
 
 	http::ResponseHandler v1_body_handler =
-		[received_body, api_handler, handle_data](http::ExpectedIncomingResponsePtr exp_resp) {
+		[received_body, api_handler, handle_data, is_data, state](
+			http::ExpectedIncomingResponsePtr exp_resp) {
 			if (!exp_resp) {
 				log::Error("Request to check new deployments failed: " + exp_resp.error().message);
 				CheckUpdatesAPIResponse response = expected::unexpected(exp_resp.error());
@@ -173,9 +226,11 @@ error::Error DeploymentClient::CheckNewDeployments(
 			}
 			auto resp = exp_resp.value();
 			auto status = resp->GetStatusCode();
-			if ((status == http::StatusOK) || (status == http::StatusNoContent)) {
-				handle_data(status);
+			if (is_data(status)) {
+				handle_data(*resp);
 			} else {
+				// Don't let an ETag from before the error hide a deployment afterwards.
+				state->no_deployment_etag.clear();
 				auto ex_err_msg = api::ErrorMsgFromErrorResponse(*received_body);
 				string err_str;
 				if (ex_err_msg) {
@@ -195,6 +250,8 @@ error::Error DeploymentClient::CheckNewDeployments(
 											 v1_body_handler,
 											 api_handler,
 											 handle_data,
+											 is_data,
+											 state,
 											 &client](http::ExpectedIncomingResponsePtr exp_resp) {
 		if (!exp_resp) {
 			log::Error("Request to check new deployments failed: " + exp_resp.error().message);
@@ -204,9 +261,10 @@ error::Error DeploymentClient::CheckNewDeployments(
 		}
 		auto resp = exp_resp.value();
 		auto status = resp->GetStatusCode();
-		if ((status == http::StatusOK) || (status == http::StatusNoContent)) {
-			handle_data(status);
+		if (is_data(status)) {
+			handle_data(*resp);
 		} else if (status == http::StatusNotFound) {
+			// The v1 response decides what happens to the ETag.
 			log::Debug(
 				"POST request to v2 version of the deployments API failed, falling back to v1 version and GET");
 			auto err = client.AsyncCall(v1_req, header_handler, v1_body_handler);
@@ -214,6 +272,7 @@ error::Error DeploymentClient::CheckNewDeployments(
 				api_handler(expected::unexpected(err.WithContext("While calling v1 endpoint")));
 			}
 		} else {
+			state->no_deployment_etag.clear();
 			auto ex_err_msg = api::ErrorMsgFromErrorResponse(*received_body);
 			string err_str;
 			if (ex_err_msg) {
@@ -360,6 +419,59 @@ const vector<uint8_t> JsonLogMessagesReader::header_ = {
 	'{', '"', 'm', 'e', 's', 's', 'a', 'g', 'e', 's', '"', ':', '['};
 const vector<uint8_t> JsonLogMessagesReader::closing_ = {']', '}'};
 
+// Uses memchr(), which goes through many bytes at once, instead of looking at them one by one.
+static void NewlinesToCommas(vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) {
+	if (start == end) {
+		return;
+	}
+	uint8_t *data = &*start;
+	uint8_t *data_end = data + (end - start);
+	while (data < data_end) {
+		auto nl = static_cast<uint8_t *>(memchr(data, '\n', static_cast<size_t>(data_end - data)));
+		if (nl == nullptr) {
+			break;
+		}
+		*nl = ',';
+		data = nl + 1;
+	}
+}
+
+ExpectedSize JsonLogMessagesReader::ReadStream(
+	vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) {
+	if (end - start < 2) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::invalid_argument), "Buffer too small for log data"));
+	}
+
+	// A newline at the end of what was read may be the trailing one, which has to be left
+	// out. So it is held back until we know whether more data follows.
+	auto read_start = separator_pending_ ? start + 1 : start;
+	auto ex_sz = reader_->Read(read_start, end);
+	if (!ex_sz) {
+		return ex_sz;
+	}
+	auto n_read = ex_sz.value();
+	if (n_read == 0) {
+		stream_done_ = true;
+		return 0;
+	}
+
+	auto read_end = read_start + n_read;
+	if (separator_pending_) {
+		*start = ',';
+	}
+	separator_pending_ = (read_end[-1] == '\n');
+	if (separator_pending_) {
+		read_end--;
+	}
+	NewlinesToCommas(start, read_end);
+	if (read_end == start) {
+		// Only the newline, keep going.
+		return ReadStream(start, end);
+	}
+	return static_cast<size_t>(read_end - start);
+}
+
 ExpectedSize JsonLogMessagesReader::Read(
 	vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) {
 	if (header_rem_ > 0) {
@@ -389,14 +501,14 @@ ExpectedSize JsonLogMessagesReader::Read(
 				MakeError(InvalidDataError, "Unexpected EOF when reading logs file"));
 		}
 
-		// Replace all newlines with commas
-		const auto read_end = start + n_read;
-		for (auto it = start; it < read_end; it++) {
-			if (it[0] == '\n') {
-				it[0] = ',';
-			}
-		}
+		NewlinesToCommas(start, start + n_read);
 		return n_read;
+	} else if ((raw_data_size_ < 0) && !stream_done_) {
+		auto ex_sz = ReadStream(start, end);
+		if (!ex_sz || (ex_sz.value() > 0)) {
+			return ex_sz;
+		}
+		return Read(start, end);
 	} else if (closing_rem_ > 0) {
 		io::Vsize target_size = end - start;
 		auto copy_end = copy_n(
@@ -418,26 +530,43 @@ error::Error DeploymentClient::PushLogs(
 	const string &log_file_path,
 	api::Client &client,
 	LogsAPIResponseHandler api_handler) {
-	auto ex_size = GetLogFileDataSize(log_file_path);
-	if (!ex_size) {
-		// api_handler(ex_size.error()) ???
-		return ex_size.error();
+	auto ex_compressed = IsCompressedLogFile(log_file_path);
+	if (!ex_compressed) {
+		return ex_compressed.error();
 	}
-	auto data_size = ex_size.value();
-
-	auto file_reader = make_shared<io::FileReader>(log_file_path);
-	auto logs_reader = make_shared<JsonLogMessagesReader>(file_reader, data_size);
 
 	auto req = make_shared<api::APIRequest>();
 	req->SetPath(http::JoinUrl(deployments_uri_prefix, deployment_id, logs_uri_suffix));
 	req->SetMethod(http::Method::PUT);
 	req->SetHeader("Content-Type", "application/json");
-	req->SetHeader("Content-Length", to_string(JsonLogMessagesReader::TotalDataSize(data_size)));
 	req->SetHeader("Accept", "application/json");
-	req->SetBodyGenerator([logs_reader]() {
-		logs_reader->Rewind();
-		return logs_reader;
-	});
+
+	if (ex_compressed.value()) {
+		// The size is only known after decompressing everything, so rather than doing that
+		// twice, the data is sent in chunks as it is decompressed.
+		req->SetHeader("Transfer-Encoding", "chunked");
+		req->SetBodyGenerator([log_file_path]() -> io::ExpectedReaderPtr {
+			return make_shared<JsonLogMessagesReader>(
+				make_shared<LogFileReader>(log_file_path));
+		});
+	} else {
+		auto ex_size = GetLogFileDataSize(log_file_path);
+		if (!ex_size) {
+			// api_handler(ex_size.error()) ???
+			return ex_size.error();
+		}
+		auto data_size = ex_size.value();
+
+		auto file_reader = make_shared<io::FileReader>(log_file_path);
+		auto logs_reader = make_shared<JsonLogMessagesReader>(file_reader, data_size);
+
+		req->SetHeader(
+			"Content-Length", to_string(JsonLogMessagesReader::TotalDataSize(data_size)));
+		req->SetBodyGenerator([logs_reader]() {
+			logs_reader->Rewind();
+			return logs_reader;
+		});
+	}
 
 	auto received_body = make_shared<vector<uint8_t>>();
 	return client.AsyncCall(
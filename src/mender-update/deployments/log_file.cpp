@@ -0,0 +1,520 @@
+// Copyright 2024 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/deployments.hpp>
+
+#include <common/config.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+#include <zstd.h>
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+
+#include <common/error.hpp>
+#include <common/expected.hpp>
+#include <common/io.hpp>
+#include <common/path.hpp>
+
+namespace mender {
+namespace update {
+namespace deployments {
+
+using namespace std;
+
+namespace error = mender::common::error;
+namespace expected = mender::common::expected;
+namespace io = mender::common::io;
+namespace path = mender::common::path;
+
+static const vector<uint8_t> kZstdMagic = {0x28, 0xB5, 0x2F, 0xFD};
+
+static const string kLeftOutMessage = "Deployment log too large, left out ";
+
+// Reads the first few bytes of a log file, enough to tell which format it is in.
+static error::Error ReadHead(io::Reader &reader, vector<uint8_t> &head) {
+	head.resize(kZstdMagic.size());
+	size_t n_read = 0;
+	while (n_read < head.size()) {
+		auto ex_n = reader.Read(head.begin() + n_read, head.end());
+		if (!ex_n) {
+			return ex_n.error();
+		}
+		if (ex_n.value() == 0) {
+			break;
+		}
+		n_read += ex_n.value();
+	}
+	head.resize(n_read);
+	return error::NoError;
+}
+
+static bool HasZstdMagic(const vector<uint8_t> &head) {
+	return (head.size() >= kZstdMagic.size())
+		   && equal(kZstdMagic.begin(), kZstdMagic.end(), head.begin());
+}
+
+expected::ExpectedBool IsCompressedLogFile(const string &path) {
+	io::FileReader reader {path};
+	vector<uint8_t> head;
+	auto err = ReadHead(reader, head);
+	if (err != error::NoError) {
+		return expected::unexpected(err);
+	}
+	return HasZstdMagic(head);
+}
+
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+
+class LogFileReader::Decompressor {
+public:
+	Decompressor(const vector<uint8_t> &head) :
+		dctx_ {ZSTD_createDCtx()},
+		in_buf_(max(ZSTD_DStreamInSize(), head.size())) {
+		copy(head.begin(), head.end(), in_buf_.begin());
+		in_ = {in_buf_.data(), head.size(), 0};
+	}
+
+	~Decompressor() {
+		ZSTD_freeDCtx(dctx_);
+	}
+
+	expected::ExpectedSize Read(
+		io::Reader &reader,
+		vector<uint8_t>::iterator start,
+		vector<uint8_t>::iterator end,
+		bool &truncated) {
+		ZSTD_outBuffer out {&*start, static_cast<size_t>(end - start), 0};
+		while (true) {
+			if ((in_.pos == in_.size) && !eof_) {
+				auto ex_n = reader.Read(in_buf_.begin(), in_buf_.end());
+				if (!ex_n) {
+					return ex_n;
+				}
+				if (ex_n.value() == 0) {
+					eof_ = true;
+				} else {
+					in_ = {in_buf_.data(), ex_n.value(), 0};
+				}
+			}
+
+			// Called even without new input, to get out what is still buffered.
+			auto ret = ZSTD_decompressStream(dctx_, &out, &in_);
+			if (ZSTD_isError(ret)) {
+				return expected::unexpected(MakeError(
+					InvalidDataError,
+					string("Failed to decompress deployment log: ") + ZSTD_getErrorName(ret)));
+			}
+			if (out.pos > 0) {
+				return out.pos;
+			}
+			if (eof_ && (in_.pos == in_.size)) {
+				// A non-zero return means that the decoder is in the middle of a frame.
+				truncated = (ret != 0);
+				return 0;
+			}
+		}
+	}
+
+private:
+	ZSTD_DCtx *dctx_;
+	vector<uint8_t> in_buf_;
+	ZSTD_inBuffer in_;
+	bool eof_ {false};
+};
+
+#else // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+
+class LogFileReader::Decompressor {
+public:
+	Decompressor(const vector<uint8_t> &head) {
+	}
+
+	expected::ExpectedSize Read(
+		io::Reader &reader,
+		vector<uint8_t>::iterator start,
+		vector<uint8_t>::iterator end,
+		bool &truncated) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::not_supported),
+			"Deployment log is compressed, but support for compressed logs is not compiled in"));
+	}
+};
+
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+
+LogFileReader::LogFileReader(const string &path) :
+	file_reader_ {path} {
+}
+
+LogFileReader::~LogFileReader() {
+}
+
+expected::ExpectedSize LogFileReader::Read(
+	vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) {
+	if (start == end) {
+		return 0;
+	}
+
+	if (!started_) {
+		auto err = ReadHead(file_reader_, head_);
+		if (err != error::NoError) {
+			return expected::unexpected(err);
+		}
+		started_ = true;
+		if (HasZstdMagic(head_)) {
+			decompressor_.reset(new Decompressor(head_));
+		}
+	}
+
+	if (decompressor_) {
+		return decompressor_->Read(file_reader_, start, end, truncated_);
+	}
+
+	if (head_pos_ < head_.size()) {
+		auto n_copied = min(head_.size() - head_pos_, static_cast<size_t>(end - start));
+		copy_n(head_.begin() + head_pos_, n_copied, start);
+		head_pos_ += n_copied;
+		return n_copied;
+	}
+	return file_reader_.Read(start, end);
+}
+
+class LogFileWriter::Output {
+public:
+	Output() {
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+		cctx_ = ZSTD_createCCtx();
+		out_buf_.resize(ZSTD_CStreamOutSize());
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+	}
+
+	~Output() {
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+		ZSTD_freeCCtx(cctx_);
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+	}
+
+	static bool Compressed() {
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+		return true;
+#else
+		return false;
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+	}
+
+	error::Error Open(const string &path, bool append) {
+		auto ex_os = io::OpenOfstream(path, append);
+		if (!ex_os) {
+			return ex_os.error();
+		}
+		os_ = std::move(ex_os.value());
+		return error::NoError;
+	}
+
+	// Everything written is passed on to the file right away, so that it can be read back and
+	// survives a crash of the process.
+	error::Error Write(const string &data) {
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+		ZSTD_inBuffer in {data.data(), data.size(), 0};
+		auto err = Compress(in, ZSTD_e_flush);
+#else
+		auto err = WriteOut(data.data(), data.size());
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+		if (err != error::NoError) {
+			return err;
+		}
+		return Flush();
+	}
+
+	error::Error Close() {
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+		// Ends the frame. The next Open() in append mode starts a new one.
+		ZSTD_inBuffer in {nullptr, 0, 0};
+		auto err = Compress(in, ZSTD_e_end);
+		if (err != error::NoError) {
+			return err;
+		}
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+		auto flush_err = Flush();
+		os_.close();
+		return flush_err;
+	}
+
+private:
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+	error::Error Compress(ZSTD_inBuffer &in, ZSTD_EndDirective mode) {
+		size_t remaining;
+		do {
+			ZSTD_outBuffer out {out_buf_.data(), out_buf_.size(), 0};
+			remaining = ZSTD_compressStream2(cctx_, &out, &in, mode);
+			if (ZSTD_isError(remaining)) {
+				return MakeError(
+					InvalidDataError,
+					string("Failed to compress deployment log: ")
+						+ ZSTD_getErrorName(remaining));
+			}
+			auto err = WriteOut(out_buf_.data(), out.pos);
+			if (err != error::NoError) {
+				return err;
+			}
+		} while ((remaining != 0) || (in.pos < in.size));
+		return error::NoError;
+	}
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+
+	error::Error WriteOut(const char *data, size_t size) {
+		errno = 0;
+		os_.write(data, static_cast<streamsize>(size));
+		if (!os_) {
+			int io_errno = errno;
+			return error::Error(
+				generic_category().default_error_condition(io_errno),
+				"Failed to write deployment log");
+		}
+		return error::NoError;
+	}
+
+	error::Error Flush() {
+		errno = 0;
+		os_.flush();
+		if (!os_) {
+			int io_errno = errno;
+			return error::Error(
+				generic_category().default_error_condition(io_errno),
+				"Failed to flush deployment log");
+		}
+		return error::NoError;
+	}
+
+	ofstream os_;
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+	ZSTD_CCtx *cctx_;
+	vector<char> out_buf_;
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+};
+
+LogFileWriter::LogFileWriter(const string &path, size_t max_size) :
+	path_ {path},
+	max_size_ {max_size} {
+}
+
+LogFileWriter::~LogFileWriter() {
+	if (out_) {
+		Close();
+	}
+}
+
+error::Error LogFileWriter::Open() {
+	size_ = 0;
+	bool rewrite = false;
+	if (path::FileExists(path_)) {
+		LogFileReader reader {path_};
+		vector<uint8_t> buf(MENDER_BUFSIZE);
+		size_t n_read;
+		do {
+			auto ex_n = reader.Read(buf.begin(), buf.end());
+			if (!ex_n) {
+				return ex_n.error();
+			}
+			n_read = ex_n.value();
+			size_ += n_read;
+		} while (n_read > 0);
+
+		// Frames can only be appended after complete ones, and the whole file has to be in one
+		// format. Anything else is converted first.
+		rewrite = (size_ > 0)
+				  && ((reader.Compressed() != Output::Compressed()) || reader.Truncated());
+	}
+
+	if (rewrite || ((max_size_ > 0) && (size_ > max_size_))) {
+		return Rewrite((max_size_ > 0) && (size_ > max_size_));
+	}
+
+	out_.reset(new Output);
+	auto err = out_->Open(path_, true);
+	if (err != error::NoError) {
+		out_.reset();
+	}
+	return err;
+}
+
+error::Error LogFileWriter::Append(const string &lines) {
+	if (!out_) {
+		return error::Error(
+			make_error_condition(errc::bad_file_descriptor), "Deployment log is not open");
+	}
+	auto err = out_->Write(lines);
+	if (err != error::NoError) {
+		return err;
+	}
+	size_ += lines.size();
+
+	if ((max_size_ > 0) && (size_ > max_size_)) {
+		return Rewrite(true);
+	}
+	return error::NoError;
+}
+
+error::Error LogFileWriter::Close() {
+	if (!out_) {
+		return error::NoError;
+	}
+	auto err = out_->Close();
+	out_.reset();
+	return err;
+}
+
+// Returns how many lines a previous "left out" line stands for, or 0 if #line isn't one.
+static size_t LinesLeftOutBefore(const string &line) {
+	auto pos = line.find(kLeftOutMessage);
+	if (pos == string::npos) {
+		return 0;
+	}
+	return strtoul(line.c_str() + pos + kLeftOutMessage.size(), nullptr, 10);
+}
+
+static string LeftOutLine(size_t n_lines) {
+	char timestamp[sizeof("YYYY-MM-DDTHH:MM:SS.000000Z")] = "";
+	auto now = time(nullptr);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S.000000Z", gmtime(&now));
+	return string(R"({"timestamp":")") + timestamp + R"(","level":"warning","message":")"
+		   + kLeftOutMessage + to_string(n_lines) + " lines\"}\n";
+}
+
+error::Error LogFileWriter::Rewrite(bool compact) {
+	auto err = Close();
+	if (err != error::NoError) {
+		return err;
+	}
+
+	// Lines which fit within the first `keep` bytes are kept, and so are the lines starting
+	// within the last `keep` bytes.
+	const size_t keep = compact ? (max_size_ / 4) : size_;
+	const size_t tail_start = size_ - keep;
+
+	const string tmp_path = path_ + ".tmp";
+	unique_ptr<Output> tmp {new Output};
+	// Not to leave a half written copy behind.
+	auto fail = [&tmp, &tmp_path](error::Error err) -> error::Error {
+		tmp.reset();
+		path::FileDelete(tmp_path);
+		return err;
+	};
+	err = tmp->Open(tmp_path, false);
+	if (err != error::NoError) {
+		return fail(err);
+	}
+
+	LogFileReader reader {path_};
+	vector<uint8_t> buf(MENDER_BUFSIZE);
+	string line;
+	string pending;
+	size_t offset = 0;
+	size_t new_size = 0;
+	size_t left_out = 0;
+	bool in_head = true;
+	bool in_tail = false;
+
+	auto write_pending = [&]() -> error::Error {
+		auto err = tmp->Write(pending);
+		new_size += pending.size();
+		pending.clear();
+		return err;
+	};
+	auto take_line = [&]() -> error::Error {
+		if (in_head && (offset + line.size() <= keep)) {
+			pending += line;
+		} else if (offset >= tail_start) {
+			if (!in_tail && (left_out > 0)) {
+				pending += LeftOutLine(left_out);
+			}
+			in_head = false;
+			in_tail = true;
+			pending += line;
+		} else {
+			in_head = false;
+			auto before = LinesLeftOutBefore(line);
+			left_out += (before > 0) ? before : 1;
+		}
+		offset += line.size();
+		line.clear();
+		if (pending.size() >= MENDER_BUFSIZE) {
+			return write_pending();
+		}
+		return error::NoError;
+	};
+
+	size_t n_read;
+	do {
+		auto ex_n = reader.Read(buf.begin(), buf.end());
+		if (!ex_n) {
+			return fail(ex_n.error());
+		}
+		n_read = ex_n.value();
+
+		auto data = reinterpret_cast<const char *>(buf.data());
+		auto data_end = data + n_read;
+		while (data < data_end) {
+			auto nl = static_cast<const char *>(
+				memchr(data, '\n', static_cast<size_t>(data_end - data)));
+			if (nl == nullptr) {
+				line.append(data, data_end);
+				break;
+			}
+			line.append(data, nl + 1);
+			data = nl + 1;
+			err = take_line();
+			if (err != error::NoError) {
+				return fail(err);
+			}
+		}
+	} while (n_read > 0);
+
+	if (!line.empty()) {
+		// Cut off by a crash of the process. Complete it so the rest stays valid.
+		line += '\n';
+		err = take_line();
+		if (err != error::NoError) {
+			return fail(err);
+		}
+	}
+	if (!in_tail && (left_out > 0)) {
+		pending += LeftOutLine(left_out);
+	}
+	err = write_pending();
+	if (err != error::NoError) {
+		return fail(err);
+	}
+
+	err = path::Rename(tmp_path, path_);
+	if (err != error::NoError) {
+		return fail(err);
+	}
+	// The stream still refers to the file under its new name, so we can go on writing into it.
+	out_ = std::move(tmp);
+	size_ = new_size;
+	return error::NoError;
+}
+
+} // namespace deployments
+} // namespace update
+} // namespace mender
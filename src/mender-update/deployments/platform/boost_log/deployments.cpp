@@ -17,6 +17,8 @@
 #include <algorithm>
 #include <cctype>
 #include <filesystem>
+#include <ostream>
+#include <streambuf>
 #include <string>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -68,9 +70,77 @@ static void JsonLogFormatter(logging::record_view const &rec, logging::formattin
 	strm << R"("message":")" << json::EscapeString(*rec[expr::smessage]) << "\"}";
 }
 
+// Passes complete lines written to it on to a `LogFileWriter` whenever it is flushed, which
+// the sinks do after every record or batch of records.
+class LogFileStreamBuf : public std::streambuf {
+public:
+	LogFileStreamBuf(const string &path, size_t max_size) :
+		writer_ {path, max_size} {
+	}
+
+	~LogFileStreamBuf() {
+		sync();
+		writer_.Close();
+	}
+
+	error::Error Open() {
+		return writer_.Open();
+	}
+
+protected:
+	int_type overflow(int_type c) override {
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			buffer_ += traits_type::to_char_type(c);
+		}
+		return traits_type::not_eof(c);
+	}
+
+	streamsize xsputn(const char_type *s, streamsize count) override {
+		buffer_.append(s, static_cast<size_t>(count));
+		return count;
+	}
+
+	int sync() override {
+		auto last_nl = buffer_.rfind('\n');
+		if (last_nl == string::npos) {
+			return 0;
+		}
+		auto err = writer_.Append(buffer_.substr(0, last_nl + 1));
+		buffer_.erase(0, last_nl + 1);
+		// Nothing can be logged from here, the sink is busy with this very record.
+		return (err == error::NoError) ? 0 : -1;
+	}
+
+private:
+	LogFileWriter writer_;
+	string buffer_;
+};
+
+class LogFileStream : public std::ostream {
+public:
+	// The base class is constructed before `buf_`, so it only gets the buffer once that exists.
+	LogFileStream(const string &path, size_t max_size) :
+		std::ostream {nullptr},
+		buf_ {path, max_size} {
+		rdbuf(&buf_);
+	}
+
+	error::Error Open() {
+		return buf_.Open();
+	}
+
+private:
+	LogFileStreamBuf buf_;
+};
+
 static const size_t kMaxExistingLogs = 5;
 static const uintmax_t kLogsFreeSpaceRequired = 100 * 1024; // 100 KiB
 
+// deployments.NNNN.ID.log -> deployments.NNNN.ID.trace.json
+static string TraceFileName(const string &log_file_name) {
+	return log_file_name.substr(0, log_file_name.size() - 4) + ".trace.json";
+}
+
 error::Error DeploymentLog::PrepareLogDirectory() {
 	try {
 		return DoPrepareLogDirectory();
@@ -145,6 +215,11 @@ error::Error DeploymentLog::DoPrepareLogDirectory() {
 				ec.default_error_condition(),
 				"Failed to remove old log file '" + last_log_file + "'");
 		}
+		if (!fs::remove(dir_path / TraceFileName(last_log_file), ec) && ec) {
+			return error::Error(
+				ec.default_error_condition(),
+				"Failed to remove old trace file '" + TraceFileName(last_log_file) + "'");
+		}
 		if (space_info.available < kLogsFreeSpaceRequired) {
 			space_info = fs::space(dir_path, ec);
 			if (ec) {
@@ -186,6 +261,15 @@ error::Error DeploymentLog::DoPrepareLogDirectory() {
 				ec.default_error_condition(),
 				"Failed to rename old log file '" + old_logs[i] + "'");
 		}
+		auto old_trace = dir_path / TraceFileName(old_logs[i]);
+		if (fs::exists(old_trace)) {
+			fs::rename(old_trace, dir_path / TraceFileName(new_name), ec);
+			if (ec) {
+				return error::Error(
+					ec.default_error_condition(),
+					"Failed to rename old trace file '" + old_trace.filename().string() + "'");
+			}
+		}
 	}
 
 	return error::NoError;
@@ -197,16 +281,13 @@ error::Error DeploymentLog::BeginLogging() {
 		return err;
 	}
 
-	auto ex_ofstr = io::OpenOfstream(LogFilePath(), true);
-	if (!ex_ofstr) {
-		return ex_ofstr.error();
+	auto log_stream = boost::make_shared<LogFileStream>(LogFilePath(), max_size_);
+	err = log_stream->Open();
+	if (err != error::NoError) {
+		return err;
 	}
 
-	auto log_stream = boost::make_shared<std::ofstream>(std::move(ex_ofstr.value()));
-	sink_ = boost::make_shared<text_sink>();
-	sink_->set_formatter(&JsonLogFormatter);
-	sink_->locked_backend()->add_stream(log_stream);
-	sink_->locked_backend()->auto_flush(true);
+	sink_ = mlog::MakeTextSink(log_stream, &JsonLogFormatter);
 
 	logging::core::get()->add_sink(sink_);
 
@@ -215,10 +296,17 @@ error::Error DeploymentLog::BeginLogging() {
 
 error::Error DeploymentLog::FinishLogging() {
 	logging::core::get()->remove_sink(sink_);
+	sink_->flush();
 	sink_.reset();
 	return error::NoError;
 }
 
+void DeploymentLog::Flush() {
+	if (sink_) {
+		sink_->flush();
+	}
+}
+
 string DeploymentLog::LogFileName() {
 	return "deployments.0000." + id_ + ".log";
 }
@@ -227,6 +315,10 @@ string DeploymentLog::LogFilePath() {
 	return path::Join(data_store_dir_, LogFileName());
 }
 
+string DeploymentLog::TraceFilePath() {
+	return path::Join(data_store_dir_, TraceFileName(LogFileName()));
+}
+
 } // namespace deployments
 } // namespace update
 } // namespace mender
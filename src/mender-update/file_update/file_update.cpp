@@ -0,0 +1,752 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/file_update/file_update.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+#include <common/log.hpp>
+#include <common/path.hpp>
+
+namespace mender {
+namespace update {
+namespace file_update {
+
+namespace log = mender::common::log;
+namespace path = mender::common::path;
+
+const size_t kMaxQueuedBytes {32 * 1024 * 1024};
+const size_t kStreamQueueSize {4 * 1024 * 1024};
+
+static size_t WorkerCount() {
+	return max<size_t>(2, min<size_t>(8, thread::hardware_concurrency()));
+}
+
+WorkerPool::WorkerPool(size_t threads, size_t max_queued_bytes) :
+	max_queued_bytes_ {max_queued_bytes} {
+	for (size_t i = 0; i < threads; i++) {
+		threads_.emplace_back([this]() { Work(); });
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		unique_lock<mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	cond_.notify_all();
+	for (auto &t : threads_) {
+		t.join();
+	}
+}
+
+void WorkerPool::Submit(Job job, size_t bytes) {
+	unique_lock<mutex> lock(mutex_);
+	// A job which is larger than the limit on its own is accepted once the queue is empty.
+	cond_.wait(lock, [this, bytes]() {
+		return queue_.empty() || queued_bytes_ + bytes <= max_queued_bytes_;
+	});
+	queue_.emplace_back(std::move(job), bytes);
+	queued_bytes_ += bytes;
+	cond_.notify_all();
+}
+
+error::Error WorkerPool::Wait() {
+	unique_lock<mutex> lock(mutex_);
+	cond_.wait(lock, [this]() { return queue_.empty() && running_ == 0; });
+	auto err = error_;
+	error_ = error::NoError;
+	return err;
+}
+
+void WorkerPool::Work() {
+	unique_lock<mutex> lock(mutex_);
+	while (true) {
+		cond_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+		if (queue_.empty()) {
+			return;
+		}
+
+		auto job = std::move(queue_.front());
+		queue_.pop_front();
+		running_++;
+		bool skip = error_ != error::NoError;
+
+		lock.unlock();
+		auto err = skip ? error::NoError : job.first();
+		// Release the memory before it is accounted for.
+		job.first = nullptr;
+		lock.lock();
+
+		queued_bytes_ -= job.second;
+		running_--;
+		if (err != error::NoError && error_ == error::NoError) {
+			error_ = err;
+		}
+		cond_.notify_all();
+	}
+}
+
+StreamQueue::StreamQueue(size_t max_bytes) :
+	max_bytes_ {max_bytes} {
+}
+
+bool StreamQueue::Push(const uint8_t *data, size_t size) {
+	unique_lock<mutex> lock(mutex_);
+	cond_.wait(lock, [this]() { return stopped_ || buffered_ < max_bytes_; });
+	if (stopped_) {
+		return false;
+	}
+	chunks_.emplace_back(data, data + size);
+	buffered_ += size;
+	cond_.notify_all();
+	return true;
+}
+
+void StreamQueue::Close() {
+	unique_lock<mutex> lock(mutex_);
+	closed_ = true;
+	cond_.notify_all();
+}
+
+void StreamQueue::StopReading() {
+	unique_lock<mutex> lock(mutex_);
+	stopped_ = true;
+	chunks_.clear();
+	buffered_ = 0;
+	offset_ = 0;
+	cond_.notify_all();
+}
+
+expected::ExpectedSize StreamQueue::Read(
+	vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) {
+	unique_lock<mutex> lock(mutex_);
+	cond_.wait(lock, [this]() { return !chunks_.empty() || closed_ || stopped_; });
+	if (chunks_.empty()) {
+		return 0;
+	}
+
+	auto &chunk = chunks_.front();
+	size_t n = min(static_cast<size_t>(end - start), chunk.size() - offset_);
+	auto chunk_start = chunk.begin() + static_cast<ptrdiff_t>(offset_);
+	copy(chunk_start, chunk_start + static_cast<ptrdiff_t>(n), start);
+	offset_ += n;
+	buffered_ -= n;
+	if (offset_ == chunk.size()) {
+		chunks_.pop_front();
+		offset_ = 0;
+	}
+	cond_.notify_all();
+	return n;
+}
+
+Module::Module(const string &work_path) :
+	work_path_ {work_path},
+	files_path_ {path::Join(work_path, "files")},
+	tmp_path_ {path::Join(work_path, "tmp")} {
+}
+
+error::Error Module::BeginPayloadFile(const string &name, int64_t size) {
+	if (name == "" || name == "." || name == ".." || name.find('/') != string::npos) {
+		return error::Error(
+			make_error_condition(errc::invalid_argument), "Invalid payload file name: " + name);
+	}
+
+	auto err = path::CreateDirectories(files_path_);
+	if (err != error::NoError) {
+		return err;
+	}
+
+	current_file_ = path::Join(files_path_, name);
+	auto exp_file = io::OpenOfstream(current_file_);
+	if (!exp_file) {
+		return exp_file.error();
+	}
+	file_.reset(new ofstream(std::move(exp_file.value())));
+	return error::NoError;
+}
+
+error::Error Module::PayloadFileData(const uint8_t *data, size_t size) {
+	errno = 0;
+	file_->write(reinterpret_cast<const char *>(data), static_cast<streamsize>(size));
+	if (!*file_) {
+		int io_errno = errno;
+		return error::Error(
+			generic_category().default_error_condition(io_errno),
+			"Failed to write to " + current_file_);
+	}
+	return error::NoError;
+}
+
+error::Error Module::EndPayloadFile() {
+	errno = 0;
+	file_->close();
+	bool failed = file_->fail();
+	file_.reset();
+	if (failed) {
+		int io_errno = errno;
+		return error::Error(
+			generic_category().default_error_condition(io_errno),
+			"Failed to close " + current_file_);
+	}
+	return error::NoError;
+}
+
+expected::ExpectedString Module::ReadPayloadValue(const string &name) {
+	auto exp_file = io::OpenIfstream(path::Join(files_path_, name));
+	if (!exp_file) {
+		return expected::unexpected(exp_file.error());
+	}
+	stringstream ss;
+	ss << exp_file.value().rdbuf();
+	string value = ss.str();
+	while (value.size() > 0 && value.back() == '\n') {
+		value.pop_back();
+	}
+	return value;
+}
+
+DirectoryModule::DirectoryModule(const string &work_path) :
+	Module(work_path),
+	staging_path_ {path::Join(work_path, "staging")},
+	marker_path_ {path::Join(tmp_path_, "new-tree")} {
+}
+
+DirectoryModule::~DirectoryModule() {
+	if (queue_) {
+		queue_->StopReading();
+	}
+	if (extract_thread_.joinable()) {
+		extract_thread_.join();
+	}
+}
+
+error::Error DirectoryModule::BeginPayloadFile(const string &name, int64_t size) {
+	if (name != "update.tar") {
+		return Module::BeginPayloadFile(name, size);
+	}
+
+	auto err = path::DeleteRecursively(staging_path_);
+	if (err == error::NoError) {
+		err = path::CreateDirectories(staging_path_);
+	}
+	if (err != error::NoError) {
+		return err.WithContext("Could not create " + staging_path_);
+	}
+
+	pool_.reset(new WorkerPool(WorkerCount(), kMaxQueuedBytes));
+	queue_.reset(new StreamQueue(kStreamQueueSize));
+	extract_error_ = error::NoError;
+	extract_thread_ = thread([this]() {
+		extract_error_ = ExtractTar(*queue_, staging_path_, *pool_);
+		// Either the archive is complete, or it failed, so there is no point in accepting more
+		// data.
+		queue_->StopReading();
+	});
+	return error::NoError;
+}
+
+error::Error DirectoryModule::PayloadFileData(const uint8_t *data, size_t size) {
+	if (!queue_) {
+		return Module::PayloadFileData(data, size);
+	}
+	if (!queue_->Push(data, size)) {
+		auto err = FinishExtraction();
+		if (err == error::NoError) {
+			err = error::Error(
+				make_error_condition(errc::invalid_argument),
+				"Trailing data after the end of update.tar");
+		}
+		return err;
+	}
+	return error::NoError;
+}
+
+error::Error DirectoryModule::EndPayloadFile() {
+	if (!queue_) {
+		return Module::EndPayloadFile();
+	}
+	queue_->Close();
+	return FinishExtraction();
+}
+
+error::Error DirectoryModule::FinishExtraction() {
+	extract_thread_.join();
+	queue_.reset();
+	pool_.reset();
+	if (extract_error_ != error::NoError) {
+		return extract_error_.WithContext("Could not unpack update.tar");
+	}
+	return error::NoError;
+}
+
+expected::Expected<DirectoryModule::Paths> DirectoryModule::GetPaths() {
+	auto exp_dest = ReadPayloadValue("dest_dir");
+	if (!exp_dest) {
+		return expected::unexpected(exp_dest.error().WithContext("Could not read dest_dir"));
+	}
+	string dest = exp_dest.value();
+	while (dest.size() > 1 && dest.back() == '/') {
+		dest.pop_back();
+	}
+	if (dest == "") {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::invalid_argument), "dest_dir is undefined"));
+	}
+	if (dest == "/" || !path::IsAbsolute(dest)) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::invalid_argument),
+			"dest_dir must be an absolute path to a directory other than /: " + dest));
+	}
+
+	Paths paths;
+	paths.dest = dest;
+	paths.parent = path::DirName(dest);
+	string base = path::BaseName(dest);
+	paths.new_tree = path::Join(paths.parent, "." + base + ".mender-new");
+	paths.previous_tree = path::Join(paths.parent, "." + base + ".mender-prev");
+	return paths;
+}
+
+error::Error DirectoryModule::ArtifactInstall() {
+	auto exp_paths = GetPaths();
+	if (!exp_paths) {
+		return exp_paths.error();
+	}
+	auto &paths = exp_paths.value();
+
+	if (!path::FileExists(staging_path_)) {
+		return error::Error(
+			make_error_condition(errc::no_such_file_or_directory),
+			"The payload does not contain update.tar");
+	}
+
+	auto err = path::CreateDirectories(paths.dest);
+	if (err != error::NoError) {
+		return err;
+	}
+	// Leftovers from an earlier, interrupted, deployment.
+	err = path::DeleteRecursively(paths.new_tree);
+	if (err == error::NoError) {
+		err = path::DeleteRecursively(paths.previous_tree);
+	}
+	if (err != error::NoError) {
+		return err;
+	}
+
+	err = path::Rename(staging_path_, paths.new_tree);
+	if (err.code == make_error_condition(errc::cross_device_link)) {
+		log::Debug(
+			"The work directory is on a different file system than " + paths.dest
+			+ ". Copying the new files");
+		err = path::CreateDirectory(paths.new_tree);
+		if (err == error::NoError) {
+			WorkerPool pool(WorkerCount(), kMaxQueuedBytes);
+			err = CopyTree(staging_path_, paths.new_tree, pool);
+		}
+	}
+	if (err != error::NoError) {
+		return err;
+	}
+
+	// One sync for all the new files, instead of one for each of them.
+	err = SyncFileSystem(paths.new_tree);
+	if (err != error::NoError) {
+		return err;
+	}
+
+	auto exp_identity = FileIdentity(paths.new_tree);
+	if (!exp_identity) {
+		return exp_identity.error();
+	}
+	err = path::CreateDirectories(tmp_path_);
+	if (err != error::NoError) {
+		return err;
+	}
+	auto exp_marker = io::OpenOfstream(marker_path_);
+	if (!exp_marker) {
+		return exp_marker.error();
+	}
+	err = io::WriteStringIntoOfstream(exp_marker.value(), exp_identity.value());
+	exp_marker.value().close();
+	if (err == error::NoError) {
+		err = SyncPath(marker_path_);
+	}
+	if (err != error::NoError) {
+		return err.WithContext("Could not record the new directory tree");
+	}
+
+	err = ExchangePaths(paths.new_tree, paths.dest);
+	if (err == error::NoError) {
+		err = path::Rename(paths.new_tree, paths.previous_tree);
+	} else if (err.code == make_error_condition(errc::function_not_supported)) {
+		log::Debug("Atomic exchange is not supported for " + paths.dest + ". Using two renames");
+		err = path::Rename(paths.dest, paths.previous_tree);
+		if (err == error::NoError) {
+			err = path::Rename(paths.new_tree, paths.dest);
+		}
+	}
+	if (err != error::NoError) {
+		return err;
+	}
+
+	return SyncPath(paths.parent);
+}
+
+error::Error DirectoryModule::ArtifactRollback() {
+	if (!path::FileExists(marker_path_)) {
+		// The destination was never touched.
+		return error::NoError;
+	}
+
+	auto exp_paths = GetPaths();
+	if (!exp_paths) {
+		return exp_paths.error();
+	}
+	auto &paths = exp_paths.value();
+
+	auto exp_file = io::OpenIfstream(marker_path_);
+	if (!exp_file) {
+		return exp_file.error();
+	}
+	string new_identity;
+	getline(exp_file.value(), new_identity);
+
+	auto exp_dest_identity = FileIdentity(paths.dest);
+	bool swapped = exp_dest_identity && exp_dest_identity.value() == new_identity;
+
+	error::Error err;
+	if (swapped) {
+		if (!path::FileExists(paths.previous_tree)) {
+			if (!path::FileExists(paths.new_tree)) {
+				return error::Error(
+					make_error_condition(errc::no_such_file_or_directory),
+					"The previous contents of " + paths.dest + " are gone");
+			}
+			// The exchange happened, but not the rename afterwards.
+			err = path::Rename(paths.new_tree, paths.previous_tree);
+			if (err != error::NoError) {
+				return err;
+			}
+		}
+		err = ExchangePaths(paths.previous_tree, paths.dest);
+		if (err.code == make_error_condition(errc::function_not_supported)) {
+			err = path::Rename(paths.dest, paths.new_tree);
+			if (err == error::NoError) {
+				err = path::Rename(paths.previous_tree, paths.dest);
+			}
+			if (err == error::NoError) {
+				err = path::DeleteRecursively(paths.new_tree);
+			}
+		} else if (err == error::NoError) {
+			err = path::DeleteRecursively(paths.previous_tree);
+		}
+	} else {
+		if (!path::FileExists(paths.dest) && path::FileExists(paths.previous_tree)) {
+			// Interrupted between the two renames.
+			err = path::Rename(paths.previous_tree, paths.dest);
+		}
+		if (err == error::NoError) {
+			err = path::DeleteRecursively(paths.new_tree);
+		}
+	}
+	if (err == error::NoError) {
+		err = SyncPath(paths.parent);
+	}
+	if (err != error::NoError) {
+		return err;
+	}
+
+	return path::FileDelete(marker_path_);
+}
+
+error::Error DirectoryModule::Cleanup() {
+	auto exp_paths = GetPaths();
+	if (!exp_paths) {
+		// Nothing was installed.
+		return error::NoError;
+	}
+	auto err = path::DeleteRecursively(exp_paths.value().previous_tree);
+	return err.FollowedBy(path::DeleteRecursively(exp_paths.value().new_tree));
+}
+
+SingleFileModule::SingleFileModule(const string &work_path) :
+	Module(work_path) {
+}
+
+expected::Expected<SingleFileModule::Paths> SingleFileModule::GetPaths() {
+	auto exp_filename = ReadPayloadValue("filename");
+	if (!exp_filename) {
+		return expected::unexpected(exp_filename.error().WithContext("Could not read filename"));
+	}
+	auto exp_dest_dir = ReadPayloadValue("dest_dir");
+	if (!exp_dest_dir) {
+		return expected::unexpected(exp_dest_dir.error().WithContext("Could not read dest_dir"));
+	}
+
+	Paths paths;
+	paths.filename = exp_filename.value();
+	paths.dest_dir = exp_dest_dir.value();
+	if (paths.filename == "" || paths.filename == "." || paths.filename == ".."
+		|| paths.filename.find('/') != string::npos) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::invalid_argument), "Invalid filename: " + paths.filename));
+	}
+	if (paths.dest_dir == "") {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::invalid_argument), "dest_dir is undefined"));
+	}
+
+	paths.target = path::Join(paths.dest_dir, paths.filename);
+	paths.tmp = path::Join(paths.dest_dir, "." + paths.filename + ".mender-tmp");
+	paths.backup = path::Join(tmp_path_, string("backup"), paths.filename);
+	return paths;
+}
+
+error::Error SingleFileModule::ArtifactInstall() {
+	auto exp_paths = GetPaths();
+	if (!exp_paths) {
+		return exp_paths.error();
+	}
+	auto &paths = exp_paths.value();
+	string src = path::Join(files_path_, paths.filename);
+	if (!path::FileExists(src)) {
+		return error::Error(
+			make_error_condition(errc::no_such_file_or_directory),
+			"The payload does not contain " + paths.filename);
+	}
+
+	auto exp_permissions = ReadPayloadValue("permissions");
+	if (exp_permissions) {
+		unsigned int mode;
+		if (sscanf(exp_permissions.value().c_str(), "%o", &mode) != 1) {
+			return error::Error(
+				make_error_condition(errc::invalid_argument),
+				"Invalid permissions: " + exp_permissions.value());
+		}
+		auto err = SetMode(src, mode);
+		if (err != error::NoError) {
+			return err;
+		}
+	}
+
+	auto err = path::CreateDirectories(paths.dest_dir);
+	if (err != error::NoError) {
+		return err;
+	}
+
+	if (path::FileExists(paths.target)) {
+		err = path::CreateDirectories(path::DirName(paths.backup));
+		if (err == error::NoError) {
+			err = path::DeleteRecursively(paths.backup);
+		}
+		if (err != error::NoError) {
+			return err;
+		}
+		// A hardlink keeps the old file alive after the rename below, without copying it.
+		err = HardLink(paths.target, paths.backup);
+		if (err != error::NoError) {
+			log::Debug(err.String() + ". Copying " + paths.target + " instead");
+			err = CopyFile(paths.target, paths.backup);
+		}
+		if (err == error::NoError) {
+			err = SyncPath(paths.backup);
+		}
+		if (err == error::NoError) {
+			err = SyncPath(path::DirName(paths.backup));
+		}
+		if (err != error::NoError) {
+			return err.WithContext("Could not back up " + paths.target);
+		}
+	}
+
+	err = path::DeleteRecursively(paths.tmp);
+	if (err != error::NoError) {
+		return err;
+	}
+	err = path::Rename(src, paths.tmp);
+	if (err.code == make_error_condition(errc::cross_device_link)) {
+		err = CopyFile(src, paths.tmp);
+	}
+	if (err == error::NoError) {
+		err = SyncPath(paths.tmp);
+	}
+	if (err == error::NoError) {
+		err = path::Rename(paths.tmp, paths.target);
+	}
+	if (err != error::NoError) {
+		return err;
+	}
+	return SyncPath(paths.dest_dir);
+}
+
+error::Error SingleFileModule::ArtifactRollback() {
+	auto exp_paths = GetPaths();
+	if (!exp_paths) {
+		return exp_paths.error();
+	}
+	auto &paths = exp_paths.value();
+
+	if (!path::FileExists(paths.backup)) {
+		// There was no previous file, or it was never replaced.
+		log::Info("No backup of " + paths.target + " to restore");
+		return error::NoError;
+	}
+
+	auto err = path::Rename(paths.backup, paths.target);
+	if (err.code == make_error_condition(errc::cross_device_link)) {
+		err = path::DeleteRecursively(paths.tmp);
+		if (err == error::NoError) {
+			err = CopyFile(paths.backup, paths.tmp);
+		}
+		if (err == error::NoError) {
+			err = SyncPath(paths.tmp);
+		}
+		if (err == error::NoError) {
+			err = path::Rename(paths.tmp, paths.target);
+		}
+	}
+	if (err != error::NoError) {
+		return err;
+	}
+	return SyncPath(paths.dest_dir);
+}
+
+DiscardModule::DiscardModule(const string &work_path) :
+	Module(work_path) {
+}
+
+error::Error DiscardModule::BeginPayloadFile(const string &name, int64_t size) {
+	return error::NoError;
+}
+
+error::Error DiscardModule::PayloadFileData(const uint8_t *data, size_t size) {
+	return error::NoError;
+}
+
+error::Error DiscardModule::EndPayloadFile() {
+	return error::NoError;
+}
+
+error::Error DiscardModule::ArtifactInstall() {
+	return error::Error(
+		make_error_condition(errc::not_supported),
+		"The payload has been discarded, and can't be installed");
+}
+
+error::Error DiscardModule::ArtifactRollback() {
+	return error::NoError;
+}
+
+namespace {
+
+int Status(const error::Error &err) {
+	if (err != error::NoError) {
+		log::Error(err.String());
+		return 1;
+	}
+	return 0;
+}
+
+template <typename T>
+void *Open(const char *work_path, mender_update_module_log_func) {
+	return new T(work_path);
+}
+
+int PayloadFileBegin(void *instance, const char *name, int64_t size) {
+	return Status(static_cast<Module *>(instance)->BeginPayloadFile(name, size));
+}
+
+int PayloadFileData(void *instance, const uint8_t *data, size_t size) {
+	return Status(static_cast<Module *>(instance)->PayloadFileData(data, size));
+}
+
+int PayloadFileEnd(void *instance) {
+	return Status(static_cast<Module *>(instance)->EndPayloadFile());
+}
+
+int CallState(void *instance, const char *state, char *output, size_t output_size) {
+	auto module = static_cast<Module *>(instance);
+	string state_string {state};
+	string result;
+	error::Error err;
+	if (state_string == "ArtifactInstall") {
+		err = module->ArtifactInstall();
+	} else if (state_string == "ArtifactRollback") {
+		err = module->ArtifactRollback();
+	} else if (state_string == "Cleanup") {
+		err = module->Cleanup();
+	} else if (state_string == "NeedsArtifactReboot") {
+		result = "No";
+	} else if (state_string == "SupportsRollback") {
+		result = "Yes";
+	}
+	snprintf(output, output_size, "%s", result.c_str());
+	return Status(err.WithContext(state_string));
+}
+
+void Close(void *instance) {
+	delete static_cast<Module *>(instance);
+}
+
+const mender_update_module_plugin kDirectoryModule {
+	MENDER_UPDATE_MODULE_PLUGIN_ABI_VERSION,
+	Open<DirectoryModule>,
+	PayloadFileBegin,
+	PayloadFileData,
+	PayloadFileEnd,
+	CallState,
+	Close,
+};
+
+const mender_update_module_plugin kSingleFileModule {
+	MENDER_UPDATE_MODULE_PLUGIN_ABI_VERSION,
+	Open<SingleFileModule>,
+	PayloadFileBegin,
+	PayloadFileData,
+	PayloadFileEnd,
+	CallState,
+	Close,
+};
+
+const mender_update_module_plugin kDiscardModule {
+	MENDER_UPDATE_MODULE_PLUGIN_ABI_VERSION,
+	Open<DiscardModule>,
+	PayloadFileBegin,
+	PayloadFileData,
+	PayloadFileEnd,
+	CallState,
+	Close,
+};
+
+} // namespace
+
+const mender_update_module_plugin *BuiltinModule(const string &payload_type) {
+	if (payload_type == "directory") {
+		return &kDirectoryModule;
+	} else if (payload_type == "single-file") {
+		return &kSingleFileModule;
+	}
+	return nullptr;
+}
+
+const mender_update_module_plugin *BuiltinDiscardModule() {
+	return &kDiscardModule;
+}
+
+} // namespace file_update
+} // namespace update
+} // namespace mender
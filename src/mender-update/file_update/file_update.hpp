@@ -0,0 +1,263 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#ifndef MENDER_UPDATE_FILE_UPDATE_HPP
+#define MENDER_UPDATE_FILE_UPDATE_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <common/error.hpp>
+#include <common/expected.hpp>
+#include <common/io.hpp>
+
+#include <mender-update/update_module/v3/update_module_plugin.h>
+
+namespace mender {
+namespace update {
+namespace file_update {
+
+using namespace std;
+
+namespace error = mender::common::error;
+namespace expected = mender::common::expected;
+namespace io = mender::common::io;
+
+// Returns the built-in implementation of the Update Module for `payload_type`, in the form of a
+// plugin (see update_module_plugin.h), or nullptr if there is none. The built-in modules are
+// drop-in replacements for the `directory` and `single-file` scripts, using the same payload
+// files, but they unpack the payload while it is being downloaded, and write files in parallel.
+const mender_update_module_plugin *BuiltinModule(const string &payload_type);
+
+// Returns the built-in module which reads the payload and throws it away. It can't be selected by
+// payload type, and is only used by `mender-update benchmark`, to measure everything up to the
+// Update Module.
+const mender_update_module_plugin *BuiltinDiscardModule();
+
+// Runs jobs on a fixed set of threads. Writing many small files one by one is dominated by the
+// latency of the storage, so it helps a lot to have several writes in flight.
+class WorkerPool {
+public:
+	using Job = function<error::Error()>;
+
+	// `max_queued_bytes` limits how much memory the jobs waiting in the queue may hold on to.
+	WorkerPool(size_t threads, size_t max_queued_bytes);
+	~WorkerPool();
+
+	// Blocks while the queue is full. `bytes` is how much memory the job holds on to.
+	void Submit(Job job, size_t bytes = 0);
+
+	// Waits until all submitted jobs have finished, and returns the first error any of them
+	// returned since the last call. Once a job has failed, the remaining ones are skipped.
+	error::Error Wait();
+
+private:
+	void Work();
+
+	mutex mutex_;
+	condition_variable cond_;
+	deque<pair<Job, size_t>> queue_;
+	size_t queued_bytes_ {0};
+	size_t max_queued_bytes_;
+	size_t running_ {0};
+	bool stopping_ {false};
+	error::Error error_;
+	vector<thread> threads_;
+};
+
+// Passes a stream of data from one thread to another, with a bounded buffer in between. The
+// writing side blocks while the buffer is full, and the reading side while it is empty. In the
+// built-in modules, the writing side is the thread the client calls the plugin from, which
+// doesn't read more of the artifact until the call returns, so a full buffer holds back the
+// download without blocking the event loop.
+class StreamQueue : virtual public io::Reader {
+public:
+	StreamQueue(size_t max_bytes);
+
+	// Returns false if the reading side has stopped reading.
+	bool Push(const uint8_t *data, size_t size);
+	// Signals the end of the stream to the reading side.
+	void Close();
+	// Called by the reading side to make `Push` return instead of waiting for it.
+	void StopReading();
+
+	expected::ExpectedSize Read(
+		vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) override;
+
+private:
+	mutex mutex_;
+	condition_variable cond_;
+	deque<vector<uint8_t>> chunks_;
+	// How much of the first chunk has been read.
+	size_t offset_ {0};
+	size_t buffered_ {0};
+	size_t max_bytes_;
+	bool closed_ {false};
+	bool stopped_ {false};
+};
+
+// Unpacks a tar archive into the existing directory `dest`, keeping modes and modification
+// times, and also ownership when running as root. Entries which would end up outside of `dest`
+// are rejected. Regular files are written by `pool`. Nothing is synced to storage.
+error::Error ExtractTar(io::Reader &reader, const string &dest, WorkerPool &pool);
+
+// Copies the directory tree `src` into the existing directory `dest`, in the same way as
+// `ExtractTar`. Hardlinks within the tree are copied as separate files.
+error::Error CopyTree(const string &src, const string &dest, WorkerPool &pool);
+
+// Copies a regular file, including mode and modification time. If the file system supports it,
+// the data is shared with the original (a reflink) instead of copied. `dest` must not exist.
+error::Error CopyFile(const string &src, const string &dest);
+
+// Writes everything which has been written to the file system containing `path` to storage.
+// This is one call, instead of one fsync() per file.
+error::Error SyncFileSystem(const string &path);
+
+// fsync() of a single file or directory.
+error::Error SyncPath(const string &path);
+
+// Atomically swaps two paths, which must be on the same file system. Fails with
+// `errc::function_not_supported` if the file system can't do that.
+error::Error ExchangePaths(const string &path1, const string &path2);
+
+// Sets the permission bits of a file.
+error::Error SetMode(const string &path, uint32_t mode);
+
+error::Error HardLink(const string &target, const string &link);
+
+// Identifies a file or directory for as long as it exists: its device and inode number. Doesn't
+// follow symlinks.
+expected::ExpectedString FileIdentity(const string &path);
+
+// One instance per deployment, for the work directory of the Update Module.
+class Module {
+public:
+	Module(const string &work_path);
+	virtual ~Module() {
+	}
+
+	// Payload files are stored in `files/` in the work directory, like the client does for
+	// executable Update Modules.
+	virtual error::Error BeginPayloadFile(const string &name, int64_t size);
+	virtual error::Error PayloadFileData(const uint8_t *data, size_t size);
+	virtual error::Error EndPayloadFile();
+
+	virtual error::Error ArtifactInstall() = 0;
+	virtual error::Error ArtifactRollback() = 0;
+	virtual error::Error Cleanup() {
+		return error::NoError;
+	}
+
+protected:
+	// Contents of a file from the payload, without trailing newlines, like `$(cat file)` in a
+	// shell script.
+	expected::ExpectedString ReadPayloadValue(const string &name);
+
+	string work_path_;
+	string files_path_;
+	string tmp_path_;
+
+private:
+	unique_ptr<ofstream> file_;
+	string current_file_;
+};
+
+// Replaces the directory in the payload file `dest_dir` with the contents of `update.tar`.
+//
+// The archive is unpacked into a staging directory while it is being downloaded. On install, the
+// staging directory is moved next to the destination, and swapped with it in one atomic rename,
+// so that the destination is never partially updated. The previous contents are kept next to it
+// until `Cleanup`, so that they can be restored by `ArtifactRollback`.
+class DirectoryModule : public Module {
+public:
+	DirectoryModule(const string &work_path);
+	~DirectoryModule();
+
+	error::Error BeginPayloadFile(const string &name, int64_t size) override;
+	error::Error PayloadFileData(const uint8_t *data, size_t size) override;
+	error::Error EndPayloadFile() override;
+
+	error::Error ArtifactInstall() override;
+	error::Error ArtifactRollback() override;
+	error::Error Cleanup() override;
+
+private:
+	struct Paths {
+		string dest;
+		string parent;
+		string new_tree;
+		string previous_tree;
+	};
+	expected::Expected<Paths> GetPaths();
+	error::Error FinishExtraction();
+
+	string staging_path_;
+	// Marks that the new tree has been prepared, and records its identity, so that rollback can
+	// tell whether the swap has happened.
+	string marker_path_;
+
+	unique_ptr<WorkerPool> pool_;
+	unique_ptr<StreamQueue> queue_;
+	thread extract_thread_;
+	error::Error extract_error_;
+};
+
+// Replaces the file in `filename` in the directory in `dest_dir` with the file of the same name
+// from the payload, and sets the mode in `permissions`, if present. The previous file is backed
+// up in the work directory, using a hardlink when possible, so that it can be restored.
+class SingleFileModule : public Module {
+public:
+	SingleFileModule(const string &work_path);
+
+	error::Error ArtifactInstall() override;
+	error::Error ArtifactRollback() override;
+
+private:
+	struct Paths {
+		string filename;
+		string dest_dir;
+		string target;
+		string tmp;
+		string backup;
+	};
+	expected::Expected<Paths> GetPaths();
+};
+
+// Accepts the payload without storing any of it, and refuses to install it.
+class DiscardModule : public Module {
+public:
+	DiscardModule(const string &work_path);
+
+	error::Error BeginPayloadFile(const string &name, int64_t size) override;
+	error::Error PayloadFileData(const uint8_t *data, size_t size) override;
+	error::Error EndPayloadFile() override;
+
+	error::Error ArtifactInstall() override;
+	error::Error ArtifactRollback() override;
+};
+
+} // namespace file_update
+} // namespace update
+} // namespace mender
+
+#endif // MENDER_UPDATE_FILE_UPDATE_HPP
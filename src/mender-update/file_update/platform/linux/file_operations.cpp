@@ -0,0 +1,537 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/file_update/file_update.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <artifact/tar/tar.hpp>
+#include <common/log.hpp>
+#include <common/path.hpp>
+
+namespace mender {
+namespace update {
+namespace file_update {
+
+namespace fs = std::filesystem;
+namespace log = mender::common::log;
+namespace path = mender::common::path;
+namespace tar = mender::tar;
+
+// Files up to this size are read into memory and written by the worker pool. Larger ones are
+// streamed directly to disk by the extracting thread, since there is little to gain from
+// parallelism for them.
+const size_t kSmallFileSize {1024 * 1024};
+const size_t kCopyBufferSize {1024 * 1024};
+
+static error::Error MakeErrnoError(int errnum, const string &msg) {
+	return error::Error(generic_category().default_error_condition(errnum), msg);
+}
+
+// Closes the file descriptor when going out of scope.
+class FileDescriptor {
+public:
+	FileDescriptor(int fd) :
+		fd_ {fd} {
+	}
+	~FileDescriptor() {
+		if (fd_ >= 0) {
+			::close(fd_);
+		}
+	}
+	int Get() {
+		return fd_;
+	}
+	error::Error Close(const string &path) {
+		int ret = ::close(fd_);
+		fd_ = -1;
+		if (ret != 0) {
+			return MakeErrnoError(errno, "Could not close " + path);
+		}
+		return error::NoError;
+	}
+
+private:
+	int fd_;
+};
+
+static error::Error WriteAll(int fd, const uint8_t *data, size_t size, const string &path) {
+	while (size > 0) {
+		ssize_t n = ::write(fd, data, size);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return MakeErrnoError(errno, "Could not write to " + path);
+		}
+		data += n;
+		size -= static_cast<size_t>(n);
+	}
+	return error::NoError;
+}
+
+struct Attributes {
+	uint32_t mode;
+	int64_t uid;
+	int64_t gid;
+	int64_t mtime;
+};
+
+// Ownership is only restored when running as root, like tar does. The numeric IDs are used as
+// they are, without mapping user and group names.
+static bool RestoreOwnership() {
+	return geteuid() == 0;
+}
+
+static error::Error ApplyAttributes(int fd, const Attributes &attrs, const string &path) {
+	if (RestoreOwnership()
+		&& fchown(fd, static_cast<uid_t>(attrs.uid), static_cast<gid_t>(attrs.gid)) != 0) {
+		return MakeErrnoError(errno, "Could not change the owner of " + path);
+	}
+	// After chown, which clears the setuid and setgid bits.
+	if (fchmod(fd, static_cast<mode_t>(attrs.mode & 07777)) != 0) {
+		return MakeErrnoError(errno, "Could not change the mode of " + path);
+	}
+	struct timespec times[2] = {{0, UTIME_OMIT}, {static_cast<time_t>(attrs.mtime), 0}};
+	if (futimens(fd, times) != 0) {
+		return MakeErrnoError(errno, "Could not change the modification time of " + path);
+	}
+	return error::NoError;
+}
+
+static error::Error ApplyAttributes(const string &path, const Attributes &attrs) {
+	FileDescriptor fd(open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+	if (fd.Get() < 0) {
+		return MakeErrnoError(errno, "Could not open " + path);
+	}
+	return ApplyAttributes(fd.Get(), attrs, path);
+}
+
+static error::Error ApplySymlinkAttributes(const string &path, const Attributes &attrs) {
+	if (RestoreOwnership()
+		&& lchown(path.c_str(), static_cast<uid_t>(attrs.uid), static_cast<gid_t>(attrs.gid))
+			   != 0) {
+		return MakeErrnoError(errno, "Could not change the owner of " + path);
+	}
+	struct timespec times[2] = {{0, UTIME_OMIT}, {static_cast<time_t>(attrs.mtime), 0}};
+	if (utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0) {
+		return MakeErrnoError(errno, "Could not change the modification time of " + path);
+	}
+	return error::NoError;
+}
+
+static expected::Expected<int> CreateFile(const string &path) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		return expected::unexpected(MakeErrnoError(errno, "Could not create " + path));
+	}
+	return fd;
+}
+
+static error::Error WriteFile(
+	const string &path, const vector<uint8_t> &data, const Attributes &attrs) {
+	auto exp_fd = CreateFile(path);
+	if (!exp_fd) {
+		return exp_fd.error();
+	}
+	FileDescriptor fd(exp_fd.value());
+	auto err = WriteAll(fd.Get(), data.data(), data.size(), path);
+	if (err == error::NoError) {
+		err = ApplyAttributes(fd.Get(), attrs, path);
+	}
+	if (err != error::NoError) {
+		return err;
+	}
+	return fd.Close(path);
+}
+
+static error::Error StreamFile(const string &path, io::Reader &reader, const Attributes &attrs) {
+	auto exp_fd = CreateFile(path);
+	if (!exp_fd) {
+		return exp_fd.error();
+	}
+	FileDescriptor fd(exp_fd.value());
+	vector<uint8_t> buf(kCopyBufferSize);
+	while (true) {
+		auto exp_n = reader.Read(buf.begin(), buf.end());
+		if (!exp_n) {
+			return exp_n.error();
+		}
+		if (exp_n.value() == 0) {
+			break;
+		}
+		auto err = WriteAll(fd.Get(), buf.data(), exp_n.value(), path);
+		if (err != error::NoError) {
+			return err;
+		}
+	}
+	auto err = ApplyAttributes(fd.Get(), attrs, path);
+	if (err != error::NoError) {
+		return err;
+	}
+	return fd.Close(path);
+}
+
+static error::Error CreateDirectory(const string &path) {
+	if (mkdir(path.c_str(), 0700) != 0) {
+		int mkdir_errno = errno;
+		struct stat st;
+		if (mkdir_errno != EEXIST || lstat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+			return MakeErrnoError(mkdir_errno, "Could not create directory " + path);
+		}
+	}
+	return error::NoError;
+}
+
+// Returns the path for an entry, making sure that it is within `dest`, also if earlier entries
+// have created symlinks.
+static expected::ExpectedString EntryPath(const string &dest, const string &name) {
+	string entry_path = fs::path(path::Join(dest, name)).lexically_normal().string();
+	while (entry_path.size() > 1 && entry_path.back() == '/') {
+		entry_path.pop_back();
+	}
+	string relative = fs::path(entry_path).lexically_relative(dest).string();
+	bool outside = relative == "" || relative == ".." || relative.compare(0, 3, "../") == 0;
+	if (!outside && entry_path != dest) {
+		// Only the parent needs to be resolved, the entry itself is replaced, not followed.
+		auto exp_within = path::IsWithinOrEqual(path::DirName(entry_path), dest);
+		if (!exp_within) {
+			return expected::unexpected(exp_within.error());
+		}
+		outside = !exp_within.value();
+	}
+	if (outside) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::permission_denied),
+			"Archive entry " + name + " is outside of the destination directory"));
+	}
+	return entry_path;
+}
+
+struct DirectoryAttributes {
+	string path;
+	Attributes attrs;
+};
+
+// Directories are created with restrictive permissions, and get their real attributes after
+// their contents have been written, since that changes the modification time, and since they
+// may not be writable.
+static error::Error ApplyDirectoryAttributes(const vector<DirectoryAttributes> &directories) {
+	for (auto it = directories.rbegin(); it != directories.rend(); it++) {
+		auto err = ApplyAttributes(it->path, it->attrs);
+		if (err != error::NoError) {
+			return err;
+		}
+	}
+	return error::NoError;
+}
+
+static error::Error ExtractEntry(
+	tar::Entry &entry,
+	const string &dest,
+	WorkerPool &pool,
+	vector<DirectoryAttributes> &directories) {
+	auto exp_path = EntryPath(dest, entry.Name());
+	if (!exp_path) {
+		return exp_path.error();
+	}
+	const string &entry_path = exp_path.value();
+	auto &metadata = entry.Metadata();
+	Attributes attrs {metadata.mode, metadata.uid, metadata.gid, metadata.mtime};
+
+	// Archives don't always contain entries for all directories.
+	if (entry_path != dest) {
+		auto err = path::CreateDirectories(path::DirName(entry_path));
+		if (err != error::NoError) {
+			return err;
+		}
+	}
+
+	switch (metadata.type) {
+	case tar::EntryType::Directory: {
+		if (entry_path != dest) {
+			auto err = CreateDirectory(entry_path);
+			if (err != error::NoError) {
+				return err;
+			}
+		}
+		directories.push_back({entry_path, attrs});
+		return error::NoError;
+	}
+
+	case tar::EntryType::Regular: {
+		auto size = entry.Size();
+		if (size > static_cast<int64_t>(kSmallFileSize)) {
+			return StreamFile(entry_path, entry, attrs);
+		}
+
+		auto data = make_shared<vector<uint8_t>>(static_cast<size_t>(size));
+		io::ByteWriter writer(data);
+		auto err = io::Copy(writer, entry);
+		if (err != error::NoError) {
+			return err.WithContext("Could not read " + entry.Name());
+		}
+		pool.Submit(
+			[entry_path, data, attrs]() { return WriteFile(entry_path, *data, attrs); },
+			data->size());
+		return error::NoError;
+	}
+
+	case tar::EntryType::Symlink:
+		if (symlink(metadata.link_target.c_str(), entry_path.c_str()) != 0) {
+			return MakeErrnoError(errno, "Could not create symlink " + entry_path);
+		}
+		return ApplySymlinkAttributes(entry_path, attrs);
+
+	case tar::EntryType::Hardlink: {
+		auto exp_target = EntryPath(dest, metadata.link_target);
+		if (!exp_target) {
+			return exp_target.error();
+		}
+		// The target may still be in the queue.
+		auto err = pool.Wait();
+		if (err != error::NoError) {
+			return err;
+		}
+		if (link(exp_target.value().c_str(), entry_path.c_str()) != 0) {
+			return MakeErrnoError(errno, "Could not create hardlink " + entry_path);
+		}
+		return error::NoError;
+	}
+
+	case tar::EntryType::Other:
+		log::Warning("Skipping special file " + entry.Name() + " in archive");
+		return error::NoError;
+	}
+
+	return error::NoError;
+}
+
+error::Error ExtractTar(io::Reader &reader, const string &dest, WorkerPool &pool) {
+	tar::Reader tar_reader(reader);
+	vector<DirectoryAttributes> directories;
+
+	error::Error err;
+	while (true) {
+		auto exp_entry = tar_reader.Next();
+		if (!exp_entry) {
+			if (exp_entry.error().code != tar::MakeError(tar::TarEOFError, "").code) {
+				err = exp_entry.error();
+			}
+			break;
+		}
+		err = ExtractEntry(exp_entry.value(), dest, pool, directories);
+		if (err != error::NoError) {
+			break;
+		}
+	}
+
+	err = err.FollowedBy(pool.Wait());
+	if (err != error::NoError) {
+		return err;
+	}
+	return ApplyDirectoryAttributes(directories);
+}
+
+error::Error CopyTree(const string &src, const string &dest, WorkerPool &pool) {
+	vector<DirectoryAttributes> directories;
+	error_code ec;
+
+	struct stat st;
+	if (lstat(src.c_str(), &st) != 0) {
+		return MakeErrnoError(errno, "Could not stat " + src);
+	}
+	directories.push_back({dest, {st.st_mode, st.st_uid, st.st_gid, st.st_mtim.tv_sec}});
+
+	error::Error err;
+	for (fs::recursive_directory_iterator it(src, ec), end; !ec && it != end; it.increment(ec)) {
+		string entry_src = it->path().string();
+		string entry_dest = path::Join(dest, it->path().lexically_relative(src).string());
+		if (lstat(entry_src.c_str(), &st) != 0) {
+			err = MakeErrnoError(errno, "Could not stat " + entry_src);
+			break;
+		}
+		Attributes attrs {st.st_mode, st.st_uid, st.st_gid, st.st_mtim.tv_sec};
+
+		if (S_ISDIR(st.st_mode)) {
+			err = CreateDirectory(entry_dest);
+			directories.push_back({entry_dest, attrs});
+		} else if (S_ISREG(st.st_mode)) {
+			pool.Submit([entry_src, entry_dest]() { return CopyFile(entry_src, entry_dest); });
+		} else if (S_ISLNK(st.st_mode)) {
+			auto target = fs::read_symlink(entry_src, ec);
+			if (ec) {
+				break;
+			}
+			if (symlink(target.c_str(), entry_dest.c_str()) != 0) {
+				err = MakeErrnoError(errno, "Could not create symlink " + entry_dest);
+			} else {
+				err = ApplySymlinkAttributes(entry_dest, attrs);
+			}
+		} else {
+			log::Warning("Skipping special file " + entry_src);
+		}
+		if (err != error::NoError) {
+			break;
+		}
+	}
+	if (ec) {
+		err = err.FollowedBy(
+			error::Error(ec.default_error_condition(), "Could not copy directory " + src));
+	}
+
+	err = err.FollowedBy(pool.Wait());
+	if (err != error::NoError) {
+		return err;
+	}
+	return ApplyDirectoryAttributes(directories);
+}
+
+error::Error CopyFile(const string &src, const string &dest) {
+	FileDescriptor in(open(src.c_str(), O_RDONLY | O_CLOEXEC));
+	if (in.Get() < 0) {
+		return MakeErrnoError(errno, "Could not open " + src);
+	}
+	struct stat st;
+	if (fstat(in.Get(), &st) != 0) {
+		return MakeErrnoError(errno, "Could not stat " + src);
+	}
+
+	auto exp_fd = CreateFile(dest);
+	if (!exp_fd) {
+		return exp_fd.error();
+	}
+	FileDescriptor out(exp_fd.value());
+
+	if (ioctl(out.Get(), FICLONE, in.Get()) != 0) {
+		// No reflinks. copy_file_range() still avoids copying through user space, and some file
+		// systems can do it on the server or device side.
+		bool use_read_write = false;
+		off_t remaining = st.st_size;
+		while (remaining > 0) {
+			ssize_t n = copy_file_range(
+				in.Get(), nullptr, out.Get(), nullptr, static_cast<size_t>(remaining), 0);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+					use_read_write = true;
+					break;
+				}
+				return MakeErrnoError(errno, "Could not copy " + src + " to " + dest);
+			}
+			if (n == 0) {
+				break;
+			}
+			remaining -= n;
+		}
+
+		if (use_read_write) {
+			vector<uint8_t> buf(kCopyBufferSize);
+			while (true) {
+				ssize_t n = read(in.Get(), buf.data(), buf.size());
+				if (n < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return MakeErrnoError(errno, "Could not read " + src);
+				}
+				if (n == 0) {
+					break;
+				}
+				auto err = WriteAll(out.Get(), buf.data(), static_cast<size_t>(n), dest);
+				if (err != error::NoError) {
+					return err;
+				}
+			}
+		}
+	}
+
+	auto err = ApplyAttributes(
+		out.Get(), {st.st_mode, st.st_uid, st.st_gid, st.st_mtim.tv_sec}, dest);
+	if (err != error::NoError) {
+		return err;
+	}
+	return out.Close(dest);
+}
+
+error::Error SyncFileSystem(const string &path) {
+	FileDescriptor fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+	if (fd.Get() < 0) {
+		return MakeErrnoError(errno, "Could not open " + path);
+	}
+	if (syncfs(fd.Get()) != 0) {
+		return MakeErrnoError(errno, "Could not sync the file system of " + path);
+	}
+	return error::NoError;
+}
+
+error::Error SyncPath(const string &path) {
+	FileDescriptor fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+	if (fd.Get() < 0) {
+		return MakeErrnoError(errno, "Could not open " + path);
+	}
+	if (fsync(fd.Get()) != 0) {
+		return MakeErrnoError(errno, "Could not sync " + path);
+	}
+	return error::NoError;
+}
+
+error::Error ExchangePaths(const string &path1, const string &path2) {
+	if (renameat2(AT_FDCWD, path1.c_str(), AT_FDCWD, path2.c_str(), RENAME_EXCHANGE) != 0) {
+		int rename_errno = errno;
+		if (rename_errno == EINVAL || rename_errno == ENOSYS) {
+			return error::Error(
+				make_error_condition(errc::function_not_supported),
+				"Could not exchange " + path1 + " and " + path2);
+		}
+		return MakeErrnoError(rename_errno, "Could not exchange " + path1 + " and " + path2);
+	}
+	return error::NoError;
+}
+
+error::Error SetMode(const string &path, uint32_t mode) {
+	if (chmod(path.c_str(), static_cast<mode_t>(mode & 07777)) != 0) {
+		return MakeErrnoError(errno, "Could not change the mode of " + path);
+	}
+	return error::NoError;
+}
+
+error::Error HardLink(const string &target, const string &link) {
+	if (::link(target.c_str(), link.c_str()) != 0) {
+		return MakeErrnoError(errno, "Could not link " + target + " to " + link);
+	}
+	return error::NoError;
+}
+
+expected::ExpectedString FileIdentity(const string &path) {
+	struct stat st;
+	if (lstat(path.c_str(), &st) != 0) {
+		return expected::unexpected(MakeErrnoError(errno, "Could not stat " + path));
+	}
+	return to_string(st.st_dev) + ":" + to_string(st.st_ino);
+}
+
+} // namespace file_update
+} // namespace update
+} // namespace mender
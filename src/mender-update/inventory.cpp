@@ -14,12 +14,15 @@
 
 #include <mender-update/inventory.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <sstream>
 #include <string>
 
 #include <api/api.hpp>
 #include <api/client.hpp>
+#include <artifact/sha/sha.hpp>
 #include <common/common.hpp>
 #include <client_shared/conf.hpp>
 #include <common/error.hpp>
@@ -28,6 +31,7 @@
 #include <client_shared/inventory_parser.hpp>
 #include <common/io.hpp>
 #include <common/json.hpp>
+#include <common/key_value_database.hpp>
 #include <common/log.hpp>
 
 namespace mender {
@@ -46,7 +50,10 @@ namespace http = mender::common::http;
 namespace inv_parser = mender::client_shared::inventory_parser;
 namespace io = mender::common::io;
 namespace json = mender::common::json;
+namespace kv_db = mender::common::key_value_database;
+namespace kvp = mender::common::key_value_parser;
 namespace log = mender::common::log;
+namespace sha = mender::sha;
 
 const InventoryErrorCategoryClass InventoryErrorCategory;
 
@@ -69,17 +76,18 @@ error::Error MakeError(InventoryErrorCode code, const string &msg) {
 	return error::Error(error_condition(code, InventoryErrorCategory), msg);
 }
 
+// All inventory keys start with this.
+const string kInventoryKeyPrefix {"inventory-"};
+const string kInventoryDataKey {"inventory-data"};
+const string kInventoryLastFullSyncKey {"inventory-last-full-sync"};
+const string kInventoryFingerprintKey {"inventory-fingerprint"};
+
 const string uri = "/api/devices/v1/inventory/device/attributes";
 
-error::Error PushInventoryData(
-	const string &inventory_generators_dir,
-	events::EventLoop &loop,
-	api::Client &client,
-	size_t &last_data_hash,
-	APIResponseHandler api_handler) {
+static kvp::ExpectedKeyValuesMap CollectInventoryData(const string &inventory_generators_dir) {
 	auto ex_inv_data = inv_parser::GetInventoryData(inventory_generators_dir);
 	if (!ex_inv_data) {
-		return ex_inv_data.error();
+		return ex_inv_data;
 	}
 	auto &inv_data = ex_inv_data.value();
 
@@ -94,20 +102,25 @@ error::Error PushInventoryData(
 		inv_data["mender_client_version_provider"] = {"internal"};
 	}
 
+	return ex_inv_data;
+}
+
+string MakeInventoryPayload(const kvp::KeyValuesMap &inv_data) {
 	stringstream top_ss;
 	top_ss << "[";
 	auto key_vector = common::GetMapKeyVector(inv_data);
 	std::sort(key_vector.begin(), key_vector.end());
 	for (const auto &key : key_vector) {
+		const auto &values = inv_data.at(key);
 		top_ss << R"({"name":")";
 		top_ss << json::EscapeString(key);
 		top_ss << R"(","value":)";
-		if (inv_data[key].size() == 1) {
-			top_ss << "\"" + json::EscapeString(inv_data[key][0]) + "\"";
+		if (values.size() == 1) {
+			top_ss << "\"" + json::EscapeString(values[0]) + "\"";
 		} else {
 			stringstream items_ss;
 			items_ss << "[";
-			for (const auto &str : inv_data[key]) {
+			for (const auto &str : values) {
 				items_ss << "\"" + json::EscapeString(str) + "\",";
 			}
 			auto items_str = items_ss.str();
@@ -124,20 +137,75 @@ error::Error PushInventoryData(
 	}
 	payload.push_back(']');
 
-	size_t payload_hash = std::hash<string> {}(payload);
-	if (payload_hash == last_data_hash) {
-		log::Info("Inventory data unchanged, not submitting");
-		loop.Post([api_handler]() { api_handler(error::NoError); });
-		return error::NoError;
+	return payload;
+}
+
+kvp::ExpectedKeyValuesMap ParseInventoryPayload(const string &payload) {
+	auto ex_j = json::Load(payload);
+	if (!ex_j) {
+		return expected::unexpected(ex_j.error());
+	}
+	auto ex_size = ex_j.value().GetArraySize();
+	if (!ex_size) {
+		return expected::unexpected(ex_size.error());
+	}
+
+	kvp::KeyValuesMap ret;
+	for (size_t i = 0; i < ex_size.value(); i++) {
+		auto ex_item = ex_j.value().Get(i);
+		if (!ex_item) {
+			return expected::unexpected(ex_item.error());
+		}
+		auto ex_name = json::Get<string>(ex_item.value(), "name", json::MissingOk::No);
+		if (!ex_name) {
+			return expected::unexpected(ex_name.error());
+		}
+		auto ex_value = ex_item.value().Get("value");
+		if (!ex_value) {
+			return expected::unexpected(ex_value.error());
+		}
+		if (ex_value.value().IsString()) {
+			ret[ex_name.value()] = {ex_value.value().GetString().value()};
+		} else {
+			auto ex_values = json::ToStringVector(ex_value.value());
+			if (!ex_values) {
+				return expected::unexpected(ex_values.error());
+			}
+			ret[ex_name.value()] = ex_values.value();
+		}
+	}
+
+	return ret;
+}
+
+InventoryDiff DiffInventoryData(const kvp::KeyValuesMap &previous, const kvp::KeyValuesMap &current) {
+	InventoryDiff diff;
+	for (const auto &attr : current) {
+		auto prev = previous.find(attr.first);
+		if (prev == previous.end() || prev->second != attr.second) {
+			diff.changed.insert(attr);
+		}
+	}
+	for (const auto &attr : previous) {
+		if (current.find(attr.first) == current.end()) {
+			diff.removed.push_back(attr.first);
+		}
 	}
+	return diff;
+}
 
+static error::Error SendInventoryRequest(
+	api::Client &client,
+	http::Method method,
+	const string &payload,
+	APIResponseHandler api_handler) {
 	http::BodyGenerator payload_gen = [payload]() {
 		return make_shared<io::StringReader>(payload);
 	};
 
 	auto req = make_shared<api::APIRequest>();
 	req->SetPath(uri);
-	req->SetMethod(http::Method::PUT);
+	req->SetMethod(method);
 	req->SetHeader("Content-Type", "application/json");
 	req->SetHeader("Content-Length", to_string(payload.size()));
 	req->SetHeader("Accept", "application/json");
@@ -165,8 +233,7 @@ error::Error PushInventoryData(
 			}
 			resp->SetBodyWriter(body_writer);
 		},
-		[received_body, api_handler, payload_hash, &last_data_hash](
-			http::ExpectedIncomingResponsePtr exp_resp) {
+		[received_body, api_handler](http::ExpectedIncomingResponsePtr exp_resp) {
 			if (!exp_resp) {
 				log::Error("Request to push inventory data failed: " + exp_resp.error().message);
 				api_handler(exp_resp.error());
@@ -177,7 +244,6 @@ error::Error PushInventoryData(
 			auto status = resp->GetStatusCode();
 			if (status == http::StatusOK) {
 				log::Info("Inventory data submitted successfully");
-				last_data_hash = payload_hash;
 				api_handler(error::NoError);
 			} else {
 				auto ex_err_msg = api::ErrorMsgFromErrorResponse(*received_body);
@@ -195,6 +261,261 @@ error::Error PushInventoryData(
 		});
 }
 
+static expected::ExpectedString DigestString(const string &data) {
+	auto ex_sha = sha::Shasum(common::ByteVectorFromString(data));
+	if (!ex_sha) {
+		return expected::unexpected(ex_sha.error());
+	}
+	return ex_sha.value().String();
+}
+
+struct Fingerprint {
+	string digest;
+	string server_url;
+	// Digest of the tenant token, we don't want to store the token itself.
+	string tenant_token_digest;
+};
+
+static string FingerprintToJson(const Fingerprint &fingerprint) {
+	return R"({"digest":")" + json::EscapeString(fingerprint.digest) + R"(","server_url":")"
+		   + json::EscapeString(fingerprint.server_url) + R"(","tenant_token_digest":")"
+		   + json::EscapeString(fingerprint.tenant_token_digest) + R"("})";
+}
+
+static expected::expected<Fingerprint, error::Error> FingerprintFromJson(const string &str) {
+	auto ex_j = json::Load(str);
+	if (!ex_j) {
+		return expected::unexpected(ex_j.error());
+	}
+	Fingerprint ret;
+	auto ex_str = json::Get<string>(ex_j.value(), "digest", json::MissingOk::No);
+	if (!ex_str) {
+		return expected::unexpected(ex_str.error());
+	}
+	ret.digest = ex_str.value();
+	ex_str = json::Get<string>(ex_j.value(), "server_url", json::MissingOk::No);
+	if (!ex_str) {
+		return expected::unexpected(ex_str.error());
+	}
+	ret.server_url = ex_str.value();
+	ex_str = json::Get<string>(ex_j.value(), "tenant_token_digest", json::MissingOk::No);
+	if (!ex_str) {
+		return expected::unexpected(ex_str.error());
+	}
+	ret.tenant_token_digest = ex_str.value();
+	return ret;
+}
+
+error::Error PushInventoryData(
+	const string &inventory_generators_dir,
+	events::EventLoop &loop,
+	api::Client &client,
+	string &last_data_digest,
+	APIResponseHandler api_handler) {
+	auto ex_inv_data = CollectInventoryData(inventory_generators_dir);
+	if (!ex_inv_data) {
+		return ex_inv_data.error();
+	}
+
+	auto payload = MakeInventoryPayload(ex_inv_data.value());
+
+	auto ex_digest = DigestString(payload);
+	if (!ex_digest) {
+		return ex_digest.error();
+	}
+	auto payload_digest = ex_digest.value();
+	if (payload_digest == last_data_digest) {
+		log::Info("Inventory data unchanged, not submitting");
+		loop.Post([api_handler]() { api_handler(error::NoError); });
+		return error::NoError;
+	}
+
+	return SendInventoryRequest(
+		client,
+		http::Method::PUT,
+		payload,
+		[api_handler, payload_digest, &last_data_digest](error::Error err) {
+			if (err == error::NoError) {
+				last_data_digest = payload_digest;
+			}
+			api_handler(err);
+		});
+}
+
+error::Error PushInventoryData(
+	const string &inventory_generators_dir,
+	events::EventLoop &loop,
+	api::Client &client,
+	kv_db::KeyValueDatabase &db,
+	const SubmissionTarget &target,
+	chrono::seconds full_sync_interval,
+	APIResponseHandler api_handler) {
+	auto ex_inv_data = CollectInventoryData(inventory_generators_dir);
+	if (!ex_inv_data) {
+		return ex_inv_data.error();
+	}
+	auto &inv_data = ex_inv_data.value();
+
+	auto full_payload = MakeInventoryPayload(inv_data);
+
+	Fingerprint fingerprint;
+	fingerprint.server_url = target.server_url;
+	auto ex_digest = DigestString(full_payload);
+	if (!ex_digest) {
+		return ex_digest.error();
+	}
+	fingerprint.digest = ex_digest.value();
+	if (target.tenant_token != "") {
+		ex_digest = DigestString(target.tenant_token);
+		if (!ex_digest) {
+			return ex_digest.error();
+		}
+		fingerprint.tenant_token_digest = ex_digest.value();
+	}
+
+	string stored_payload;
+	string stored_fingerprint_str;
+	string last_full_sync_str;
+	auto err = db.ReadTransaction(
+		[&stored_payload, &stored_fingerprint_str, &last_full_sync_str](kv_db::Transaction &txn) {
+			auto err = kv_db::ReadString(txn, kInventoryDataKey, stored_payload, true);
+			if (err != error::NoError) {
+				return err;
+			}
+			err = kv_db::ReadString(txn, kInventoryFingerprintKey, stored_fingerprint_str, true);
+			if (err != error::NoError) {
+				return err;
+			}
+			return kv_db::ReadString(txn, kInventoryLastFullSyncKey, last_full_sync_str, true);
+		});
+	if (err != error::NoError) {
+		log::Warning("Could not load previously submitted inventory data: " + err.String());
+		stored_payload.clear();
+	}
+
+	auto now =
+		chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch());
+
+	bool full_sync = stored_payload.empty();
+	bool unchanged = false;
+	if (not full_sync) {
+		auto ex_stored_fingerprint = FingerprintFromJson(stored_fingerprint_str);
+		if (!ex_stored_fingerprint) {
+			log::Debug("No valid fingerprint for previously submitted inventory data");
+			full_sync = true;
+		} else if (
+			ex_stored_fingerprint.value().server_url != fingerprint.server_url
+			or ex_stored_fingerprint.value().tenant_token_digest
+				   != fingerprint.tenant_token_digest) {
+			log::Info(
+				"Server or tenant has changed since the last inventory submission, submitting everything");
+			full_sync = true;
+		} else {
+			// Compare the digest first, so that we can avoid parsing the stored data in the
+			// common case where nothing has changed.
+			unchanged = ex_stored_fingerprint.value().digest == fingerprint.digest;
+		}
+	}
+
+	InventoryDiff diff;
+	if (not full_sync and not unchanged) {
+		auto ex_previous = ParseInventoryPayload(stored_payload);
+		if (!ex_previous) {
+			log::Warning(
+				"Previously submitted inventory data is invalid, submitting everything: "
+				+ ex_previous.error().String());
+			full_sync = true;
+		} else {
+			diff = DiffInventoryData(ex_previous.value(), inv_data);
+			if (diff.removed.size() > 0) {
+				log::Debug("Inventory attributes have been removed, submitting everything");
+				full_sync = true;
+			}
+			unchanged = diff.changed.empty() and diff.removed.empty();
+		}
+	}
+	if (not full_sync and full_sync_interval > chrono::seconds::zero()) {
+		auto ex_last_full_sync = common::StringTo<int64_t>(last_full_sync_str);
+		// Also resync if the clock has gone backwards.
+		if (!ex_last_full_sync or now < chrono::seconds(ex_last_full_sync.value())
+			or now - chrono::seconds(ex_last_full_sync.value()) >= full_sync_interval) {
+			log::Debug("Periodic full inventory submission is due");
+			full_sync = true;
+		}
+	}
+
+	if (not full_sync and unchanged) {
+		log::Info("Inventory data unchanged, not submitting");
+		loop.Post([api_handler]() { api_handler(error::NoError); });
+		return error::NoError;
+	}
+
+	http::Method method;
+	string payload;
+	if (full_sync) {
+		method = http::Method::PUT;
+		payload = full_payload;
+	} else {
+		log::Debug(
+			"Submitting " + to_string(diff.changed.size()) + " changed inventory attribute(s)");
+		method = http::Method::PATCH;
+		payload = MakeInventoryPayload(diff.changed);
+	}
+
+	// Note: On failure we keep the previous data. Both PUT and PATCH are idempotent, so
+	// whatever the server managed to apply will simply be sent again next time.
+	return SendInventoryRequest(
+		client,
+		method,
+		payload,
+		[api_handler, &db, full_payload, fingerprint, full_sync, now](error::Error err) {
+			if (err != error::NoError) {
+				api_handler(err);
+				return;
+			}
+
+			// If this is lost, the data is just sent again.
+			err = db.WriteTransactionDeferredSync(
+				[&full_payload, &fingerprint, full_sync, now](kv_db::Transaction &txn) {
+					auto err =
+						txn.Write(kInventoryDataKey, common::ByteVectorFromString(full_payload));
+					if (err != error::NoError) {
+						return err;
+					}
+					err = txn.Write(
+						kInventoryFingerprintKey,
+						common::ByteVectorFromString(FingerprintToJson(fingerprint)));
+					if (err != error::NoError or not full_sync) {
+						return err;
+					}
+					return txn.Write(
+						kInventoryLastFullSyncKey,
+						common::ByteVectorFromString(to_string(now.count())));
+				});
+			if (err != error::NoError) {
+				log::Error("Could not store submitted inventory data: " + err.String());
+				// Make sure we don't compare against stale data next time.
+				err = ClearInventoryData(db);
+				if (err != error::NoError) {
+					log::Error("Could not clear stored inventory data: " + err.String());
+				}
+			}
+			api_handler(error::NoError);
+		});
+}
+
+error::Error ClearInventoryData(kv_db::KeyValueDatabase &db) {
+	return db.WriteTransaction(
+		[](kv_db::Transaction &txn) { return kv_db::RemovePrefix(txn, kInventoryKeyPrefix); });
+}
+
+void InventoryClient::ClearDataCache() {
+	auto err = ClearInventoryData(db_);
+	if (err != error::NoError) {
+		log::Error("Could not clear stored inventory data: " + err.String());
+	}
+}
+
 } // namespace inventory
 } // namespace update
 } // namespace mender
@@ -15,7 +15,9 @@
 #ifndef MENDER_UPDATE_INVENTORY_HPP
 #define MENDER_UPDATE_INVENTORY_HPP
 
+#include <chrono>
 #include <string>
+#include <vector>
 
 #include <api/client.hpp>
 #include <common/error.hpp>
@@ -23,6 +25,8 @@
 #include <common/expected.hpp>
 #include <common/http.hpp>
 #include <common/json.hpp>
+#include <common/key_value_database.hpp>
+#include <common/key_value_parser.hpp>
 #include <common/optional.hpp>
 
 namespace mender {
@@ -36,6 +40,8 @@ namespace error = mender::common::error;
 namespace events = mender::common::events;
 namespace expected = mender::common::expected;
 namespace json = mender::common::json;
+namespace kv_db = mender::common::key_value_database;
+namespace kvp = mender::common::key_value_parser;
 
 enum InventoryErrorCode {
 	NoError = 0,
@@ -53,13 +59,63 @@ error::Error MakeError(InventoryErrorCode code, const string &msg);
 using APIResponse = error::Error;
 using APIResponseHandler = function<void(APIResponse)>;
 
+// Database key holding the inventory most recently acknowledged by the server, in the same format
+// as the payload that is sent to it.
+extern const string kInventoryDataKey;
+// Database key holding the time of the last full (PUT) inventory submission, in seconds since the
+// epoch.
+extern const string kInventoryLastFullSyncKey;
+// Database key holding the fingerprint of the data under kInventoryDataKey: The SHA256 digest of the
+// payload, and where it was submitted to.
+extern const string kInventoryFingerprintKey;
+
+// Where the inventory is submitted to. The stored inventory is only used for comparison as long as
+// this stays the same.
+struct SubmissionTarget {
+	string server_url;
+	string tenant_token;
+};
+
+// Serializes the given attributes into the JSON array format expected by the inventory API,
+// sorted by attribute name.
+string MakeInventoryPayload(const kvp::KeyValuesMap &inv_data);
+// The inverse of MakeInventoryPayload().
+kvp::ExpectedKeyValuesMap ParseInventoryPayload(const string &payload);
+
+struct InventoryDiff {
+	// Attributes which are new or have a different value.
+	kvp::KeyValuesMap changed;
+	// Attributes which are no longer present.
+	vector<string> removed;
+};
+
+InventoryDiff DiffInventoryData(const kvp::KeyValuesMap &previous, const kvp::KeyValuesMap &current);
+
+// `last_data_digest` is the hex encoded SHA256 digest of the last successfully submitted payload.
 error::Error PushInventoryData(
 	const string &inventory_generators_dir,
 	events::EventLoop &loop,
 	api::Client &client,
-	size_t &last_data_hash,
+	string &last_data_digest,
 	APIResponseHandler api_handler);
 
+// Submits only the attributes which changed since the last acknowledged submission stored in
+// `db`, using PATCH. A full PUT is done instead if nothing has been stored yet, if the stored data
+// was submitted to a different `target`, if attributes have been removed (PATCH can't remove
+// them), or if `full_sync_interval` has passed since the last full submission. A zero interval
+// disables the periodic full submission.
+error::Error PushInventoryData(
+	const string &inventory_generators_dir,
+	events::EventLoop &loop,
+	api::Client &client,
+	kv_db::KeyValueDatabase &db,
+	const SubmissionTarget &target,
+	chrono::seconds full_sync_interval,
+	APIResponseHandler api_handler);
+
+// Forgets the stored inventory, so that the next submission is a full one.
+error::Error ClearInventoryData(kv_db::KeyValueDatabase &db);
+
 class InventoryAPI {
 public:
 	virtual ~InventoryAPI() {
@@ -78,21 +134,36 @@ public:
 
 class InventoryClient : public InventoryAPI {
 public:
+	InventoryClient(
+		kv_db::KeyValueDatabase &db,
+		const SubmissionTarget &target,
+		chrono::seconds full_sync_interval) :
+		db_ {db},
+		target_ {target},
+		full_sync_interval_ {full_sync_interval} {
+	}
+
 	error::Error PushData(
 		const string &inventory_generators_dir,
 		events::EventLoop &loop,
 		api::Client &client,
 		APIResponseHandler api_handler) override {
 		return PushInventoryData(
-			inventory_generators_dir, loop, client, last_data_hash_, api_handler);
+			inventory_generators_dir,
+			loop,
+			client,
+			db_,
+			target_,
+			full_sync_interval_,
+			api_handler);
 	};
 
-	void ClearDataCache() override {
-		last_data_hash_ = 0;
-	}
+	void ClearDataCache() override;
 
 private:
-	size_t last_data_hash_ {0};
+	kv_db::KeyValueDatabase &db_;
+	SubmissionTarget target_;
+	chrono::seconds full_sync_interval_;
 };
 
 } // namespace inventory
@@ -0,0 +1,496 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/rootfs_writer/rootfs_writer.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <artifact/sha/sha.hpp>
+
+#include <common/log.hpp>
+
+namespace mender {
+namespace update {
+namespace rootfs_writer {
+
+namespace log = mender::common::log;
+namespace sha = mender::sha;
+
+// Large enough that the device only sees big sequential writes, and a multiple of any sector size.
+const size_t kBufferSize = 1024 * 1024;
+const size_t kDefaultAlignment = 4096;
+
+error::Error Writer::MakeErrnoError(int errnum, const string &what) {
+	return error::Error(
+		generic_category().default_error_condition(errnum),
+		what + " " + path_ + ": " + strerror(errnum));
+}
+
+expected::Expected<unique_ptr<Writer>> Writer::Open(
+	const string &path,
+	int64_t size,
+	const config_parser::RootfsImageWriter &config,
+	int64_t resume_offset,
+	CheckpointHandler checkpoint_handler) {
+	bool direct = config.direct_io;
+	int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC | (direct ? O_DIRECT : 0));
+	if (fd < 0 and direct and errno == EINVAL) {
+		log::Info(path + " does not support direct I/O, writing through the page cache");
+		direct = false;
+		fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	}
+	if (fd < 0) {
+		int errnum = errno;
+		return expected::unexpected(error::Error(
+			generic_category().default_error_condition(errnum),
+			"Could not open " + path + ": " + strerror(errnum)));
+	}
+
+	unique_ptr<Writer> writer {new Writer(path, fd, direct, kDefaultAlignment, size, config)};
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		return expected::unexpected(writer->MakeErrnoError(errno, "Could not stat"));
+	}
+	writer->block_device_ = S_ISBLK(st.st_mode);
+	if (writer->block_device_) {
+		uint64_t device_size;
+		if (ioctl(fd, BLKGETSIZE64, &device_size) != 0) {
+			return expected::unexpected(writer->MakeErrnoError(errno, "Could not get size of"));
+		}
+		if (static_cast<uint64_t>(size) > device_size) {
+			return expected::unexpected(error::Error(
+				make_error_condition(errc::no_space_on_device),
+				"Payload of " + to_string(size) + " bytes does not fit on " + path + " ("
+					+ to_string(device_size) + " bytes)"));
+		}
+		int sector_size;
+		if (ioctl(fd, BLKSSZGET, &sector_size) == 0 and sector_size > 0) {
+			writer->alignment_ = max(writer->alignment_, static_cast<size_t>(sector_size));
+		}
+	}
+
+	void *buffer;
+	int result = posix_memalign(&buffer, writer->alignment_, kBufferSize);
+	if (result != 0) {
+		return expected::unexpected(writer->MakeErrnoError(result, "Could not allocate buffer for"));
+	}
+	writer->buffer_.reset(static_cast<uint8_t *>(buffer));
+
+	if (resume_offset < 0 or resume_offset > size
+		or resume_offset % static_cast<int64_t>(writer->alignment_) != 0) {
+		log::Warning(
+			"Ignoring invalid checkpoint at byte " + to_string(resume_offset)
+			+ ", writing the whole payload");
+		resume_offset = 0;
+	} else if (resume_offset > 0) {
+		log::Info(
+			"Continuing from checkpoint: The first " + to_string(resume_offset)
+			+ " bytes are already on " + path);
+	}
+	writer->resume_offset_ = resume_offset;
+	writer->flushing_ = writer->synced_ = writer->checkpointed_ = resume_offset;
+	writer->checkpoint_handler_ = checkpoint_handler;
+
+	return writer;
+}
+
+Writer::Writer(
+	const string &path,
+	int fd,
+	bool direct,
+	size_t alignment,
+	int64_t size,
+	const config_parser::RootfsImageWriter &config) :
+	path_ {path},
+	fd_ {fd},
+	direct_ {direct},
+	alignment_ {alignment},
+	size_ {size},
+	config_ {config} {
+}
+
+Writer::~Writer() {
+	if (fd_ >= 0) {
+		close(fd_);
+	}
+}
+
+expected::ExpectedSize Writer::Write(
+	vector<uint8_t>::const_iterator start, vector<uint8_t>::const_iterator end) {
+	if (fd_ < 0) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::bad_file_descriptor), path_ + " is already finished"));
+	}
+	if (written_ + static_cast<int64_t>(buffered_) + (end - start) > size_) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::file_too_large),
+			"Payload is larger than the " + to_string(size_) + " bytes it was declared with"));
+	}
+
+	auto remaining = start;
+	if (written_ < resume_offset_) {
+		// Already on the device.
+		auto n = min<int64_t>(end - remaining, resume_offset_ - written_);
+		remaining += n;
+		written_ += n;
+	}
+	while (remaining != end) {
+		auto n = min(static_cast<size_t>(end - remaining), kBufferSize - buffered_);
+		copy(remaining, remaining + n, buffer_.get() + buffered_);
+		buffered_ += n;
+		remaining += n;
+		if (buffered_ == kBufferSize) {
+			auto err = WriteOut(buffered_);
+			if (err != error::NoError) {
+				return expected::unexpected(err);
+			}
+			buffered_ = 0;
+		}
+	}
+	return end - start;
+}
+
+// glibc's memcmp() is vectorized for all the architectures we run on, so comparing the block with
+// itself shifted by one byte is as fast as a hand written SIMD loop, without being tied to one.
+static bool IsZero(const uint8_t *data, size_t length) {
+	return length > 0 and data[0] == 0 and memcmp(data, data + 1, length - 1) == 0;
+}
+
+// Only whole blocks are skipped, so that everything stays aligned for O_DIRECT.
+bool Writer::IsZeroBlock(size_t offset, size_t length) {
+	return config_.skip_zero_blocks and length - offset >= alignment_
+		   and IsZero(buffer_.get() + offset, alignment_);
+}
+
+error::Error Writer::WriteOut(size_t length) {
+	size_t pos = 0;
+	while (pos < length) {
+		auto start = pos;
+		while (pos < length and not IsZeroBlock(pos, length)) {
+			pos = min(pos + alignment_, length);
+		}
+		auto err = WriteRange(start, pos);
+		if (err != error::NoError) {
+			return err;
+		}
+
+		start = pos;
+		while (pos < length and IsZeroBlock(pos, length)) {
+			pos += alignment_;
+		}
+		err = SkipRange(start, pos);
+		if (err != error::NoError) {
+			return err;
+		}
+	}
+
+	if (config_.sync_interval_bytes > 0 and written_ - flushing_ >= config_.sync_interval_bytes) {
+		auto err = SyncWindow();
+		if (err != error::NoError) {
+			return err;
+		}
+	}
+	if (checkpoint_handler_ and config_.checkpoint_interval_bytes > 0
+		and written_ - checkpointed_ >= config_.checkpoint_interval_bytes) {
+		return SaveCheckpoint();
+	}
+	return error::NoError;
+}
+
+error::Error Writer::SaveCheckpoint() {
+	// The checkpoint must never be stored before the data it refers to is on the device, also
+	// not in the device's write cache.
+	if (fdatasync(fd_) != 0) {
+		return MakeErrnoError(errno, "Could not sync");
+	}
+	auto err = checkpoint_handler_(written_);
+	if (err != error::NoError) {
+		return err.WithContext("Could not store checkpoint");
+	}
+	checkpointed_ = written_;
+	log::Debug([this]() {
+		return "Stored checkpoint at byte " + to_string(written_) + " of " + path_;
+	});
+	return error::NoError;
+}
+
+error::Error Writer::WriteRange(size_t start, size_t end) {
+	while (start < end) {
+		auto n = pwrite(fd_, buffer_.get() + start, end - start, written_);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return MakeErrnoError(errno, "Could not write to");
+		}
+		start += static_cast<size_t>(n);
+		written_ += n;
+	}
+	return error::NoError;
+}
+
+error::Error Writer::SkipRange(size_t start, size_t end) {
+	if (start == end) {
+		return error::NoError;
+	}
+	auto length = static_cast<int64_t>(end - start);
+
+	if (!config_.target_pre_discarded and zero_out_supported_) {
+		// The old contents still need to go. Let the device do it, which with most eMMC and
+		// SSDs means just unmapping the blocks.
+		int result;
+		if (block_device_) {
+			uint64_t range[2] {static_cast<uint64_t>(written_), static_cast<uint64_t>(length)};
+			result = ioctl(fd_, BLKZEROOUT, range);
+		} else {
+			result = fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, written_, length);
+		}
+		if (result != 0) {
+			if (errno != EOPNOTSUPP and errno != ENOTTY and errno != EINVAL) {
+				return MakeErrnoError(errno, "Could not zero out blocks on");
+			}
+			log::Info(path_ + " does not support zeroing out blocks, writing them instead");
+			zero_out_supported_ = false;
+		}
+	}
+	if (!config_.target_pre_discarded and !zero_out_supported_) {
+		return WriteRange(start, end);
+	}
+
+	written_ += length;
+	skipped_ += length;
+	return error::NoError;
+}
+
+error::Error Writer::SyncWindow() {
+	if (direct_) {
+		// The data is already on its way to the device, but the device may cache it, so flush
+		// it regularly, rather than all at once at the end.
+		if (fdatasync(fd_) != 0) {
+			return MakeErrnoError(errno, "Could not sync");
+		}
+		flushing_ = synced_ = written_;
+		return error::NoError;
+	}
+
+	// Write-behind: Start writeback of the current window without waiting for it, and then wait
+	// for the previous window, which by now is most likely done, and drop it from the page
+	// cache. This keeps the amount of dirty data at around two windows, instead of whatever the
+	// kernel's dirty limits allow, and the device is kept busy all the time.
+	if (sync_file_range(fd_, flushing_, written_ - flushing_, SYNC_FILE_RANGE_WRITE) != 0) {
+		return MakeErrnoError(errno, "Could not start writeback of");
+	}
+	if (synced_ < flushing_) {
+		if (sync_file_range(
+				fd_,
+				synced_,
+				flushing_ - synced_,
+				SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER)
+			!= 0) {
+			return MakeErrnoError(errno, "Could not wait for writeback of");
+		}
+		posix_fadvise(fd_, synced_, flushing_ - synced_, POSIX_FADV_DONTNEED);
+		synced_ = flushing_;
+	}
+	flushing_ = written_;
+	return error::NoError;
+}
+
+error::Error Writer::Finish(const string &checksum) {
+	if (fd_ < 0) {
+		return error::Error(
+			make_error_condition(errc::bad_file_descriptor), path_ + " is already finished");
+	}
+
+	if (buffered_ > 0) {
+		auto tail = buffered_ % alignment_;
+		if (direct_ and tail != 0) {
+			// O_DIRECT can only write whole sectors, so write the last, partial one through
+			// the page cache.
+			auto err = WriteOut(buffered_ - tail);
+			if (err != error::NoError) {
+				return err;
+			}
+			int flags = fcntl(fd_, F_GETFL);
+			if (flags < 0 or fcntl(fd_, F_SETFL, flags & ~O_DIRECT) != 0) {
+				return MakeErrnoError(errno, "Could not disable direct I/O for");
+			}
+			memmove(buffer_.get(), buffer_.get() + buffered_ - tail, tail);
+			buffered_ = tail;
+		}
+		auto err = WriteOut(buffered_);
+		if (err != error::NoError) {
+			return err;
+		}
+		buffered_ = 0;
+	}
+
+	if (written_ != size_) {
+		return error::Error(
+			make_error_condition(errc::io_error),
+			"Payload ended after " + to_string(written_) + " bytes, expected "
+				+ to_string(size_));
+	}
+
+	if (!block_device_) {
+		// If the payload ended with zero blocks which were skipped, the file may still be too
+		// short.
+		struct stat st;
+		if (fstat(fd_, &st) != 0) {
+			return MakeErrnoError(errno, "Could not stat");
+		}
+		if (st.st_size < written_ and ftruncate(fd_, written_) != 0) {
+			return MakeErrnoError(errno, "Could not extend");
+		}
+	}
+
+	if (fsync(fd_) != 0) {
+		return MakeErrnoError(errno, "Could not sync");
+	}
+	if (!direct_) {
+		posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+	}
+	int fd = fd_;
+	fd_ = -1;
+	if (close(fd) != 0) {
+		return MakeErrnoError(errno, "Could not close");
+	}
+	log::Debug("Wrote and synced " + to_string(written_) + " bytes to " + path_);
+	if (skipped_ > 0) {
+		log::Info(
+			"Skipped writing " + to_string(skipped_) + " of " + to_string(written_)
+			+ " bytes, which were all zeros");
+	}
+
+	if (!config_.verify) {
+		return error::NoError;
+	}
+	return Verify(checksum);
+}
+
+namespace {
+
+// Reads back the first `size` bytes of the device, bypassing the page cache where possible, so
+// that what is compared is what is actually stored, and not what we wrote a moment ago.
+class DeviceReader : virtual public io::Reader {
+public:
+	DeviceReader(int fd, bool direct, uint8_t *buffer, size_t buffer_size, int64_t size) :
+		fd_ {fd},
+		direct_ {direct},
+		buffer_ {buffer},
+		buffer_size_ {buffer_size},
+		size_ {size} {
+	}
+
+	expected::ExpectedSize Read(
+		vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) override {
+		if (available_ == 0) {
+			if (offset_ >= size_) {
+				return 0;
+			}
+			ssize_t n;
+			do {
+				// Always read whole buffers, since O_DIRECT requires aligned sizes.
+				n = pread(fd_, buffer_, buffer_size_, offset_);
+			} while (n < 0 and errno == EINTR);
+			if (n < 0) {
+				int errnum = errno;
+				return expected::unexpected(error::Error(
+					generic_category().default_error_condition(errnum),
+					string("Could not read back written data: ") + strerror(errnum)));
+			} else if (n == 0) {
+				return expected::unexpected(error::Error(
+					make_error_condition(errc::io_error),
+					"Unexpected end of device while reading back written data"));
+			}
+			if (!direct_) {
+				posix_fadvise(fd_, offset_, n, POSIX_FADV_DONTNEED);
+			}
+			consumed_ = 0;
+			available_ = static_cast<size_t>(min<int64_t>(n, size_ - offset_));
+			offset_ += static_cast<int64_t>(available_);
+		}
+		auto n = min(static_cast<size_t>(end - start), available_);
+		copy(buffer_ + consumed_, buffer_ + consumed_ + n, start);
+		consumed_ += n;
+		available_ -= n;
+		return n;
+	}
+
+private:
+	int fd_;
+	bool direct_;
+	uint8_t *buffer_;
+	size_t buffer_size_;
+	int64_t size_;
+	int64_t offset_ {0};
+	size_t consumed_ {0};
+	size_t available_ {0};
+};
+
+} // namespace
+
+error::Error Writer::Verify(const string &checksum) {
+	if (checksum.empty()) {
+		log::Warning("No checksum to verify the contents of " + path_ + " against");
+		return error::NoError;
+	}
+
+	bool direct = direct_;
+	int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC | (direct ? O_DIRECT : 0));
+	if (fd < 0 and direct and errno == EINVAL) {
+		direct = false;
+		fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+	}
+	if (fd < 0) {
+		return MakeErrnoError(errno, "Could not open for verification");
+	}
+	if (!direct) {
+		// Drop anything left from writing, so that it has to be read from the device.
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	}
+
+	DeviceReader device_reader(fd, direct, buffer_.get(), kBufferSize, size_);
+	sha::Reader sha_reader(device_reader, checksum);
+	vector<uint8_t> buf(kBufferSize);
+	error::Error err;
+	while (true) {
+		auto result = sha_reader.Read(buf.begin(), buf.end());
+		if (!result) {
+			err = result.error().WithContext("Verification of " + path_ + " failed");
+			break;
+		} else if (result.value() == 0) {
+			break;
+		}
+	}
+	close(fd);
+
+	if (err == error::NoError) {
+		log::Info("Verified the contents of " + path_);
+	}
+	return err;
+}
+
+} // namespace rootfs_writer
+} // namespace update
+} // namespace mender
@@ -0,0 +1,273 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/rootfs_writer/rootfs_writer.hpp>
+
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include <common/common.hpp>
+#include <common/json.hpp>
+#include <common/log.hpp>
+#include <common/path.hpp>
+#include <common/processes.hpp>
+
+namespace mender {
+namespace update {
+namespace rootfs_writer {
+
+namespace common = mender::common;
+namespace json = mender::common::json;
+namespace log = mender::common::log;
+namespace path = mender::common::path;
+namespace procs = mender::common::processes;
+
+const string kCheckpointKey {"rootfs-image-writer-checkpoint"};
+
+const string kGrubEnvPrintTool {"grub-mender-grubenv-print"};
+const string kUbootEnvPrintTool {"fw_printenv"};
+
+bool Checkpoint::Matches(const string &partition, const string &checksum, int64_t size) const {
+	return this->partition == partition and not checksum.empty() and this->checksum == checksum
+		   and this->size == size;
+}
+
+string CheckpointToJson(const Checkpoint &checkpoint) {
+	stringstream content;
+	content << "{";
+	content << R"("Partition":")" << json::EscapeString(checkpoint.partition) << R"(",)";
+	content << R"("Checksum":")" << json::EscapeString(checkpoint.checksum) << R"(",)";
+	content << R"("Size":)" << checkpoint.size << ",";
+	content << R"("Offset":)" << checkpoint.offset;
+	content << "}";
+	return content.str();
+}
+
+expected::Expected<Checkpoint> CheckpointFromJson(const string &data) {
+	auto exp_json = json::Load(data);
+	if (!exp_json) {
+		return expected::unexpected(exp_json.error().WithContext("Invalid checkpoint"));
+	}
+	auto &checkpoint_json = exp_json.value();
+
+	Checkpoint checkpoint;
+	auto exp_string = json::Get<string>(checkpoint_json, "Partition", json::MissingOk::No);
+	if (!exp_string) {
+		return expected::unexpected(exp_string.error().WithContext("Invalid checkpoint"));
+	}
+	checkpoint.partition = exp_string.value();
+	exp_string = json::Get<string>(checkpoint_json, "Checksum", json::MissingOk::No);
+	if (!exp_string) {
+		return expected::unexpected(exp_string.error().WithContext("Invalid checkpoint"));
+	}
+	checkpoint.checksum = exp_string.value();
+	auto exp_int = json::Get<int64_t>(checkpoint_json, "Size", json::MissingOk::No);
+	if (!exp_int) {
+		return expected::unexpected(exp_int.error().WithContext("Invalid checkpoint"));
+	}
+	checkpoint.size = exp_int.value();
+	exp_int = json::Get<int64_t>(checkpoint_json, "Offset", json::MissingOk::No);
+	if (!exp_int) {
+		return expected::unexpected(exp_int.error().WithContext("Invalid checkpoint"));
+	}
+	checkpoint.offset = exp_int.value();
+
+	return checkpoint;
+}
+
+bool IsUbiVolume(const string &device) {
+	return common::StartsWith<string>(device, "/dev/ubi")
+		   or common::StartsWith<string>(device, "ubi");
+}
+
+// Same as `resolve_rootfs` in the rootfs-image Update Module: Only these symlinks are resolved,
+// any other path is used as it is.
+static string ResolveDevice(string device) {
+	if (common::StartsWith<string>(device, "ubi")) {
+		// The kernel only accepts UBI volumes without `/dev/`, but all the tools want it.
+		device = "/dev/" + device;
+	}
+	if (device != "/dev/root" and not common::StartsWith<string>(device, "/dev/disk/by-partlabel/")
+		and not common::StartsWith<string>(device, "/dev/disk/by-partuuid/")) {
+		return device;
+	}
+	char resolved[PATH_MAX];
+	if (realpath(device.c_str(), resolved) == nullptr) {
+		return device;
+	}
+	return resolved;
+}
+
+static bool IsInPath(const string &program) {
+	auto path_env = getenv("PATH");
+	if (path_env == nullptr) {
+		return false;
+	}
+	for (const auto &dir : common::SplitString(path_env, ":")) {
+		if (!dir.empty() and path::FileExists(path::Join(dir, program))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static expected::ExpectedLongLong PartitionNumber(const string &device) {
+	auto pos = device.find_last_not_of("0123456789");
+	if (pos == string::npos or pos + 1 == device.size()) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::invalid_argument),
+			"Could not determine partition number of " + device));
+	}
+	return common::StringToLongLong(device.substr(pos + 1));
+}
+
+static expected::ExpectedString ReadBootEnv(const string &name) {
+	auto tool = IsInPath(kGrubEnvPrintTool) ? kGrubEnvPrintTool : kUbootEnvPrintTool;
+	procs::Process proc({tool, name});
+	auto exp_lines = proc.GenerateLineData();
+	if (!exp_lines) {
+		return expected::unexpected(
+			exp_lines.error().WithContext("Could not read `" + name + "` from boot environment"));
+	}
+	auto &lines = exp_lines.value();
+	auto prefix = name + "=";
+	if (lines.size() != 1 or not common::StartsWith(lines[0], prefix)) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::protocol_error),
+			"Unexpected output from " + tool + " when reading `" + name + "`"));
+	}
+	return lines[0].substr(prefix.size());
+}
+
+static expected::ExpectedString KernelRootArgument() {
+	ifstream cmdline("/proc/cmdline");
+	string arg;
+	while (cmdline >> arg) {
+		if (common::StartsWith<string>(arg, "root=")) {
+			return arg.substr(5);
+		}
+	}
+	return expected::unexpected(error::Error(
+		make_error_condition(errc::no_such_device), "No root= argument in /proc/cmdline"));
+}
+
+static error::Error CheckMountedRoot(const string &active) {
+	struct stat device_stat;
+	struct stat root_stat;
+	if (stat(active.c_str(), &device_stat) == 0 and stat("/", &root_stat) == 0
+		and S_ISBLK(device_stat.st_mode) and device_stat.st_rdev == root_stat.st_dev) {
+		return error::NoError;
+	}
+
+	// The root filesystem may not be mounted directly from the device, for instance if it is
+	// read-only and has an overlay on top. Check what the kernel was told to mount instead.
+	auto exp_root = KernelRootArgument();
+	if (exp_root) {
+		auto root = exp_root.value();
+		if (not common::StartsWith<string>(root, "/")) {
+			// UUID=, PARTUUID=, etc.
+			procs::Process findfs({"findfs", root});
+			auto exp_lines = findfs.GenerateLineData();
+			if (exp_lines and exp_lines.value().size() == 1) {
+				root = exp_lines.value()[0];
+			}
+		}
+		if (root == active) {
+			return error::NoError;
+		}
+	}
+
+	return error::Error(
+		make_error_condition(errc::device_or_resource_busy),
+		"Mounted root does not match boot loader environment (" + active
+			+ "). Refusing to write to the inactive partition");
+}
+
+expected::ExpectedString GetInactivePartition(const conf::MenderConfig &config) {
+	if (config.rootfs_part_A.empty() or config.rootfs_part_B.empty()) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::invalid_argument),
+			"RootfsPartA and RootfsPartB must be set in the configuration to use the built-in "
+			"rootfs-image writer"));
+	}
+
+	auto part_a = ResolveDevice(config.rootfs_part_A);
+	auto part_b = ResolveDevice(config.rootfs_part_B);
+	if (IsUbiVolume(part_a) or IsUbiVolume(part_b)) {
+		// These are written by the Update Module, and neither the partition numbers nor the
+		// mounted root check below work for them.
+		return IsUbiVolume(part_a) ? part_a : part_b;
+	}
+
+	auto exp_num_a = PartitionNumber(part_a);
+	if (!exp_num_a) {
+		return expected::unexpected(exp_num_a.error());
+	}
+	auto exp_num_b = PartitionNumber(part_b);
+	if (!exp_num_b) {
+		return expected::unexpected(exp_num_b.error());
+	}
+
+	auto exp_boot_part = ReadBootEnv("mender_boot_part");
+	if (!exp_boot_part) {
+		return expected::unexpected(exp_boot_part.error());
+	}
+	auto exp_active_num = common::StringToLongLong(exp_boot_part.value());
+	if (!exp_active_num) {
+		return expected::unexpected(
+			exp_active_num.error().WithContext("Invalid mender_boot_part in boot environment"));
+	}
+
+	auto exp_upgrade_available = ReadBootEnv("upgrade_available");
+	if (!exp_upgrade_available) {
+		return expected::unexpected(exp_upgrade_available.error());
+	}
+	if (exp_upgrade_available.value() != "0") {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::operation_in_progress),
+			"Unexpected `upgrade_available=" + exp_upgrade_available.value()
+				+ "` in boot environment. Is another update in progress?"));
+	}
+
+	string active;
+	string inactive;
+	if (exp_active_num.value() == exp_num_a.value()) {
+		active = part_a;
+		inactive = part_b;
+	} else if (exp_active_num.value() == exp_num_b.value()) {
+		active = part_b;
+		inactive = part_a;
+	} else {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::invalid_argument),
+			"mender_boot_part=" + exp_boot_part.value() + " matches neither " + part_a + " nor "
+				+ part_b));
+	}
+
+	auto err = CheckMountedRoot(active);
+	if (err != error::NoError) {
+		return expected::unexpected(err);
+	}
+
+	log::Debug("Active partition: " + active + ", inactive partition: " + inactive);
+	return inactive;
+}
+
+} // namespace rootfs_writer
+} // namespace update
+} // namespace mender
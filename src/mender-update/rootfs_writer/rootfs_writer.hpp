@@ -0,0 +1,154 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#ifndef MENDER_UPDATE_ROOTFS_WRITER_HPP
+#define MENDER_UPDATE_ROOTFS_WRITER_HPP
+
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <client_shared/conf.hpp>
+#include <common/error.hpp>
+#include <common/expected.hpp>
+#include <common/io.hpp>
+
+namespace mender {
+namespace update {
+namespace rootfs_writer {
+
+using namespace std;
+
+namespace conf = mender::client_shared::conf;
+namespace config_parser = mender::client_shared::config_parser;
+namespace error = mender::common::error;
+namespace expected = mender::common::expected;
+namespace io = mender::common::io;
+
+// Finds the partition a rootfs-image payload should be written to, the same way the rootfs-image
+// Update Module does: out of `RootfsPartA` and `RootfsPartB`, the one the boot loader is not
+// booting. Also makes sure that the boot loader agrees with what is actually mounted as root, and
+// that no update is already pending, so that we never write to the running system.
+expected::ExpectedString GetInactivePartition(const conf::MenderConfig &config);
+
+// Database key for the checkpoint of an interrupted write.
+extern const string kCheckpointKey;
+
+// Records how much of a payload is known to be on the device. If the same payload is written to
+// the same partition again, the writer can continue from `offset`. The whole payload still needs
+// to be fed to the writer, since the artifact has to be parsed and verified from the start
+// anyway, but the data before `offset` is not written again.
+struct Checkpoint {
+	string partition;
+	string checksum;
+	int64_t size {0};
+	int64_t offset {0};
+
+	bool Matches(const string &partition, const string &checksum, int64_t size) const;
+};
+
+string CheckpointToJson(const Checkpoint &checkpoint);
+expected::Expected<Checkpoint> CheckpointFromJson(const string &data);
+
+// UBI volumes need to be written with the UBI_IOCVOLUP ioctl, which the writer doesn't support.
+bool IsUbiVolume(const string &device);
+
+// Writes a payload to a block device, or a regular file, without filling the page cache with
+// data that will never be read again. See `config_parser::RootfsImageWriter` for the options.
+//
+// All the methods block until the device has caught up, which can take seconds on slow storage,
+// so from an event loop they should be called through `events::io::AsyncRunBlocking`. The
+// `CheckpointHandler` is called from the same thread as `Write`.
+class Writer : virtual public io::Writer {
+public:
+	// Called with the offset up to which the data has been synced to the device, at most every
+	// `checkpoint_interval_bytes`.
+	using CheckpointHandler = function<error::Error(int64_t offset)>;
+
+	// If `resume_offset` is non-zero, data before it is assumed to be on the device already, and
+	// is skipped. It must be a value which has been passed to a `CheckpointHandler`.
+	static expected::Expected<unique_ptr<Writer>> Open(
+		const string &path,
+		int64_t size,
+		const config_parser::RootfsImageWriter &config,
+		int64_t resume_offset = 0,
+		CheckpointHandler checkpoint_handler = nullptr);
+	~Writer();
+
+	expected::ExpectedSize Write(
+		vector<uint8_t>::const_iterator start, vector<uint8_t>::const_iterator end) override;
+
+	// Writes out what remains in the buffer, and syncs everything to the device. Then, if
+	// enabled, reads it back and compares it with `checksum`, which should be the checksum of
+	// the payload from the artifact manifest.
+	error::Error Finish(const string &checksum);
+
+private:
+	Writer(
+		const string &path,
+		int fd,
+		bool direct,
+		size_t alignment,
+		int64_t size,
+		const config_parser::RootfsImageWriter &config);
+
+	error::Error WriteOut(size_t length);
+	error::Error SaveCheckpoint();
+	bool IsZeroBlock(size_t offset, size_t length);
+	error::Error WriteRange(size_t start, size_t end);
+	error::Error SkipRange(size_t start, size_t end);
+	error::Error SyncWindow();
+	error::Error Verify(const string &checksum);
+	error::Error MakeErrnoError(int errnum, const string &what);
+
+	struct FreeDeleter {
+		void operator()(uint8_t *p) {
+			free(p);
+		}
+	};
+
+	string path_;
+	int fd_;
+	bool block_device_ {false};
+	bool direct_;
+	size_t alignment_;
+	int64_t size_;
+	config_parser::RootfsImageWriter config_;
+
+	// Staging buffer, aligned for O_DIRECT, which makes sure the device only sees large writes.
+	unique_ptr<uint8_t, FreeDeleter> buffer_;
+	size_t buffered_ {0};
+
+	// Bytes written to the file descriptor.
+	int64_t written_ {0};
+	// End of the range which writeback has been started for.
+	int64_t flushing_ {0};
+	// End of the range which is known to be on the device.
+	int64_t synced_ {0};
+	// Bytes in zero blocks which were not written.
+	int64_t skipped_ {0};
+
+	int64_t resume_offset_ {0};
+	CheckpointHandler checkpoint_handler_;
+	int64_t checkpointed_ {0};
+	bool zero_out_supported_ {true};
+};
+
+} // namespace rootfs_writer
+} // namespace update
+} // namespace mender
+
+#endif // MENDER_UPDATE_ROOTFS_WRITER_HPP
@@ -15,7 +15,10 @@
 #ifndef MENDER_UPDATE_STANDALONE_HPP
 #define MENDER_UPDATE_STANDALONE_HPP
 
+#include <chrono>
+#include <cstdint>
 #include <unordered_map>
+#include <vector>
 
 #include <common/error.hpp>
 #include <common/expected.hpp>
@@ -56,6 +59,8 @@ namespace artifact = mender::artifact;
 ExpectedOptionalStateData LoadStateData(database::KeyValueDatabase &db);
 
 StateData StateDataFromPayloadHeaderView(const artifact::PayloadHeaderView &header);
+io::ExpectedReaderPtr ReaderFromUrl(
+	events::EventLoop &loop, http::Client &http_client, const string &src);
 error::Error SaveStateData(database::KeyValueDatabase &db, const StateData &data);
 error::Error SaveStateData(database::Transaction &txn, const StateData &data);
 
@@ -132,6 +137,45 @@ ResultAndError Resume(Context &ctx);
 ResultAndError Commit(Context &ctx);
 ResultAndError Rollback(Context &ctx);
 
+enum class BenchmarkSink {
+	// Streams the payload to a built-in Update Module which throws it away, see
+	// `file_update::BuiltinDiscardModule()`.
+	Discard,
+	// Streams the payload to the real Update Module, but stops after its `Download` state.
+	UpdateModule,
+};
+
+// Bytes and time of one stage of the Artifact pipeline, see `metrics::Stage`.
+struct BenchmarkStage {
+	string name;
+	double bytes;
+	double seconds;
+};
+
+struct BenchmarkResult {
+	string artifact_name;
+	string payload_type;
+	uint64_t artifact_bytes {0};
+	// Until the header has been downloaded, parsed and verified.
+	chrono::steady_clock::duration header_time {};
+	chrono::steady_clock::duration total_time {};
+	// Only the stages which saw any bytes.
+	vector<BenchmarkStage> stages;
+	// Used during the benchmark, by the client and the Update Module processes together.
+	chrono::microseconds user_cpu_time {};
+	chrono::microseconds system_cpu_time {};
+	// Of the client or of the largest Update Module process, whichever is higher, since they
+	// were started.
+	int64_t peak_rss_kib {0};
+};
+using ExpectedBenchmarkResult = expected::expected<BenchmarkResult, error::Error>;
+
+// Runs the download, parse, verify and stream steps of installing `src`, and measures them.
+// Nothing is installed, and neither the provides nor the standalone state data are touched. The
+// Artifact depends are not checked either, so that any Artifact can be used for measuring. Refuses
+// to run while a standalone installation or a deployment of the daemon is in progress.
+ExpectedBenchmarkResult Benchmark(Context &ctx, const string &src, BenchmarkSink sink);
+
 } // namespace standalone
 } // namespace update
 } // namespace mender
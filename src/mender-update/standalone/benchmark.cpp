@@ -0,0 +1,290 @@
+// Copyright 2024 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/standalone.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/resource.h>
+
+#include <common/io.hpp>
+#include <common/log.hpp>
+#include <common/metrics.hpp>
+#include <common/path.hpp>
+
+#include <mender-update/file_update/file_update.hpp>
+
+namespace mender {
+namespace update {
+namespace standalone {
+
+namespace file_update = mender::update::file_update;
+namespace io = mender::common::io;
+namespace log = mender::common::log;
+namespace metrics = mender::common::metrics;
+namespace path = mender::common::path;
+
+// Counts the bytes of the Artifact itself, as they are read from the file or the network.
+class CountingReader : virtual public io::Reader {
+public:
+	CountingReader(io::Reader &reader) :
+		reader_ {reader} {
+	}
+
+	expected::ExpectedSize Read(
+		vector<uint8_t>::iterator start, vector<uint8_t>::iterator end) override {
+		auto result = reader_.Read(start, end);
+		if (result) {
+			count_ += result.value();
+		}
+		return result;
+	}
+
+	uint64_t Count() const {
+		return count_;
+	}
+
+private:
+	io::Reader &reader_;
+	uint64_t count_ {0};
+};
+
+static error::Error StreamToUpdateModule(
+	context::MenderContext &main_context,
+	artifact::PayloadHeaderView &header,
+	artifact::Payload &payload,
+	BenchmarkSink sink) {
+	auto exp_update_module =
+		update_module::UpdateModule::Create(main_context, header.header.payload_type);
+	if (!exp_update_module) {
+		return exp_update_module.error();
+	}
+	auto &update_module = *exp_update_module.value();
+	// Nothing is installed, so there is never anything to resume.
+	update_module.DisableRootfsImageWriterCheckpoints();
+	if (sink == BenchmarkSink::Discard) {
+		// Streamed in the same way as to any other Update Module, just not stored anywhere.
+		update_module.UseBuiltinModule("discard", file_update::BuiltinDiscardModule());
+	}
+
+	auto work_dir = update_module.GetUpdateModuleWorkDir();
+	auto err = update_module.CleanAndPrepareFileTree(work_dir, header);
+	if (err != error::NoError) {
+		return err;
+	}
+
+	auto with_sizes = update_module.ProvidePayloadFileSizes();
+	if (!with_sizes) {
+		err = with_sizes.error();
+	} else if (with_sizes.value()) {
+		err = update_module.DownloadWithFileSizes(payload);
+	} else {
+		err = update_module.Download(payload);
+	}
+
+	// Never proceed to `ArtifactInstall`, but let the Update Module drop whatever it stored.
+	err = err.FollowedBy(update_module.Cleanup());
+	return err.FollowedBy(update_module.DeleteFileTree(work_dir));
+}
+
+static error::Error RunBenchmark(
+	Context &ctx,
+	const string &src,
+	BenchmarkSink sink,
+	const string &scripts_path,
+	BenchmarkResult &result) {
+	auto start = chrono::steady_clock::now();
+
+	if (src.find("http://") == 0 || src.find("https://") == 0) {
+		ctx.http_client = make_shared<http::Client>(
+			ctx.main_context.GetConfig().GetHttpClientConfig(), ctx.loop);
+		auto reader = ReaderFromUrl(ctx.loop, *ctx.http_client, src);
+		if (!reader) {
+			return reader.error();
+		}
+		ctx.artifact_reader = reader.value();
+	} else {
+		auto stream = io::OpenIfstream(src);
+		if (!stream) {
+			return stream.error();
+		}
+		auto file_stream = make_shared<ifstream>(std::move(stream.value()));
+		ctx.artifact_reader = make_shared<io::StreamReader>(file_stream);
+	}
+	CountingReader counting_reader {*ctx.artifact_reader};
+
+	artifact::config::ParserConfig config {
+		.artifact_scripts_filesystem_path = scripts_path,
+		.artifact_scripts_version = 3,
+		.artifact_verify_keys = ctx.main_context.GetConfig().artifact_verify_keys,
+		.verify_signature = artifact::config::Signature::Verify,
+	};
+
+	auto exp_parser = artifact::Parse(counting_reader, config);
+	if (!exp_parser) {
+		return exp_parser.error();
+	}
+	ctx.parser.reset(new artifact::Artifact(std::move(exp_parser.value())));
+
+	auto exp_header = artifact::View(*ctx.parser, 0);
+	if (!exp_header) {
+		return exp_header.error();
+	}
+	auto &header = exp_header.value();
+	result.artifact_name = header.header.artifact_name;
+	result.payload_type = header.header.payload_type;
+	result.header_time = chrono::steady_clock::now() - start;
+
+	if (header.header.payload_type != "") {
+		auto payload = ctx.parser->Next();
+		if (!payload) {
+			return payload.error();
+		}
+
+		auto err = StreamToUpdateModule(ctx.main_context, header, payload.value(), sink);
+		if (err != error::NoError) {
+			return err;
+		}
+
+		auto next = ctx.parser->Next();
+		if (next) {
+			return error::Error(
+				make_error_condition(errc::not_supported),
+				"Multiple payloads are not supported in standalone mode");
+		} else if (
+			next.error().code
+			!= artifact::parser_error::MakeError(artifact::parser_error::EOFError, "").code) {
+			return next.error();
+		}
+	}
+
+	result.total_time = chrono::steady_clock::now() - start;
+	result.artifact_bytes = counting_reader.Count();
+	return error::NoError;
+}
+
+static chrono::microseconds Microseconds(const struct timeval &time) {
+	return chrono::seconds(time.tv_sec) + chrono::microseconds(time.tv_usec);
+}
+
+// Of the client itself and of the Update Module processes it has waited for.
+struct ResourceUsage {
+	struct rusage self;
+	struct rusage children;
+};
+
+static bool GetResourceUsage(ResourceUsage &usage) {
+	if (getrusage(RUSAGE_SELF, &usage.self) != 0
+		|| getrusage(RUSAGE_CHILDREN, &usage.children) != 0) {
+		log::Warning("Could not get the resource usage: " + string(strerror(errno)));
+		return false;
+	}
+	return true;
+}
+
+// The Update Module work directory is shared with real installations, both standalone ones and
+// those of the daemon.
+static error::Error CheckNoUpdateInProgress(database::KeyValueDatabase &db) {
+	auto exp_in_progress = LoadStateData(db);
+	if (!exp_in_progress) {
+		return exp_in_progress.error();
+	}
+	if (exp_in_progress.value()) {
+		return error::Error(
+			make_error_condition(errc::operation_in_progress),
+			"Update in progress. Please commit or roll back first");
+	}
+
+	auto exp_daemon_state = db.Read(context::MenderContext::state_data_key);
+	if (exp_daemon_state) {
+		return error::Error(
+			make_error_condition(errc::operation_in_progress),
+			"Deployment in progress by the daemon. Please let it finish first");
+	} else if (
+		exp_daemon_state.error().code != database::MakeError(database::KeyError, "").code) {
+		return exp_daemon_state.error();
+	}
+
+	return error::NoError;
+}
+
+ExpectedBenchmarkResult Benchmark(Context &ctx, const string &src, BenchmarkSink sink) {
+	auto err = CheckNoUpdateInProgress(ctx.main_context.GetMenderStoreDB());
+	if (err != error::NoError) {
+		return expected::unexpected(err);
+	}
+
+	// Keep the scripts of the benchmarked Artifact away from those of a real installation.
+	auto scripts_path =
+		path::Join(ctx.main_context.GetConfig().paths.GetDataStore(), "benchmark-scripts");
+	err = path::DeleteRecursively(scripts_path);
+	if (err != error::NoError) {
+		return expected::unexpected(err);
+	}
+
+	vector<string> stage_names {"http_body", "tar", "sha", "module_write"};
+	vector<BenchmarkStage> before;
+	for (const auto &name : stage_names) {
+		metrics::Stage stage {name};
+		before.push_back({name, stage.BytesTotal(), stage.SecondsTotal()});
+	}
+
+	ResourceUsage usage_before;
+	bool have_usage = GetResourceUsage(usage_before);
+
+	BenchmarkResult result;
+	err = RunBenchmark(ctx, src, sink, scripts_path, result);
+
+	ResourceUsage usage_after;
+	have_usage = have_usage && GetResourceUsage(usage_after);
+	// Let go of the connection and the parser before cleaning up.
+	ctx.parser.reset();
+	ctx.artifact_reader.reset();
+	ctx.http_client.reset();
+	err = err.FollowedBy(path::DeleteRecursively(scripts_path));
+	if (err != error::NoError) {
+		return expected::unexpected(err);
+	}
+
+	for (const auto &stage_before : before) {
+		metrics::Stage stage {stage_before.name};
+		auto bytes = stage.BytesTotal() - stage_before.bytes;
+		if (bytes > 0) {
+			result.stages.push_back(
+				{stage_before.name, bytes, stage.SecondsTotal() - stage_before.seconds});
+		}
+	}
+
+	if (have_usage) {
+		result.user_cpu_time = Microseconds(usage_after.self.ru_utime)
+							   - Microseconds(usage_before.self.ru_utime)
+							   + Microseconds(usage_after.children.ru_utime)
+							   - Microseconds(usage_before.children.ru_utime);
+		result.system_cpu_time = Microseconds(usage_after.self.ru_stime)
+								 - Microseconds(usage_before.self.ru_stime)
+								 + Microseconds(usage_after.children.ru_stime)
+								 - Microseconds(usage_before.children.ru_stime);
+		// A high-water mark, which can't be taken apart like the times. The one for children is
+		// that of the largest of them. Kilobytes on Linux.
+		result.peak_rss_kib = max(usage_after.self.ru_maxrss, usage_after.children.ru_maxrss);
+	}
+
+	return result;
+}
+
+} // namespace standalone
+} // namespace update
+} // namespace mender
@@ -92,7 +92,7 @@ error::Error DoEmptyPayloadArtifact(Context &ctx) {
 		[](database::Transaction &txn) { return error::NoError; });
 }
 
-static io::ExpectedReaderPtr ReaderFromUrl(
+io::ExpectedReaderPtr ReaderFromUrl(
 	events::EventLoop &loop, http::Client &http_client, const string &src) {
 	auto req = make_shared<http::OutgoingRequest>();
 	req->SetMethod(http::Method::GET);
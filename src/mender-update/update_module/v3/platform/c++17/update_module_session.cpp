@@ -0,0 +1,425 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/update_module/v3/update_module.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <common/common.hpp>
+#include <common/events.hpp>
+#include <common/log.hpp>
+#include <common/path.hpp>
+#include <common/processes.hpp>
+
+namespace mender {
+namespace update {
+namespace update_module {
+namespace v3 {
+
+namespace error = mender::common::error;
+namespace events = mender::common::events;
+namespace log = mender::common::log;
+namespace fs = std::filesystem;
+namespace path = mender::common::path;
+namespace processes = mender::common::processes;
+
+// Session mode
+// ------------
+//
+// When `UpdateModuleSessions` is enabled in the configuration, the module is started once as
+//
+//     <module> Session <work path>
+//
+// with <work path> as its working directory, instead of once for each state. Before starting it,
+// the client creates a FIFO named `session` inside <work path>. A module which supports session
+// mode opens the FIFO for reading and prints `SessionReady` on stdout. After that it reads one
+// state name per line from the FIFO, executes the state exactly as if it had been called with
+// the state as its first argument, and prints `StateDone <exit status>` on stdout when it is
+// finished. For the states which produce output, the output follows on the same line, separated
+// by a space, for example `StateDone 0 Yes`. Any other lines on stdout are logged, just like the
+// output of the normal invocations.
+//
+// The download states, and `ProvidePayloadFileSizes`, are always executed the normal way. After
+// `Cleanup`, or when the client is done with the module for another reason, the client closes
+// the FIFO, and the module should exit when it reaches end-of-file.
+//
+// A module which doesn't know about the `Session` state is expected to exit without doing
+// anything, like it does for all unknown states. If it exits without printing `SessionReady`, or
+// doesn't print it within a few seconds, the client falls back to calling the module once for
+// each state.
+
+const string kSessionFifoName {"session"};
+const string kSessionReady {"SessionReady"};
+const string kSessionStateDone {"StateDone"};
+
+// How long to give the module to exit on its own after closing the FIFO, before it gets killed.
+// This is waited for in the destructor, which runs on the event loop, so it must be short. The
+// module isn't executing any state at that point, so killing it is harmless.
+const chrono::milliseconds kSessionExitTimeout {200};
+
+// How long to wait for `SessionReady`. A module which doesn't know about sessions, and doesn't exit
+// either, would otherwise hold up the first state for the whole module timeout.
+const chrono::seconds kSessionHandshakeTimeout {5};
+
+UpdateModule::Session::Session(
+	events::EventLoop &loop, const string &module_path, const string &module_work_path) :
+	loop_ {loop},
+	module_work_path_ {module_work_path},
+	fifo_path_ {path::Join(module_work_path, kSessionFifoName)},
+	destroyed_ {make_shared<bool>(false)},
+	timeout_timer_ {loop},
+	handshake_timer_ {loop},
+	proc_ {{module_path, "Session", module_work_path}} {
+	proc_.SetWorkDir(module_work_path);
+}
+
+UpdateModule::Session::~Session() {
+	*destroyed_ = true;
+
+	auto status = status_;
+	CloseFifo();
+	if (status == Status::Idle || status == Status::Closing) {
+		// The module has been told to exit by closing the FIFO.
+		auto err = proc_.Wait(kSessionExitTimeout);
+		if (err.code == make_error_condition(errc::timed_out)) {
+			log::Warning("Update Module session did not exit when told to. Killing it");
+			proc_.Kill();
+			proc_.Wait();
+		}
+	}
+
+	if (status != Status::NotStarted) {
+		// Ignore errors, the directory may be gone after Cleanup.
+		::unlink(fifo_path_.c_str());
+	}
+}
+
+error::Error UpdateModule::Session::AsyncCallState(
+	State state, bool procOut, chrono::seconds timeout_seconds, HandlerFunction handler) {
+	switch (status_) {
+	case Status::NotStarted:
+	case Status::Idle:
+		break;
+	case Status::Ended:
+		return error::Error(
+			make_error_condition(errc::broken_pipe), "Update Module session has ended");
+	default:
+		return error::Error(
+			make_error_condition(errc::operation_in_progress),
+			"Update Module session is busy with " + StateToString(state_));
+	}
+
+	state_ = state;
+	proc_out_ = procOut;
+	output_.clear();
+	result_ = error::NoError;
+	handler_ = handler;
+
+	auto destroyed = destroyed_;
+	timeout_timer_.AsyncWait(timeout_seconds, [this, destroyed](error::Error err) {
+		if (*destroyed || err != error::NoError) {
+			return;
+		}
+		Timeout();
+	});
+
+	error::Error err;
+	if (status_ == Status::NotStarted) {
+		err = Start();
+	} else {
+		err = SendState();
+	}
+	if (err != error::NoError) {
+		timeout_timer_.Cancel();
+		handler_ = nullptr;
+		return err.WithContext(StateToString(state));
+	}
+
+	return error::NoError;
+}
+
+error::Error UpdateModule::Session::Start() {
+	error_code ec;
+	if (!fs::is_directory(module_work_path_, ec)) {
+		// Let the normal state execution deal with this, it knows which states are allowed
+		// to run without a file tree.
+		status_ = Status::Ended;
+		Finish(error::Error(
+			make_error_condition(errc::not_supported),
+			"No file tree to start an Update Module session in"));
+		return error::NoError;
+	}
+
+	if (::unlink(fifo_path_.c_str()) != 0 && errno != ENOENT) {
+		int err = errno;
+		return error::Error(
+			generic_category().default_error_condition(err),
+			"Unable to remove stale FIFO " + fifo_path_);
+	}
+	if (::mkfifo(fifo_path_.c_str(), 0600) != 0) {
+		int err = errno;
+		return error::Error(
+			generic_category().default_error_condition(err),
+			"Unable to create FIFO " + fifo_path_);
+	}
+	// Opening for both reading and writing doesn't block, and writing works even before the
+	// module has opened the FIFO, or if it never does. This is Linux specific, see fifo(7).
+	fifo_fd_ = ::open(fifo_path_.c_str(), O_RDWR | O_CLOEXEC);
+	if (fifo_fd_ < 0) {
+		int err = errno;
+		return error::Error(
+			generic_category().default_error_condition(err),
+			"Unable to open FIFO " + fifo_path_);
+	}
+
+	auto &loop = loop_;
+	auto destroyed = destroyed_;
+	auto err = proc_.Start(
+		[this, &loop, destroyed](const char *data, size_t size) {
+			// Called from a different thread, so hand it over to the event loop.
+			string output(data, size);
+			loop.Post([this, destroyed, output]() {
+				if (!*destroyed) {
+					HandleOutput(output);
+				}
+			});
+		},
+		processes::OutputHandler {"Update Module output (stderr): "});
+	if (err != error::NoError) {
+		CloseFifo();
+		return UpdateModule::GetProcessError(err);
+	}
+
+	err = proc_.AsyncWait(loop_, [this](error::Error err) { ProcessEnded(err); });
+	if (err != error::NoError) {
+		CloseFifo();
+		return err;
+	}
+
+	status_ = Status::Starting;
+
+	handshake_timer_.AsyncWait(kSessionHandshakeTimeout, [this, destroyed](error::Error err) {
+		if (*destroyed || err != error::NoError || status_ != Status::Starting) {
+			return;
+		}
+		HandshakeTimeout();
+	});
+
+	return error::NoError;
+}
+
+error::Error UpdateModule::Session::SendState() {
+	string line = StateToString(state_) + "\n";
+	size_t written = 0;
+	while (written < line.size()) {
+		auto n = ::write(fifo_fd_, line.data() + written, line.size() - written);
+		if (n < 0) {
+			int err = errno;
+			if (err == EINTR) {
+				continue;
+			}
+			return error::Error(
+				generic_category().default_error_condition(err),
+				"Unable to send state to Update Module session");
+		}
+		written += static_cast<size_t>(n);
+	}
+
+	status_ = Status::Busy;
+	return error::NoError;
+}
+
+void UpdateModule::Session::CloseFifo() {
+	if (fifo_fd_ >= 0) {
+		::close(fifo_fd_);
+		fifo_fd_ = -1;
+	}
+}
+
+void UpdateModule::Session::HandleOutput(const string &data) {
+	partial_line_ += data;
+	size_t pos;
+	while ((pos = partial_line_.find('\n')) != string::npos) {
+		string line = partial_line_.substr(0, pos);
+		partial_line_.erase(0, pos + 1);
+		HandleLine(line);
+	}
+}
+
+void UpdateModule::Session::HandleLine(const string &line) {
+	if (status_ == Status::Starting && line == kSessionReady) {
+		log::Debug("Update Module session started");
+		handshake_timer_.Cancel();
+		auto err = SendState();
+		if (err != error::NoError) {
+			status_ = Status::Ended;
+			proc_.EnsureTerminated();
+			Finish(err.WithContext(StateToString(state_)));
+		}
+		return;
+	}
+
+	if (status_ == Status::Busy && line.substr(0, kSessionStateDone.size()) == kSessionStateDone) {
+		StateDone(line.substr(kSessionStateDone.size()));
+		return;
+	}
+
+	log::Info("Update Module output (stdout): " + line);
+}
+
+void UpdateModule::Session::StateDone(const string &result) {
+	// `result` is either " <status>" or " <status> <output>".
+	auto space = result.find(' ', 1);
+	expected::ExpectedLongLong exp_status = expected::unexpected(
+		error::Error(make_error_condition(errc::invalid_argument), "Missing status"));
+	if (result.size() > 1 && result[0] == ' ') {
+		exp_status = common::StringToLongLong(result.substr(1, space - 1));
+	}
+	if (!exp_status) {
+		status_ = Status::Ended;
+		CloseFifo();
+		proc_.EnsureTerminated();
+		Finish(error::Error(
+				   make_error_condition(errc::protocol_error),
+				   "Malformed reply from Update Module session: " + kSessionStateDone + result)
+				   .WithContext(StateToString(state_)));
+		return;
+	}
+
+	if (space != string::npos) {
+		output_ = result.substr(space + 1);
+	}
+	if (exp_status.value() != 0) {
+		result_ = processes::MakeError(
+					  processes::NonZeroExitStatusError,
+					  "Process exited with status " + to_string(exp_status.value()))
+					  .WithContext(StateToString(state_));
+	} else if (!proc_out_ && output_ != "") {
+		log::Info("Update Module output (stdout): " + output_);
+	}
+
+	if (state_ == State::Cleanup) {
+		// The module is done. Let it exit, and finish when it has.
+		status_ = Status::Closing;
+		CloseFifo();
+		return;
+	}
+
+	status_ = Status::Idle;
+	Finish(result_);
+}
+
+void UpdateModule::Session::ProcessEnded(error::Error err) {
+	auto status = status_;
+	status_ = Status::Ended;
+	CloseFifo();
+
+	switch (status) {
+	case Status::Starting:
+		Finish(error::Error(
+			make_error_condition(errc::not_supported),
+			"Update Module does not support session mode"));
+		break;
+
+	case Status::Busy:
+		Finish(error::Error(
+				   make_error_condition(errc::broken_pipe),
+				   "Update Module session ended before finishing the state")
+				   .FollowedBy(err)
+				   .WithContext(StateToString(state_)));
+		break;
+
+	case Status::Closing: {
+		if (err != error::NoError) {
+			log::Warning("Update Module session did not exit cleanly: " + err.String());
+		}
+		auto result = result_;
+		std::error_code ec;
+		// Same as for a normal Cleanup call, see StateRunner::ProcessFinishedHandler().
+		if (!fs::remove_all(module_work_path_, ec) && ec) {
+			result = result.FollowedBy(error::Error(
+				ec.default_error_condition(),
+				StateToString(state_) + ": Error removing directory: " + module_work_path_));
+		}
+		Finish(result);
+		break;
+	}
+
+	case Status::Idle:
+		log::Warning("Update Module session ended unexpectedly");
+		break;
+
+	default:
+		break;
+	}
+}
+
+void UpdateModule::Session::HandshakeTimeout() {
+	// Nothing has been sent to the module yet, so it can't be in the middle of a state. Don't
+	// wait for it to exit, the process reaps it eventually.
+	status_ = Status::Ended;
+	CloseFifo();
+	proc_.Kill();
+	Finish(error::Error(
+		make_error_condition(errc::not_supported),
+		"Update Module did not start a session within "
+			+ to_string(kSessionHandshakeTimeout.count()) + " seconds"));
+}
+
+void UpdateModule::Session::Timeout() {
+	status_ = Status::Ended;
+	CloseFifo();
+	proc_.EnsureTerminated();
+	Finish(error::Error(make_error_condition(errc::timed_out), "Update Module session")
+			   .WithContext(StateToString(state_)));
+}
+
+void UpdateModule::Session::Finish(error::Error err) {
+	timeout_timer_.Cancel();
+	handshake_timer_.Cancel();
+
+	if (!handler_) {
+		return;
+	}
+	auto handler = handler_;
+	handler_ = nullptr;
+
+	expected::expected<optional<string>, error::Error> result;
+	if (err != error::NoError) {
+		result = expected::unexpected(err);
+	} else if (proc_out_) {
+		result = optional<string>(output_);
+	} else {
+		result = optional<string>();
+	}
+
+	// Call the handler from the event loop, since it may destroy us.
+	auto destroyed = destroyed_;
+	loop_.Post([destroyed, handler, result]() {
+		if (!*destroyed) {
+			handler(result);
+		}
+	});
+}
+
+} // namespace v3
+} // namespace update_module
+} // namespace update
+} // namespace mender
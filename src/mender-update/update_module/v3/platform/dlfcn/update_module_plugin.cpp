@@ -0,0 +1,361 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/update_module/v3/update_module.hpp>
+
+#include <algorithm>
+#include <filesystem>
+
+#include <dlfcn.h>
+
+#include <common/events.hpp>
+#include <common/log.hpp>
+#include <common/processes.hpp>
+
+#include <mender-update/file_update/file_update.hpp>
+#include <mender-update/update_module/v3/update_module_plugin.h>
+
+namespace mender {
+namespace update {
+namespace update_module {
+namespace v3 {
+
+namespace error = mender::common::error;
+namespace events = mender::common::events;
+namespace file_update = mender::update::file_update;
+namespace log = mender::common::log;
+namespace fs = std::filesystem;
+namespace processes = mender::common::processes;
+
+const string kPluginSuffix {".so"};
+
+// Same limit as the one line which is accepted from executable Update Modules, in practice.
+const size_t kPluginOutputSize {1024};
+
+static void PluginLog(int level, const char *message) {
+	string msg = string("Update Module plugin: ") + message;
+	switch (level) {
+	case MENDER_UPDATE_MODULE_LOG_ERROR:
+		log::Error(msg);
+		break;
+	case MENDER_UPDATE_MODULE_LOG_WARNING:
+		log::Warning(msg);
+		break;
+	case MENDER_UPDATE_MODULE_LOG_INFO:
+		log::Info(msg);
+		break;
+	default:
+		log::Debug(msg);
+		break;
+	}
+}
+
+error::Error UpdateModule::LoadPlugin() {
+	if (plugin_loaded_) {
+		return error::NoError;
+	}
+
+	auto &builtin = ctx_.GetConfig().builtin_update_modules;
+	if (find(builtin.begin(), builtin.end(), payload_type_) != builtin.end()) {
+		auto funcs = file_update::BuiltinModule(payload_type_);
+		if (funcs == nullptr) {
+			return error::Error(
+				make_error_condition(errc::not_supported),
+				"There is no built-in Update Module for payload type " + payload_type_);
+		}
+		plugin_ = Plugin::Builtin(payload_type_, funcs);
+		plugin_loaded_ = true;
+		log::Debug("Using built-in Update Module for " + payload_type_);
+		return error::NoError;
+	}
+
+	auto plugin_path = GetModulePath() + kPluginSuffix;
+	error_code ec;
+	if (!fs::exists(plugin_path, ec)) {
+		if (ec) {
+			return error::Error(
+				ec.default_error_condition(),
+				"Error while checking for Update Module plugin " + plugin_path);
+		}
+		plugin_loaded_ = true;
+		return error::NoError;
+	}
+
+	auto exp_plugin = Plugin::Load(plugin_path);
+	if (!exp_plugin) {
+		return exp_plugin.error();
+	}
+	plugin_ = std::move(exp_plugin.value());
+	plugin_loaded_ = true;
+	log::Debug("Using Update Module plugin " + plugin_path);
+
+	return error::NoError;
+}
+
+void UpdateModule::UseBuiltinModule(const string &name, const mender_update_module_plugin *funcs) {
+	plugin_ = Plugin::Builtin(name, funcs);
+	plugin_loaded_ = true;
+	log::Debug("Using built-in Update Module " + name + " for " + payload_type_);
+}
+
+expected::Expected<unique_ptr<UpdateModule::Plugin>> UpdateModule::Plugin::Load(
+	const string &path) {
+	void *library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (library == nullptr) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::executable_format_error),
+			string("Unable to load Update Module plugin: ") + dlerror()));
+	}
+
+	auto entry_point = reinterpret_cast<mender_update_module_plugin_entry_point_func>(
+		dlsym(library, MENDER_UPDATE_MODULE_PLUGIN_ENTRY_POINT));
+	if (entry_point == nullptr) {
+		dlclose(library);
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::executable_format_error),
+			"Update Module plugin " + path + " does not export "
+				+ MENDER_UPDATE_MODULE_PLUGIN_ENTRY_POINT));
+	}
+
+	auto funcs = entry_point();
+	if (funcs == nullptr || funcs->abi_version != MENDER_UPDATE_MODULE_PLUGIN_ABI_VERSION) {
+		dlclose(library);
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::executable_format_error),
+			"Update Module plugin " + path + " uses an unsupported ABI version"));
+	}
+	if (funcs->open == nullptr || funcs->payload_file_begin == nullptr
+		|| funcs->payload_file_data == nullptr || funcs->payload_file_end == nullptr
+		|| funcs->call_state == nullptr || funcs->close == nullptr) {
+		dlclose(library);
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::executable_format_error),
+			"Update Module plugin " + path + " does not implement all functions"));
+	}
+
+	return unique_ptr<Plugin>(new Plugin(path, library, funcs));
+}
+
+unique_ptr<UpdateModule::Plugin> UpdateModule::Plugin::Builtin(
+	const string &payload_type, const mender_update_module_plugin *funcs) {
+	return unique_ptr<Plugin>(new Plugin("built-in " + payload_type, nullptr, funcs));
+}
+
+UpdateModule::Plugin::Plugin(
+	const string &path, void *handle, const mender_update_module_plugin *funcs) :
+	library_ {new Library {path, handle, funcs}},
+	queue_ {[library = library_]() { library->Close(); }} {
+}
+
+error::Error UpdateModule::Plugin::Library::Open(const string &work_path) {
+	if (instance_ != nullptr) {
+		return error::NoError;
+	}
+	instance_ = funcs_->open(work_path.c_str(), PluginLog);
+	if (instance_ == nullptr) {
+		return error::Error(
+			make_error_condition(errc::io_error),
+			"Update Module plugin " + path_ + " could not be opened in " + work_path);
+	}
+	return error::NoError;
+}
+
+void UpdateModule::Plugin::Library::Close() {
+	if (instance_ != nullptr) {
+		funcs_->close(instance_);
+		instance_ = nullptr;
+	}
+	if (handle_ != nullptr) {
+		dlclose(handle_);
+		handle_ = nullptr;
+	}
+}
+
+error::Error UpdateModule::Plugin::Library::StatusError(const string &what, int status) {
+	return processes::MakeError(
+		processes::NonZeroExitStatusError,
+		"Update Module plugin " + what + " returned status " + to_string(status));
+}
+
+void UpdateModule::Plugin::AsyncBeginPayloadFile(
+	events::EventLoop &loop,
+	const string &work_path,
+	const string &name,
+	int64_t size,
+	events::io::BlockingOperationHandler handler) {
+	auto library = library_;
+	queue_.AsyncRun(
+		loop,
+		[library, work_path, name, size]() {
+			auto err = library->Open(work_path);
+			if (err != error::NoError) {
+				return err;
+			}
+			int status =
+				library->funcs_->payload_file_begin(library->instance_, name.c_str(), size);
+			if (status != 0) {
+				return library->StatusError("payload_file_begin", status);
+			}
+			return error::NoError;
+		},
+		handler);
+}
+
+void UpdateModule::Plugin::AsyncPayloadFileData(
+	events::EventLoop &loop,
+	shared_ptr<vector<uint8_t>> buffer,
+	size_t size,
+	events::io::BlockingOperationHandler handler) {
+	auto library = library_;
+	queue_.AsyncRun(
+		loop,
+		[library, buffer, size]() {
+			int status =
+				library->funcs_->payload_file_data(library->instance_, buffer->data(), size);
+			if (status != 0) {
+				return library->StatusError("payload_file_data", status);
+			}
+			return error::NoError;
+		},
+		handler);
+}
+
+void UpdateModule::Plugin::AsyncEndPayloadFile(
+	events::EventLoop &loop, events::io::BlockingOperationHandler handler) {
+	auto library = library_;
+	queue_.AsyncRun(
+		loop,
+		[library]() {
+			int status = library->funcs_->payload_file_end(library->instance_);
+			if (status != 0) {
+				return library->StatusError("payload_file_end", status);
+			}
+			return error::NoError;
+		},
+		handler);
+}
+
+error::Error UpdateModule::Plugin::AsyncCallState(
+	events::EventLoop &loop,
+	State state,
+	bool procOut,
+	const string &work_path,
+	chrono::seconds timeout_seconds,
+	CallStateHandler handler) {
+	auto done = make_shared<bool>(false);
+
+	// The timer and the handlers are gone with this object, so neither needs to check for it.
+	timeout_timer_.reset(new events::Timer(loop));
+	timeout_timer_->AsyncWait(timeout_seconds, [done, state, handler](error::Error err) {
+		if (*done || err != error::NoError) {
+			return;
+		}
+		*done = true;
+		handler(expected::unexpected(
+			error::Error(make_error_condition(errc::timed_out), "Update Module plugin")
+				.WithContext(StateToString(state))));
+	});
+
+	auto library = library_;
+	auto result = make_shared<expected::expected<optional<string>, error::Error>>();
+	queue_.AsyncRun(
+		loop,
+		[library, result, state, procOut, work_path]() {
+			*result = library->CallState(state, procOut, work_path);
+			return error::NoError;
+		},
+		[this, done, result, handler](error::Error) {
+			if (*done) {
+				// Timed out already.
+				return;
+			}
+			*done = true;
+			timeout_timer_->Cancel();
+			handler(*result);
+		});
+
+	return error::NoError;
+}
+
+expected::expected<optional<string>, error::Error> UpdateModule::Plugin::Library::CallState(
+	State state, bool procOut, const string &work_path) {
+	string state_string = StateToString(state);
+
+	// Same checks as for executable Update Modules, see StateRunner::AsyncCallState().
+	error_code ec;
+	if (!fs::is_directory(work_path, ec) || ec) {
+		if (state == State::Cleanup) {
+			return optional<string>();
+		} else if (ec) {
+			return expected::unexpected(error::Error(
+				ec.default_error_condition(),
+				state_string + ": Error while checking file tree: " + work_path));
+		} else {
+			return expected::unexpected(error::Error(
+				make_error_condition(errc::no_such_file_or_directory),
+				state_string + ": File tree does not exist: " + work_path));
+		}
+	}
+
+	auto err = Open(work_path);
+	if (err != error::NoError) {
+		return expected::unexpected(err.WithContext(state_string));
+	}
+
+	vector<char> buf(kPluginOutputSize, '\0');
+	int status = funcs_->call_state(instance_, state_string.c_str(), buf.data(), buf.size());
+	buf.back() = '\0';
+	string output {buf.data()};
+	if (status != 0) {
+		err = StatusError(state_string, status).WithContext(state_string);
+	}
+
+	if (state == State::Cleanup) {
+		funcs_->close(instance_);
+		instance_ = nullptr;
+
+		// Same as for executable Update Modules, see StateRunner::ProcessFinishedHandler().
+		if (!fs::remove_all(work_path, ec) && ec) {
+			err = err.FollowedBy(error::Error(
+				ec.default_error_condition(),
+				state_string + ": Error removing directory: " + work_path));
+		}
+	}
+
+	if (err != error::NoError) {
+		return expected::unexpected(err);
+	}
+
+	if (!procOut) {
+		if (output != "") {
+			log::Info("Update Module output (stdout): " + output);
+		}
+		return optional<string>();
+	}
+
+	if (output.size() > 0 && output.back() == '\n') {
+		output.pop_back();
+	}
+	if (output.find('\n') != string::npos) {
+		return expected::unexpected(error::Error(
+			make_error_condition(errc::protocol_error),
+			"Too many lines when querying " + state_string));
+	}
+	return optional<string>(output);
+}
+
+} // namespace v3
+} // namespace update_module
+} // namespace update
+} // namespace mender
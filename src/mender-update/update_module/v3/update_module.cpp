@@ -17,7 +17,9 @@
 #include <common/events.hpp>
 #include <common/error.hpp>
 #include <common/expected.hpp>
+#include <common/log.hpp>
 #include <common/path.hpp>
+#include <common/tracing.hpp>
 
 namespace mender {
 namespace update {
@@ -26,6 +28,7 @@ namespace v3 {
 
 namespace error = mender::common::error;
 namespace expected = mender::common::expected;
+namespace log = mender::common::log;
 namespace path = mender::common::path;
 
 static std::string StateString[] = {
@@ -71,7 +74,8 @@ expected::Expected<std::unique_ptr<UpdateModule>> UpdateModule::Create(
 
 UpdateModule::UpdateModule(
 	MenderContext &ctx, const string &payload_type, string update_module_path) :
-	ctx_ {ctx} {
+	ctx_ {ctx},
+	payload_type_ {payload_type} {
 	update_module_path_ = update_module_path;
 	update_module_workdir_ =
 		path::Join(ctx.GetConfig().paths.GetModulesWorkPath(), "payloads", "0000", "tree");
@@ -84,6 +88,10 @@ UpdateModule::DownloadData::DownloadData(
 	buffer_.resize(MENDER_BUFSIZE);
 }
 
+UpdateModule::DownloadData::~DownloadData() {
+	*destroyed_ = true;
+}
+
 static expected::ExpectedBool HandleProvidePayloadFileSizesOutput(
 	const expected::ExpectedString &exp_output) {
 	if (!exp_output) {
@@ -293,11 +301,13 @@ error::Error UpdateModule::AsyncArtifactFailure(
 }
 
 error::Error UpdateModule::Cleanup() {
+	RemoveRootfsImageWriterCheckpoint();
 	return CallStateNoCapture(State::Cleanup);
 }
 
 error::Error UpdateModule::AsyncCleanup(
 	events::EventLoop &event_loop, StateFinishedHandler handler) {
+	RemoveRootfsImageWriterCheckpoint();
 	return AsyncCallStateNoCapture(event_loop, State::Cleanup, handler);
 }
 
@@ -318,12 +328,10 @@ error::Error UpdateModule::GetProcessError(const error::Error &err) {
 
 error::Error UpdateModule::AsyncCallStateCapture(
 	events::EventLoop &loop, State state, function<void(expected::ExpectedString)> handler) {
-	state_runner_.reset(new StateRunner(loop, state, GetModulePath(), GetModulesWorkPath()));
-
-	return state_runner_->AsyncCallState(
+	return AsyncCallState(
+		loop,
 		state,
 		true,
-		chrono::seconds(ctx_.GetConfig().module_timeout_seconds),
 		[handler](expected::expected<optional<string>, error::Error> exp_output) {
 			if (!exp_output) {
 				handler(expected::unexpected(exp_output.error()));
@@ -335,7 +343,7 @@ error::Error UpdateModule::AsyncCallStateCapture(
 }
 
 expected::ExpectedString UpdateModule::CallStateCapture(State state) {
-	events::EventLoop loop;
+	auto &loop = sync_loop_;
 	expected::ExpectedString ret;
 	auto err = AsyncCallStateCapture(loop, state, [&ret, &loop](expected::ExpectedString str) {
 		ret = str;
@@ -355,12 +363,10 @@ expected::ExpectedString UpdateModule::CallStateCapture(State state) {
 
 error::Error UpdateModule::AsyncCallStateNoCapture(
 	events::EventLoop &loop, State state, function<void(error::Error)> handler) {
-	state_runner_.reset(new StateRunner(loop, state, GetModulePath(), GetModulesWorkPath()));
-
-	return state_runner_->AsyncCallState(
+	return AsyncCallState(
+		loop,
 		state,
 		false,
-		chrono::seconds(ctx_.GetConfig().module_timeout_seconds),
 		[handler](expected::expected<optional<string>, error::Error> exp_output) {
 			if (!exp_output) {
 				handler(exp_output.error());
@@ -372,7 +378,7 @@ error::Error UpdateModule::AsyncCallStateNoCapture(
 }
 
 error::Error UpdateModule::CallStateNoCapture(State state) {
-	events::EventLoop loop;
+	auto &loop = sync_loop_;
 	error::Error err;
 	err = AsyncCallStateNoCapture(loop, state, [&err, &loop](error::Error inner_err) {
 		err = inner_err;
@@ -390,6 +396,90 @@ error::Error UpdateModule::CallStateNoCapture(State state) {
 	return err;
 }
 
+bool UpdateModule::UseSession(State state) {
+	if (!ctx_.GetConfig().update_module_sessions || session_unsupported_) {
+		return false;
+	}
+
+	switch (state) {
+	case State::ProvidePayloadFileSizes:
+	case State::Download:
+	case State::DownloadWithFileSizes:
+		// These are executed before the payload is available, and the download states
+		// have their own protocol.
+		return false;
+	default:
+		return true;
+	}
+}
+
+error::Error UpdateModule::AsyncCallState(
+	events::EventLoop &loop, State state, bool procOut, CallStateHandler handler) {
+	// One span for the whole call, whether it goes to a plugin, a session or a process of its
+	// own, and including the fallback from a session. It ends when the handler is called, or
+	// when the call couldn't be started and the handler is dropped.
+	auto span = make_shared<tracing::Span>("update_module", StateToString(state));
+	return DoAsyncCallState(
+		loop,
+		state,
+		procOut,
+		[span, handler](expected::expected<optional<string>, error::Error> exp_output) {
+			span->End();
+			handler(exp_output);
+		});
+}
+
+error::Error UpdateModule::DoAsyncCallState(
+	events::EventLoop &loop, State state, bool procOut, CallStateHandler handler) {
+	auto timeout = chrono::seconds(ctx_.GetConfig().module_timeout_seconds);
+
+	auto err = LoadPlugin();
+	if (err != error::NoError) {
+		return err.WithContext(StateToString(state));
+	}
+	if (plugin_) {
+		if (state == State::ProvidePayloadFileSizes) {
+			// Plugins are always given the sizes.
+			loop.Post([handler]() { handler(optional<string>("Yes")); });
+			return error::NoError;
+		}
+		return plugin_->AsyncCallState(
+			loop, state, procOut, GetModulesWorkPath(), timeout, handler);
+	}
+
+	if (!UseSession(state)) {
+		state_runner_.reset(new StateRunner(loop, state, GetModulePath(), GetModulesWorkPath()));
+		return state_runner_->AsyncCallState(state, procOut, timeout, handler);
+	}
+
+	if (session_ && (session_->Ended() || &session_->GetLoop() != &loop)) {
+		session_.reset();
+	}
+	if (!session_) {
+		session_.reset(new Session(loop, GetModulePath(), GetModulesWorkPath()));
+	}
+
+	return session_->AsyncCallState(
+		state,
+		procOut,
+		timeout,
+		[this, &loop, state, procOut, handler](
+			expected::expected<optional<string>, error::Error> exp_output) {
+			if (!exp_output
+				&& exp_output.error().code == make_error_condition(errc::not_supported)) {
+				log::Info(
+					exp_output.error().String() + ". Falling back to calling it once per state");
+				session_unsupported_ = true;
+				auto err = DoAsyncCallState(loop, state, procOut, handler);
+				if (err != error::NoError) {
+					handler(expected::unexpected(err));
+				}
+				return;
+			}
+			handler(exp_output);
+		});
+}
+
 void UpdateModule::SetSystemRebootRunner(unique_ptr<SystemRebootRunner> &&system_reboot_runner) {
 	system_reboot_ = std::move(system_reboot_runner);
 }
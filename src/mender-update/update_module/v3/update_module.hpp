@@ -15,21 +15,27 @@
 #ifndef MENDER_UPDATE_UPDATE_MODULE_HPP
 #define MENDER_UPDATE_UPDATE_MODULE_HPP
 
+#include <chrono>
 #include <vector>
 #include <string>
 
 #include <client_shared/conf.hpp>
 #include <common/error.hpp>
+#include <common/events_io.hpp>
 #include <common/expected.hpp>
 #include <common/optional.hpp>
 #include <common/processes.hpp>
+#include <common/tracing.hpp>
 
 #include <mender-update/context.hpp>
+#include <mender-update/rootfs_writer/rootfs_writer.hpp>
 
 #include <artifact/artifact.hpp>
 
 class UpdateModuleTests;
 
+struct mender_update_module_plugin;
+
 namespace mender {
 namespace update {
 namespace update_module {
@@ -44,6 +50,8 @@ namespace events = mender::common::events;
 namespace expected = mender::common::expected;
 namespace io = mender::common::io;
 namespace procs = mender::common::processes;
+namespace rootfs_writer = mender::update::rootfs_writer;
+namespace tracing = mender::common::tracing;
 
 using context::MenderContext;
 using expected::ExpectedBool;
@@ -99,6 +107,17 @@ public:
 		update_module_workdir_ = path;
 	}
 
+	// Use a module which is built into the client, see file_update.hpp, regardless of the
+	// payload type and of `BuiltinUpdateModules`. `name` is only used in log messages.
+	void UseBuiltinModule(const string &name, const mender_update_module_plugin *funcs);
+
+	// For downloads which are never installed, such as benchmarks. The rootfs-image writer then
+	// neither resumes from, stores nor removes a checkpoint, so that one belonging to a real
+	// deployment is left alone.
+	void DisableRootfsImageWriterCheckpoints() {
+		rootfs_writer_checkpoints_ = false;
+	}
+
 	error::Error PrepareFileTreeDeviceParts(const string &path);
 	error::Error CleanAndPrepareFileTree(
 		const string &path, artifact::PayloadHeaderView &payload_meta_data);
@@ -164,6 +183,13 @@ private:
 		events::EventLoop &loop, State state, function<void(error::Error)> handler);
 	error::Error CallStateNoCapture(State state);
 
+	using CallStateHandler = function<void(expected::expected<optional<string>, error::Error>)>;
+	error::Error AsyncCallState(
+		events::EventLoop &loop, State state, bool procOut, CallStateHandler handler);
+	error::Error DoAsyncCallState(
+		events::EventLoop &loop, State state, bool procOut, CallStateHandler handler);
+	bool UseSession(State state);
+
 	string GetModulePath() const;
 	string GetModulesWorkPath() const;
 
@@ -192,12 +218,34 @@ private:
 
 	void StartDownloadToFile();
 
+	error::Error LoadPlugin();
+	void StartPluginDownload();
+	void PluginDownloadNextFile();
+	void PluginBeginPayloadFileHandler(error::Error err);
+	void PluginPayloadReadHandler(io::ExpectedSize result);
+	void PluginPayloadWriteHandler(error::Error err, size_t written);
+	void PluginEndPayloadFileHandler(error::Error err);
+
+	bool UseRootfsImageWriter() const;
+	void StartRootfsImageWriterDownload(const string &partition);
+	void TracePayloadBegin();
+	void TracePayloadEnd();
+	void RootfsImageWriterReadHandler(io::ExpectedSize result);
+	void RootfsImageWriterWriteHandler(error::Error err, size_t written);
+	void RootfsImageWriterFinishHandler(error::Error err);
+	error::Error StoreRootfsImageWriterCheckpoint();
+	// Once the deployment is over, successful or not, the checkpoint can't be used anymore.
+	void RemoveRootfsImageWriterCheckpoint();
+
 	context::MenderContext &ctx_;
+	string payload_type_;
 	string update_module_path_;
 	string update_module_workdir_;
+	bool rootfs_writer_checkpoints_ {true};
 
 	struct DownloadData {
 		DownloadData(events::EventLoop &event_loop, artifact::Payload &payload);
+		~DownloadData();
 
 		artifact::Payload &payload_;
 		events::EventLoop &event_loop_;
@@ -216,6 +264,29 @@ private:
 		shared_ptr<io::Canceller> current_stream_opener_;
 		io::AsyncWriterPtr current_stream_writer_;
 		int64_t written_ {0};
+		// Start of the write of the current buffer, for the pipeline metrics.
+		chrono::steady_clock::time_point write_start_;
+
+		tracing::Span proc_span_;
+		tracing::Span payload_span_;
+		int64_t payload_span_written_start_ {0};
+
+		// Read into for Update Module plugins, which are given it outside of the event loop.
+		// Shared with the call in progress, for the same reason as the rootfs-image writer's
+		// below.
+		shared_ptr<vector<uint8_t>> plugin_buffer_;
+
+		// Used instead of the Update Module, see `UseRootfsImageWriter()`. The writer runs
+		// outside of the event loop, so it, the buffer it writes from, and the checkpoint it
+		// reports, are shared with the operation in progress, which may outlive the download.
+		shared_ptr<rootfs_writer::Writer> rootfs_writer_;
+		shared_ptr<vector<uint8_t>> rootfs_writer_buffer_;
+		// Stored in the database from the event loop, once the write which reached it is done.
+		shared_ptr<optional<rootfs_writer::Checkpoint>> rootfs_writer_checkpoint_;
+		string current_payload_checksum_;
+		// Set when the download is destroyed, so that a writer operation which finishes
+		// afterwards does nothing.
+		shared_ptr<bool> destroyed_ {make_shared<bool>(false)};
 
 		bool module_has_started_download_ {false};
 		bool module_has_finished_download_ {false};
@@ -233,7 +304,7 @@ private:
 			const string &module_path,
 			const string &module_work_path);
 
-		using HandlerFunction = function<void(expected::expected<optional<string>, error::Error>)>;
+		using HandlerFunction = CallStateHandler;
 
 		error::Error AsyncCallState(
 			State state, bool procOut, chrono::seconds timeout_seconds, HandlerFunction handler);
@@ -251,6 +322,143 @@ private:
 	};
 	unique_ptr<StateRunner> state_runner_;
 
+	// Used instead of StateRunner when session mode is enabled and supported by the module.
+	// Runs one module process for all the states it is used for. See
+	// update_module_session.cpp for a description of the protocol.
+	class Session {
+	public:
+		Session(
+			events::EventLoop &loop, const string &module_path, const string &module_work_path);
+		~Session();
+
+		using HandlerFunction = CallStateHandler;
+
+		// Starts the module first, if it isn't running yet. If the module turns out not to
+		// support session mode, the handler is called with an `errc::not_supported` error,
+		// without the state having been executed.
+		error::Error AsyncCallState(
+			State state, bool procOut, chrono::seconds timeout_seconds, HandlerFunction handler);
+
+		events::EventLoop &GetLoop() {
+			return loop_;
+		}
+
+		bool Ended() const {
+			return status_ == Status::Ended;
+		}
+
+	private:
+		enum class Status {
+			NotStarted,
+			Starting,
+			Idle,
+			Busy,
+			Closing,
+			Ended,
+		};
+
+		error::Error Start();
+		error::Error SendState();
+		void CloseFifo();
+
+		void HandleOutput(const string &data);
+		void HandleLine(const string &line);
+		void StateDone(const string &result);
+		void ProcessEnded(error::Error err);
+		void HandshakeTimeout();
+		void Timeout();
+		void Finish(error::Error err);
+
+		events::EventLoop &loop_;
+		string module_work_path_;
+		string fifo_path_;
+		int fifo_fd_ {-1};
+
+		Status status_ {Status::NotStarted};
+		State state_ {State::LastState};
+		bool proc_out_ {false};
+		string output_;
+		string partial_line_;
+		error::Error result_;
+		HandlerFunction handler_;
+
+		shared_ptr<bool> destroyed_;
+
+		events::Timer timeout_timer_;
+		events::Timer handshake_timer_;
+		procs::Process proc_;
+	};
+	// The loop used by the synchronous functions. Sessions outlive the individual calls, so
+	// they need a loop that does too.
+	events::EventLoop sync_loop_;
+	unique_ptr<Session> session_;
+	bool session_unsupported_ {false};
+
+	// Used instead of executing the module when it is installed as a shared object. See
+	// update_module_plugin.h.
+	class Plugin {
+	public:
+		static expected::Expected<unique_ptr<Plugin>> Load(const string &path);
+		// One of the modules which are built into the client, see file_update.hpp.
+		static unique_ptr<Plugin> Builtin(
+			const string &payload_type, const mender_update_module_plugin *funcs);
+
+		// The plugin is only ever called from a thread of its own, see `queue_`, and the
+		// handlers are called from `loop`. The buffer isn't touched again once the handler has
+		// been called.
+		void AsyncBeginPayloadFile(
+			events::EventLoop &loop,
+			const string &work_path,
+			const string &name,
+			int64_t size,
+			events::io::BlockingOperationHandler handler);
+		void AsyncPayloadFileData(
+			events::EventLoop &loop,
+			shared_ptr<vector<uint8_t>> buffer,
+			size_t size,
+			events::io::BlockingOperationHandler handler);
+		void AsyncEndPayloadFile(
+			events::EventLoop &loop, events::io::BlockingOperationHandler handler);
+
+		// If an earlier call has timed out, but not returned, this one waits for it, but the
+		// timeout is counted from now.
+		error::Error AsyncCallState(
+			events::EventLoop &loop,
+			State state,
+			bool procOut,
+			const string &work_path,
+			chrono::seconds timeout_seconds,
+			CallStateHandler handler);
+
+	private:
+		// Everything which is used from the thread of the plugin, since it may outlive this
+		// object if a call never returns.
+		struct Library {
+			error::Error Open(const string &work_path);
+			expected::expected<optional<string>, error::Error> CallState(
+				State state, bool procOut, const string &work_path);
+			error::Error StatusError(const string &what, int status);
+			void Close();
+
+			string path_;
+			// nullptr for built-in modules.
+			void *handle_;
+			const mender_update_module_plugin *funcs_;
+			void *instance_ {nullptr};
+		};
+
+		Plugin(const string &path, void *handle, const mender_update_module_plugin *funcs);
+
+		shared_ptr<Library> library_;
+		unique_ptr<events::Timer> timeout_timer_;
+		// There is no way to interrupt the plugin, so if it is still busy when this is
+		// destroyed, it is closed from its own thread once it returns.
+		events::io::BlockingOperationQueue queue_;
+	};
+	// Declared after `sync_loop_`, since the plugin may post to it.
+	unique_ptr<Plugin> plugin_;
+	bool plugin_loaded_ {false};
+
 	unique_ptr<SystemRebootRunner> system_reboot_;
 
 	friend class ::UpdateModuleTests;
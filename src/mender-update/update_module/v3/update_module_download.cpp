@@ -16,24 +16,53 @@
 
 #include <mender-update/progress_reader/progress_reader.hpp>
 
+#include <common/common.hpp>
 #include <common/events.hpp>
 #include <common/events_io.hpp>
 #include <common/log.hpp>
+#include <common/metrics.hpp>
 #include <common/path.hpp>
 #include <common/processes.hpp>
+#include <common/tracing.hpp>
 
 namespace mender {
 namespace update {
 namespace update_module {
 namespace v3 {
 
+namespace common = mender::common;
+namespace kv_db = mender::common::key_value_database;
 namespace log = mender::common::log;
+namespace metrics = mender::common::metrics;
 namespace path = mender::common::path;
 namespace processes = mender::common::processes;
 namespace progress = mender::update::progress;
 
 
 void UpdateModule::StartDownloadProcess() {
+	auto err = LoadPlugin();
+	if (err != error::NoError) {
+		DownloadErrorHandler(err);
+		return;
+	}
+	if (plugin_) {
+		StartPluginDownload();
+		return;
+	}
+	if (UseRootfsImageWriter()) {
+		auto exp_partition = rootfs_writer::GetInactivePartition(ctx_.GetConfig());
+		if (!exp_partition) {
+			DownloadErrorHandler(exp_partition.error().WithContext("Download"));
+			return;
+		}
+		if (!rootfs_writer::IsUbiVolume(exp_partition.value())) {
+			StartRootfsImageWriterDownload(exp_partition.value());
+			return;
+		}
+		log::Info(
+			"The built-in rootfs-image writer does not support UBI volumes, using the Update Module");
+	}
+
 	string download_command = "Download";
 	if (download_->downloading_with_sizes_) {
 		download_command = "DownloadWithFileSizes";
@@ -46,7 +75,7 @@ void UpdateModule::StartDownloadProcess() {
 
 	download_->proc_->SetWorkDir(update_module_workdir_);
 
-	auto err = PrepareStreamNextPipe();
+	err = PrepareStreamNextPipe();
 	if (err != error::NoError) {
 		DownloadErrorHandler(err);
 		return;
@@ -55,6 +84,7 @@ void UpdateModule::StartDownloadProcess() {
 	processes::OutputHandler stdout_handler {"Update Module output (stdout): "};
 	processes::OutputHandler stderr_handler {"Update Module output (stderr): "};
 
+	download_->proc_span_ = tracing::Span("update_module", download_command);
 	err = download_->proc_->Start(stdout_handler, stderr_handler);
 	if (err != error::NoError) {
 		DownloadErrorHandler(GetProcessError(err));
@@ -110,6 +140,7 @@ void UpdateModule::StreamNextOpenHandler(io::ExpectedAsyncWriterPtr writer) {
 	download_->current_payload_reader_ =
 		make_shared<events::io::AsyncReaderFromReader>(download_->event_loop_, progress_reader);
 	download_->current_payload_name_ = payload_reader->Name();
+	TracePayloadBegin();
 	download_->current_payload_size_ = payload_reader->Size();
 
 	auto stream_path =
@@ -191,6 +222,7 @@ void UpdateModule::PayloadReadHandler(io::ExpectedSize result) {
 		download_->current_payload_reader_.reset();
 		DownloadErrorHandler(result.error());
 	} else if (result.value() > 0) {
+		download_->write_start_ = chrono::steady_clock::now();
 		DownloadErrorHandler(download_->current_stream_writer_->AsyncWrite(
 			download_->buffer_.begin(),
 			download_->buffer_.begin() + result.value(),
@@ -201,6 +233,7 @@ void UpdateModule::PayloadReadHandler(io::ExpectedSize result) {
 		// Close streams.
 		download_->current_stream_writer_.reset();
 		download_->current_payload_reader_.reset();
+		TracePayloadEnd();
 
 		if (download_->downloading_to_files_) {
 			StartDownloadToFile();
@@ -228,8 +261,13 @@ void UpdateModule::StreamWriteHandler(size_t offset, size_t expected_n, io::Expe
 				StreamWriteHandler(new_offset, new_expected, write_result);
 			}));
 	} else {
+		static metrics::Stage stage("module_write");
+		stage.Record(offset + expected_n, chrono::steady_clock::now() - download_->write_start_);
+
 		download_->written_ += result.value();
-		log::Trace("Wrote " + to_string(download_->written_) + " bytes to Update Module");
+		log::Trace([this]() {
+			return "Wrote " + to_string(download_->written_) + " bytes to Update Module";
+		});
 		DownloadErrorHandler(download_->current_payload_reader_->AsyncRead(
 			download_->buffer_.begin(), download_->buffer_.end(), [this](io::ExpectedSize result) {
 				PayloadReadHandler(result);
@@ -252,6 +290,18 @@ void UpdateModule::EndStreamNext() {
 		}));
 }
 
+void UpdateModule::TracePayloadBegin() {
+	download_->payload_span_ = tracing::Span(
+		"payload", "payload file", tracing::Args().Add("name", download_->current_payload_name_));
+	download_->payload_span_written_start_ = download_->written_;
+}
+
+void UpdateModule::TracePayloadEnd() {
+	download_->payload_span_.AddArg(
+		"bytes", download_->written_ - download_->payload_span_written_start_);
+	download_->payload_span_.End();
+}
+
 void UpdateModule::DownloadErrorHandler(const error::Error &err) {
 	if (err != error::NoError) {
 		EndDownloadLoop(err);
@@ -263,12 +313,14 @@ void UpdateModule::EndDownloadLoop(const error::Error &err) {
 }
 
 void UpdateModule::DownloadTimeoutHandler() {
+	download_->proc_span_.End();
 	download_->proc_->EnsureTerminated();
 	EndDownloadLoop(error::Error(
 		make_error_condition(errc::timed_out), "Update Module Download process timed out"));
 }
 
 void UpdateModule::ProcessEndedHandler(error::Error err) {
+	download_->proc_span_.End();
 	if (err != error::NoError) {
 		err = GetProcessError(err);
 		DownloadErrorHandler(error::Error(
@@ -310,6 +362,7 @@ void UpdateModule::StartDownloadToFile() {
 	download_->current_payload_reader_ =
 		make_shared<events::io::AsyncReaderFromReader>(download_->event_loop_, payload_reader);
 	download_->current_payload_name_ = payload_reader->Name();
+	TracePayloadBegin();
 
 	auto stream_path = path::Join(update_module_workdir_, string("files"));
 	auto err = PrepareDownloadDirectory(stream_path);
@@ -334,6 +387,20 @@ void UpdateModule::StartDownloadToFile() {
 		return;
 	}
 
+	// The size is known up front, so check that it fits before downloading anything.
+	auto size = payload_reader->Size();
+	auto available = io::GetAvailableSpace(path::DirName(stream_path));
+	if (!available) {
+		log::Warning(available.error().String());
+	} else if (size > 0 && static_cast<uintmax_t>(size) > available.value()) {
+		DownloadErrorHandler(error::Error(
+			make_error_condition(errc::no_space_on_device),
+			"Payload file " + download_->current_payload_name_ + " of " + to_string(size)
+				+ " bytes does not fit in " + path::DirName(stream_path) + " ("
+				+ to_string(available.value()) + " bytes available)"));
+		return;
+	}
+
 	auto current_stream_writer =
 		make_shared<events::io::AsyncFileDescriptorWriter>(download_->event_loop_);
 	err = current_stream_writer->Open(stream_path);
@@ -341,6 +408,14 @@ void UpdateModule::StartDownloadToFile() {
 		DownloadErrorHandler(err);
 		return;
 	}
+	err = current_stream_writer->Preallocate(size);
+	if (err != error::NoError) {
+		DownloadErrorHandler(err.WithContext("Payload file " + download_->current_payload_name_));
+		return;
+	}
+	// The Update Module only reads the file in a later state, so there is no point in keeping it in
+	// the cache until then.
+	current_stream_writer->DropCacheBehind();
 	download_->current_stream_writer_ = current_stream_writer;
 
 	DownloadErrorHandler(download_->current_payload_reader_->AsyncRead(
@@ -349,6 +424,331 @@ void UpdateModule::StartDownloadToFile() {
 		}));
 }
 
+void UpdateModule::StartPluginDownload() {
+	log::Debug("Streaming payload to Update Module plugin");
+	PluginDownloadNextFile();
+}
+
+void UpdateModule::PluginDownloadNextFile() {
+	auto reader = download_->payload_.Next();
+	if (!reader) {
+		if (reader.error().code
+			== artifact::parser_error::MakeError(
+				   artifact::parser_error::NoMorePayloadFilesError, "")
+				   .code) {
+			log::Debug("Update Module plugin finished all downloads");
+			EndDownloadLoop(error::NoError);
+		} else {
+			DownloadErrorHandler(reader.error());
+		}
+		return;
+	}
+	auto payload_reader = make_shared<artifact::Reader>(std::move(reader.value()));
+
+	auto progress_reader = make_shared<progress::Reader>(payload_reader, payload_reader->Size());
+
+	download_->current_payload_reader_ =
+		make_shared<events::io::AsyncReaderFromReader>(download_->event_loop_, progress_reader);
+	download_->current_payload_name_ = payload_reader->Name();
+	TracePayloadBegin();
+	download_->current_payload_size_ = payload_reader->Size();
+
+	if (!download_->plugin_buffer_) {
+		download_->plugin_buffer_ = make_shared<vector<uint8_t>>(download_->buffer_.size());
+	}
+
+	auto destroyed = download_->destroyed_;
+	plugin_->AsyncBeginPayloadFile(
+		download_->event_loop_,
+		update_module_workdir_,
+		download_->current_payload_name_,
+		download_->current_payload_size_,
+		[this, destroyed](error::Error err) {
+			if (!*destroyed) {
+				PluginBeginPayloadFileHandler(err);
+			}
+		});
+}
+
+void UpdateModule::PluginBeginPayloadFileHandler(error::Error err) {
+	if (err != error::NoError) {
+		download_->current_payload_reader_.reset();
+		DownloadErrorHandler(err.WithContext("Download"));
+		return;
+	}
+
+	auto &buffer = *download_->plugin_buffer_;
+	DownloadErrorHandler(download_->current_payload_reader_->AsyncRead(
+		buffer.begin(), buffer.end(), [this](io::ExpectedSize result) {
+			PluginPayloadReadHandler(result);
+		}));
+}
+
+void UpdateModule::PluginPayloadReadHandler(io::ExpectedSize result) {
+	if (!result) {
+		download_->current_payload_reader_.reset();
+		DownloadErrorHandler(result.error());
+		return;
+	}
+
+	// The plugin may block, so it is called outside of the event loop. The buffer is not read
+	// into again before it has returned.
+	auto destroyed = download_->destroyed_;
+	if (result.value() > 0) {
+		size_t size = result.value();
+		download_->write_start_ = chrono::steady_clock::now();
+		plugin_->AsyncPayloadFileData(
+			download_->event_loop_,
+			download_->plugin_buffer_,
+			size,
+			[this, destroyed, size](error::Error err) {
+				if (!*destroyed) {
+					PluginPayloadWriteHandler(err, size);
+				}
+			});
+		return;
+	}
+
+	download_->current_payload_reader_.reset();
+	plugin_->AsyncEndPayloadFile(download_->event_loop_, [this, destroyed](error::Error err) {
+		if (!*destroyed) {
+			PluginEndPayloadFileHandler(err);
+		}
+	});
+}
+
+void UpdateModule::PluginPayloadWriteHandler(error::Error err, size_t written) {
+	if (err != error::NoError) {
+		download_->current_payload_reader_.reset();
+		DownloadErrorHandler(err.WithContext("Download"));
+		return;
+	}
+
+	static metrics::Stage stage("module_write");
+	stage.Record(written, chrono::steady_clock::now() - download_->write_start_);
+	download_->written_ += written;
+	log::Trace([this]() {
+		return "Wrote " + to_string(download_->written_) + " bytes to Update Module plugin";
+	});
+
+	auto &buffer = *download_->plugin_buffer_;
+	DownloadErrorHandler(download_->current_payload_reader_->AsyncRead(
+		buffer.begin(), buffer.end(), [this](io::ExpectedSize result) {
+			PluginPayloadReadHandler(result);
+		}));
+}
+
+void UpdateModule::PluginEndPayloadFileHandler(error::Error err) {
+	if (err != error::NoError) {
+		DownloadErrorHandler(err.WithContext("Download"));
+		return;
+	}
+	TracePayloadEnd();
+	PluginDownloadNextFile();
+}
+
+bool UpdateModule::UseRootfsImageWriter() const {
+	return payload_type_ == "rootfs-image" && ctx_.GetConfig().rootfs_image_writer.enabled;
+}
+
+void UpdateModule::StartRootfsImageWriterDownload(const string &partition) {
+	auto reader = download_->payload_.Next();
+	if (!reader) {
+		DownloadErrorHandler(reader.error().WithContext("Download"));
+		return;
+	}
+	auto payload_reader = make_shared<artifact::Reader>(std::move(reader.value()));
+
+	auto progress_reader = make_shared<progress::Reader>(payload_reader, payload_reader->Size());
+
+	download_->current_payload_reader_ =
+		make_shared<events::io::AsyncReaderFromReader>(download_->event_loop_, progress_reader);
+	download_->current_payload_name_ = payload_reader->Name();
+	TracePayloadBegin();
+	download_->current_payload_size_ = payload_reader->Size();
+	download_->current_payload_checksum_ = payload_reader->Checksum();
+
+	rootfs_writer::Checkpoint checkpoint {
+		partition, download_->current_payload_checksum_, download_->current_payload_size_, 0};
+	int64_t resume_offset = 0;
+	auto exp_checkpoint_data = ctx_.GetMenderStoreDB().Read(rootfs_writer::kCheckpointKey);
+	if (rootfs_writer_checkpoints_ && exp_checkpoint_data) {
+		auto exp_checkpoint = rootfs_writer::CheckpointFromJson(
+			common::StringFromByteVector(exp_checkpoint_data.value()));
+		if (!exp_checkpoint) {
+			log::Warning(exp_checkpoint.error().String());
+		} else if (exp_checkpoint.value().Matches(
+					   checkpoint.partition, checkpoint.checksum, checkpoint.size)) {
+			resume_offset = exp_checkpoint.value().offset;
+		}
+		if (resume_offset == 0) {
+			// Left behind by another payload, and would otherwise make every later
+			// interrupted download look resumable.
+			log::Info("Discarding rootfs-image checkpoint, which belongs to another payload");
+			RemoveRootfsImageWriterCheckpoint();
+		}
+	}
+
+	auto pending = make_shared<optional<rootfs_writer::Checkpoint>>();
+	download_->rootfs_writer_checkpoint_ = pending;
+	rootfs_writer::Writer::CheckpointHandler checkpoint_handler;
+	if (rootfs_writer_checkpoints_) {
+		// Called outside of the event loop, see `StoreRootfsImageWriterCheckpoint()`.
+		checkpoint_handler = [pending, checkpoint](int64_t offset) mutable {
+			checkpoint.offset = offset;
+			*pending = checkpoint;
+			return error::NoError;
+		};
+	}
+	auto exp_writer = rootfs_writer::Writer::Open(
+		partition,
+		download_->current_payload_size_,
+		ctx_.GetConfig().rootfs_image_writer,
+		resume_offset,
+		checkpoint_handler);
+	if (!exp_writer) {
+		DownloadErrorHandler(exp_writer.error().WithContext("Download"));
+		return;
+	}
+	download_->rootfs_writer_ = std::move(exp_writer.value());
+	download_->rootfs_writer_buffer_ = make_shared<vector<uint8_t>>(download_->buffer_.size());
+
+	log::Info("Writing " + download_->current_payload_name_ + " to " + partition);
+	auto &buffer = *download_->rootfs_writer_buffer_;
+	DownloadErrorHandler(download_->current_payload_reader_->AsyncRead(
+		buffer.begin(), buffer.end(), [this](io::ExpectedSize result) {
+			RootfsImageWriterReadHandler(result);
+		}));
+}
+
+void UpdateModule::RootfsImageWriterReadHandler(io::ExpectedSize result) {
+	if (!result) {
+		download_->current_payload_reader_.reset();
+		download_->rootfs_writer_.reset();
+		DownloadErrorHandler(result.error());
+		return;
+	}
+
+	// The writer blocks on the device, so it runs outside of the event loop. The buffer is not
+	// read into again before it has finished.
+	auto writer = download_->rootfs_writer_;
+	auto buffer = download_->rootfs_writer_buffer_;
+	auto destroyed = download_->destroyed_;
+
+	if (result.value() > 0) {
+		size_t size = result.value();
+		download_->write_start_ = chrono::steady_clock::now();
+		events::io::AsyncRunBlocking(
+			download_->event_loop_,
+			[writer, buffer, size]() -> error::Error {
+				auto exp_written = writer->Write(buffer->cbegin(), buffer->cbegin() + size);
+				if (!exp_written) {
+					return exp_written.error();
+				}
+				return error::NoError;
+			},
+			[this, destroyed, size](error::Error err) {
+				if (!*destroyed) {
+					RootfsImageWriterWriteHandler(err, size);
+				}
+			});
+		return;
+	}
+
+	download_->current_payload_reader_.reset();
+	auto checksum = download_->current_payload_checksum_;
+	events::io::AsyncRunBlocking(
+		download_->event_loop_,
+		[writer, checksum]() {
+			return writer->Finish(checksum);
+		},
+		[this, destroyed](error::Error err) {
+			if (!*destroyed) {
+				RootfsImageWriterFinishHandler(err);
+			}
+		});
+}
+
+void UpdateModule::RootfsImageWriterWriteHandler(error::Error err, size_t written) {
+	err = err.FollowedBy(StoreRootfsImageWriterCheckpoint());
+	if (err != error::NoError) {
+		download_->current_payload_reader_.reset();
+		download_->rootfs_writer_.reset();
+		DownloadErrorHandler(err.WithContext("Download"));
+		return;
+	}
+
+	static metrics::Stage stage("module_write");
+	stage.Record(written, chrono::steady_clock::now() - download_->write_start_);
+	download_->written_ += written;
+	log::Trace([this]() {
+		return "Wrote " + to_string(download_->written_) + " bytes to rootfs partition";
+	});
+
+	auto &buffer = *download_->rootfs_writer_buffer_;
+	DownloadErrorHandler(download_->current_payload_reader_->AsyncRead(
+		buffer.begin(), buffer.end(), [this](io::ExpectedSize result) {
+			RootfsImageWriterReadHandler(result);
+		}));
+}
+
+void UpdateModule::RootfsImageWriterFinishHandler(error::Error err) {
+	download_->rootfs_writer_.reset();
+	TracePayloadEnd();
+	// Either the payload is complete, or what was written doesn't match it. In both cases there
+	// is nothing to continue from. Other errors keep the checkpoint, for the next attempt.
+	RemoveRootfsImageWriterCheckpoint();
+	if (err != error::NoError) {
+		DownloadErrorHandler(err.WithContext("Download"));
+		return;
+	}
+
+	// Same restriction as in the rootfs-image Update Module.
+	auto reader = download_->payload_.Next();
+	if (reader) {
+		DownloadErrorHandler(error::Error(
+			make_error_condition(errc::invalid_argument),
+			"Download: More than one file in rootfs-image payload"));
+	} else if (
+		reader.error().code
+		!= artifact::parser_error::MakeError(artifact::parser_error::NoMorePayloadFilesError, "")
+			   .code) {
+		DownloadErrorHandler(reader.error());
+	} else {
+		EndDownloadLoop(error::NoError);
+	}
+}
+
+// The writer has synced the data up to the checkpoint to the device before reporting it, so it
+// can be stored now. The database belongs to the event loop, which is why this isn't done by the
+// writer itself.
+error::Error UpdateModule::StoreRootfsImageWriterCheckpoint() {
+	auto &pending = *download_->rootfs_writer_checkpoint_;
+	if (!pending) {
+		return error::NoError;
+	}
+	auto data = common::ByteVectorFromString(rootfs_writer::CheckpointToJson(pending.value()));
+	pending.reset();
+	// Losing the latest checkpoint only means continuing from an earlier one.
+	auto err = ctx_.GetMenderStoreDB().WriteTransactionDeferredSync(
+		[&data](kv_db::Transaction &txn) { return txn.Write(rootfs_writer::kCheckpointKey, data); });
+	if (err != error::NoError) {
+		return err.WithContext("Could not store checkpoint");
+	}
+	return error::NoError;
+}
+
+void UpdateModule::RemoveRootfsImageWriterCheckpoint() {
+	// Other payload types never store one.
+	if (!rootfs_writer_checkpoints_ || !UseRootfsImageWriter()) {
+		return;
+	}
+	auto err = ctx_.GetMenderStoreDB().Remove(rootfs_writer::kCheckpointKey);
+	if (err != error::NoError) {
+		log::Warning("Could not remove rootfs-image checkpoint: " + err.String());
+	}
+}
+
 } // namespace v3
 } // namespace update_module
 } // namespace update
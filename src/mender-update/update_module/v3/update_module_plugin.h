@@ -0,0 +1,94 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+// C ABI for Update Modules which are loaded into the client as shared objects, instead of being
+// executed as separate processes. This header is self-contained, and can be copied into the
+// source tree of a module.
+//
+// A plugin for payload type `<type>` is installed as `<modules path>/<type>.so`, next to where
+// an executable Update Module would be. If both exist, the plugin is used. The plugin must export
+// a function named by `MENDER_UPDATE_MODULE_PLUGIN_ENTRY_POINT`, with the signature of
+// `mender_update_module_plugin_entry_point_func`, returning a pointer to a table of functions
+// which stays valid until the library is unloaded.
+//
+// The states are the same as for executable Update Modules, with these differences:
+//
+// * `ProvidePayloadFileSizes` is never called; sizes are always provided.
+//
+// * Instead of `Download` and the `stream-next` / `streams` FIFOs, the client calls
+//   `payload_file_begin`, then `payload_file_data` for each block of the file, then
+//   `payload_file_end`, for each payload file, in the order they appear in the artifact. The
+//   data pointer points directly into the buffer the artifact is unpacked into, and is only
+//   valid during the call. The client doesn't read the next block of the artifact before
+//   `payload_file_data` has returned, so a plugin which can't keep up may simply block in it.
+//
+// * All the other states are passed to `call_state`. The states which produce output ("Yes",
+//   "No", etc) write it into `output` as a NUL-terminated string. A non-zero return value is
+//   treated the same way as a non-zero exit status of an executable Update Module.
+//
+// All functions, including `open` and `close`, are called from a thread of the plugin's own, one
+// at a time, and never from the client's event loop, so they may block. A state which takes
+// longer than `ModuleTimeoutSeconds` fails, but since it can't be interrupted, the client still
+// waits for it to return before calling the plugin again.
+
+#ifndef MENDER_UPDATE_UPDATE_MODULE_PLUGIN_H
+#define MENDER_UPDATE_UPDATE_MODULE_PLUGIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MENDER_UPDATE_MODULE_PLUGIN_ABI_VERSION 1
+#define MENDER_UPDATE_MODULE_PLUGIN_ENTRY_POINT "mender_update_module_plugin"
+
+enum mender_update_module_log_level {
+	MENDER_UPDATE_MODULE_LOG_ERROR = 0,
+	MENDER_UPDATE_MODULE_LOG_WARNING = 1,
+	MENDER_UPDATE_MODULE_LOG_INFO = 2,
+	MENDER_UPDATE_MODULE_LOG_DEBUG = 3,
+};
+
+// Writes a message to the client log. May be called from any thread.
+typedef void (*mender_update_module_log_func)(int level, const char *message);
+
+struct mender_update_module_plugin {
+	// Must be set to MENDER_UPDATE_MODULE_PLUGIN_ABI_VERSION.
+	uint32_t abi_version;
+
+	// Creates an instance for the file tree at `work_path`, which is also the working
+	// directory used for executable Update Modules. Returns NULL on failure.
+	void *(*open)(const char *work_path, mender_update_module_log_func log);
+
+	// All of these return zero on success.
+	int (*payload_file_begin)(void *instance, const char *name, int64_t size);
+	int (*payload_file_data)(void *instance, const uint8_t *data, size_t size);
+	int (*payload_file_end)(void *instance);
+	int (*call_state)(void *instance, const char *state, char *output, size_t output_size);
+
+	// Destroys the instance. Called after `Cleanup`, and also if the client is done with the
+	// module for any other reason, such as a restart of the client.
+	void (*close)(void *instance);
+};
+
+typedef const struct mender_update_module_plugin *(*mender_update_module_plugin_entry_point_func)(
+	void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MENDER_UPDATE_UPDATE_MODULE_PLUGIN_H
@@ -0,0 +1,484 @@
+// Copyright 2024 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+// Throughput benchmarks of the Artifact pipeline, each stage in isolation and end to end, on
+// synthetic Artifacts generated in memory. Run with `--help` for the options.
+//
+// Besides the throughput, each benchmark reports `allocs_per_MB`: the number of C++ heap
+// allocations per megabyte processed. Allocations made by C libraries, such as libarchive and
+// OpenSSL, are not counted.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <benchmark/benchmark.h>
+
+#include <artifact/artifact.hpp>
+#include <artifact/sha/sha.hpp>
+#include <artifact/tar/tar.hpp>
+#include <artifact/v3/header/header.hpp>
+#include <artifact/v3/manifest/manifest.hpp>
+#include <common/error.hpp>
+#include <common/io.hpp>
+#include <common/log.hpp>
+#include <mender-update/progress_reader/progress_reader.hpp>
+
+using namespace std;
+
+namespace artifact = mender::artifact;
+namespace error = mender::common::error;
+namespace header = mender::artifact::v3::header;
+namespace io = mender::common::io;
+namespace manifest = mender::artifact::v3::manifest;
+namespace mlog = mender::common::log;
+namespace progress = mender::update::progress;
+namespace sha = mender::sha;
+namespace tar = mender::tar;
+
+static atomic<uint64_t> allocations {0};
+
+void *operator new(size_t size) {
+	allocations.fetch_add(1, memory_order_relaxed);
+	void *ptr = malloc(size);
+	if (ptr == nullptr) {
+		throw bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	free(ptr);
+}
+
+enum class Compression {
+	None,
+	Gzip,
+	Xz,
+	Zstd,
+};
+
+static const map<Compression, string> compression_names {
+	{Compression::None, "none"},
+	{Compression::Gzip, "gzip"},
+	{Compression::Xz, "xz"},
+	{Compression::Zstd, "zstd"},
+};
+
+static const map<Compression, string> compression_suffixes {
+	{Compression::None, ""},
+	{Compression::Gzip, ".gz"},
+	{Compression::Xz, ".xz"},
+	{Compression::Zstd, ".zst"},
+};
+
+struct Options {
+	size_t size_mib {16};
+	size_t payload_files {1};
+	vector<Compression> compressions {
+		Compression::None, Compression::Gzip, Compression::Xz, Compression::Zstd};
+};
+
+// Writes a tar archive into memory, using libarchive directly, since the client itself never
+// writes archives.
+class ArchiveWriter {
+public:
+	ArchiveWriter(Compression compression) :
+		archive_ {archive_write_new(), archive_write_free} {
+		archive_write_set_format_ustar(archive_.get());
+		switch (compression) {
+		case Compression::None:
+			break;
+		case Compression::Gzip:
+			archive_write_add_filter_gzip(archive_.get());
+			break;
+		case Compression::Xz:
+			archive_write_add_filter_xz(archive_.get());
+			break;
+		case Compression::Zstd:
+			archive_write_add_filter_zstd(archive_.get());
+			break;
+		}
+		archive_write_set_bytes_in_last_block(archive_.get(), 1);
+		archive_write_open(archive_.get(), &output_, nullptr, WriteCallback, nullptr);
+	}
+
+	void Add(const string &name, const vector<uint8_t> &data) {
+		unique_ptr<archive_entry, void (*)(archive_entry *)> entry {
+			archive_entry_new(), archive_entry_free};
+		archive_entry_set_pathname(entry.get(), name.c_str());
+		archive_entry_set_size(entry.get(), static_cast<la_int64_t>(data.size()));
+		archive_entry_set_filetype(entry.get(), AE_IFREG);
+		archive_entry_set_perm(entry.get(), 0644);
+		archive_write_header(archive_.get(), entry.get());
+		archive_write_data(archive_.get(), data.data(), data.size());
+	}
+
+	vector<uint8_t> Finish() {
+		archive_write_close(archive_.get());
+		return std::move(output_);
+	}
+
+private:
+	static la_ssize_t WriteCallback(
+		struct archive *, void *client_data, const void *buffer, size_t length) {
+		auto &output = *static_cast<vector<uint8_t> *>(client_data);
+		auto bytes = static_cast<const uint8_t *>(buffer);
+		output.insert(output.end(), bytes, bytes + length);
+		return static_cast<la_ssize_t>(length);
+	}
+
+	unique_ptr<struct archive, int (*)(struct archive *)> archive_;
+	vector<uint8_t> output_;
+};
+
+static vector<uint8_t> ToBytes(const string &str) {
+	return vector<uint8_t>(str.begin(), str.end());
+}
+
+// Moderately compressible data, so that the decompressors do a realistic amount of work.
+static vector<uint8_t> GeneratePayloadFile(size_t size, uint32_t seed) {
+	vector<uint8_t> data(size);
+	uint32_t state = seed * 2654435761u + 1;
+	for (auto &byte : data) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		byte = static_cast<uint8_t>(state & 0x3f);
+	}
+	return data;
+}
+
+static string FileName(size_t index) {
+	char name[32];
+	snprintf(name, sizeof(name), "file%04zu", index);
+	return name;
+}
+
+struct SyntheticArtifact {
+	// The whole Artifact.
+	vector<uint8_t> artifact;
+	// Its parts, as stored in the Artifact.
+	vector<uint8_t> manifest;
+	vector<uint8_t> header;
+	vector<uint8_t> data;
+	// One uncompressed payload file.
+	vector<uint8_t> payload_file;
+	// Total uncompressed size of all payload files.
+	size_t payload_size {0};
+};
+
+static SyntheticArtifact GenerateArtifact(const Options &options, Compression compression) {
+	SyntheticArtifact generated;
+	const auto &suffix = compression_suffixes.at(compression);
+	size_t file_size = options.size_mib * 1024 * 1024 / options.payload_files;
+
+	string manifest_text;
+
+	ArchiveWriter data_writer {compression};
+	for (size_t i = 0; i < options.payload_files; i++) {
+		auto file = GeneratePayloadFile(file_size, static_cast<uint32_t>(i));
+		manifest_text += sha::Shasum(file).value().String() + "  data/0000/" + FileName(i) + "\n";
+		data_writer.Add(FileName(i), file);
+		generated.payload_size += file.size();
+		if (i == 0) {
+			generated.payload_file = std::move(file);
+		}
+	}
+	generated.data = data_writer.Finish();
+
+	ArchiveWriter header_writer {compression};
+	header_writer.Add(
+		"header-info",
+		ToBytes(
+			R"({"payloads":[{"type":"rootfs-image"}],)"
+			R"("artifact_provides":{"artifact_name":"bench"},)"
+			R"("artifact_depends":{"device_type":["bench-device"]}})"));
+	header_writer.Add(
+		"headers/0000/type-info",
+		ToBytes(
+			R"({"type":"rootfs-image",)"
+			R"("artifact_provides":{"rootfs-image.checksum":"bench"}})"));
+	generated.header = header_writer.Finish();
+
+	auto version = ToBytes(R"({"format":"mender","version":3})");
+	manifest_text += sha::Shasum(version).value().String() + "  version\n";
+	manifest_text +=
+		sha::Shasum(generated.header).value().String() + "  header.tar" + suffix + "\n";
+	generated.manifest = ToBytes(manifest_text);
+
+	ArchiveWriter artifact_writer {Compression::None};
+	artifact_writer.Add("version", version);
+	artifact_writer.Add("manifest", generated.manifest);
+	artifact_writer.Add("header.tar" + suffix, generated.header);
+	artifact_writer.Add("data/0000.tar" + suffix, generated.data);
+	generated.artifact = artifact_writer.Finish();
+
+	return generated;
+}
+
+// Runs `func` as the body of the benchmark, which processes `bytes` per iteration, and reports
+// the throughput and the allocations.
+static void Measure(
+	benchmark::State &state, size_t bytes, const function<error::Error()> &func) {
+	uint64_t allocations_before = allocations.load(memory_order_relaxed);
+	for (auto _ : state) {
+		auto err = func();
+		if (err != error::NoError) {
+			state.SkipWithError(err.String().c_str());
+			return;
+		}
+	}
+	auto total_bytes = static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(bytes);
+	state.SetBytesProcessed(total_bytes);
+	state.counters["allocs_per_MB"] = benchmark::Counter(
+		static_cast<double>(allocations.load(memory_order_relaxed) - allocations_before)
+		/ (static_cast<double>(total_bytes) / 1e6));
+}
+
+static void BenchIoCopy(benchmark::State &state, SyntheticArtifact &generated) {
+	Measure(state, generated.payload_file.size(), [&generated]() {
+		io::ByteReader reader {generated.payload_file};
+		io::Discard discard;
+		return io::Copy(discard, reader);
+	});
+}
+
+static void BenchShaReader(benchmark::State &state, SyntheticArtifact &generated) {
+	auto expected_sha = sha::Shasum(generated.payload_file).value().String();
+	Measure(state, generated.payload_file.size(), [&generated, &expected_sha]() {
+		io::ByteReader reader {generated.payload_file};
+		sha::Reader sha_reader {reader, expected_sha};
+		io::Discard discard;
+		return io::Copy(discard, sha_reader);
+	});
+}
+
+static void BenchProgressReader(benchmark::State &state, SyntheticArtifact &generated) {
+	// Silence the progress, which is printed to stderr.
+	auto stderr_buf = cerr.rdbuf(nullptr);
+	Measure(state, generated.payload_file.size(), [&generated]() {
+		progress::Reader progress_reader {
+			make_shared<io::ByteReader>(generated.payload_file),
+			static_cast<int64_t>(generated.payload_file.size())};
+		io::Discard discard;
+		return io::Copy(discard, progress_reader);
+	});
+	cerr.rdbuf(stderr_buf);
+	cerr.clear();
+}
+
+static void BenchManifest(benchmark::State &state, SyntheticArtifact &generated) {
+	Measure(state, generated.manifest.size(), [&generated]() {
+		io::ByteReader reader {generated.manifest};
+		auto parsed = manifest::Parse(reader);
+		return parsed ? error::NoError : parsed.error();
+	});
+}
+
+static void BenchHeader(benchmark::State &state, SyntheticArtifact &generated) {
+	Measure(state, generated.header.size(), [&generated]() {
+		io::ByteReader reader {generated.header};
+		auto parsed = header::Parse(reader);
+		return parsed ? error::NoError : parsed.error();
+	});
+}
+
+static void BenchTarReader(benchmark::State &state, SyntheticArtifact &generated) {
+	Measure(state, generated.payload_size, [&generated]() {
+		io::ByteReader reader {generated.data};
+		tar::Reader tar_reader {reader};
+		io::Discard discard;
+		while (true) {
+			auto entry = tar_reader.Next();
+			if (!entry) {
+				if (entry.error().code == tar::MakeError(tar::TarEOFError, "").code) {
+					return error::NoError;
+				}
+				return entry.error();
+			}
+			auto err = io::Copy(discard, entry.value());
+			if (err != error::NoError) {
+				return err;
+			}
+		}
+	});
+}
+
+// Parses everything up to and including the header, as done before the payload is streamed.
+static void BenchParse(benchmark::State &state, SyntheticArtifact &generated) {
+	auto bytes = generated.artifact.size() - generated.data.size();
+	Measure(state, bytes, [&generated]() {
+		io::ByteReader reader {generated.artifact};
+		auto parsed = artifact::Parse(reader);
+		return parsed ? error::NoError : parsed.error();
+	});
+}
+
+// Parses the Artifact and reads all payload files through `Artifact::Next` and `Payload::Next`,
+// verifying their checksums. The throughput is given in uncompressed payload bytes.
+static void BenchEndToEnd(benchmark::State &state, SyntheticArtifact &generated) {
+	Measure(state, generated.payload_size, [&generated]() {
+		io::ByteReader reader {generated.artifact};
+		auto parsed = artifact::Parse(reader);
+		if (!parsed) {
+			return parsed.error();
+		}
+		auto payload = parsed.value().Next();
+		if (!payload) {
+			return payload.error();
+		}
+		io::Discard discard;
+		while (true) {
+			auto payload_file = payload.value().Next();
+			if (!payload_file) {
+				if (payload_file.error().code
+					== artifact::parser_error::MakeError(
+						   artifact::parser_error::NoMorePayloadFilesError, "")
+						   .code) {
+					return error::NoError;
+				}
+				return payload_file.error();
+			}
+			auto err = io::Copy(discard, payload_file.value());
+			if (err != error::NoError) {
+				return err;
+			}
+		}
+	});
+}
+
+// Registers without copying the Artifact, which `RegisterBenchmark` would do with its arguments.
+static void Register(
+	const string &name,
+	void (*bench)(benchmark::State &, SyntheticArtifact &),
+	SyntheticArtifact &generated) {
+	benchmark::RegisterBenchmark(name.c_str(), [bench, &generated](benchmark::State &state) {
+		bench(state, generated);
+	});
+}
+
+static void PrintUsage(const char *program) {
+	cout << "Usage: " << program << " [benchmark options] [--size-mib=N] [--payload-files=N]"
+		 << " [--compression=none,gzip,xz,zstd]" << endl
+		 << endl
+		 << "  --size-mib       Total uncompressed size of the payload (default 16)." << endl
+		 << "  --payload-files  Number of files the payload is split into (default 1)." << endl
+		 << "  --compression    Compressions to benchmark, separated by commas (default all)."
+		 << endl
+		 << endl
+		 << "See `--benchmark_filter` and the other `--benchmark_*` options for the rest."
+		 << endl;
+}
+
+static bool ParseOptions(int argc, char **argv, Options &options) {
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		auto value_of = [&arg](const string &flag) -> const char * {
+			return arg.find(flag + "=") == 0 ? arg.c_str() + flag.size() + 1 : nullptr;
+		};
+		if (const char *value = value_of("--size-mib")) {
+			options.size_mib = strtoul(value, nullptr, 10);
+		} else if (const char *value = value_of("--payload-files")) {
+			options.payload_files = strtoul(value, nullptr, 10);
+		} else if (const char *value = value_of("--compression")) {
+			options.compressions.clear();
+			string list = value;
+			size_t start = 0;
+			while (start <= list.size()) {
+				auto end = list.find(',', start);
+				auto name = list.substr(start, end == string::npos ? string::npos : end - start);
+				bool found = false;
+				for (const auto &compression : compression_names) {
+					if (compression.second == name) {
+						options.compressions.push_back(compression.first);
+						found = true;
+					}
+				}
+				if (!found) {
+					cerr << "Unknown compression: " << name << endl;
+					return false;
+				}
+				if (end == string::npos) {
+					break;
+				}
+				start = end + 1;
+			}
+		} else if (arg == "--help" || arg == "-h") {
+			return false;
+		} else {
+			cerr << "Unknown option: " << arg << endl;
+			return false;
+		}
+	}
+	if (options.size_mib == 0 || options.payload_files == 0) {
+		cerr << "The size and the number of payload files must be positive" << endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	benchmark::Initialize(&argc, argv);
+
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	// Logging each parsed Artifact would dominate the measurements.
+	mlog::SetLevel(mlog::LogLevel::Warning);
+
+	// Generated up front, and kept for the whole run, since the benchmarks refer to them.
+	map<Compression, SyntheticArtifact> artifacts;
+	for (auto compression : options.compressions) {
+		artifacts[compression] = GenerateArtifact(options, compression);
+	}
+
+	// These don't depend on the compression.
+	auto &any = artifacts.begin()->second;
+	Register("io::Copy", BenchIoCopy, any);
+	Register("sha::Reader", BenchShaReader, any);
+	Register("progress::Reader", BenchProgressReader, any);
+	Register("manifest::Parse", BenchManifest, any);
+
+	for (auto &entry : artifacts) {
+		const auto &name = compression_names.at(entry.first);
+		Register("header::Parse/" + name, BenchHeader, entry.second);
+		Register("tar::Reader/" + name, BenchTarReader, entry.second);
+		Register("artifact::Parse/" + name, BenchParse, entry.second);
+		Register("end_to_end/" + name, BenchEndToEnd, entry.second);
+	}
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
@@ -35,17 +35,28 @@ const string complete_config = R"({
   "DeviceTypeFile": "DeviceTypeFile_value",
   "ServerCertificate": "ServerCertificate_value",
   "UpdateLogPath": "UpdateLogPath_value",
+  "DeploymentLogMaxSizeKiB": 256,
+  "DeploymentTracing": true,
   "TenantToken": "TenantToken_value",
   "DaemonLogLevel": "DaemonLogLevel_value",
+  "DaemonLogOverflowPolicy": "block",
   "DeviceTier": "standard",
 
   "SkipVerify": true,
+  "UpdateModuleSessions": true,
+  "BuiltinUpdateModules": ["directory", "single-file"],
+  "DatabaseDeferredSync": true,
+  "DatabaseCache": false,
   "DBus": { "Enabled": true },
 
   "UpdateControlMapExpirationTimeSeconds": 1,
   "UpdateControlMapBootExpirationTimeSeconds": 2,
   "UpdatePollIntervalSeconds": 3,
+  "DeploymentLongPollSeconds": 240,
+  "DaemonLogQueueSize": 4096,
+  "DaemonStallThresholdMilliseconds": 50,
   "InventoryPollIntervalSeconds": 4,
+  "InventoryFullSyncIntervalSeconds": 12,
   "RetryPollIntervalSeconds": 5,
   "RetryPollCount": 6,
   "StateScriptTimeoutSeconds": 7,
@@ -75,6 +86,16 @@ const string complete_config = R"({
     "SSLEngine": "SecuritySSLEngine_value"
   },
 
+  "RootfsImageWriter": {
+    "Enabled": true,
+    "DirectIO": false,
+    "SyncIntervalBytes": 13,
+    "Verify": false,
+    "SkipZeroBlocks": true,
+    "TargetPreDiscarded": true,
+    "CheckpointIntervalBytes": 14
+  },
+
   "Connectivity": {
     "DisableKeepAlive": true,
     "IdleConnTimeoutSeconds": 11
@@ -98,14 +119,25 @@ TEST(ConfigParserDefaultsTests, ConfigParserDefaults) {
 	EXPECT_EQ(mc.device_type_file, "");
 	EXPECT_EQ(mc.server_certificate, "");
 	EXPECT_EQ(mc.update_log_path, "");
+	EXPECT_EQ(mc.deployment_log_max_size_kib, 1024);
+	EXPECT_FALSE(mc.deployment_tracing);
 	EXPECT_EQ(mc.tenant_token, "");
 	EXPECT_EQ(mc.daemon_log_level, "");
+	EXPECT_EQ(mc.daemon_log_overflow_policy, "");
 	EXPECT_EQ(mc.device_tier, device_tier::kStandard);
 
 	EXPECT_FALSE(mc.skip_verify);
+	EXPECT_FALSE(mc.update_module_sessions);
+	EXPECT_TRUE(mc.builtin_update_modules.empty());
+	EXPECT_FALSE(mc.database_deferred_sync);
+	EXPECT_TRUE(mc.database_cache);
 
 	EXPECT_EQ(mc.update_poll_interval_seconds, 1800);
+	EXPECT_EQ(mc.deployment_long_poll_seconds, 0);
+	EXPECT_EQ(mc.daemon_log_queue_size, 0);
+	EXPECT_EQ(mc.daemon_stall_threshold_milliseconds, 0);
 	EXPECT_EQ(mc.inventory_poll_interval_seconds, 28800);
+	EXPECT_EQ(mc.inventory_full_sync_interval_seconds, 86400);
 	EXPECT_EQ(mc.retry_poll_interval_seconds, 0);
 	EXPECT_EQ(mc.retry_poll_count, 0);
 	EXPECT_EQ(mc.state_script_timeout_seconds, 3600);
@@ -123,6 +155,16 @@ TEST(ConfigParserDefaultsTests, ConfigParserDefaults) {
 
 	EXPECT_EQ(mc.security.auth_private_key, "");
 	EXPECT_EQ(mc.security.ssl_engine, "");
+
+	EXPECT_EQ(mc.rootfs_part_A, "");
+	EXPECT_EQ(mc.rootfs_part_B, "");
+	EXPECT_FALSE(mc.rootfs_image_writer.enabled);
+	EXPECT_TRUE(mc.rootfs_image_writer.direct_io);
+	EXPECT_EQ(mc.rootfs_image_writer.sync_interval_bytes, 8 * 1024 * 1024);
+	EXPECT_TRUE(mc.rootfs_image_writer.verify);
+	EXPECT_FALSE(mc.rootfs_image_writer.skip_zero_blocks);
+	EXPECT_FALSE(mc.rootfs_image_writer.target_pre_discarded);
+	EXPECT_EQ(mc.rootfs_image_writer.checkpoint_interval_bytes, 64 * 1024 * 1024);
 }
 
 TEST_F(ConfigParserTests, LoadComplete) {
@@ -138,14 +180,25 @@ TEST_F(ConfigParserTests, LoadComplete) {
 	EXPECT_EQ(mc.device_type_file, "DeviceTypeFile_value");
 	EXPECT_EQ(mc.server_certificate, "ServerCertificate_value");
 	EXPECT_EQ(mc.update_log_path, "UpdateLogPath_value");
+	EXPECT_EQ(mc.deployment_log_max_size_kib, 256);
+	EXPECT_TRUE(mc.deployment_tracing);
 	EXPECT_EQ(mc.tenant_token, "TenantToken_value");
 	EXPECT_EQ(mc.daemon_log_level, "DaemonLogLevel_value");
+	EXPECT_EQ(mc.daemon_log_overflow_policy, "block");
 	EXPECT_EQ(mc.device_tier, device_tier::kStandard);
 
 	EXPECT_TRUE(mc.skip_verify);
+	EXPECT_TRUE(mc.update_module_sessions);
+	EXPECT_EQ(mc.builtin_update_modules, vector<string>({"directory", "single-file"}));
+	EXPECT_TRUE(mc.database_deferred_sync);
+	EXPECT_FALSE(mc.database_cache);
 
 	EXPECT_EQ(mc.update_poll_interval_seconds, 3);
+	EXPECT_EQ(mc.deployment_long_poll_seconds, 240);
+	EXPECT_EQ(mc.daemon_log_queue_size, 4096);
+	EXPECT_EQ(mc.daemon_stall_threshold_milliseconds, 50);
 	EXPECT_EQ(mc.inventory_poll_interval_seconds, 4);
+	EXPECT_EQ(mc.inventory_full_sync_interval_seconds, 12);
 	EXPECT_EQ(mc.retry_poll_interval_seconds, 5);
 	EXPECT_EQ(mc.retry_poll_count, 6);
 	EXPECT_EQ(mc.state_script_timeout_seconds, 7);
@@ -168,6 +221,16 @@ TEST_F(ConfigParserTests, LoadComplete) {
 
 	EXPECT_EQ(mc.security.auth_private_key, "AuthPrivateKey_value");
 	EXPECT_EQ(mc.security.ssl_engine, "SecuritySSLEngine_value");
+
+	EXPECT_EQ(mc.rootfs_part_A, "RootfsPartA_value");
+	EXPECT_EQ(mc.rootfs_part_B, "RootfsPartB_value");
+	EXPECT_TRUE(mc.rootfs_image_writer.enabled);
+	EXPECT_FALSE(mc.rootfs_image_writer.direct_io);
+	EXPECT_EQ(mc.rootfs_image_writer.sync_interval_bytes, 13);
+	EXPECT_FALSE(mc.rootfs_image_writer.verify);
+	EXPECT_TRUE(mc.rootfs_image_writer.skip_zero_blocks);
+	EXPECT_TRUE(mc.rootfs_image_writer.target_pre_discarded);
+	EXPECT_EQ(mc.rootfs_image_writer.checkpoint_interval_bytes, 14);
 }
 
 TEST_F(ConfigParserTests, LoadPartial) {
@@ -14,9 +14,16 @@
 
 #include <common/events_io.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
 #include <vector>
 #include <fstream>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <gtest/gtest.h>
 
 #include <common/path.hpp>
@@ -444,6 +451,276 @@ TEST(EventsIo, FileOpenErrors) {
 	EXPECT_EQ(err.code, make_error_condition(errc::no_such_file_or_directory));
 }
 
+TEST(EventsIo, FileReadAndWriteInChunks) {
+	mtesting::TemporaryDirectory tmpdir;
+	TestEventLoop loop;
+	string tmpfile = path::Join(tmpdir.Path(), "file");
+
+	vector<uint8_t> send;
+	for (int i = 0; i < 100000; i++) {
+		send.push_back(static_cast<uint8_t>(i));
+	}
+	const size_t chunk_size = 4096;
+
+	events::io::AsyncFileDescriptorWriter w(loop);
+	auto err = w.Open(tmpfile);
+	ASSERT_EQ(err, error::NoError);
+
+	// The loop must keep running other handlers while the file operations are in progress.
+	bool timer_fired {false};
+	events::Timer timer {loop};
+	timer.AsyncWait(chrono::milliseconds(0), [&timer_fired](error::Error err) {
+		timer_fired = true;
+	});
+
+	size_t written {0};
+	function<void(io::ExpectedSize)> write_handler;
+	write_handler = [&](io::ExpectedSize result) {
+		ASSERT_TRUE(result) << result.error().String();
+		written += result.value();
+		if (written == send.size()) {
+			loop.Stop();
+			return;
+		}
+		auto end = send.begin() + min(written + chunk_size, send.size());
+		auto err = w.AsyncWrite(send.begin() + written, end, write_handler);
+		ASSERT_EQ(err, error::NoError);
+	};
+	err = w.AsyncWrite(send.begin(), send.begin() + chunk_size, write_handler);
+	ASSERT_EQ(err, error::NoError);
+
+	loop.Run();
+	EXPECT_EQ(written, send.size());
+	EXPECT_TRUE(timer_fired);
+
+	events::io::AsyncFileDescriptorReader r(loop);
+	err = r.Open(tmpfile);
+	ASSERT_EQ(err, error::NoError);
+
+	vector<uint8_t> recv;
+	vector<uint8_t> buf(chunk_size);
+	function<void(io::ExpectedSize)> read_handler;
+	read_handler = [&](io::ExpectedSize result) {
+		ASSERT_TRUE(result) << result.error().String();
+		if (result.value() == 0) {
+			loop.Stop();
+			return;
+		}
+		recv.insert(recv.end(), buf.begin(), buf.begin() + result.value());
+		auto err = r.AsyncRead(buf.begin(), buf.end(), read_handler);
+		ASSERT_EQ(err, error::NoError);
+	};
+	err = r.AsyncRead(buf.begin(), buf.end(), read_handler);
+	ASSERT_EQ(err, error::NoError);
+
+	loop.Run();
+	EXPECT_EQ(recv, send);
+}
+
+TEST(EventsIo, CancelFileWrite) {
+	mtesting::TemporaryDirectory tmpdir;
+	TestEventLoop loop;
+
+	events::io::AsyncFileDescriptorWriter w(loop);
+	auto err = w.Open(path::Join(tmpdir.Path(), "file"));
+	ASSERT_EQ(err, error::NoError);
+
+	vector<uint8_t> send(1000, 'a');
+	bool called {false};
+	err = w.AsyncWrite(send.begin(), send.end(), [&](io::ExpectedSize result) {
+		called = true;
+		ASSERT_FALSE(result);
+		EXPECT_EQ(result.error().code, make_error_condition(errc::operation_canceled));
+		loop.Stop();
+	});
+	ASSERT_EQ(err, error::NoError);
+	w.Cancel();
+
+	loop.Run();
+	EXPECT_TRUE(called);
+}
+
+TEST(EventsIo, DestroyFileWriterBeforeHandlerIsCalled) {
+	mtesting::TemporaryDirectory tmpdir;
+	TestEventLoop loop;
+
+	auto w = make_shared<events::io::AsyncFileDescriptorWriter>(loop);
+	auto err = w->Open(path::Join(tmpdir.Path(), "file"));
+	ASSERT_EQ(err, error::NoError);
+
+	vector<uint8_t> send(1000, 'a');
+	err = w->AsyncWrite(send.begin(), send.end(), [](io::ExpectedSize result) {
+		FAIL() << "Should never get here";
+	});
+	ASSERT_EQ(err, error::NoError);
+
+	w.reset();
+
+	events::Timer timer {loop};
+	timer.AsyncWait(chrono::milliseconds(100), [&loop](error::Error err) { loop.Stop(); });
+
+	loop.Run();
+}
+
+TEST(EventsIo, FilePreallocate) {
+	mtesting::TemporaryDirectory tmpdir;
+	TestEventLoop loop;
+	string tmpfile = path::Join(tmpdir.Path(), "file");
+
+	events::io::AsyncFileDescriptorWriter w(loop);
+	auto err = w.Open(tmpfile);
+	ASSERT_EQ(err, error::NoError);
+	err = w.Preallocate(1024 * 1024);
+	ASSERT_EQ(err, error::NoError);
+
+	// The size stays the same, only the storage is reserved.
+	struct stat st;
+	ASSERT_EQ(stat(tmpfile.c_str(), &st), 0);
+	EXPECT_EQ(st.st_size, 0);
+
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	close(fds[0]);
+	events::io::AsyncFileDescriptorWriter pipe_writer(loop, fds[1]);
+	EXPECT_EQ(pipe_writer.Preallocate(1024 * 1024), error::NoError);
+}
+
+TEST(EventsIo, FileDropCacheBehind) {
+	mtesting::TemporaryDirectory tmpdir;
+	TestEventLoop loop;
+	string tmpfile = path::Join(tmpdir.Path(), "file");
+
+	vector<uint8_t> send(1024 * 1024);
+	for (size_t i = 0; i < send.size(); i++) {
+		send[i] = static_cast<uint8_t>(i / 7);
+	}
+	// Enough to get past the distance at which pages are dropped.
+	const int chunks = 32;
+
+	events::io::AsyncFileDescriptorWriter w(loop);
+	auto err = w.Open(tmpfile);
+	ASSERT_EQ(err, error::NoError);
+	ASSERT_EQ(w.Preallocate(send.size() * chunks), error::NoError);
+	w.DropCacheBehind();
+
+	int written {0};
+	function<void(io::ExpectedSize)> write_handler;
+	write_handler = [&](io::ExpectedSize result) {
+		ASSERT_TRUE(result) << result.error().String();
+		ASSERT_EQ(result.value(), send.size());
+		if (++written == chunks) {
+			loop.Stop();
+			return;
+		}
+		auto err = w.AsyncWrite(send.begin(), send.end(), write_handler);
+		ASSERT_EQ(err, error::NoError);
+	};
+	err = w.AsyncWrite(send.begin(), send.end(), write_handler);
+	ASSERT_EQ(err, error::NoError);
+
+	loop.Run();
+	ASSERT_EQ(written, chunks);
+
+	ifstream f(tmpfile, ios::binary);
+	vector<uint8_t> recv(send.size());
+	for (int i = 0; i < chunks; i++) {
+		ASSERT_TRUE(f.read(reinterpret_cast<char *>(recv.data()), recv.size()));
+		ASSERT_EQ(recv, send);
+	}
+	EXPECT_FALSE(f.read(reinterpret_cast<char *>(recv.data()), 1));
+}
+
+TEST(EventsIo, RunBlocking) {
+	TestEventLoop loop;
+	auto loop_thread = this_thread::get_id();
+
+	thread::id operation_thread;
+	bool timer_fired {false};
+	bool timer_fired_first {false};
+	events::io::AsyncRunBlocking(
+		loop,
+		[&operation_thread]() {
+			operation_thread = this_thread::get_id();
+			this_thread::sleep_for(chrono::milliseconds(500));
+			return error::Error(make_error_condition(errc::io_error), "Slow device");
+		},
+		[&](error::Error err) {
+			EXPECT_EQ(this_thread::get_id(), loop_thread);
+			EXPECT_EQ(err.code, make_error_condition(errc::io_error));
+			timer_fired_first = timer_fired;
+			loop.Stop();
+		});
+
+	// The loop keeps running while the operation blocks.
+	events::Timer timer {loop};
+	timer.AsyncWait(chrono::milliseconds(10), [&timer_fired](error::Error err) {
+		timer_fired = true;
+	});
+
+	loop.Run();
+	EXPECT_NE(operation_thread, loop_thread);
+	EXPECT_TRUE(timer_fired_first);
+}
+
+TEST(EventsIo, BlockingOperationQueue) {
+	TestEventLoop loop;
+
+	auto finished = make_shared<vector<int>>();
+	auto final_called = make_shared<atomic<bool>>(false);
+	vector<int> handled;
+	{
+		events::io::BlockingOperationQueue queue([final_called]() { *final_called = true; });
+
+		// The operations run in order, and never at the same time.
+		auto thread_id = make_shared<thread::id>();
+		for (int i = 0; i < 3; i++) {
+			queue.AsyncRun(
+				loop,
+				[finished, thread_id, i]() {
+					if (i == 0) {
+						*thread_id = this_thread::get_id();
+						this_thread::sleep_for(chrono::milliseconds(100));
+					}
+					EXPECT_EQ(*thread_id, this_thread::get_id());
+					finished->push_back(i);
+					return error::NoError;
+				},
+				[&handled, &loop, i](error::Error err) {
+					EXPECT_EQ(err, error::NoError);
+					handled.push_back(i);
+					if (i == 2) {
+						loop.Stop();
+					}
+				});
+		}
+		loop.Run();
+		EXPECT_EQ(handled, (vector<int> {0, 1, 2}));
+
+		// One which never finishes in time doesn't hold up the destruction, and neither it,
+		// nor the one after it, calls its handler.
+		for (int i = 3; i < 5; i++) {
+			queue.AsyncRun(
+				loop,
+				[finished, i]() {
+					this_thread::sleep_for(chrono::milliseconds(500));
+					finished->push_back(i);
+					return error::NoError;
+				},
+				[&handled, i](error::Error err) { handled.push_back(i); });
+		}
+		this_thread::sleep_for(chrono::milliseconds(100));
+	}
+	EXPECT_FALSE(*final_called);
+
+	events::Timer timer {loop};
+	timer.AsyncWait(chrono::seconds(1), [&loop](error::Error err) { loop.Stop(); });
+	loop.Run();
+
+	EXPECT_TRUE(*final_called);
+	EXPECT_EQ(*finished, (vector<int> {0, 1, 2, 3}));
+	EXPECT_EQ(handled, (vector<int> {0, 1, 2}));
+}
+
 TEST(EventsIo, DestroyWriterBeforeHandlerIsCalled) {
 	TestEventLoop loop;
 
@@ -22,6 +22,7 @@
 #include <array>
 
 #include <common/error.hpp>
+#include <common/metrics.hpp>
 
 using namespace std;
 
@@ -160,3 +161,44 @@ TEST(Events, SignalHandlerTest) {
 
 	EXPECT_EQ(n_sigs_handled, 3);
 }
+
+TEST(Events, StallDetection) {
+	auto &registry = mender::common::metrics::DefaultRegistry();
+	auto &stalls = registry.GetCounter("mender_event_loop_stalls_total", "");
+	auto callback_count = [&registry]() {
+		uint64_t count = 0;
+		for (auto bucket :
+			 registry.GetHistogram("mender_event_loop_callback_seconds", "").BucketCounts()) {
+			count += bucket;
+		}
+		return count;
+	};
+
+	events::EventLoop loop;
+	loop.EnableStallDetection(std::chrono::milliseconds(100));
+	auto stalls_before = stalls.Value();
+	auto callbacks_before = callback_count();
+
+	testing::internal::CaptureStderr();
+
+	loop.Post([]() {});
+	loop.Post(
+		[]() { std::this_thread::sleep_for(std::chrono::milliseconds(200)); }, "slow callback");
+	loop.Post([&loop]() {
+		// A recursive run which takes long, but doesn't block the loop.
+		events::Timer timer(loop);
+		timer.AsyncWait(std::chrono::milliseconds(200), [&loop](error::Error err) {
+			loop.Stop();
+		});
+		loop.Run();
+		loop.Stop();
+	});
+
+	loop.Run();
+
+	auto output = testing::internal::GetCapturedStderr();
+	EXPECT_NE(output.find(" for slow callback registered at "), string::npos) << output;
+	EXPECT_EQ(stalls.Value() - stalls_before, 1);
+	// The timer callback is measured too.
+	EXPECT_EQ(callback_count() - callbacks_before, 4);
+}
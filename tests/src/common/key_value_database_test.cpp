@@ -13,6 +13,7 @@
 //    limitations under the License.
 
 #include <common/key_value_database.hpp>
+#include <common/key_value_database_cache.hpp>
 
 #include <common/common.hpp>
 #include <common/config.h>
@@ -42,6 +43,8 @@ struct KeyValueDatabaseSetup {
 	string name;
 	// Order is important here: db should be destroyed before tmpdir.
 	shared_ptr<mender::common::testing::TemporaryDirectory> tmpdir;
+	// The database under `db`, if `db` is a cache, otherwise null.
+	shared_ptr<kvdb::KeyValueDatabase> backing;
 	shared_ptr<kvdb::KeyValueDatabase> db;
 };
 
@@ -59,6 +62,16 @@ static vector<KeyValueDatabaseSetup> GenerateDatabaseSetups() {
 	assert(err == error::NoError);
 	elem.db = lmdb_db;
 	ret.push_back(elem);
+
+	elem.name = "CachedLMDB";
+	elem.tmpdir = std::make_shared<mender::common::testing::TemporaryDirectory>();
+	lmdb_db = std::make_shared<kvdb::KeyValueDatabaseLmdb>();
+	err = lmdb_db->Open(elem.tmpdir->Path() + "mender-store");
+	assert(err == error::NoError);
+	elem.backing = lmdb_db;
+	elem.db = std::make_shared<kvdb::KeyValueDatabaseCache>(
+		*lmdb_db, vector<string> {"key", "foo", "test", "bogus"});
+	ret.push_back(elem);
 #endif
 
 	return ret;
@@ -193,7 +206,260 @@ TEST_P(KeyValueDatabaseTest, TestReadTransactionFailure) {
 	EXPECT_EQ(db_error, err);
 }
 
+TEST_P(KeyValueDatabaseTest, TestWriteTransactionDeferredSync) {
+	kvdb::KeyValueDatabase &db = *GetParam().db;
+
+	auto err = db.WriteTransactionDeferredSync([](kvdb::Transaction &txn) -> error::Error {
+		return txn.Write("foo", common::ByteVectorFromString("bar"));
+	});
+	ASSERT_EQ(error::NoError, err);
+	err = db.WriteTransactionDeferredSync([](kvdb::Transaction &txn) -> error::Error {
+		txn.Write("test", common::ByteVectorFromString("val"));
+		return kvdb::Error(make_error_condition(errc::io_error), "Some test error from I/O");
+	});
+	ASSERT_NE(error::NoError, err);
+
+	auto data = db.Read("foo");
+	ASSERT_TRUE(data);
+	EXPECT_EQ(data.value(), common::ByteVectorFromString("bar"));
+	EXPECT_FALSE(db.Read("test"));
+
+	EXPECT_EQ(error::NoError, db.Sync());
+}
+
+TEST_P(KeyValueDatabaseTest, TestScan) {
+	kvdb::KeyValueDatabase &db = *GetParam().db;
+
+	auto err = db.WriteMany({
+		{"b-2", common::ByteVectorFromString("2")},
+		{"a", common::ByteVectorFromString("0")},
+		{"b-1", common::ByteVectorFromString("1")},
+		{"b", common::ByteVectorFromString("b")},
+		{"c", common::ByteVectorFromString("3")},
+	});
+	ASSERT_EQ(error::NoError, err);
+
+	vector<string> keys;
+	vector<string> values;
+	err = db.Scan("b-", [&keys, &values](const string &key, const vector<uint8_t> &value) {
+		keys.push_back(key);
+		values.push_back(common::StringFromByteVector(value));
+		return error::NoError;
+	});
+	ASSERT_EQ(error::NoError, err);
+	EXPECT_EQ(keys, vector<string>({"b-1", "b-2"}));
+	EXPECT_EQ(values, vector<string>({"1", "2"}));
+
+	// Everything, in order.
+	auto all_keys = db.ReadTransaction([](kvdb::Transaction &txn) -> error::Error {
+		auto keys = kvdb::ListKeys(txn, "");
+		EXPECT_TRUE(keys);
+		EXPECT_EQ(keys.value(), vector<string>({"a", "b", "b-1", "b-2", "c"}));
+		return error::NoError;
+	});
+	ASSERT_EQ(error::NoError, all_keys);
+
+	// No matches.
+	err = db.Scan("d", [](const string &key, const vector<uint8_t> &value) {
+		ADD_FAILURE() << "Unexpected key " << key;
+		return error::NoError;
+	});
+	EXPECT_EQ(error::NoError, err);
+
+	// Errors stop the scan.
+	int count = 0;
+	auto scan_err = kvdb::Error(make_error_condition(errc::io_error), "Stop");
+	err = db.Scan("", [&count, &scan_err](const string &key, const vector<uint8_t> &value) {
+		count++;
+		return scan_err;
+	});
+	EXPECT_EQ(scan_err, err);
+	EXPECT_EQ(count, 1);
+
+	err = db.WriteTransaction(
+		[](kvdb::Transaction &txn) -> error::Error { return kvdb::RemovePrefix(txn, "b"); });
+	ASSERT_EQ(error::NoError, err);
+	err = db.ReadTransaction([](kvdb::Transaction &txn) -> error::Error {
+		auto keys = kvdb::ListKeys(txn, "");
+		EXPECT_TRUE(keys);
+		EXPECT_EQ(keys.value(), vector<string>({"a", "c"}));
+		return error::NoError;
+	});
+	ASSERT_EQ(error::NoError, err);
+}
+
+TEST_P(KeyValueDatabaseTest, TestReadMany) {
+	kvdb::KeyValueDatabase &db = *GetParam().db;
+
+	db.Write("foo", common::ByteVectorFromString("bar"));
+	db.Write("test", common::ByteVectorFromString("val"));
+
+	auto values = db.ReadMany({"test", "bogus", "foo"});
+	ASSERT_TRUE(values) << values.error().String();
+	EXPECT_EQ(
+		values.value(),
+		kvdb::KeyValueMap({
+			{"foo", common::ByteVectorFromString("bar")},
+			{"test", common::ByteVectorFromString("val")},
+		}));
+
+	values = db.ReadMany({});
+	ASSERT_TRUE(values);
+	EXPECT_TRUE(values.value().empty());
+}
+
 #ifdef MENDER_USE_LMDB
+TEST(KeyValueDatabaseLmdbTest, DeferredSync) {
+	mtesting::TemporaryDirectory tmpdir;
+	string db_path = path::Join(tmpdir.Path(), "db");
+
+	kvdb::KeyValueDatabaseLmdb db;
+	ASSERT_EQ(error::NoError, db.Open(db_path));
+	db.SetDeferredSync(true);
+
+	auto err = db.WriteTransactionDeferredSync([](kvdb::Transaction &txn) -> error::Error {
+		return txn.Write("deferred", common::ByteVectorFromString("1"));
+	});
+	ASSERT_EQ(error::NoError, err);
+	// Synced commits are still synced, and take the deferred ones with them.
+	ASSERT_EQ(error::NoError, db.Write("synced", common::ByteVectorFromString("2")));
+	err = db.WriteTransactionDeferredSync([](kvdb::Transaction &txn) -> error::Error {
+		return txn.Write("deferred", common::ByteVectorFromString("3"));
+	});
+	ASSERT_EQ(error::NoError, err);
+
+	// Closing syncs what is left.
+	db.Close();
+	ASSERT_EQ(error::NoError, db.Open(db_path));
+
+	auto data = db.Read("deferred");
+	ASSERT_TRUE(data);
+	EXPECT_EQ(data.value(), common::ByteVectorFromString("3"));
+	data = db.Read("synced");
+	ASSERT_TRUE(data);
+	EXPECT_EQ(data.value(), common::ByteVectorFromString("2"));
+}
+
+TEST(KeyValueDatabaseLmdbTest, LastTransactionId) {
+	mtesting::TemporaryDirectory tmpdir;
+	string db_path = path::Join(tmpdir.Path(), "db");
+
+	kvdb::KeyValueDatabaseLmdb db;
+	ASSERT_EQ(error::NoError, db.Open(db_path));
+
+	auto id = db.LastTransactionId();
+	ASSERT_TRUE(id) << id.error().String();
+	auto first = id.value();
+
+	ASSERT_EQ(error::NoError, db.Write("foo", common::ByteVectorFromString("bar")));
+	id = db.LastTransactionId();
+	ASSERT_TRUE(id);
+	EXPECT_EQ(id.value(), first + 1);
+
+	// Aborted transactions don't count.
+	db.WriteTransaction([](kvdb::Transaction &txn) -> error::Error {
+		txn.Write("foo", common::ByteVectorFromString("baz"));
+		return error::MakeError(error::GenericError, "Abort");
+	});
+	id = db.LastTransactionId();
+	ASSERT_TRUE(id);
+	EXPECT_EQ(id.value(), first + 1);
+}
+
+TEST(KeyValueDatabaseCacheTest, SeesWritesFromOtherInstances) {
+	mtesting::TemporaryDirectory tmpdir;
+	string db_path = path::Join(tmpdir.Path(), "db");
+
+	kvdb::KeyValueDatabaseLmdb db;
+	ASSERT_EQ(error::NoError, db.Open(db_path));
+	kvdb::KeyValueDatabaseCache cache(db, {"foo", "missing"});
+	// Stands in for another process.
+	kvdb::KeyValueDatabaseLmdb other;
+	ASSERT_EQ(error::NoError, other.Open(db_path));
+
+	ASSERT_EQ(error::NoError, cache.Write("foo", common::ByteVectorFromString("bar")));
+	auto data = cache.Read("foo");
+	ASSERT_TRUE(data);
+	EXPECT_EQ(data.value(), common::ByteVectorFromString("bar"));
+	data = cache.Read("missing");
+	ASSERT_FALSE(data);
+	EXPECT_EQ(data.error().code, kvdb::MakeError(kvdb::KeyError, "").code);
+
+	ASSERT_EQ(error::NoError, other.Write("foo", common::ByteVectorFromString("baz")));
+	ASSERT_EQ(error::NoError, other.Write("missing", common::ByteVectorFromString("found")));
+
+	data = cache.Read("foo");
+	ASSERT_TRUE(data);
+	EXPECT_EQ(data.value(), common::ByteVectorFromString("baz"));
+	auto values = cache.ReadMany({"foo", "missing"});
+	ASSERT_TRUE(values);
+	EXPECT_EQ(
+		values.value(),
+		kvdb::KeyValueMap({
+			{"foo", common::ByteVectorFromString("baz")},
+			{"missing", common::ByteVectorFromString("found")},
+		}));
+
+	// Own writes update the cache, also when they come in a transaction.
+	auto err = cache.WriteTransaction([](kvdb::Transaction &txn) -> error::Error {
+		auto err = txn.Remove("foo");
+		if (err != error::NoError) {
+			return err;
+		}
+		return txn.Write("missing", common::ByteVectorFromString("again"));
+	});
+	ASSERT_EQ(error::NoError, err);
+	data = cache.Read("foo");
+	EXPECT_FALSE(data);
+	data = other.Read("missing");
+	ASSERT_TRUE(data);
+	EXPECT_EQ(data.value(), common::ByteVectorFromString("again"));
+	data = cache.Read("missing");
+	ASSERT_TRUE(data);
+	EXPECT_EQ(data.value(), common::ByteVectorFromString("again"));
+}
+
+TEST(KeyValueDatabaseCacheTest, WritesWhichChangeNothing) {
+	mtesting::TemporaryDirectory tmpdir;
+	string db_path = path::Join(tmpdir.Path(), "db");
+
+	kvdb::KeyValueDatabaseLmdb db;
+	ASSERT_EQ(error::NoError, db.Open(db_path));
+	kvdb::KeyValueDatabaseCache cache(db, {"foo", "missing"});
+	kvdb::KeyValueDatabaseLmdb other;
+	ASSERT_EQ(error::NoError, other.Open(db_path));
+
+	ASSERT_EQ(error::NoError, cache.Write("foo", common::ByteVectorFromString("bar")));
+
+	// These may not commit anything, and must neither break the cache nor make it miss the
+	// writes which come after them.
+	ASSERT_EQ(error::NoError, cache.Remove("missing"));
+	ASSERT_EQ(error::NoError, cache.Remove("other"));
+	ASSERT_EQ(error::NoError, cache.WriteTransaction([](kvdb::Transaction &txn) -> error::Error {
+		return error::NoError;
+	}));
+	auto data = cache.Read("missing");
+	EXPECT_FALSE(data);
+
+	ASSERT_EQ(error::NoError, other.Write("foo", common::ByteVectorFromString("baz")));
+	data = cache.Read("foo");
+	ASSERT_TRUE(data);
+	EXPECT_EQ(data.value(), common::ByteVectorFromString("baz"));
+
+	// With the cache disabled, everything still works, straight from the database.
+	cache.SetEnabled(false);
+	ASSERT_EQ(error::NoError, cache.Write("foo", common::ByteVectorFromString("qux")));
+	ASSERT_EQ(error::NoError, other.Write("missing", common::ByteVectorFromString("found")));
+	auto values = cache.ReadMany({"foo", "missing"});
+	ASSERT_TRUE(values);
+	EXPECT_EQ(
+		values.value(),
+		kvdb::KeyValueMap({
+			{"foo", common::ByteVectorFromString("qux")},
+			{"missing", common::ByteVectorFromString("found")},
+		}));
+}
+
 TEST(KeyValueDatabaseLmdbTest, TestSomeLmdbExceptionPaths) {
 	kvdb::KeyValueDatabaseLmdb db;
 	auto err = db.Open("/non-existing-junk-path/leaf");
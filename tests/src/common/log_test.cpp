@@ -134,6 +134,45 @@ TEST_F(LogTestEnv, LoggerLevelFilters) {
 	EXPECT_THAT(output, testing::HasSubstr("Foobar"));
 }
 
+TEST_F(LogTestEnv, LazyMessages) {
+	namespace log = mender::common::log;
+
+	int built = 0;
+	auto message = [&built]() {
+		built++;
+		return string("lazy message");
+	};
+
+	testing::internal::CaptureStderr();
+	log::Debug(message);
+	logger.Trace(message);
+	auto output = testing::internal::GetCapturedStderr();
+	EXPECT_EQ(built, 0);
+	EXPECT_EQ(output, "");
+
+	testing::internal::CaptureStderr();
+	log::Info(message);
+	logger.Warning(message);
+	logger.Log(log::LogLevel::Error, message);
+	output = testing::internal::GetCapturedStderr();
+	EXPECT_EQ(built, 3);
+	EXPECT_THAT(output, testing::HasSubstr(R"(msg="lazy message")"));
+
+	log::SetLevel(log::LogLevel::Trace);
+	testing::internal::CaptureStderr();
+	log::Trace(message);
+	output = testing::internal::GetCapturedStderr();
+#ifdef MENDER_LOG_COMPILE_OUT_DEBUG
+	EXPECT_EQ(built, 3);
+	EXPECT_EQ(output, "");
+	EXPECT_EQ(log::Level(), log::LogLevel::Info);
+#else
+	EXPECT_EQ(built, 4);
+	EXPECT_THAT(output, testing::HasSubstr(R"(msg="lazy message")"));
+	EXPECT_EQ(log::Level(), log::LogLevel::Trace);
+#endif
+}
+
 class FileLogTestEnv : public LogTestEnv {
 protected:
 	mender::common::testing::TemporaryDirectory logs_dir;
@@ -167,3 +206,124 @@ TEST(BadFileLogTest, SetupBadFileLogging) {
 	ASSERT_NE(error::NoError, err);
 	EXPECT_EQ(err.code, log::MakeError(log::LogErrorCode::LogFileError, "").code);
 }
+
+static vector<string> ReadLines(const string &path) {
+	vector<string> lines;
+	std::ifstream stream(path);
+	string line;
+	while (std::getline(stream, line)) {
+		lines.push_back(line);
+	}
+	return lines;
+}
+
+TEST_F(FileLogTestEnv, AsyncLogging) {
+	namespace log = mender::common::log;
+	auto log_path = logs_dir.Path() + "/test.log";
+	ASSERT_EQ(log::SetupFileLogging(log_path), error::NoError);
+	log::SetupAsyncLogging({1024, log::LogOverflowPolicy::Block});
+
+	log::Info("info test message");
+	log::Error("error test message");
+	log::Flush();
+
+	auto lines = ReadLines(log_path);
+	ASSERT_EQ(lines.size(), 2);
+	EXPECT_THAT(lines[0], testing::HasSubstr("severity=info"));
+	EXPECT_THAT(lines[0], testing::HasSubstr(R"(msg="info test message")"));
+	EXPECT_THAT(lines[1], testing::HasSubstr("severity=error"));
+	EXPECT_THAT(lines[1], testing::HasSubstr(R"(msg="error test message")"));
+
+	// Going back to synchronous logging keeps writing to the same file.
+	log::SetupAsyncLogging({});
+	log::Info("sync test message");
+	lines = ReadLines(log_path);
+	ASSERT_EQ(lines.size(), 3);
+	EXPECT_THAT(lines[2], testing::HasSubstr(R"(msg="sync test message")"));
+}
+
+TEST_F(FileLogTestEnv, AsyncLoggingBlocksWhenFull) {
+	namespace log = mender::common::log;
+	auto log_path = logs_dir.Path() + "/test.log";
+	ASSERT_EQ(log::SetupFileLogging(log_path), error::NoError);
+	log::SetupAsyncLogging({2, log::LogOverflowPolicy::Block});
+
+	const int count = 1000;
+	for (int i = 0; i < count; i++) {
+		log::Info("message " + to_string(i));
+	}
+	log::SetupAsyncLogging({});
+
+	auto lines = ReadLines(log_path);
+	ASSERT_EQ(lines.size(), count);
+	for (int i = 0; i < count; i++) {
+		EXPECT_THAT(lines[i], testing::HasSubstr("msg=\"message " + to_string(i) + "\""));
+	}
+}
+
+TEST_F(FileLogTestEnv, AsyncLoggingDropsWhenFull) {
+	namespace log = mender::common::log;
+	auto log_path = logs_dir.Path() + "/test.log";
+	ASSERT_EQ(log::SetupFileLogging(log_path), error::NoError);
+	log::SetupAsyncLogging({2, log::LogOverflowPolicy::Drop});
+
+	const int count = 1000;
+	for (int i = 0; i < count; i++) {
+		log::Info("message " + to_string(i));
+	}
+	log::SetupAsyncLogging({});
+
+	// What gets dropped depends on how fast the writer thread is, but what makes it to the file
+	// must be in order.
+	auto lines = ReadLines(log_path);
+	ASSERT_GT(lines.size(), 0);
+	int next = 0;
+	for (auto &line : lines) {
+		if (line.find("log records were dropped") != string::npos) {
+			continue;
+		}
+		auto pos = line.find("msg=\"message ");
+		ASSERT_NE(pos, string::npos) << line;
+		int i = stoi(line.substr(pos + 13));
+		EXPECT_GE(i, next);
+		next = i + 1;
+	}
+}
+
+TEST_F(FileLogTestEnv, AsyncLoggingDoesNotDropWhenThereIsRoom) {
+	namespace log = mender::common::log;
+	auto log_path = logs_dir.Path() + "/test.log";
+	ASSERT_EQ(log::SetupFileLogging(log_path), error::NoError);
+
+	const int count = 1000;
+	log::SetupAsyncLogging({count, log::LogOverflowPolicy::Drop});
+	for (int i = 0; i < count; i++) {
+		log::Info("message " + to_string(i));
+	}
+	log::Flush();
+
+	auto lines = ReadLines(log_path);
+	ASSERT_EQ(lines.size(), count);
+	for (int i = 0; i < count; i++) {
+		EXPECT_THAT(lines[i], testing::HasSubstr("msg=\"message " + to_string(i) + "\""));
+	}
+
+	log::SetupAsyncLogging({});
+}
+
+TEST(LogOverflowPolicyTest, StringToLogOverflowPolicy) {
+	namespace log = mender::common::log;
+	auto policy = log::StringToLogOverflowPolicy("drop");
+	ASSERT_TRUE(policy);
+	EXPECT_EQ(policy.value(), log::LogOverflowPolicy::Drop);
+
+	policy = log::StringToLogOverflowPolicy("block");
+	ASSERT_TRUE(policy);
+	EXPECT_EQ(policy.value(), log::LogOverflowPolicy::Block);
+
+	policy = log::StringToLogOverflowPolicy("wait");
+	ASSERT_FALSE(policy);
+	EXPECT_EQ(
+		policy.error().code,
+		log::MakeError(log::LogErrorCode::InvalidOverflowPolicyError, "").code);
+}
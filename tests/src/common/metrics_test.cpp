@@ -0,0 +1,117 @@
+// Copyright 2024 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <common/metrics.hpp>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace metrics = mender::common::metrics;
+
+using namespace std;
+
+TEST(MetricsTests, CounterAndGauge) {
+	metrics::Registry registry;
+
+	auto &counter = registry.GetCounter("test_total", "A counter.");
+	counter.Increment();
+	counter.Increment(2.5);
+	EXPECT_EQ(counter.Value(), 3.5);
+
+	// The same name and labels give the same metric.
+	EXPECT_EQ(&registry.GetCounter("test_total", "A counter."), &counter);
+	EXPECT_NE(&registry.GetCounter("test_total", "A counter.", {{"a", "b"}}), &counter);
+
+	auto &gauge = registry.GetGauge("test_gauge", "A gauge.");
+	gauge.Set(10);
+	gauge.Add(-4);
+	EXPECT_EQ(gauge.Value(), 6);
+}
+
+TEST(MetricsTests, Histogram) {
+	metrics::Histogram histogram({1, 5});
+
+	histogram.Observe(0.5);
+	histogram.Observe(1);
+	histogram.Observe(3);
+	histogram.Observe(100);
+
+	EXPECT_EQ(histogram.BucketCounts(), (vector<uint64_t> {2, 1, 1}));
+	EXPECT_EQ(histogram.Sum(), 104.5);
+}
+
+TEST(MetricsTests, ConcurrentUpdates) {
+	metrics::Registry registry;
+	auto &counter = registry.GetCounter("test_total", "A counter.");
+
+	vector<thread> threads;
+	for (int i = 0; i < 4; i++) {
+		threads.emplace_back([&counter]() {
+			for (int j = 0; j < 10000; j++) {
+				counter.Increment();
+			}
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	EXPECT_EQ(counter.Value(), 40000);
+}
+
+TEST(MetricsTests, PrometheusText) {
+	metrics::Registry registry;
+
+	registry.GetCounter("test_bytes_total", "Bytes.", {{"stage", "sha"}}).Increment(1024);
+	registry.GetCounter("test_bytes_total", "Bytes.", {{"stage", "a\"b\\c\nd"}}).Increment();
+	registry.GetGauge("test_gauge", "A gauge.").Set(0.25);
+	auto &histogram = registry.GetHistogram("test_seconds", "Durations.", {{"x", "y"}}, {0.1, 1});
+	histogram.Observe(0.05);
+	histogram.Observe(0.5);
+	histogram.Observe(2);
+
+	EXPECT_EQ(registry.PrometheusText(), R"(# HELP test_bytes_total Bytes.
+# TYPE test_bytes_total counter
+test_bytes_total{stage="a\"b\\c\nd"} 1
+test_bytes_total{stage="sha"} 1024
+# HELP test_gauge A gauge.
+# TYPE test_gauge gauge
+test_gauge 0.25
+# HELP test_seconds Durations.
+# TYPE test_seconds histogram
+test_seconds_bucket{x="y",le="0.1"} 1
+test_seconds_bucket{x="y",le="1"} 2
+test_seconds_bucket{x="y",le="+Inf"} 3
+test_seconds_sum{x="y"} 2.55
+test_seconds_count{x="y"} 3
+)");
+}
+
+TEST(MetricsTests, Stage) {
+	metrics::Stage stage("metrics_test");
+	stage.Record(100, chrono::milliseconds(500));
+	stage.Record(50, chrono::milliseconds(250));
+
+	auto &registry = metrics::DefaultRegistry();
+	EXPECT_EQ(
+		registry.GetCounter("mender_pipeline_bytes_total", "", {{"stage", "metrics_test"}}).Value(),
+		150);
+	EXPECT_EQ(
+		registry.GetCounter("mender_pipeline_seconds_total", "", {{"stage", "metrics_test"}})
+			.Value(),
+		0.75);
+}
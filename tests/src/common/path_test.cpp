@@ -12,14 +12,18 @@
 //    See the License for the specific language governing permissions and
 //    limitations under the License.
 
+#include <fstream>
+
 #include <gtest/gtest.h>
 #include <common/error.hpp>
 #include <common/path.hpp>
 #include <common/expected.hpp>
+#include <common/testing.hpp>
 
 namespace error = mender::common::error;
 namespace path = mender::common::path;
 namespace expected = mender::common::expected;
+namespace mtesting = mender::common::testing;
 using namespace std;
 
 
@@ -74,4 +78,47 @@ TEST(Path, IsWithinOrEqual) {
 
 	EXPECT_FALSE_NO_ERROR(path::IsWithinOrEqual("/completely/different/path/", "/path/to/dir"));
 	EXPECT_FALSE_NO_ERROR(path::IsWithinOrEqual("/completely/different/path/", "/path/to/dir/"));
-}
\ No newline at end of file
+}
+
+TEST(Path, SyncBatch) {
+	mtesting::TemporaryDirectory tmpdir;
+	path::SyncBatch batch;
+
+	auto subdir = path::Join(tmpdir.Path(), "subdir");
+	ASSERT_EQ(path::CreateDirectories(subdir), error::NoError);
+	batch.Add(subdir + "/");
+	for (int i = 0; i < 3; i++) {
+		auto file = path::Join(subdir, "file" + to_string(i));
+		ofstream(file) << "content";
+		batch.Add(file);
+	}
+
+	// Removed again before syncing, which is not an error.
+	auto removed = path::Join(tmpdir.Path(), "removed");
+	ofstream(removed) << "content";
+	batch.Add(removed);
+	ASSERT_EQ(path::FileDelete(removed), error::NoError);
+
+	EXPECT_EQ(batch.Sync(), error::NoError);
+	// Nothing left to sync.
+	EXPECT_EQ(batch.Sync(), error::NoError);
+}
+
+TEST(Path, SyncBatchManyFiles) {
+	mtesting::TemporaryDirectory tmpdir;
+	for (int i = 0; i < 100; i++) {
+		ofstream(path::Join(tmpdir.Path(), "file" + to_string(i))) << "content";
+	}
+
+	path::SyncBatch batch;
+	EXPECT_EQ(batch.AddRecursively(tmpdir.Path()), error::NoError);
+	EXPECT_EQ(batch.Sync(), error::NoError);
+
+	EXPECT_EQ(path::DataSyncRecursively(tmpdir.Path()), error::NoError);
+}
+
+TEST(Path, DataSyncRecursivelyMissingDirectory) {
+	mtesting::TemporaryDirectory tmpdir;
+	auto err = path::DataSyncRecursively(path::Join(tmpdir.Path(), "does-not-exist"));
+	EXPECT_EQ(err.code, make_error_condition(errc::no_such_file_or_directory));
+}
@@ -16,6 +16,7 @@
 
 #include <fstream>
 #include <cstdio>
+#include <fcntl.h>
 #include <sys/stat.h>
 
 #include <gtest/gtest.h>
@@ -33,8 +34,6 @@ namespace path = mender::common::path;
 namespace procs = mender::common::processes;
 namespace mtesting = mender::common::testing;
 
-namespace tpl = TinyProcessLib;
-
 using namespace std;
 
 class ProcessesTests : public testing::Test {
@@ -66,7 +65,7 @@ protected:
 
 class ProcessesTestsHelper {
 public:
-	static unique_ptr<tpl::Process> &GetNativeProc(procs::Process &proc) {
+	static unique_ptr<procs::NativeProcess> &GetNativeProc(procs::Process &proc) {
 		return proc.proc_;
 	}
 	static chrono::seconds &GetMaxTerminationTime(procs::Process &proc) {
@@ -153,6 +152,49 @@ exit 1
 	EXPECT_EQ(proc.GetExitStatus(), 1);
 }
 
+TEST_F(ProcessesTests, MissingExecutableTest) {
+	// Not absolute, so only found to be missing when the process is executed.
+	procs::Process proc({"mender-test-no-such-command"});
+	auto err = proc.Run();
+	EXPECT_EQ(err.code, procs::MakeError(procs::NonZeroExitStatusError, "").code)
+		<< err.String();
+	EXPECT_EQ(proc.GetExitStatus(), 1);
+
+	procs::Process proc2({"mender-test-no-such-command"});
+	auto ex_line_data = proc2.GenerateLineData();
+	ASSERT_FALSE(ex_line_data);
+	EXPECT_EQ(
+		ex_line_data.error().code, procs::MakeError(procs::NonZeroExitStatusError, "").code)
+		<< ex_line_data.error().String();
+	EXPECT_EQ(proc2.GetExitStatus(), 1);
+}
+
+TEST_F(ProcessesTests, WorkDirAndDescriptorsTest) {
+	string script = R"(#!/bin/sh
+pwd
+if [ -e /proc/$$/fd/$1 ]; then
+    echo "leaked"
+fi
+exit 0
+)";
+	auto ret = PrepareTestScript(script);
+	ASSERT_TRUE(ret);
+
+	// Deliberately not close-on-exec, the child should still not see it.
+	int fd = open(TestScriptPath().c_str(), O_RDONLY);
+	ASSERT_GE(fd, 0);
+
+	// Relative command, so this also tests the PATH lookup.
+	procs::Process proc({"sh", TestScriptPath(), to_string(fd)});
+	proc.SetWorkDir(tmpdir_->Path());
+	auto ex_line_data = proc.GenerateLineData();
+	close(fd);
+	ASSERT_TRUE(ex_line_data) << ex_line_data.error().String();
+	EXPECT_EQ(proc.GetExitStatus(), 0);
+	ASSERT_EQ(ex_line_data.value().size(), 1);
+	EXPECT_EQ(ex_line_data.value()[0], tmpdir_->Path());
+}
+
 TEST_F(ProcessesTests, StartInBackground) {
 	mtesting::TemporaryDirectory tmpdir;
 
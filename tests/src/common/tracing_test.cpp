@@ -0,0 +1,161 @@
+// Copyright 2024 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <common/tracing.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <common/json.hpp>
+#include <common/path.hpp>
+#include <common/testing.hpp>
+
+namespace json = mender::common::json;
+namespace mtesting = mender::common::testing;
+namespace path = mender::common::path;
+namespace tracing = mender::common::tracing;
+
+using namespace std;
+
+// The closing bracket is never written, so add it before parsing.
+static json::Json LoadTrace(const string &trace_path) {
+	ifstream in(trace_path);
+	stringstream content;
+	content << in.rdbuf() << "]";
+	auto loaded = json::Load(content.str());
+	EXPECT_TRUE(loaded) << loaded.error().String() << ": " << content.str();
+	return loaded ? loaded.value() : json::Json();
+}
+
+static json::Json Event(const json::Json &trace, size_t idx) {
+	auto event = trace.Get(idx);
+	EXPECT_TRUE(event) << event.error().String();
+	return event ? event.value() : json::Json();
+}
+
+static string Field(const json::Json &event, const string &key) {
+	auto value = event.Get(key);
+	if (!value) {
+		return "";
+	}
+	auto str = value.value().GetString();
+	if (str) {
+		return str.value();
+	}
+	auto num = value.value().GetInt64();
+	return num ? to_string(num.value()) : "";
+}
+
+static string Arg(const json::Json &event, const string &key) {
+	auto args = event.Get("args");
+	if (!args) {
+		return "";
+	}
+	return Field(args.value(), key);
+}
+
+TEST(TracingTests, SpansAndArgs) {
+	mtesting::TemporaryDirectory tmpdir;
+	auto trace_path = path::Join(tmpdir.Path(), "trace.json");
+
+	// Nothing is recorded while tracing is off.
+	tracing::Span before("cat", "before");
+	EXPECT_FALSE(before.Active());
+
+	auto err = tracing::Start(trace_path);
+	ASSERT_EQ(err, mender::common::error::NoError);
+	EXPECT_TRUE(tracing::Enabled());
+	{
+		tracing::Span outer("cat", "outer", tracing::Args().Add("text", "a \"quoted\"\nvalue"));
+		EXPECT_TRUE(outer.Active());
+
+		tracing::Span inner("cat", "inner", 42);
+		inner.AddArg("bytes", 1000);
+		inner.AddArg("bytes", 2000);
+		inner.End();
+		EXPECT_FALSE(inner.Active());
+		// Ending twice does nothing.
+		inner.End();
+
+		tracing::Span moved = std::move(outer);
+		EXPECT_FALSE(outer.Active());
+		EXPECT_TRUE(moved.Active());
+	}
+	before.End();
+	tracing::Stop();
+	EXPECT_FALSE(tracing::Enabled());
+
+	auto trace = LoadTrace(trace_path);
+	ASSERT_EQ(trace.GetArraySize().value(), 4);
+
+	EXPECT_EQ(Field(Event(trace, 0), "ph"), "b");
+	EXPECT_EQ(Field(Event(trace, 0), "name"), "outer");
+	EXPECT_EQ(Arg(Event(trace, 0), "text"), "a \"quoted\"\nvalue");
+
+	EXPECT_EQ(Field(Event(trace, 1), "ph"), "b");
+	EXPECT_EQ(Field(Event(trace, 1), "name"), "inner");
+	EXPECT_EQ(Field(Event(trace, 1), "id"), "42");
+	EXPECT_EQ(Field(Event(trace, 1), "pid"), to_string(getpid()));
+
+	EXPECT_EQ(Field(Event(trace, 2), "ph"), "e");
+	EXPECT_EQ(Field(Event(trace, 2), "name"), "inner");
+	EXPECT_EQ(Arg(Event(trace, 2), "bytes"), "2000");
+
+	EXPECT_EQ(Field(Event(trace, 3), "ph"), "e");
+	EXPECT_EQ(Field(Event(trace, 3), "name"), "outer");
+	EXPECT_EQ(Field(Event(trace, 3), "id"), Field(Event(trace, 0), "id"));
+
+	EXPECT_LE(stoll(Field(Event(trace, 0), "ts")), stoll(Field(Event(trace, 3), "ts")));
+}
+
+TEST(TracingTests, AppendAndRestart) {
+	mtesting::TemporaryDirectory tmpdir;
+	auto trace_path = path::Join(tmpdir.Path(), "trace.json");
+
+	ASSERT_EQ(tracing::Start(trace_path, true), mender::common::error::NoError);
+	tracing::Span first("cat", "first");
+	tracing::Stop();
+
+	// A span which outlives its trace doesn't end up in the next one.
+	ASSERT_EQ(tracing::Start(trace_path, true), mender::common::error::NoError);
+	EXPECT_FALSE(first.Active());
+	first.End();
+	tracing::AsyncBegin("cat", "second", 1);
+	tracing::Stop();
+
+	auto trace = LoadTrace(trace_path);
+	ASSERT_EQ(trace.GetArraySize().value(), 2);
+	EXPECT_EQ(Field(Event(trace, 0), "name"), "first");
+	EXPECT_EQ(Field(Event(trace, 1), "name"), "second");
+
+	// Without appending, the file is replaced.
+	ASSERT_EQ(tracing::Start(trace_path), mender::common::error::NoError);
+	tracing::AsyncBegin("cat", "third", 1);
+	tracing::Stop();
+
+	trace = LoadTrace(trace_path);
+	ASSERT_EQ(trace.GetArraySize().value(), 1);
+	EXPECT_EQ(Field(Event(trace, 0), "name"), "third");
+}
+
+TEST(TracingTests, StartFailure) {
+	auto err = tracing::Start("/non/existing/directory/trace.json");
+	EXPECT_NE(err, mender::common::error::NoError);
+	EXPECT_FALSE(tracing::Enabled());
+}
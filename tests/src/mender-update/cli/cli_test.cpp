@@ -29,6 +29,7 @@
 
 #include <mender-update/cli/actions.hpp>
 #include <mender-update/context.hpp>
+#include <mender-update/rootfs_writer/rootfs_writer.hpp>
 
 namespace cli = mender::update::cli;
 namespace common = mender::common;
@@ -38,6 +39,7 @@ namespace error = mender::common::error;
 namespace mtesting = mender::common::testing;
 namespace path = mender::common::path;
 namespace processes = mender::common::processes;
+namespace rootfs_writer = mender::update::rootfs_writer;
 
 using namespace std;
 
@@ -480,6 +482,228 @@ artifact_name=test
 )"));
 }
 
+TEST(CliTest, Benchmark) {
+	mtesting::TemporaryDirectory tmpdir;
+	ASSERT_TRUE(InitDefaultProvides(tmpdir.Path()));
+
+	string artifact = path::Join(tmpdir.Path(), "artifact.mender");
+	ASSERT_TRUE(PrepareSimpleArtifact(tmpdir.Path(), artifact));
+
+	string update_module = path::Join(tmpdir.Path(), "rootfs-image");
+
+	ASSERT_TRUE(PrepareUpdateModule(update_module, R"(#!/bin/bash
+
+TEST_DIR=")" + tmpdir.Path() + R"("
+
+echo "$1" >> $TEST_DIR/call.log
+
+exit 0
+)"));
+
+	{
+		vector<string> args {
+			"--datastore",
+			tmpdir.Path(),
+			"benchmark",
+			artifact,
+		};
+
+		mtesting::RedirectStreamOutputs output;
+		int exit_status = cli::Main(
+			args, [&tmpdir](context::MenderContext &ctx) { SetTestDir(tmpdir.Path(), ctx); });
+		EXPECT_EQ(exit_status, 0) << exit_status;
+
+		EXPECT_THAT(output.GetCout(), testing::HasSubstr("Artifact:      test (rootfs-image)\n"));
+		EXPECT_THAT(output.GetCout(), testing::HasSubstr("Stage sha: "));
+		EXPECT_THAT(output.GetCout(), testing::HasSubstr("Stage module_write: "));
+		EXPECT_THAT(output.GetCout(), testing::HasSubstr("Peak RSS: "));
+	}
+
+	// The installed Update Module is never called when the payload is discarded.
+	EXPECT_FALSE(path::FileExists(path::Join(tmpdir.Path(), "call.log")));
+
+	EXPECT_TRUE(VerifyProvides(tmpdir.Path(), R"(rootfs-image.version=previous
+rootfs-image.checksum=46ca895be3a18fb50c1c6b5a3bd2e97fb637b35a22924c2f3dea3cf09e9e2e74
+artifact_name=previous
+)"));
+}
+
+TEST(CliTest, BenchmarkWithUpdateModule) {
+	mtesting::TemporaryDirectory tmpdir;
+	ASSERT_TRUE(InitDefaultProvides(tmpdir.Path()));
+
+	string artifact = path::Join(tmpdir.Path(), "artifact.mender");
+	ASSERT_TRUE(PrepareSimpleArtifact(tmpdir.Path(), artifact));
+
+	string update_module = path::Join(tmpdir.Path(), "rootfs-image");
+
+	ASSERT_TRUE(PrepareUpdateModule(update_module, R"(#!/bin/bash
+
+TEST_DIR=")" + tmpdir.Path() + R"("
+
+echo "$1" >> $TEST_DIR/call.log
+
+exit 0
+)"));
+
+	// Left behind by an interrupted deployment. The benchmark doesn't install anything, so it
+	// must neither use nor remove it.
+	string checkpoint_data = R"({"partition":"/dev/other","checksum":"abc","size":1,"offset":1})";
+	{
+		conf::MenderConfig conf;
+		conf.paths.SetDataStore(tmpdir.Path());
+		context::MenderContext context(conf);
+		auto err = context.Initialize();
+		ASSERT_EQ(err, error::NoError) << err.String();
+
+		err = context.GetMenderStoreDB().Write(
+			rootfs_writer::kCheckpointKey, common::ByteVectorFromString(checkpoint_data));
+		ASSERT_EQ(err, error::NoError) << err.String();
+	}
+
+	{
+		vector<string> args {
+			"--datastore",
+			tmpdir.Path(),
+			"benchmark",
+			"--update-module",
+			artifact,
+		};
+
+		mtesting::RedirectStreamOutputs output;
+		int exit_status = cli::Main(
+			args, [&tmpdir](context::MenderContext &ctx) { SetTestDir(tmpdir.Path(), ctx); });
+		EXPECT_EQ(exit_status, 0) << exit_status;
+
+		EXPECT_THAT(output.GetCout(), testing::HasSubstr("Stage module_write: "));
+	}
+
+	EXPECT_TRUE(mtesting::FileContainsExactly(
+		path::Join(tmpdir.Path(), "call.log"), R"(ProvidePayloadFileSizes
+Download
+Cleanup
+)"));
+
+	{
+		conf::MenderConfig conf;
+		conf.paths.SetDataStore(tmpdir.Path());
+		context::MenderContext context(conf);
+		auto err = context.Initialize();
+		ASSERT_EQ(err, error::NoError) << err.String();
+
+		auto exp_data = context.GetMenderStoreDB().Read(rootfs_writer::kCheckpointKey);
+		ASSERT_TRUE(exp_data) << exp_data.error().String();
+		EXPECT_EQ(common::StringFromByteVector(exp_data.value()), checkpoint_data);
+	}
+
+	EXPECT_TRUE(VerifyProvides(tmpdir.Path(), R"(rootfs-image.version=previous
+rootfs-image.checksum=46ca895be3a18fb50c1c6b5a3bd2e97fb637b35a22924c2f3dea3cf09e9e2e74
+artifact_name=previous
+)"));
+}
+
+TEST(CliTest, BenchmarkRefusesDuringUpdate) {
+	mtesting::TemporaryDirectory tmpdir;
+
+	string artifact = path::Join(tmpdir.Path(), "artifact.mender");
+	ASSERT_TRUE(PrepareSimpleArtifact(tmpdir.Path(), artifact));
+
+	string update_module = path::Join(tmpdir.Path(), "rootfs-image");
+
+	ASSERT_TRUE(PrepareUpdateModule(update_module, R"(#!/bin/bash
+
+TEST_DIR=")" + tmpdir.Path() + R"("
+
+echo "$1" >> $TEST_DIR/call.log
+
+case "$1" in
+    SupportsRollback)
+        echo "Yes"
+        ;;
+esac
+
+exit 0
+)"));
+
+	auto expect_refused = [&tmpdir, &artifact](const string &message) {
+		for (bool with_update_module : {false, true}) {
+			vector<string> args {
+				"--datastore",
+				tmpdir.Path(),
+				"benchmark",
+			};
+			if (with_update_module) {
+				args.push_back("--update-module");
+			}
+			args.push_back(artifact);
+
+			mtesting::RedirectStreamOutputs output;
+			int exit_status = cli::Main(
+				args, [&tmpdir](context::MenderContext &ctx) { SetTestDir(tmpdir.Path(), ctx); });
+			EXPECT_EQ(exit_status, 1) << exit_status;
+			EXPECT_EQ(output.GetCout(), "");
+			EXPECT_THAT(output.GetCerr(), testing::EndsWith(message + "\n"));
+		}
+	};
+
+	// A standalone installation which hasn't been committed yet.
+	{
+		vector<string> args {
+			"--datastore",
+			tmpdir.Path(),
+			"install",
+			artifact,
+		};
+
+		mtesting::RedirectStreamOutputs output;
+		int exit_status = cli::Main(
+			args, [&tmpdir](context::MenderContext &ctx) { SetTestDir(tmpdir.Path(), ctx); });
+		ASSERT_EQ(exit_status, 0) << exit_status;
+	}
+
+	expect_refused("Update in progress. Please commit or roll back first");
+
+	// Nothing more than the installation itself.
+	EXPECT_TRUE(mtesting::FileContainsExactly(
+		path::Join(tmpdir.Path(), "call.log"), R"(ProvidePayloadFileSizes
+Download
+ArtifactInstall
+NeedsArtifactReboot
+SupportsRollback
+)"));
+
+	{
+		vector<string> args {
+			"--datastore",
+			tmpdir.Path(),
+			"rollback",
+		};
+
+		mtesting::RedirectStreamOutputs output;
+		int exit_status = cli::Main(
+			args, [&tmpdir](context::MenderContext &ctx) { SetTestDir(tmpdir.Path(), ctx); });
+		ASSERT_EQ(exit_status, 0) << exit_status;
+	}
+	ASSERT_EQ(path::DeleteRecursively(path::Join(tmpdir.Path(), "call.log")), error::NoError);
+
+	// A deployment of the daemon.
+	{
+		conf::MenderConfig conf;
+		conf.paths.SetDataStore(tmpdir.Path());
+		context::MenderContext context(conf);
+		auto err = context.Initialize();
+		ASSERT_EQ(err, error::NoError) << err.String();
+
+		err = context.GetMenderStoreDB().Write(
+			context::MenderContext::state_data_key, common::ByteVectorFromString("{}"));
+		ASSERT_EQ(err, error::NoError) << err.String();
+	}
+
+	expect_refused("Deployment in progress by the daemon. Please let it finish first");
+
+	EXPECT_FALSE(path::FileExists(path::Join(tmpdir.Path(), "call.log")));
+}
+
 TEST(CliTest, InstallAndCommitArtifactCheckProvidesDepends) {
 	/* Install two Artifacts. One to install some provides, and the second one to
 	 verify the depends
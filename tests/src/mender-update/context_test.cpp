@@ -134,6 +134,39 @@ TEST_F(ContextTests, LoadProvidesValid) {
 	EXPECT_EQ(provides_data["something_else"], "something_else value");
 }
 
+TEST_F(ContextTests, LoadProvidesChangedByOtherProcess) {
+	conf::MenderConfig cfg;
+	cfg.paths.SetDataStore(test_state_dir.Path());
+
+	context::MenderContext ctx(cfg);
+	auto err = ctx.Initialize();
+	ASSERT_EQ(err, error::NoError);
+
+	auto &db = ctx.GetMenderStoreDB();
+	err = db.Write("artifact-name", common::ByteVectorFromString("old name"));
+	ASSERT_EQ(err, error::NoError);
+
+	auto ex_provides_data = ctx.LoadProvides();
+	ASSERT_TRUE(ex_provides_data);
+	EXPECT_EQ(ex_provides_data.value()["artifact_name"], "old name");
+
+	// Another process writes to the same database.
+	kv_db::KeyValueDatabaseLmdb other;
+	err = other.Open(path::Join(test_state_dir.Path(), "mender-store"));
+	ASSERT_EQ(err, error::NoError);
+	err = other.Write("artifact-name", common::ByteVectorFromString("new name"));
+	ASSERT_EQ(err, error::NoError);
+	err = other.Write("artifact-provides", common::ByteVectorFromString(R"({"rootfs": "1"})"));
+	ASSERT_EQ(err, error::NoError);
+
+	ex_provides_data = ctx.LoadProvides();
+	ASSERT_TRUE(ex_provides_data);
+	auto provides_data = ex_provides_data.value();
+	EXPECT_EQ(provides_data.size(), 2);
+	EXPECT_EQ(provides_data["artifact_name"], "new name");
+	EXPECT_EQ(provides_data["rootfs"], "1");
+}
+
 TEST_F(ContextTests, LoadProvidesEmpty) {
 	conf::MenderConfig cfg;
 	cfg.paths.SetDataStore(test_state_dir.Path());
@@ -221,7 +254,8 @@ TEST_F(ContextTests, LoadProvidesClosedDB) {
 	err = db.Write("artifact-provides", common::ByteVectorFromString(input_provides_data_str));
 	ASSERT_EQ(err, error::NoError);
 
-	auto &lmdb = dynamic_cast<kv_db::KeyValueDatabaseLmdb &>(db);
+	auto &cache = dynamic_cast<kv_db::KeyValueDatabaseCache &>(db);
+	auto &lmdb = dynamic_cast<kv_db::KeyValueDatabaseLmdb &>(cache.GetDatabase());
 	lmdb.Close();
 
 	auto ex_provides_data = ctx.LoadProvides();
@@ -26,15 +26,18 @@
 #include <client_shared/conf.hpp>
 #include <common/error.hpp>
 #include <common/events.hpp>
+#include <common/io.hpp>
 #include <common/key_value_database.hpp>
 #include <common/path.hpp>
 #include <common/processes.hpp>
 #include <common/testing.hpp>
 
 #include <mender-update/context.hpp>
+#include <mender-update/deployments.hpp>
 #include <mender-update/inventory.hpp>
 #include <mender-update/daemon/context.hpp>
 #include <mender-update/daemon/state_machine.hpp>
+#include <mender-update/rootfs_writer/rootfs_writer.hpp>
 
 #define DEPLOYMENT_ID "w81s4fae-7dec-11d0-a765-00a0c91e6bf6"
 
@@ -49,6 +52,7 @@ namespace common = mender::common;
 namespace conf = mender::client_shared::conf;
 namespace error = mender::common::error;
 namespace events = mender::common::events;
+namespace io = mender::common::io;
 namespace kvdb = mender::common::key_value_database;
 namespace path = mender::common::path;
 namespace processes = mender::common::processes;
@@ -57,6 +61,7 @@ namespace mtesting = mender::common::testing;
 
 namespace context = mender::update::context;
 namespace inventory = mender::update::inventory;
+namespace rootfs_writer = mender::update::rootfs_writer;
 
 using namespace std;
 
@@ -3923,6 +3928,27 @@ private:
 	mtesting::TemporaryDirectory tmpdir_;
 };
 
+// Deployment logs may be stored compressed.
+::testing::AssertionResult DeploymentLogContains(const string &log_path, const string &content) {
+	if (!path::FileExists(log_path)) {
+		return ::testing::AssertionFailure() << "`" << log_path << "` does not exist";
+	}
+	deployments::LogFileReader reader {log_path};
+	vector<uint8_t> data;
+	io::ByteWriter writer {data};
+	writer.SetUnlimited(true);
+	auto err = io::Copy(writer, reader);
+	if (err != error::NoError) {
+		return ::testing::AssertionFailure() << err.String();
+	}
+	auto log_data = common::StringFromByteVector(data);
+	if (log_data.find(content) != string::npos) {
+		return ::testing::AssertionSuccess();
+	}
+	return ::testing::AssertionFailure()
+		   << "'" << log_data << "' does not contain '" << content << "'";
+}
+
 TEST_F(StateTestWithArtifact, DeploymentLogging) {
 	mtesting::TemporaryDirectory tmpdir;
 	conf::MenderConfig config;
@@ -3947,9 +3973,9 @@ TEST_F(StateTestWithArtifact, DeploymentLogging) {
 	}
 
 	auto deployment_log = path::Join(tmpdir.Path(), "deployments.0000." DEPLOYMENT_ID ".log");
-	EXPECT_TRUE(mtesting::FileContains(deployment_log, "Running mender-update"));
+	EXPECT_TRUE(DeploymentLogContains(deployment_log, "Running mender-update"));
 	EXPECT_TRUE(
-		mtesting::FileContains(deployment_log, "Deployment with ID " DEPLOYMENT_ID " started"));
+		DeploymentLogContains(deployment_log, "Deployment with ID " DEPLOYMENT_ID " started"));
 	ASSERT_EQ(deployment_client->log_files.size(), 1);
 	EXPECT_EQ(deployment_client->log_files[0], deployment_log);
 
@@ -3966,20 +3992,19 @@ TEST_F(StateTestWithArtifact, DeploymentLogging) {
 	}
 
 	deployment_log = path::Join(tmpdir.Path(), "deployments.0000." + new_id + ".log");
-	EXPECT_TRUE(mtesting::FileContains(deployment_log, "Running mender-update"));
-	EXPECT_TRUE(
-		mtesting::FileContains(deployment_log, "Deployment with ID " + new_id + " started"));
+	EXPECT_TRUE(DeploymentLogContains(deployment_log, "Running mender-update"));
+	EXPECT_TRUE(DeploymentLogContains(deployment_log, "Deployment with ID " + new_id + " started"));
 	ASSERT_EQ(deployment_client->log_files.size(), 1);
 	EXPECT_EQ(deployment_client->log_files[0], deployment_log);
 
 	auto moved_deployment_log = path::Join(tmpdir.Path(), "deployments.0001." DEPLOYMENT_ID ".log");
-	EXPECT_TRUE(mtesting::FileContains(moved_deployment_log, "Running mender-update"));
-	EXPECT_TRUE(mtesting::FileContains(
+	EXPECT_TRUE(DeploymentLogContains(moved_deployment_log, "Running mender-update"));
+	EXPECT_TRUE(DeploymentLogContains(
 		moved_deployment_log, "Deployment with ID " DEPLOYMENT_ID " started"));
 
 	auto no_such_deployment_log =
 		path::Join(tmpdir.Path(), "deployments.0002." DEPLOYMENT_ID ".log");
-	EXPECT_FALSE(mtesting::FileContains(no_such_deployment_log, "Running mender-update"));
+	EXPECT_FALSE(DeploymentLogContains(no_such_deployment_log, "Running mender-update"));
 }
 
 TEST(SignalHandlingTests, SigquitHandlingTest) {
@@ -4087,6 +4112,94 @@ TEST(StateTest, UpdateControlCleanup) {
 	EXPECT_EQ(exp_data.error().code, kvdb::MakeError(kvdb::KeyError, "").code);
 }
 
+TEST(StateTest, ResumeInterruptedRootfsImageDownload) {
+	mtesting::TemporaryDirectory tmpdir;
+	conf::MenderConfig config {};
+	config.paths.SetDataStore(tmpdir.Path());
+	config.paths.SetModulesPath(tmpdir.Path());
+	config.paths.SetModulesWorkPath(tmpdir.Path());
+	config.paths.SetRootfsScriptsPath(tmpdir.Path());
+	config.rootfs_image_writer.enabled = true;
+
+	auto script_log = path::Join(tmpdir.Path(), "scripts.log");
+	{
+		ofstream version_file(path::Join(tmpdir.Path(), "version"));
+		version_file << "3";
+		ASSERT_TRUE(version_file.good());
+	}
+	for (auto script : {"Download_Enter_00", "rootfs-image"}) {
+		auto script_path = path::Join(tmpdir.Path(), script);
+		ofstream f(script_path);
+		f << "#!/bin/sh\necho " << script << " >> " << script_log << "\n";
+		ASSERT_TRUE(f.good());
+		f.close();
+		ASSERT_EQ(chmod(script_path.c_str(), S_IRUSR | S_IWUSR | S_IXUSR), 0);
+	}
+
+	context::MenderContext main_context {config};
+	auto err = main_context.Initialize();
+	ASSERT_EQ(err, error::NoError);
+
+	mtesting::TestEventLoop event_loop;
+	Context ctx {main_context, event_loop};
+	ctx.deployment_client = make_shared<NoopDeploymentClient>();
+	ctx.inventory_client = make_shared<NoopInventoryClient>();
+
+	// Nothing to download, so the resumed download fails.
+	mtesting::HttpFileServer server(tmpdir.Path());
+
+	auto &db = main_context.GetMenderStoreDB();
+	auto interrupt_download = [&](const string &id) {
+		StateData state_data;
+		state_data.state = Context::kUpdateStateDownload;
+		state_data.update_info.id = id;
+		state_data.update_info.artifact.source.uri =
+			http::JoinUrl(server.GetBaseUrl(), "nonexisting.mender");
+		state_data.update_info.artifact.payload_types = {"rootfs-image"};
+		state_data.update_info.artifact.artifact_name = "artifact-name";
+		ASSERT_EQ(ctx.SaveDeploymentStateData(state_data), error::NoError);
+	};
+	auto run_deployment = [&]() {
+		StateMachine state_machine {ctx, event_loop, chrono::milliseconds(1)};
+		state_machine.LoadStateFromDb();
+		state_machine.StopAfterDeployment();
+		auto err = state_machine.Run();
+		EXPECT_EQ(err, error::NoError);
+	};
+	auto scripts_ran = [&]() {
+		ifstream f(script_log);
+		string content {istreambuf_iterator<char>(f), istreambuf_iterator<char>()};
+		remove(script_log.c_str());
+		return content;
+	};
+
+	// A checkpoint from another payload looks the same to the daemon, and the writer only finds
+	// out that it can't be used once it is downloading.
+	rootfs_writer::Checkpoint stale {"/dev/other", "abcd", 1024, 512};
+	err = db.Write(
+		rootfs_writer::kCheckpointKey,
+		common::ByteVectorFromString(rootfs_writer::CheckpointToJson(stale)));
+	ASSERT_EQ(err, error::NoError);
+	interrupt_download(DEPLOYMENT_ID);
+	run_deployment();
+
+	auto log = scripts_ran();
+	EXPECT_NE(log.find("Download_Enter_00"), string::npos) << log;
+	// The failed deployment doesn't leave anything behind.
+	auto exp_checkpoint = db.Read(rootfs_writer::kCheckpointKey);
+	ASSERT_FALSE(exp_checkpoint);
+	EXPECT_EQ(exp_checkpoint.error().code, kvdb::MakeError(kvdb::KeyError, "").code);
+	EXPECT_FALSE(db.Read(context::MenderContext::state_data_key));
+
+	// So the next deployment which is interrupted while downloading is not mistaken for one
+	// which can be resumed.
+	interrupt_download("01234567-89ab-cdef-0123-456789abcdef");
+	run_deployment();
+
+	log = scripts_ran();
+	EXPECT_EQ(log.find("Download_Enter_00"), string::npos) << log;
+	EXPECT_FALSE(db.Read(context::MenderContext::state_data_key));
+}
 
 TEST(DBSchemaMigrationTest, TestFromVersion1To2) {
 	// Setup
@@ -255,6 +255,291 @@ TEST_F(DeploymentsTests, TestV2APIWithNoNextDeployment) {
 	EXPECT_TRUE(handler_called);
 }
 
+TEST_F(DeploymentsTests, TestV2APILongPoll) {
+	conf::MenderConfig cfg;
+	cfg.paths.SetDataStore(test_state_dir.Path());
+	cfg.deployment_long_poll_seconds = 240;
+
+	context::MenderContext ctx(cfg);
+	auto err = ctx.Initialize();
+	ASSERT_EQ(err, error::NoError);
+
+	auto &db = ctx.GetMenderStoreDB();
+	err = db.Write("artifact-name", common::ByteVectorFromString("artifact-name value"));
+	ASSERT_EQ(err, error::NoError);
+
+	ofstream os(cfg.paths.GetDataStore() + "/device_type");
+	ASSERT_TRUE(os);
+	os << "device_type=Some device type" << endl;
+	os.close();
+
+	TestEventLoop loop;
+
+	http::ServerConfig server_config;
+	http::Server server(server_config, loop);
+
+	http::ClientConfig client_config;
+	NoAuthHTTPClient client {client_config, loop};
+
+	bool apply_preference = true;
+	vector<uint8_t> received_body;
+	server.AsyncServeUrl(
+		TEST_SERVER,
+		[&received_body](http::ExpectedIncomingRequestPtr exp_req) {
+			ASSERT_TRUE(exp_req) << exp_req.error().String();
+			auto req = exp_req.value();
+
+			auto prefer = req->GetHeader("Prefer");
+			ASSERT_TRUE(prefer);
+			EXPECT_EQ(prefer.value(), "wait=240");
+
+			auto content_length = req->GetHeader("Content-Length");
+			ASSERT_TRUE(content_length);
+			auto ex_len = common::StringToLongLong(content_length.value());
+			ASSERT_TRUE(ex_len);
+
+			auto body_writer = make_shared<io::ByteWriter>(received_body);
+			received_body.resize(ex_len.value());
+			req->SetBodyWriter(body_writer);
+		},
+		[&apply_preference](http::ExpectedIncomingRequestPtr exp_req) {
+			ASSERT_TRUE(exp_req) << exp_req.error().String();
+
+			auto result = exp_req.value()->MakeResponse();
+			ASSERT_TRUE(result);
+			auto resp = result.value();
+
+			if (apply_preference) {
+				resp->SetHeader("Preference-Applied", "wait=240");
+			}
+			resp->SetHeader("Content-Length", "0");
+			resp->SetBodyReader(make_shared<io::StringReader>(""));
+			resp->SetStatusCodeAndMessage(http::StatusNoContent, "No content");
+			resp->AsyncReply([](error::Error err) { ASSERT_EQ(error::NoError, err); });
+		});
+
+	deps::DeploymentClient deployment_client;
+	EXPECT_FALSE(deployment_client.LastCheckWasHeld());
+
+	for (bool held : {true, false}) {
+		apply_preference = held;
+		bool handler_called = false;
+		err = deployment_client.CheckNewDeployments(
+			ctx, client, [&handler_called, &loop](deps::CheckUpdatesAPIResponse resp) {
+				handler_called = true;
+				ASSERT_TRUE(resp);
+				EXPECT_EQ(resp.value(), nullopt);
+				loop.Stop();
+			});
+		EXPECT_EQ(err, error::NoError);
+
+		loop.Run();
+		EXPECT_TRUE(handler_called);
+		EXPECT_EQ(deployment_client.LastCheckWasHeld(), held);
+	}
+}
+
+TEST_F(DeploymentsTests, TestV2APINotModified) {
+	conf::MenderConfig cfg;
+	cfg.paths.SetDataStore(test_state_dir.Path());
+
+	context::MenderContext ctx(cfg);
+	auto err = ctx.Initialize();
+	ASSERT_EQ(err, error::NoError);
+
+	auto &db = ctx.GetMenderStoreDB();
+	err = db.Write("artifact-name", common::ByteVectorFromString("artifact-name value"));
+	ASSERT_EQ(err, error::NoError);
+
+	ofstream os(cfg.paths.GetDataStore() + "/device_type");
+	ASSERT_TRUE(os);
+	os << "device_type=Some device type" << endl;
+	os.close();
+
+	TestEventLoop loop;
+
+	http::ServerConfig server_config;
+	http::Server server(server_config, loop);
+
+	http::ClientConfig client_config;
+	NoAuthHTTPClient client {client_config, loop};
+
+	// What the server received in If-None-Match, or "" if nothing.
+	vector<string> received_etags;
+	vector<uint8_t> received_body;
+	server.AsyncServeUrl(
+		TEST_SERVER,
+		[&received_body, &received_etags](http::ExpectedIncomingRequestPtr exp_req) {
+			ASSERT_TRUE(exp_req) << exp_req.error().String();
+			auto req = exp_req.value();
+
+			auto etag = req->GetHeader("If-None-Match");
+			received_etags.push_back(etag ? etag.value() : "");
+
+			auto content_length = req->GetHeader("Content-Length");
+			ASSERT_TRUE(content_length);
+			auto ex_len = common::StringToLongLong(content_length.value());
+			ASSERT_TRUE(ex_len);
+
+			auto body_writer = make_shared<io::ByteWriter>(received_body);
+			received_body.resize(ex_len.value());
+			req->SetBodyWriter(body_writer);
+		},
+		[&received_etags](http::ExpectedIncomingRequestPtr exp_req) {
+			ASSERT_TRUE(exp_req) << exp_req.error().String();
+
+			auto result = exp_req.value()->MakeResponse();
+			ASSERT_TRUE(result);
+			auto resp = result.value();
+
+			resp->SetHeader("Content-Length", "0");
+			resp->SetBodyReader(make_shared<io::StringReader>(""));
+			if (received_etags.back() == R"("no-deployment")") {
+				resp->SetStatusCodeAndMessage(http::StatusNotModified, "Not modified");
+			} else {
+				resp->SetHeader("ETag", R"("no-deployment")");
+				resp->SetStatusCodeAndMessage(http::StatusNoContent, "No content");
+			}
+			resp->AsyncReply([](error::Error err) { ASSERT_EQ(error::NoError, err); });
+		});
+
+	deps::DeploymentClient deployment_client;
+	auto check = [&]() {
+		bool handler_called = false;
+		auto err = deployment_client.CheckNewDeployments(
+			ctx, client, [&handler_called, &loop](deps::CheckUpdatesAPIResponse resp) {
+				handler_called = true;
+				ASSERT_TRUE(resp) << resp.error().String();
+				EXPECT_EQ(resp.value(), nullopt);
+				loop.Stop();
+			});
+		EXPECT_EQ(err, error::NoError);
+
+		loop.Run();
+		EXPECT_TRUE(handler_called);
+	};
+
+	check();
+	check();
+	check();
+	// New provides make a new request, which the old ETag doesn't apply to.
+	err = db.Write("artifact-name", common::ByteVectorFromString("new artifact-name value"));
+	ASSERT_EQ(err, error::NoError);
+	check();
+
+	EXPECT_EQ(
+		received_etags,
+		vector<string>({"", R"("no-deployment")", R"("no-deployment")", ""}));
+	EXPECT_THAT(
+		common::StringFromByteVector(received_body),
+		testing::HasSubstr(R"("artifact_name":"new artifact-name value")"));
+}
+
+TEST_F(DeploymentsTests, TestV2APIPreconditionFailed) {
+	conf::MenderConfig cfg;
+	cfg.paths.SetDataStore(test_state_dir.Path());
+
+	context::MenderContext ctx(cfg);
+	auto err = ctx.Initialize();
+	ASSERT_EQ(err, error::NoError);
+
+	auto &db = ctx.GetMenderStoreDB();
+	err = db.Write("artifact-name", common::ByteVectorFromString("artifact-name value"));
+	ASSERT_EQ(err, error::NoError);
+
+	ofstream os(cfg.paths.GetDataStore() + "/device_type");
+	ASSERT_TRUE(os);
+	os << "device_type=Some device type" << endl;
+	os.close();
+
+	TestEventLoop loop;
+
+	http::ServerConfig server_config;
+	http::Server server(server_config, loop);
+
+	http::ClientConfig client_config;
+	NoAuthHTTPClient client {client_config, loop};
+
+	// The server's answers, in order. A matching ETag on a POST gets 412 instead of 304.
+	vector<http::StatusCode> statuses {
+		http::StatusNoContent,
+		http::StatusPreconditionFailed,
+		http::StatusInternalServerError,
+		http::StatusNoContent,
+	};
+	// What the server received in If-None-Match, or "" if nothing.
+	vector<string> received_etags;
+	vector<uint8_t> received_body;
+	server.AsyncServeUrl(
+		TEST_SERVER,
+		[&received_body, &received_etags](http::ExpectedIncomingRequestPtr exp_req) {
+			ASSERT_TRUE(exp_req) << exp_req.error().String();
+			auto req = exp_req.value();
+
+			auto etag = req->GetHeader("If-None-Match");
+			received_etags.push_back(etag ? etag.value() : "");
+
+			auto content_length = req->GetHeader("Content-Length");
+			ASSERT_TRUE(content_length);
+			auto ex_len = common::StringToLongLong(content_length.value());
+			ASSERT_TRUE(ex_len);
+
+			auto body_writer = make_shared<io::ByteWriter>(received_body);
+			received_body.resize(ex_len.value());
+			req->SetBodyWriter(body_writer);
+		},
+		[&received_etags, &statuses](http::ExpectedIncomingRequestPtr exp_req) {
+			ASSERT_TRUE(exp_req) << exp_req.error().String();
+			ASSERT_LE(received_etags.size(), statuses.size());
+
+			auto result = exp_req.value()->MakeResponse();
+			ASSERT_TRUE(result);
+			auto resp = result.value();
+
+			auto status = statuses[received_etags.size() - 1];
+			resp->SetHeader("Content-Length", "0");
+			resp->SetBodyReader(make_shared<io::StringReader>(""));
+			if (status == http::StatusNoContent) {
+				resp->SetHeader("ETag", R"("no-deployment")");
+			}
+			resp->SetStatusCodeAndMessage(status, "Test");
+			resp->AsyncReply([](error::Error err) { ASSERT_EQ(error::NoError, err); });
+		});
+
+	deps::DeploymentClient deployment_client;
+	auto check = [&](bool expect_error) {
+		bool handler_called = false;
+		auto err = deployment_client.CheckNewDeployments(
+			ctx,
+			client,
+			[&handler_called, &loop, expect_error](deps::CheckUpdatesAPIResponse resp) {
+				handler_called = true;
+				if (expect_error) {
+					EXPECT_FALSE(resp);
+				} else {
+					ASSERT_TRUE(resp) << resp.error().String();
+					EXPECT_EQ(resp.value(), nullopt);
+				}
+				loop.Stop();
+			});
+		EXPECT_EQ(err, error::NoError);
+
+		loop.Run();
+		EXPECT_TRUE(handler_called);
+	};
+
+	check(false);
+	// Means the same as 304 Not Modified.
+	check(false);
+	// After an error, the ETag is not sent anymore.
+	check(true);
+	check(false);
+
+	EXPECT_EQ(
+		received_etags,
+		vector<string>({"", R"("no-deployment")", R"("no-deployment")", ""}));
+}
+
 TEST_F(DeploymentsTests, TestV2APIError) {
 	conf::MenderConfig cfg;
 	cfg.paths.SetDataStore(test_state_dir.Path());
@@ -1322,6 +1607,16 @@ TEST_F(DeploymentsTests, PushLogsFailureTest) {
 	EXPECT_TRUE(handler_called);
 }
 
+string ReadLogFile(const string &path) {
+	deps::LogFileReader reader {path};
+	vector<uint8_t> data;
+	io::ByteWriter writer {data};
+	writer.SetUnlimited(true);
+	auto err = io::Copy(writer, reader);
+	EXPECT_EQ(err, error::NoError) << err.String();
+	return common::StringFromByteVector(data);
+}
+
 TEST_F(DeploymentsTests, DeploymentLogTest) {
 	deps::DeploymentLog dlog {test_state_dir.Path(), "1"};
 	dlog.BeginLogging();
@@ -1330,7 +1625,7 @@ TEST_F(DeploymentsTests, DeploymentLogTest) {
 	dlog.FinishLogging();
 	mlog::Warning("Shouldn't appear in the deployment log");
 
-	ifstream is {path::Join(test_state_dir.Path(), "deployments.0000.1.log")};
+	istringstream is {ReadLogFile(path::Join(test_state_dir.Path(), "deployments.0000.1.log"))};
 	string line;
 	size_t line_idx = 0;
 	for (; getline(is, line); line_idx++) {
@@ -1371,7 +1666,7 @@ TEST_F(DeploymentsTests, DeploymentLogScopedTest) {
 	}
 	mlog::Warning("Shouldn't appear in the deployment log");
 
-	ifstream is {path::Join(test_state_dir.Path(), "deployments.0000.1.log")};
+	istringstream is {ReadLogFile(path::Join(test_state_dir.Path(), "deployments.0000.1.log"))};
 	string line;
 	size_t line_idx = 0;
 	for (; getline(is, line); line_idx++) {
@@ -1416,7 +1711,7 @@ TEST_F(DeploymentsTests, DeploymentLogFileAppendTest) {
 		mlog::Error("Testing error deployment logging");
 	}
 
-	ifstream is {path::Join(test_state_dir.Path(), "deployments.0000.1.log")};
+	istringstream is {ReadLogFile(path::Join(test_state_dir.Path(), "deployments.0000.1.log"))};
 	string line;
 	size_t line_idx = 0;
 	for (; getline(is, line); line_idx++) {
@@ -1490,7 +1785,7 @@ TEST_F(DeploymentsTests, DeploymentLogRenameAndCleanPreviousLogsTest) {
 	dlog.FinishLogging();
 	mlog::Warning("Shouldn't appear in the deployment log");
 
-	ifstream is {path::Join(test_state_dir.Path(), "deployments.0000.21.log")};
+	istringstream is {ReadLogFile(path::Join(test_state_dir.Path(), "deployments.0000.21.log"))};
 	string line;
 	size_t line_idx = 0;
 	for (; getline(is, line); line_idx++) {
@@ -1545,3 +1840,299 @@ TEST_F(DeploymentsTests, DeploymentLogRenameAndCleanPreviousLogsTest) {
 		GetFileContent(path::Join(test_state_dir.Path(), "deployments.3.log")),
 		"Test content in malformed file name 3\n");
 }
+
+TEST_F(DeploymentsTests, DeploymentLogRotatesTraceFilesTest) {
+	ofstream os;
+	for (int i : {0, 1, 2, 3, 4}) {
+		string base_name = "deployments.000" + to_string(i) + ".1" + to_string(i);
+		os.open(path::Join(test_state_dir.Path(), base_name + ".log"));
+		os << "Log " + to_string(i) + "\n";
+		os.close();
+		// No trace for one of the deployments, tracing may have been disabled then.
+		if (i != 2) {
+			os.open(path::Join(test_state_dir.Path(), base_name + ".trace.json"));
+			os << "Trace " + to_string(i) + "\n";
+			os.close();
+		}
+	}
+
+	deps::DeploymentLog dlog {test_state_dir.Path(), "21"};
+	EXPECT_EQ(
+		dlog.TraceFilePath(),
+		path::Join(test_state_dir.Path(), "deployments.0000.21.trace.json"));
+	dlog.BeginLogging();
+	dlog.FinishLogging();
+
+	for (int i : {0, 1, 3}) {
+		string file_name =
+			"deployments.000" + to_string(i + 1) + ".1" + to_string(i) + ".trace.json";
+		EXPECT_EQ(
+			GetFileContent(path::Join(test_state_dir.Path(), file_name)),
+			"Trace " + to_string(i) + "\n");
+	}
+	EXPECT_FALSE(
+		path::FileExists(path::Join(test_state_dir.Path(), "deployments.0003.12.trace.json")));
+	// The trace goes away with the log of the same deployment.
+	EXPECT_FALSE(
+		path::FileExists(path::Join(test_state_dir.Path(), "deployments.0004.14.trace.json")));
+	EXPECT_FALSE(
+		path::FileExists(path::Join(test_state_dir.Path(), "deployments.0005.14.trace.json")));
+}
+
+string LogLine(int i) {
+	return R"({"timestamp":"2024-01-01T00:00:00.000000Z","level":"info","message":"Line )"
+		   + to_string(i) + "\"}\n";
+}
+
+TEST_F(DeploymentsTests, LogFileWriterTest) {
+	const string log_path = path::Join(test_state_dir.Path(), "test.log");
+	string expected_data;
+	{
+		deps::LogFileWriter writer {log_path, 0};
+		ASSERT_EQ(writer.Open(), error::NoError);
+		for (int i = 0; i < 100; i++) {
+			ASSERT_EQ(writer.Append(LogLine(i)), error::NoError);
+			expected_data += LogLine(i);
+		}
+		EXPECT_EQ(writer.Size(), expected_data.size());
+
+		// Readable while still being written.
+		EXPECT_EQ(ReadLogFile(log_path), expected_data);
+	}
+	EXPECT_EQ(ReadLogFile(log_path), expected_data);
+
+	{
+		// should just append to the same file
+		deps::LogFileWriter writer {log_path, 0};
+		ASSERT_EQ(writer.Open(), error::NoError);
+		EXPECT_EQ(writer.Size(), expected_data.size());
+		ASSERT_EQ(writer.Append(LogLine(100)), error::NoError);
+		expected_data += LogLine(100);
+	}
+	EXPECT_EQ(ReadLogFile(log_path), expected_data);
+
+	auto ex_compressed = deps::IsCompressedLogFile(log_path);
+	ASSERT_TRUE(ex_compressed);
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+	EXPECT_TRUE(ex_compressed.value());
+	EXPECT_LT(GetFileContent(log_path).size(), expected_data.size() / 4);
+#else
+	EXPECT_FALSE(ex_compressed.value());
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+}
+
+TEST_F(DeploymentsTests, LogFileWriterContinuesPlainAndCutOffLogsTest) {
+	const string log_path = path::Join(test_state_dir.Path(), "test.log");
+	const string cut_log_path = path::Join(test_state_dir.Path(), "cut.log");
+	{
+		// A log written by an older client.
+		ofstream os {log_path};
+		os << LogLine(0) << LogLine(1);
+	}
+
+	{
+		deps::LogFileWriter writer {log_path, 0};
+		ASSERT_EQ(writer.Open(), error::NoError);
+		ASSERT_EQ(writer.Append(LogLine(2)), error::NoError);
+
+		// What is left when the process is killed at this point.
+		ofstream os {cut_log_path};
+		os << GetFileContent(log_path);
+	}
+	EXPECT_EQ(ReadLogFile(log_path), LogLine(0) + LogLine(1) + LogLine(2));
+
+	deps::LogFileReader reader {cut_log_path};
+	vector<uint8_t> buf(4096);
+	size_t n_read;
+	do {
+		auto ex_n = reader.Read(buf.begin(), buf.end());
+		ASSERT_TRUE(ex_n) << ex_n.error().String();
+		n_read = ex_n.value();
+	} while (n_read > 0);
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+	EXPECT_TRUE(reader.Truncated());
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+
+	{
+		deps::LogFileWriter writer {cut_log_path, 0};
+		ASSERT_EQ(writer.Open(), error::NoError);
+		ASSERT_EQ(writer.Append(LogLine(3)), error::NoError);
+	}
+	EXPECT_EQ(ReadLogFile(cut_log_path), LogLine(0) + LogLine(1) + LogLine(2) + LogLine(3));
+	EXPECT_FALSE(path::FileExists(cut_log_path + ".tmp"));
+}
+
+TEST_F(DeploymentsTests, LogFileWriterSizeLimitTest) {
+	const string log_path = path::Join(test_state_dir.Path(), "test.log");
+	const size_t max_size = 40 * LogLine(0).size();
+
+	auto check_log = [&log_path, max_size](int n_lines) {
+		istringstream is {ReadLogFile(log_path)};
+		vector<string> lines;
+		string line;
+		while (getline(is, line)) {
+			auto ex_j = json::Load(line);
+			ASSERT_TRUE(ex_j) << line;
+			auto ex_msg = ex_j.value().Get("message").and_then(json::ToString);
+			ASSERT_TRUE(ex_msg);
+			lines.push_back(ex_msg.value());
+		}
+		ASSERT_GT(lines.size(), 3u);
+
+		// The start and the end of the log are kept, with a line in between saying how much is
+		// missing.
+		EXPECT_EQ(lines[0], "Line 0");
+		EXPECT_EQ(lines.back(), "Line " + to_string(n_lines - 1));
+		auto marker = find_if(lines.begin(), lines.end(), [](const string &l) {
+			return l.find("left out") != string::npos;
+		});
+		ASSERT_NE(marker, lines.end());
+		EXPECT_EQ(*(marker - 1), "Line " + to_string(marker - lines.begin() - 1));
+		auto n_kept = static_cast<int>(lines.size()) - 1;
+		EXPECT_EQ(
+			*marker,
+			"Deployment log too large, left out " + to_string(n_lines - n_kept) + " lines");
+		EXPECT_LE(GetFileContent(log_path).size(), max_size);
+	};
+
+	{
+		deps::LogFileWriter writer {log_path, max_size};
+		ASSERT_EQ(writer.Open(), error::NoError);
+		for (int i = 0; i < 1000; i++) {
+			ASSERT_EQ(writer.Append(LogLine(i)), error::NoError);
+			EXPECT_LE(writer.Size(), max_size);
+		}
+	}
+	check_log(1000);
+
+	{
+		// The count of lines left out adds up over repeated cuts.
+		deps::LogFileWriter writer {log_path, max_size};
+		ASSERT_EQ(writer.Open(), error::NoError);
+		for (int i = 1000; i < 1100; i++) {
+			ASSERT_EQ(writer.Append(LogLine(i)), error::NoError);
+		}
+	}
+	check_log(1100);
+}
+
+TEST_F(DeploymentsTests, DeploymentLogSizeLimitTest) {
+	{
+		deps::DeploymentLog dlog {test_state_dir.Path(), "1", 4096};
+		dlog.BeginLogging();
+		for (int i = 0; i < 1000; i++) {
+			mlog::Info("Testing deployment logging " + to_string(i));
+		}
+	}
+
+	auto log_data = ReadLogFile(path::Join(test_state_dir.Path(), "deployments.0000.1.log"));
+	EXPECT_LE(log_data.size(), 4096u);
+	EXPECT_THAT(log_data, testing::HasSubstr("Testing deployment logging 0\""));
+	EXPECT_THAT(log_data, testing::HasSubstr("Deployment log too large, left out "));
+	EXPECT_THAT(log_data, testing::HasSubstr("Testing deployment logging 999\""));
+}
+
+TEST_F(DeploymentsTests, JsonLogMessageReaderStreamTest) {
+	const string messages = LogLine(0) + LogLine(1) + LogLine(2);
+	string expected_data = R"({"messages":[)" + messages + "}";
+	replace(expected_data.begin(), expected_data.end(), '\n', ',');
+	expected_data[expected_data.size() - 2] = ']';
+
+	for (size_t buf_size : {2, 3, 7, 1024}) {
+		deps::JsonLogMessagesReader logs_reader {make_shared<io::StringReader>(messages)};
+		EXPECT_NE(logs_reader.Rewind(), error::NoError);
+
+		string data;
+		vector<uint8_t> buf(buf_size);
+		size_t n_read = 0;
+		do {
+			auto ex_n_read = logs_reader.Read(buf.begin(), buf.end());
+			ASSERT_TRUE(ex_n_read);
+			n_read = ex_n_read.value();
+			EXPECT_LE(n_read, buf.size());
+			data.append(buf.begin(), buf.begin() + n_read);
+		} while (n_read > 0);
+		EXPECT_EQ(data, expected_data) << "Buffer size: " << buf_size;
+	}
+}
+
+TEST_F(DeploymentsTests, PushCompressedLogsTest) {
+	TestEventLoop loop;
+
+	http::ServerConfig server_config;
+	http::Server server(server_config, loop);
+
+	http::ClientConfig client_config;
+	NoAuthHTTPClient client {client_config, loop};
+
+	const string test_log_file_path = test_state_dir.Path() + "/test.log";
+	string expected_request_data = R"({"messages":[)";
+	{
+		deps::LogFileWriter writer {test_log_file_path, 0};
+		ASSERT_EQ(writer.Open(), error::NoError);
+		for (int i = 0; i < 1000; i++) {
+			ASSERT_EQ(writer.Append(LogLine(i)), error::NoError);
+			expected_request_data += LogLine(i);
+			expected_request_data.back() = ',';
+		}
+		expected_request_data.back() = ']';
+		expected_request_data += "}";
+	}
+
+	string deployment_id = "2";
+	vector<uint8_t> received_body;
+	server.AsyncServeUrl(
+		TEST_SERVER,
+		[&received_body](http::ExpectedIncomingRequestPtr exp_req) {
+			ASSERT_TRUE(exp_req) << exp_req.error().String();
+			auto req = exp_req.value();
+
+			auto ex_transfer_encoding = req->GetHeader("Transfer-Encoding");
+#ifdef MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+			ASSERT_TRUE(ex_transfer_encoding);
+			EXPECT_EQ(ex_transfer_encoding.value(), "chunked");
+			EXPECT_FALSE(req->GetHeader("Content-Length"));
+#else
+			EXPECT_FALSE(ex_transfer_encoding);
+#endif // MENDER_DEPLOYMENT_LOG_ZSTD_COMPRESSION
+
+			auto body_writer = make_shared<io::ByteWriter>(received_body);
+			body_writer->SetUnlimited(true);
+			req->SetBodyWriter(body_writer);
+		},
+		[&received_body, &expected_request_data, deployment_id](
+			http::ExpectedIncomingRequestPtr exp_req) {
+			ASSERT_TRUE(exp_req) << exp_req.error().String();
+
+			auto req = exp_req.value();
+			EXPECT_EQ(
+				req->GetPath(),
+				"/api/devices/v1/deployments/device/deployments/" + deployment_id + "/log");
+			EXPECT_EQ(req->GetMethod(), http::Method::PUT);
+			EXPECT_EQ(common::StringFromByteVector(received_body), expected_request_data);
+
+			auto result = req->MakeResponse();
+			ASSERT_TRUE(result);
+			auto resp = result.value();
+
+			resp->SetHeader("Content-Length", "0");
+			resp->SetBodyReader(make_shared<io::StringReader>(""));
+			resp->SetStatusCodeAndMessage(204, "No content");
+			resp->AsyncReply([](error::Error err) { ASSERT_EQ(error::NoError, err); });
+		});
+
+	bool handler_called = false;
+	auto err = deps::DeploymentClient().PushLogs(
+		deployment_id,
+		test_log_file_path,
+		client,
+		[&handler_called, &loop](deps::StatusAPIResponse resp) {
+			handler_called = true;
+			EXPECT_EQ(resp, error::NoError);
+			loop.Stop();
+		});
+	EXPECT_EQ(err, error::NoError);
+
+	loop.Run();
+	EXPECT_TRUE(handler_called);
+}
@@ -0,0 +1,382 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/file_update/file_update.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <common/io.hpp>
+#include <common/path.hpp>
+#include <common/processes.hpp>
+#include <common/testing.hpp>
+
+using namespace std;
+
+namespace file_update = mender::update::file_update;
+namespace io = mender::common::io;
+namespace path = mender::common::path;
+namespace processes = mender::common::processes;
+namespace mtesting = mender::common::testing;
+
+class FileUpdateTests : public testing::Test {
+public:
+	void SetUp() override {
+		work_path_ = path::Join(tmpdir_.Path(), "work");
+		ASSERT_EQ(path::CreateDirectory(work_path_), mender::common::error::NoError);
+	}
+
+	void RunScript(const string &script) {
+		processes::Process proc({"/bin/sh", "-c", "set -e\ncd " + tmpdir_.Path() + "\n" + script});
+		auto err = proc.Run();
+		ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	}
+
+	string Contents(const string &file) {
+		ifstream f(file);
+		return string(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+	}
+
+	uint32_t Mode(const string &file) {
+		struct stat st;
+		EXPECT_EQ(lstat(file.c_str(), &st), 0) << file;
+		return st.st_mode & 07777;
+	}
+
+	// Feeds a file to the module in small chunks, like the client does.
+	void AddPayloadFile(file_update::Module &module, const string &name, const string &file) {
+		auto data = Contents(file);
+		auto err = module.BeginPayloadFile(name, static_cast<int64_t>(data.size()));
+		ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+		const size_t chunk = 10000;
+		for (size_t offset = 0; offset < data.size(); offset += chunk) {
+			auto n = min(chunk, data.size() - offset);
+			err = module.PayloadFileData(
+				reinterpret_cast<const uint8_t *>(data.data() + offset), n);
+			ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+		}
+		err = module.EndPayloadFile();
+		ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	}
+
+	void AddPayloadValue(file_update::Module &module, const string &name, const string &value) {
+		string file = path::Join(tmpdir_.Path(), "value");
+		ofstream(file) << value;
+		AddPayloadFile(module, name, file);
+	}
+
+protected:
+	mtesting::TemporaryDirectory tmpdir_;
+	string work_path_;
+};
+
+TEST_F(FileUpdateTests, ExtractTar) {
+	RunScript(R"(
+mkdir -p tree/sub/empty tree/locked
+echo small > tree/sub/small
+head -c 3000000 /dev/urandom > tree/large
+ln -s sub/small tree/link
+ln tree/sub/small tree/hardlink
+chmod 640 tree/sub/small
+chmod 751 tree/sub
+echo secret > tree/locked/file
+chmod 500 tree/locked
+touch -d 2020-01-01 tree/sub tree/large
+tar -C tree -cf update.tar .
+)");
+
+	string dest = path::Join(tmpdir_.Path(), "dest");
+	ASSERT_EQ(path::CreateDirectory(dest), mender::common::error::NoError);
+
+	io::FileReader reader(path::Join(tmpdir_.Path(), "update.tar"));
+	file_update::WorkerPool pool(4, 1024 * 1024);
+	auto err = file_update::ExtractTar(reader, dest, pool);
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+
+	string tree = path::Join(tmpdir_.Path(), "tree");
+	EXPECT_EQ(Contents(path::Join(dest, "sub/small")), "small\n");
+	EXPECT_EQ(Contents(path::Join(dest, "large")), Contents(path::Join(tree, "large")));
+	EXPECT_EQ(Contents(path::Join(dest, "locked/file")), "secret\n");
+	EXPECT_TRUE(path::FileExists(path::Join(dest, "sub/empty")));
+
+	EXPECT_EQ(Mode(path::Join(dest, "sub/small")), 0640);
+	EXPECT_EQ(Mode(path::Join(dest, "sub")), 0751);
+	EXPECT_EQ(Mode(path::Join(dest, "locked")), 0500);
+
+	struct stat st;
+	ASSERT_EQ(stat(path::Join(dest, "large").c_str(), &st), 0);
+	struct stat orig_st;
+	ASSERT_EQ(stat(path::Join(tree, "large").c_str(), &orig_st), 0);
+	EXPECT_EQ(st.st_mtim.tv_sec, orig_st.st_mtim.tv_sec);
+	ASSERT_EQ(stat(path::Join(dest, "sub").c_str(), &st), 0);
+	ASSERT_EQ(stat(path::Join(tree, "sub").c_str(), &orig_st), 0);
+	EXPECT_EQ(st.st_mtim.tv_sec, orig_st.st_mtim.tv_sec);
+
+	char target[100] {};
+	ASSERT_GT(readlink(path::Join(dest, "link").c_str(), target, sizeof(target) - 1), 0);
+	EXPECT_EQ(string(target), "sub/small");
+
+	struct stat hardlink_st;
+	ASSERT_EQ(stat(path::Join(dest, "sub/small").c_str(), &st), 0);
+	ASSERT_EQ(stat(path::Join(dest, "hardlink").c_str(), &hardlink_st), 0);
+	EXPECT_EQ(st.st_ino, hardlink_st.st_ino);
+
+	// So that the temporary directory can be removed.
+	chmod(path::Join(dest, "locked").c_str(), 0700);
+	chmod(path::Join(tree, "locked").c_str(), 0700);
+}
+
+TEST_F(FileUpdateTests, ExtractTarRejectsPathsOutsideOfDestination) {
+	RunScript(R"(
+mkdir tree
+echo evil > tree/evil
+tar -C tree -cf parent.tar --transform 's,^\./evil,../evil,' ./evil
+ln -s .. tree/up
+tar -C tree -cf symlink.tar ./up --transform 's,^\./evil,./up/evil,' ./evil
+)");
+
+	for (auto archive : {"parent.tar", "symlink.tar"}) {
+		string dest = path::Join(tmpdir_.Path(), "dest");
+		ASSERT_EQ(path::DeleteRecursively(dest), mender::common::error::NoError);
+		ASSERT_EQ(path::CreateDirectory(dest), mender::common::error::NoError);
+
+		io::FileReader reader(path::Join(tmpdir_.Path(), archive));
+		file_update::WorkerPool pool(2, 1024 * 1024);
+		auto err = file_update::ExtractTar(reader, dest, pool);
+		EXPECT_NE(err, mender::common::error::NoError) << archive;
+		EXPECT_FALSE(path::FileExists(path::Join(tmpdir_.Path(), "evil"))) << archive;
+	}
+}
+
+TEST_F(FileUpdateTests, StreamQueueBackpressure) {
+	file_update::StreamQueue queue(4);
+	const uint8_t data[] = "abcd";
+
+	// Doesn't wait while there is room.
+	ASSERT_TRUE(queue.Push(data, 4));
+
+	atomic<bool> pushed {false};
+	thread writer([&]() {
+		EXPECT_TRUE(queue.Push(data, 4));
+		pushed = true;
+		EXPECT_FALSE(queue.Push(data, 4));
+	});
+	this_thread::sleep_for(chrono::milliseconds(100));
+	EXPECT_FALSE(pushed);
+
+	vector<uint8_t> buf(4);
+	auto result = queue.Read(buf.begin(), buf.end());
+	ASSERT_TRUE(result) << result.error();
+	EXPECT_EQ(result.value(), 4);
+	while (!pushed) {
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+
+	// Releases the writer, which is now waiting again.
+	queue.StopReading();
+	writer.join();
+}
+
+TEST_F(FileUpdateTests, CopyTree) {
+	RunScript(R"(
+mkdir -p tree/sub copy
+echo data > tree/sub/file
+chmod 604 tree/sub/file
+ln -s sub/file tree/link
+)");
+
+	string tree = path::Join(tmpdir_.Path(), "tree");
+	string copy = path::Join(tmpdir_.Path(), "copy");
+	file_update::WorkerPool pool(2, 1024 * 1024);
+	auto err = file_update::CopyTree(tree, copy, pool);
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+
+	EXPECT_EQ(Contents(path::Join(copy, "sub/file")), "data\n");
+	EXPECT_EQ(Mode(path::Join(copy, "sub/file")), 0604);
+	char target[100] {};
+	ASSERT_GT(readlink(path::Join(copy, "link").c_str(), target, sizeof(target) - 1), 0);
+	EXPECT_EQ(string(target), "sub/file");
+}
+
+TEST_F(FileUpdateTests, DirectoryInstallCommit) {
+	RunScript(R"(
+mkdir -p new/sub dest
+echo new > new/sub/file
+echo old > dest/old-file
+tar -C new -cf update.tar .
+)");
+	string dest = path::Join(tmpdir_.Path(), "dest");
+
+	file_update::DirectoryModule module(work_path_);
+	AddPayloadValue(module, "dest_dir", dest + "/\n");
+	AddPayloadFile(module, "update.tar", path::Join(tmpdir_.Path(), "update.tar"));
+
+	auto err = module.ArtifactInstall();
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	EXPECT_EQ(Contents(path::Join(dest, "sub/file")), "new\n");
+	EXPECT_FALSE(path::FileExists(path::Join(dest, "old-file")));
+	EXPECT_TRUE(path::FileExists(path::Join(tmpdir_.Path(), ".dest.mender-prev")));
+
+	err = module.Cleanup();
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	EXPECT_EQ(Contents(path::Join(dest, "sub/file")), "new\n");
+	EXPECT_FALSE(path::FileExists(path::Join(tmpdir_.Path(), ".dest.mender-prev")));
+	EXPECT_FALSE(path::FileExists(path::Join(tmpdir_.Path(), ".dest.mender-new")));
+}
+
+TEST_F(FileUpdateTests, DirectoryInstallRollback) {
+	RunScript(R"(
+mkdir -p new dest
+echo new > new/file
+echo old > dest/file
+tar -C new -cf update.tar .
+)");
+	string dest = path::Join(tmpdir_.Path(), "dest");
+
+	file_update::DirectoryModule module(work_path_);
+	AddPayloadValue(module, "dest_dir", dest);
+	AddPayloadFile(module, "update.tar", path::Join(tmpdir_.Path(), "update.tar"));
+
+	auto err = module.ArtifactInstall();
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	EXPECT_EQ(Contents(path::Join(dest, "file")), "new\n");
+
+	// A new instance, like after a restart of the client.
+	file_update::DirectoryModule restarted(work_path_);
+	err = restarted.ArtifactRollback();
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	EXPECT_EQ(Contents(path::Join(dest, "file")), "old\n");
+
+	err = restarted.Cleanup();
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	EXPECT_EQ(Contents(path::Join(dest, "file")), "old\n");
+	EXPECT_FALSE(path::FileExists(path::Join(tmpdir_.Path(), ".dest.mender-prev")));
+}
+
+TEST_F(FileUpdateTests, DirectoryRollbackBeforeInstall) {
+	RunScript(R"(
+mkdir -p dest
+echo old > dest/file
+)");
+	string dest = path::Join(tmpdir_.Path(), "dest");
+
+	file_update::DirectoryModule module(work_path_);
+	AddPayloadValue(module, "dest_dir", dest);
+
+	auto err = module.ArtifactRollback();
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	EXPECT_EQ(Contents(path::Join(dest, "file")), "old\n");
+}
+
+TEST_F(FileUpdateTests, DirectoryRejectsRoot) {
+	file_update::DirectoryModule module(work_path_);
+	AddPayloadValue(module, "dest_dir", "/");
+
+	auto err = module.ArtifactInstall();
+	EXPECT_NE(err, mender::common::error::NoError);
+}
+
+TEST_F(FileUpdateTests, DirectoryCorruptArchive) {
+	RunScript(R"(
+head -c 10000 /dev/urandom > corrupt.tar
+)");
+
+	file_update::DirectoryModule module(work_path_);
+	auto data = Contents(path::Join(tmpdir_.Path(), "corrupt.tar"));
+	auto err = module.BeginPayloadFile("update.tar", static_cast<int64_t>(data.size()));
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	err = module.PayloadFileData(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+	if (err == mender::common::error::NoError) {
+		err = module.EndPayloadFile();
+	}
+	EXPECT_NE(err, mender::common::error::NoError);
+}
+
+TEST_F(FileUpdateTests, SingleFileInstallRollback) {
+	RunScript(R"(
+mkdir -p dest
+echo old > dest/app.conf
+echo new > app.conf
+)");
+	string dest = path::Join(tmpdir_.Path(), "dest");
+	string target = path::Join(dest, "app.conf");
+
+	file_update::SingleFileModule module(work_path_);
+	AddPayloadValue(module, "filename", "app.conf\n");
+	AddPayloadValue(module, "dest_dir", dest + "\n");
+	AddPayloadValue(module, "permissions", "600\n");
+	AddPayloadFile(module, "app.conf", path::Join(tmpdir_.Path(), "app.conf"));
+
+	auto err = module.ArtifactInstall();
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	EXPECT_EQ(Contents(target), "new\n");
+	EXPECT_EQ(Mode(target), 0600);
+	EXPECT_FALSE(path::FileExists(path::Join(dest, ".app.conf.mender-tmp")));
+
+	err = module.ArtifactRollback();
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	EXPECT_EQ(Contents(target), "old\n");
+}
+
+TEST_F(FileUpdateTests, SingleFileNewFile) {
+	RunScript(R"(
+echo new > app.conf
+)");
+	string dest = path::Join(tmpdir_.Path(), "dest");
+	string target = path::Join(dest, "app.conf");
+
+	file_update::SingleFileModule module(work_path_);
+	AddPayloadValue(module, "filename", "app.conf");
+	AddPayloadValue(module, "dest_dir", dest);
+	AddPayloadFile(module, "app.conf", path::Join(tmpdir_.Path(), "app.conf"));
+
+	auto err = module.ArtifactInstall();
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	EXPECT_EQ(Contents(target), "new\n");
+
+	// Nothing to restore.
+	err = module.ArtifactRollback();
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+	EXPECT_EQ(Contents(target), "new\n");
+}
+
+TEST_F(FileUpdateTests, BuiltinModule) {
+	EXPECT_EQ(file_update::BuiltinModule("rootfs-image"), nullptr);
+	ASSERT_NE(file_update::BuiltinModule("single-file"), nullptr);
+
+	auto funcs = file_update::BuiltinModule("directory");
+	ASSERT_NE(funcs, nullptr);
+	EXPECT_EQ(funcs->abi_version, MENDER_UPDATE_MODULE_PLUGIN_ABI_VERSION);
+
+	auto instance = funcs->open(work_path_.c_str(), nullptr);
+	ASSERT_NE(instance, nullptr);
+	char output[100];
+	EXPECT_EQ(funcs->call_state(instance, "NeedsArtifactReboot", output, sizeof(output)), 0);
+	EXPECT_EQ(string(output), "No");
+	EXPECT_EQ(funcs->call_state(instance, "SupportsRollback", output, sizeof(output)), 0);
+	EXPECT_EQ(string(output), "Yes");
+	// No dest_dir.
+	EXPECT_NE(funcs->call_state(instance, "ArtifactInstall", output, sizeof(output)), 0);
+	funcs->close(instance);
+}
@@ -21,12 +21,15 @@
 #include <gtest/gtest.h>
 
 #include <api/client.hpp>
+#include <artifact/sha/sha.hpp>
 #include <common/common.hpp>
 #include <client_shared/conf.hpp>
 #include <common/error.hpp>
 #include <common/events.hpp>
 #include <common/http.hpp>
 #include <common/io.hpp>
+#include <common/key_value_database_lmdb.hpp>
+#include <common/path.hpp>
 #include <common/testing.hpp>
 
 #define TEST_SERVER "http://127.0.0.1:8002"
@@ -41,7 +44,16 @@ namespace events = mender::common::events;
 namespace http = mender::common::http;
 namespace io = mender::common::io;
 namespace inv = mender::update::inventory;
+namespace kv_db = mender::common::key_value_database;
+namespace path = mender::common::path;
 namespace mtesting = mender::common::testing;
+namespace sha = mender::sha;
+
+static string Digest(const string &data) {
+	auto ex_sha = sha::Shasum(common::ByteVectorFromString(data));
+	EXPECT_TRUE(ex_sha);
+	return ex_sha.value().String();
+}
 
 class NoAuthHTTPClient : public api::Client {
 public:
@@ -136,12 +148,12 @@ exit 0
 		});
 
 	bool handler_called = false;
-	size_t last_hash = 0;
+	string last_digest;
 	auto err = inv::PushInventoryData(
 		test_scripts_dir.Path(),
 		loop,
 		client,
-		last_hash,
+		last_digest,
 		[&handler_called, &loop](error::Error err) {
 			handler_called = true;
 			ASSERT_EQ(err, error::NoError);
@@ -151,7 +163,7 @@ exit 0
 
 	loop.Run();
 	EXPECT_TRUE(handler_called);
-	EXPECT_EQ(last_hash, std::hash<string> {}(expected_request_data));
+	EXPECT_EQ(last_digest, Digest(expected_request_data));
 }
 
 TEST_F(InventoryAPITests, PushInventoryDataTestVersionMultiple) {
@@ -219,12 +231,12 @@ exit 0
 		});
 
 	bool handler_called = false;
-	size_t last_hash = 0;
+	string last_digest;
 	auto err = inv::PushInventoryData(
 		test_scripts_dir.Path(),
 		loop,
 		client,
-		last_hash,
+		last_digest,
 		[&handler_called, &loop](error::Error err) {
 			handler_called = true;
 			ASSERT_EQ(err, error::NoError);
@@ -234,7 +246,7 @@ exit 0
 
 	loop.Run();
 	EXPECT_TRUE(handler_called);
-	EXPECT_EQ(last_hash, std::hash<string> {}(expected_request_data));
+	EXPECT_EQ(last_digest, Digest(expected_request_data));
 }
 
 TEST_F(InventoryAPITests, PushInventoryNoDataTest) {
@@ -291,12 +303,12 @@ exit 0
 		});
 
 	bool handler_called = false;
-	size_t last_hash = 0;
+	string last_digest;
 	auto err = inv::PushInventoryData(
 		test_scripts_dir.Path(),
 		loop,
 		client,
-		last_hash,
+		last_digest,
 		[&handler_called, &loop](error::Error err) {
 			handler_called = true;
 			ASSERT_EQ(err, error::NoError);
@@ -306,8 +318,7 @@ exit 0
 
 	loop.Run();
 	EXPECT_TRUE(handler_called);
-	size_t expected_hash = std::hash<string> {}(expected_request_data);
-	EXPECT_EQ(last_hash, expected_hash);
+	EXPECT_EQ(last_digest, Digest(expected_request_data));
 }
 
 TEST_F(InventoryAPITests, PushInventoryDataFailTest) {
@@ -373,12 +384,12 @@ exit 0
 		});
 
 	bool handler_called = false;
-	size_t last_hash = 0;
+	string last_digest;
 	auto err = inv::PushInventoryData(
 		test_scripts_dir.Path(),
 		loop,
 		client,
-		last_hash,
+		last_digest,
 		[&handler_called, &loop](error::Error err) {
 			handler_called = true;
 			ASSERT_NE(err, error::NoError);
@@ -394,7 +405,7 @@ exit 0
 	EXPECT_TRUE(handler_called);
 
 	// no change in case of failure
-	EXPECT_EQ(last_hash, 0);
+	EXPECT_EQ(last_digest, "");
 }
 
 TEST_F(InventoryAPITests, PushInventoryDataNoopTest) {
@@ -425,16 +436,16 @@ exit 0
 		[](http::ExpectedIncomingRequestPtr exp_req) { EXPECT_TRUE(false); });
 
 	bool handler_called = false;
-	size_t last_hash = std::hash<string> {}(
+	string last_digest = Digest(
 		R"([{"name":"key1","value":["value1","value11"]},{"name":"key2","value":"value2"},{"name":"key3","value":"value3"},{"name":"mender_client_version","value":")"
 		+ conf::kMenderVersion
 		+ R"("},{"name":"mender_client_version_provider","value":"internal"}])");
-	size_t last_hash_orig = last_hash;
+	string last_digest_orig = last_digest;
 	auto err = inv::PushInventoryData(
 		test_scripts_dir.Path(),
 		loop,
 		client,
-		last_hash,
+		last_digest,
 		[&handler_called, &loop](error::Error err) {
 			handler_called = true;
 			ASSERT_EQ(err, error::NoError);
@@ -444,5 +455,281 @@ exit 0
 
 	loop.Run();
 	EXPECT_TRUE(handler_called);
-	EXPECT_EQ(last_hash, last_hash_orig);
+	EXPECT_EQ(last_digest, last_digest_orig);
+}
+
+TEST(InventoryDataTests, PayloadRoundTrip) {
+	mender::common::key_value_parser::KeyValuesMap data {
+		{"key2", {"value2"}},
+		{"key1", {"value1", "value11"}},
+		{"quoted", {"\"value\""}},
+	};
+
+	auto payload = inv::MakeInventoryPayload(data);
+	EXPECT_EQ(
+		payload,
+		R"([{"name":"key1","value":["value1","value11"]},{"name":"key2","value":"value2"},{"name":"quoted","value":"\"value\""}])");
+
+	auto ex_parsed = inv::ParseInventoryPayload(payload);
+	ASSERT_TRUE(ex_parsed) << ex_parsed.error().String();
+	EXPECT_EQ(ex_parsed.value(), data);
+
+	EXPECT_EQ(inv::MakeInventoryPayload({}), "[]");
+	EXPECT_FALSE(inv::ParseInventoryPayload(R"({"name":"key1"})"));
+}
+
+TEST(InventoryDataTests, Diff) {
+	mender::common::key_value_parser::KeyValuesMap previous {
+		{"same", {"value"}},
+		{"changed", {"old"}},
+		{"removed", {"value"}},
+		{"multi", {"a", "b"}},
+	};
+	mender::common::key_value_parser::KeyValuesMap current {
+		{"same", {"value"}},
+		{"changed", {"new"}},
+		{"added", {"value"}},
+		{"multi", {"a", "b", "c"}},
+	};
+
+	auto diff = inv::DiffInventoryData(previous, current);
+	mender::common::key_value_parser::KeyValuesMap expected_changed {
+		{"changed", {"new"}},
+		{"added", {"value"}},
+		{"multi", {"a", "b", "c"}},
+	};
+	EXPECT_EQ(diff.changed, expected_changed);
+	EXPECT_EQ(diff.removed, vector<string> {"removed"});
+
+	diff = inv::DiffInventoryData(current, current);
+	EXPECT_TRUE(diff.changed.empty());
+	EXPECT_TRUE(diff.removed.empty());
+}
+
+class InventoryIncrementalTests : public InventoryAPITests {
+protected:
+	void SetUp() override {
+		auto err = db.Open(path::Join(db_dir.Path(), "mender-store"));
+		ASSERT_EQ(err, error::NoError);
+	}
+
+	// Runs one submission and returns the method and body that reached the server, if any.
+	void Push(
+		chrono::seconds full_sync_interval,
+		http::Method &received_method,
+		string &received_body_str,
+		bool &request_received) {
+		Push(target, full_sync_interval, received_method, received_body_str, request_received);
+	}
+
+	void Push(
+		const inv::SubmissionTarget &target,
+		chrono::seconds full_sync_interval,
+		http::Method &received_method,
+		string &received_body_str,
+		bool &request_received) {
+		mtesting::TestEventLoop loop;
+
+		http::ServerConfig server_config;
+		http::Server server(server_config, loop);
+
+		http::ClientConfig client_config;
+		NoAuthHTTPClient client {client_config, loop};
+
+		auto received_body = make_shared<vector<uint8_t>>();
+		request_received = false;
+		server.AsyncServeUrl(
+			TEST_SERVER,
+			[received_body](http::ExpectedIncomingRequestPtr exp_req) {
+				ASSERT_TRUE(exp_req) << exp_req.error().String();
+				auto req = exp_req.value();
+
+				auto content_length = req->GetHeader("Content-Length");
+				ASSERT_TRUE(content_length);
+				auto ex_len = common::StringToLongLong(content_length.value());
+				ASSERT_TRUE(ex_len);
+
+				received_body->resize(ex_len.value());
+				req->SetBodyWriter(make_shared<io::ByteWriter>(received_body));
+			},
+			[received_body, &received_method, &received_body_str, &request_received](
+				http::ExpectedIncomingRequestPtr exp_req) {
+				ASSERT_TRUE(exp_req) << exp_req.error().String();
+
+				auto req = exp_req.value();
+				EXPECT_EQ(req->GetPath(), "/api/devices/v1/inventory/device/attributes");
+				request_received = true;
+				received_method = req->GetMethod();
+				received_body_str = common::StringFromByteVector(*received_body);
+
+				auto result = req->MakeResponse();
+				ASSERT_TRUE(result);
+				auto resp = result.value();
+
+				resp->SetHeader("Content-Length", "0");
+				resp->SetStatusCodeAndMessage(200, "Success");
+				resp->AsyncReply([](error::Error err) { ASSERT_EQ(error::NoError, err); });
+			});
+
+		bool handler_called = false;
+		auto err = inv::PushInventoryData(
+			test_scripts_dir.Path(),
+			loop,
+			client,
+			db,
+			target,
+			full_sync_interval,
+			[&handler_called, &loop](error::Error err) {
+				handler_called = true;
+				EXPECT_EQ(err, error::NoError);
+				loop.Stop();
+			});
+		ASSERT_EQ(err, error::NoError);
+
+		loop.Run();
+		EXPECT_TRUE(handler_called);
+	}
+
+	mtesting::TemporaryDirectory db_dir;
+	kv_db::KeyValueDatabaseLmdb db;
+	inv::SubmissionTarget target {TEST_SERVER, "tenant-token"};
+};
+
+TEST_F(InventoryIncrementalTests, SendsOnlyChangedAttributes) {
+	ASSERT_TRUE(PrepareTestScript("mender-inventory-script1", R"(#!/bin/sh
+echo "key1=value1"
+echo "key2=value2"
+echo "mender_client_version=1.2.3"
+)"));
+
+	const string full_payload =
+		R"([{"name":"key1","value":"value1"},{"name":"key2","value":"value2"},{"name":"mender_client_version","value":"1.2.3"},{"name":"mender_client_version_provider","value":"external"}])";
+
+	http::Method method;
+	string body;
+	bool received;
+
+	// Nothing stored yet, so everything is sent.
+	Push(chrono::hours(1), method, body, received);
+	ASSERT_TRUE(received);
+	EXPECT_EQ(method, http::Method::PUT);
+	EXPECT_EQ(body, full_payload);
+
+	auto ex_stored = db.Read(inv::kInventoryDataKey);
+	ASSERT_TRUE(ex_stored);
+	EXPECT_EQ(common::StringFromByteVector(ex_stored.value()), full_payload);
+
+	// Nothing changed, nothing sent.
+	Push(chrono::hours(1), method, body, received);
+	EXPECT_FALSE(received);
+
+	// One attribute changed, only that one is sent.
+	ASSERT_TRUE(PrepareTestScript("mender-inventory-script1", R"(#!/bin/sh
+echo "key1=value1"
+echo "key2=new_value"
+echo "mender_client_version=1.2.3"
+)"));
+	Push(chrono::hours(1), method, body, received);
+	ASSERT_TRUE(received);
+	EXPECT_EQ(method, http::Method::PATCH);
+	EXPECT_EQ(body, R"([{"name":"key2","value":"new_value"}])");
+
+	ex_stored = db.Read(inv::kInventoryDataKey);
+	ASSERT_TRUE(ex_stored);
+	EXPECT_THAT(
+		common::StringFromByteVector(ex_stored.value()),
+		testing::HasSubstr(R"({"name":"key2","value":"new_value"})"));
+
+	// An attribute was removed, which PATCH can't express.
+	ASSERT_TRUE(PrepareTestScript("mender-inventory-script1", R"(#!/bin/sh
+echo "key1=value1"
+echo "mender_client_version=1.2.3"
+)"));
+	Push(chrono::hours(1), method, body, received);
+	ASSERT_TRUE(received);
+	EXPECT_EQ(method, http::Method::PUT);
+	EXPECT_EQ(
+		body,
+		R"([{"name":"key1","value":"value1"},{"name":"mender_client_version","value":"1.2.3"},{"name":"mender_client_version_provider","value":"external"}])");
+}
+
+TEST_F(InventoryIncrementalTests, PeriodicFullSync) {
+	ASSERT_TRUE(PrepareTestScript("mender-inventory-script1", R"(#!/bin/sh
+echo "key1=value1"
+)"));
+
+	http::Method method;
+	string body;
+	bool received;
+
+	Push(chrono::hours(1), method, body, received);
+	ASSERT_TRUE(received);
+	EXPECT_EQ(method, http::Method::PUT);
+
+	// Pretend that the last full submission was long ago.
+	auto err = db.Write(inv::kInventoryLastFullSyncKey, common::ByteVectorFromString("0"));
+	ASSERT_EQ(err, error::NoError);
+
+	// Disabled, so unchanged data is not sent.
+	Push(chrono::seconds::zero(), method, body, received);
+	EXPECT_FALSE(received);
+
+	Push(chrono::hours(1), method, body, received);
+	ASSERT_TRUE(received);
+	EXPECT_EQ(method, http::Method::PUT);
+
+	// And now it's not due anymore.
+	Push(chrono::hours(1), method, body, received);
+	EXPECT_FALSE(received);
+
+	// Clearing the data forces a full submission.
+	ASSERT_EQ(inv::ClearInventoryData(db), error::NoError);
+	Push(chrono::hours(1), method, body, received);
+	ASSERT_TRUE(received);
+	EXPECT_EQ(method, http::Method::PUT);
+}
+
+TEST_F(InventoryIncrementalTests, PersistsFingerprint) {
+	ASSERT_TRUE(PrepareTestScript("mender-inventory-script1", R"(#!/bin/sh
+echo "key1=value1"
+echo "mender_client_version=1.2.3"
+)"));
+
+	const string full_payload =
+		R"([{"name":"key1","value":"value1"},{"name":"mender_client_version","value":"1.2.3"},{"name":"mender_client_version_provider","value":"external"}])";
+
+	http::Method method;
+	string body;
+	bool received;
+
+	Push(chrono::hours(1), method, body, received);
+	ASSERT_TRUE(received);
+	EXPECT_EQ(method, http::Method::PUT);
+
+	auto ex_fingerprint = db.Read(inv::kInventoryFingerprintKey);
+	ASSERT_TRUE(ex_fingerprint);
+	auto fingerprint_str = common::StringFromByteVector(ex_fingerprint.value());
+	EXPECT_THAT(fingerprint_str, testing::HasSubstr(Digest(full_payload)));
+	EXPECT_THAT(fingerprint_str, testing::HasSubstr(TEST_SERVER));
+	EXPECT_THAT(fingerprint_str, testing::HasSubstr(Digest("tenant-token")));
+	EXPECT_THAT(fingerprint_str, testing::Not(testing::HasSubstr("\"tenant-token\"")));
+
+	// Same target, same data, nothing sent.
+	Push(chrono::hours(1), method, body, received);
+	EXPECT_FALSE(received);
+
+	// Another tenant means the server doesn't have our data.
+	Push({TEST_SERVER, "other-tenant-token"}, chrono::hours(1), method, body, received);
+	ASSERT_TRUE(received);
+	EXPECT_EQ(method, http::Method::PUT);
+	EXPECT_EQ(body, full_payload);
+
+	// Likewise with another server.
+	Push({"https://other.server", "other-tenant-token"}, chrono::hours(1), method, body, received);
+	ASSERT_TRUE(received);
+	EXPECT_EQ(method, http::Method::PUT);
+	EXPECT_EQ(body, full_payload);
+
+	Push({"https://other.server", "other-tenant-token"}, chrono::hours(1), method, body, received);
+	EXPECT_FALSE(received);
 }
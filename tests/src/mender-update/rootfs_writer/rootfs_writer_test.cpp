@@ -0,0 +1,279 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+#include <mender-update/rootfs_writer/rootfs_writer.hpp>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <artifact/sha/sha.hpp>
+#include <common/path.hpp>
+#include <common/testing.hpp>
+
+using namespace std;
+
+namespace conf = mender::client_shared::conf;
+namespace config_parser = mender::client_shared::config_parser;
+namespace path = mender::common::path;
+namespace rootfs_writer = mender::update::rootfs_writer;
+namespace sha = mender::sha;
+namespace mtesting = mender::common::testing;
+
+class RootfsWriterTests : public testing::TestWithParam<bool> {
+public:
+	void SetUp() override {
+		device_ = path::Join(tmpdir_.Path(), "device");
+		// Like a partition, the target already exists, and is larger than the payload.
+		ofstream f(device_);
+		f << string(5 * 1024 * 1024, 'x');
+
+		// Not a multiple of any block size, to exercise the unaligned tail.
+		data_.resize(3 * 1024 * 1024 + 123);
+		for (size_t i = 0; i < data_.size(); i++) {
+			data_[i] = static_cast<uint8_t>(i * 7 + i / 4096);
+		}
+		// Zero blocks, like in a filesystem image. One run spans a buffer boundary, and one
+		// doesn't start on a block boundary.
+		fill(data_.begin() + 40960, data_.begin() + 1024 * 1024 + 8192, 0);
+		fill(data_.begin() + 2 * 1024 * 1024 + 100, data_.begin() + 2 * 1024 * 1024 + 50000, 0);
+
+		config_.direct_io = GetParam();
+		config_.sync_interval_bytes = 1024 * 1024;
+	}
+
+	string Checksum() {
+		auto exp_sha = sha::Shasum(data_);
+		EXPECT_TRUE(exp_sha);
+		return exp_sha.value().String();
+	}
+
+	vector<uint8_t> DeviceContents() {
+		ifstream f(device_, ios::binary);
+		return vector<uint8_t>(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+	}
+
+	// Writes in chunks which don't line up with the writer's buffer.
+	void WriteData(rootfs_writer::Writer &writer) {
+		const size_t chunk = 10000;
+		for (size_t offset = 0; offset < data_.size(); offset += chunk) {
+			auto end = min(offset + chunk, data_.size());
+			auto result = writer.Write(data_.cbegin() + offset, data_.cbegin() + end);
+			ASSERT_TRUE(result) << result.error().String();
+			ASSERT_EQ(result.value(), end - offset);
+		}
+	}
+
+protected:
+	mtesting::TemporaryDirectory tmpdir_;
+	string device_;
+	vector<uint8_t> data_;
+	config_parser::RootfsImageWriter config_;
+};
+
+INSTANTIATE_TEST_SUITE_P(DirectIO, RootfsWriterTests, testing::Values(true, false));
+
+TEST_P(RootfsWriterTests, WriteAndVerify) {
+	auto exp_writer = rootfs_writer::Writer::Open(device_, data_.size(), config_);
+	ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+	auto &writer = *exp_writer.value();
+
+	WriteData(writer);
+	auto err = writer.Finish(Checksum());
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+
+	auto contents = DeviceContents();
+	ASSERT_EQ(contents.size(), 5 * 1024 * 1024);
+	EXPECT_TRUE(equal(data_.begin(), data_.end(), contents.begin()));
+	// The rest of the device is untouched.
+	EXPECT_EQ(contents[data_.size()], 'x');
+	EXPECT_EQ(contents.back(), 'x');
+}
+
+TEST_P(RootfsWriterTests, ChecksumMismatch) {
+	auto exp_writer = rootfs_writer::Writer::Open(device_, data_.size(), config_);
+	ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+	auto &writer = *exp_writer.value();
+
+	WriteData(writer);
+	auto err = writer.Finish(string(64, '0'));
+	ASSERT_NE(err, mender::common::error::NoError);
+	EXPECT_EQ(err.code, sha::MakeError(sha::ShasumMismatchError, "").code) << err.String();
+}
+
+TEST_P(RootfsWriterTests, NoVerify) {
+	config_.verify = false;
+	auto exp_writer = rootfs_writer::Writer::Open(device_, data_.size(), config_);
+	ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+	auto &writer = *exp_writer.value();
+
+	WriteData(writer);
+	auto err = writer.Finish(string(64, '0'));
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+}
+
+TEST_P(RootfsWriterTests, PayloadLargerThanDeclared) {
+	auto exp_writer = rootfs_writer::Writer::Open(device_, data_.size() - 1, config_);
+	ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+	auto &writer = *exp_writer.value();
+
+	auto result = writer.Write(data_.cbegin(), data_.cend());
+	ASSERT_FALSE(result);
+	EXPECT_EQ(result.error().code, make_error_condition(errc::file_too_large));
+}
+
+TEST_P(RootfsWriterTests, PayloadSmallerThanDeclared) {
+	auto exp_writer = rootfs_writer::Writer::Open(device_, data_.size() + 1, config_);
+	ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+	auto &writer = *exp_writer.value();
+
+	WriteData(writer);
+	auto err = writer.Finish(Checksum());
+	ASSERT_NE(err, mender::common::error::NoError);
+	EXPECT_EQ(err.code, make_error_condition(errc::io_error)) << err.String();
+}
+
+TEST_P(RootfsWriterTests, SkipZeroBlocks) {
+	config_.skip_zero_blocks = true;
+	auto exp_writer = rootfs_writer::Writer::Open(device_, data_.size(), config_);
+	ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+	auto &writer = *exp_writer.value();
+
+	WriteData(writer);
+	auto err = writer.Finish(Checksum());
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+
+	auto contents = DeviceContents();
+	ASSERT_EQ(contents.size(), 5 * 1024 * 1024);
+	EXPECT_TRUE(equal(data_.begin(), data_.end(), contents.begin()));
+	EXPECT_EQ(contents[data_.size()], 'x');
+}
+
+TEST_P(RootfsWriterTests, SkipZeroBlocksPreDiscarded) {
+	{
+		ofstream f(device_);
+		f << string(5 * 1024 * 1024, '\0');
+	}
+
+	config_.skip_zero_blocks = true;
+	config_.target_pre_discarded = true;
+	auto exp_writer = rootfs_writer::Writer::Open(device_, data_.size(), config_);
+	ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+	auto &writer = *exp_writer.value();
+
+	WriteData(writer);
+	auto err = writer.Finish(Checksum());
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+
+	auto contents = DeviceContents();
+	EXPECT_TRUE(equal(data_.begin(), data_.end(), contents.begin()));
+}
+
+TEST_P(RootfsWriterTests, SkipZeroBlocksNotActuallyPreDiscarded) {
+	// The zero blocks are not touched, so the old contents remain, and verification catches it.
+	config_.skip_zero_blocks = true;
+	config_.target_pre_discarded = true;
+	auto exp_writer = rootfs_writer::Writer::Open(device_, data_.size(), config_);
+	ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+	auto &writer = *exp_writer.value();
+
+	WriteData(writer);
+	auto err = writer.Finish(Checksum());
+	ASSERT_NE(err, mender::common::error::NoError);
+	EXPECT_EQ(err.code, sha::MakeError(sha::ShasumMismatchError, "").code) << err.String();
+
+	auto contents = DeviceContents();
+	EXPECT_EQ(contents[40960], 'x');
+}
+
+TEST_P(RootfsWriterTests, ResumeFromCheckpoint) {
+	config_.checkpoint_interval_bytes = 1024 * 1024;
+
+	vector<int64_t> checkpoints;
+	auto handler = [&checkpoints](int64_t offset) {
+		checkpoints.push_back(offset);
+		return mender::common::error::NoError;
+	};
+
+	{
+		// Interrupted after a bit more than two checkpoints.
+		auto exp_writer = rootfs_writer::Writer::Open(device_, data_.size(), config_, 0, handler);
+		ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+		auto result = exp_writer.value()->Write(data_.cbegin(), data_.cbegin() + 2500000);
+		ASSERT_TRUE(result) << result.error().String();
+	}
+	ASSERT_EQ(checkpoints, (vector<int64_t> {1024 * 1024, 2 * 1024 * 1024}));
+
+	// Prove that the data before the checkpoint is not written again.
+	fstream f(device_, ios::in | ios::out | ios::binary);
+	f.seekp(100);
+	f.put('y');
+	f.close();
+
+	checkpoints.clear();
+	auto exp_writer =
+		rootfs_writer::Writer::Open(device_, data_.size(), config_, 2 * 1024 * 1024, handler);
+	ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+	auto &writer = *exp_writer.value();
+	WriteData(writer);
+	auto err = writer.Finish(Checksum());
+	ASSERT_NE(err, mender::common::error::NoError);
+	EXPECT_EQ(err.code, sha::MakeError(sha::ShasumMismatchError, "").code) << err.String();
+	EXPECT_EQ(checkpoints, (vector<int64_t> {3 * 1024 * 1024}));
+
+	auto contents = DeviceContents();
+	EXPECT_EQ(contents[100], 'y');
+	EXPECT_TRUE(equal(data_.begin() + 101, data_.end(), contents.begin() + 101));
+}
+
+TEST_P(RootfsWriterTests, InvalidResumeOffset) {
+	auto exp_writer = rootfs_writer::Writer::Open(device_, data_.size(), config_, 1000);
+	ASSERT_TRUE(exp_writer) << exp_writer.error().String();
+	auto &writer = *exp_writer.value();
+	WriteData(writer);
+	auto err = writer.Finish(Checksum());
+	ASSERT_EQ(err, mender::common::error::NoError) << err.String();
+}
+
+TEST(RootfsWriterCheckpointTests, Json) {
+	rootfs_writer::Checkpoint checkpoint {"/dev/mmcblk0p3", string(64, 'a'), 12345, 4096};
+	auto exp_checkpoint =
+		rootfs_writer::CheckpointFromJson(rootfs_writer::CheckpointToJson(checkpoint));
+	ASSERT_TRUE(exp_checkpoint) << exp_checkpoint.error().String();
+	EXPECT_TRUE(exp_checkpoint.value().Matches("/dev/mmcblk0p3", string(64, 'a'), 12345));
+	EXPECT_EQ(exp_checkpoint.value().offset, 4096);
+
+	EXPECT_FALSE(exp_checkpoint.value().Matches("/dev/mmcblk0p2", string(64, 'a'), 12345));
+	EXPECT_FALSE(exp_checkpoint.value().Matches("/dev/mmcblk0p3", string(64, 'b'), 12345));
+	EXPECT_FALSE(exp_checkpoint.value().Matches("/dev/mmcblk0p3", string(64, 'a'), 12346));
+
+	EXPECT_FALSE(rootfs_writer::CheckpointFromJson(R"({"Partition": "/dev/sda2"})"));
+	EXPECT_FALSE(rootfs_writer::CheckpointFromJson("garbage"));
+}
+
+TEST(RootfsWriterPartitionTests, PartitionsNotConfigured) {
+	conf::MenderConfig config;
+	auto exp_partition = rootfs_writer::GetInactivePartition(config);
+	ASSERT_FALSE(exp_partition);
+	EXPECT_EQ(exp_partition.error().code, make_error_condition(errc::invalid_argument));
+}
+
+TEST(RootfsWriterPartitionTests, IsUbiVolume) {
+	EXPECT_TRUE(rootfs_writer::IsUbiVolume("/dev/ubi0_1"));
+	EXPECT_TRUE(rootfs_writer::IsUbiVolume("ubi0_1"));
+	EXPECT_FALSE(rootfs_writer::IsUbiVolume("/dev/mmcblk0p2"));
+}
@@ -0,0 +1,103 @@
+// Copyright 2023 Northern.tech AS
+//
+//    Licensed under the Apache License, Version 2.0 (the "License");
+//    you may not use this file except in compliance with the License.
+//    You may obtain a copy of the License at
+//
+//        http://www.apache.org/licenses/LICENSE-2.0
+//
+//    Unless required by applicable law or agreed to in writing, software
+//    distributed under the License is distributed on an "AS IS" BASIS,
+//    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//    See the License for the specific language governing permissions and
+//    limitations under the License.
+
+// Update Module plugin used by update_module_test. Logs all calls to the file named by the
+// TEST_PLUGIN_LOG environment variable, and stores the payload in `payload` in the file tree. The
+// state named by TEST_PLUGIN_HANG takes three seconds.
+
+#include <mender-update/update_module/v3/update_module_plugin.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+struct TestPlugin {
+	string work_path;
+	ofstream payload;
+};
+
+static void Log(const string &line) {
+	const char *log_path = getenv("TEST_PLUGIN_LOG");
+	if (log_path != nullptr) {
+		ofstream(log_path, ios::app) << line << endl;
+	}
+}
+
+static void *Open(const char *work_path, mender_update_module_log_func log) {
+	Log("open");
+	log(MENDER_UPDATE_MODULE_LOG_INFO, "Opened");
+	return new TestPlugin {work_path, ofstream()};
+}
+
+static int PayloadFileBegin(void *instance, const char *name, int64_t size) {
+	auto plugin = static_cast<TestPlugin *>(instance);
+	Log(string("begin ") + name + " " + to_string(size));
+	plugin->payload.open(plugin->work_path + "/payload", ios::binary | ios::trunc);
+	return plugin->payload.good() ? 0 : 1;
+}
+
+static int PayloadFileData(void *instance, const uint8_t *data, size_t size) {
+	auto plugin = static_cast<TestPlugin *>(instance);
+	plugin->payload.write(reinterpret_cast<const char *>(data), static_cast<streamsize>(size));
+	return plugin->payload.good() ? 0 : 1;
+}
+
+static int PayloadFileEnd(void *instance) {
+	auto plugin = static_cast<TestPlugin *>(instance);
+	Log("end");
+	plugin->payload.close();
+	return 0;
+}
+
+static int CallState(void *instance, const char *state, char *output, size_t output_size) {
+	Log(state);
+	string s {state};
+	const char *hang = getenv("TEST_PLUGIN_HANG");
+	if (hang != nullptr && s == hang) {
+		this_thread::sleep_for(chrono::seconds(3));
+		Log(s + " returned");
+	}
+	if (s == "NeedsArtifactReboot") {
+		strncpy(output, "Yes", output_size);
+	} else if (s == "SupportsRollback") {
+		strncpy(output, "No", output_size);
+	} else if (s == "ArtifactRollback") {
+		return 2;
+	}
+	return 0;
+}
+
+static void Close(void *instance) {
+	Log("close");
+	delete static_cast<TestPlugin *>(instance);
+}
+
+static const mender_update_module_plugin plugin_funcs {
+	MENDER_UPDATE_MODULE_PLUGIN_ABI_VERSION,
+	Open,
+	PayloadFileBegin,
+	PayloadFileData,
+	PayloadFileEnd,
+	CallState,
+	Close,
+};
+
+extern "C" const mender_update_module_plugin *mender_update_module_plugin() {
+	return &plugin_funcs;
+}
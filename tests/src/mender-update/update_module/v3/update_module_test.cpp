@@ -17,7 +17,9 @@
 #include <sys/stat.h>
 
 #include <algorithm>
+#include <chrono>
 #include <string>
+#include <thread>
 #include <sstream>
 #include <filesystem>
 
@@ -30,6 +32,7 @@
 #include <common/key_value_database_lmdb.hpp>
 #include <common/testing.hpp>
 #include <common/processes.hpp>
+#include <common/tracing.hpp>
 #include <common/error.hpp>
 #include <common/path.hpp>
 
@@ -50,6 +53,7 @@ namespace error = mender::common::error;
 namespace path = mender::common::path;
 
 namespace processes = mender::common::processes;
+namespace tracing = mender::common::tracing;
 
 
 using namespace std;
@@ -1374,6 +1378,375 @@ exit 0
 	EXPECT_FALSE(std::filesystem::exists(temp_dir_.Path() + "/work/files/../rootfs"));
 }
 
+static string ReadLog(const string &log_path) {
+	ifstream f(log_path);
+	stringstream content;
+	content << f.rdbuf();
+	return content.str();
+}
+
+TEST_F(UpdateModuleTests, SessionMode) {
+	conf::MenderConfig config;
+	config.update_module_sessions = true;
+	context::MenderContext ctx(config);
+	auto exp_update_module = update_module::UpdateModule::Create(ctx, "test-type");
+	ASSERT_TRUE(exp_update_module) << exp_update_module.error();
+	auto &update_module = *exp_update_module.value();
+
+	auto log_path = path::Join(temp_dir_.Path(), "calls.log");
+	auto ok = PrepareUpdateModuleScript(update_module, R"(#!/bin/bash
+echo "$1" >> )" + log_path + R"(
+if [ "$1" != "Session" ]; then
+    exit 1
+fi
+exec 3< session
+echo SessionReady
+while read -r state <&3; do
+    echo "  $state" >> )" + log_path + R"(
+    case "$state" in
+        NeedsArtifactReboot)
+            echo "StateDone 0 Yes"
+            ;;
+        SupportsRollback)
+            echo "StateDone 0 No"
+            ;;
+        ArtifactCommit)
+            echo "Some output which isn't part of the protocol"
+            echo "StateDone 0"
+            ;;
+        ArtifactRollback)
+            echo "StateDone 2"
+            ;;
+        *)
+            echo "StateDone 0"
+            ;;
+    esac
+done
+echo "Exited" >> )" + log_path + R"(
+)");
+	ASSERT_TRUE(ok);
+
+	EXPECT_EQ(update_module.ArtifactInstall(), error::NoError);
+	auto reboot = update_module.NeedsReboot();
+	ASSERT_TRUE(reboot) << reboot.error();
+	EXPECT_EQ(reboot.value(), update_module::RebootAction::Yes);
+	auto rollback = update_module.SupportsRollback();
+	ASSERT_TRUE(rollback) << rollback.error();
+	EXPECT_FALSE(rollback.value());
+	EXPECT_EQ(update_module.ArtifactCommit(), error::NoError);
+	auto err = update_module.ArtifactRollback();
+	EXPECT_EQ(err.code, processes::MakeError(processes::NonZeroExitStatusError, "").code)
+		<< err.String();
+	EXPECT_EQ(update_module.Cleanup(), error::NoError);
+
+	EXPECT_EQ(ReadLog(log_path), R"(Session
+  ArtifactInstall
+  NeedsArtifactReboot
+  SupportsRollback
+  ArtifactCommit
+  ArtifactRollback
+  Cleanup
+Exited
+)");
+	EXPECT_FALSE(path::FileExists(GetUpdateModuleWorkDir()));
+}
+
+TEST_F(UpdateModuleTests, SessionModeNotSupported) {
+	conf::MenderConfig config;
+	config.update_module_sessions = true;
+	context::MenderContext ctx(config);
+	auto exp_update_module = update_module::UpdateModule::Create(ctx, "test-type");
+	ASSERT_TRUE(exp_update_module) << exp_update_module.error();
+	auto &update_module = *exp_update_module.value();
+
+	auto log_path = path::Join(temp_dir_.Path(), "calls.log");
+	auto ok = PrepareUpdateModuleScript(update_module, R"(#!/bin/bash
+echo "$1" >> )" + log_path + R"(
+if [ "$1" = "NeedsArtifactReboot" ]; then
+    echo "No"
+fi
+exit 0
+)");
+	ASSERT_TRUE(ok);
+
+	EXPECT_EQ(update_module.ArtifactInstall(), error::NoError);
+	auto reboot = update_module.NeedsReboot();
+	ASSERT_TRUE(reboot) << reboot.error();
+	EXPECT_EQ(reboot.value(), update_module::RebootAction::No);
+	EXPECT_EQ(update_module.Cleanup(), error::NoError);
+
+	// Only one attempt at starting a session.
+	EXPECT_EQ(ReadLog(log_path), R"(Session
+ArtifactInstall
+NeedsArtifactReboot
+Cleanup
+)");
+}
+
+TEST_F(UpdateModuleTests, SessionModeTimeout) {
+	conf::MenderConfig config;
+	config.update_module_sessions = true;
+	config.module_timeout_seconds = 1;
+	context::MenderContext ctx(config);
+	auto exp_update_module = update_module::UpdateModule::Create(ctx, "test-type");
+	ASSERT_TRUE(exp_update_module) << exp_update_module.error();
+	auto &update_module = *exp_update_module.value();
+
+	auto ok = PrepareUpdateModuleScript(update_module, R"(#!/bin/bash
+exec 3< session
+echo SessionReady
+while read -r state <&3; do
+    sleep 10
+done
+)");
+	ASSERT_TRUE(ok);
+
+	auto err = update_module.ArtifactInstall();
+	EXPECT_EQ(err.code, make_error_condition(errc::timed_out)) << err.String();
+}
+
+TEST_F(UpdateModuleTests, SessionModeModuleDoesNotExit) {
+	conf::MenderConfig config;
+	config.update_module_sessions = true;
+	context::MenderContext ctx(config);
+	auto exp_update_module = update_module::UpdateModule::Create(ctx, "test-type");
+	ASSERT_TRUE(exp_update_module) << exp_update_module.error();
+
+	auto ok = PrepareUpdateModuleScript(*exp_update_module.value(), R"(#!/bin/bash
+exec 3< session
+echo SessionReady
+while read -r state <&3; do
+    echo "StateDone 0"
+done
+sleep 30
+)");
+	ASSERT_TRUE(ok);
+
+	EXPECT_EQ(exp_update_module.value()->ArtifactInstall(), error::NoError);
+
+	// The module ignores the end of the session, which must not hold up the client.
+	auto start = chrono::steady_clock::now();
+	exp_update_module.value().reset();
+	EXPECT_LT(chrono::steady_clock::now() - start, chrono::seconds(5));
+}
+
+TEST_F(UpdateModuleTests, SessionModeNoHandshake) {
+	conf::MenderConfig config;
+	config.update_module_sessions = true;
+	context::MenderContext ctx(config);
+	auto exp_update_module = update_module::UpdateModule::Create(ctx, "test-type");
+	ASSERT_TRUE(exp_update_module) << exp_update_module.error();
+	auto &update_module = *exp_update_module.value();
+
+	// Neither speaks the session protocol, nor exits on the unknown state.
+	auto log_path = path::Join(temp_dir_.Path(), "calls.log");
+	auto ok = PrepareUpdateModuleScript(update_module, R"(#!/bin/bash
+echo "$1" >> )" + log_path + R"(
+if [ "$1" = "Session" ]; then
+    sleep 30
+fi
+exit 0
+)");
+	ASSERT_TRUE(ok);
+
+	auto start = chrono::steady_clock::now();
+	EXPECT_EQ(update_module.ArtifactInstall(), error::NoError);
+	EXPECT_EQ(update_module.ArtifactCommit(), error::NoError);
+	EXPECT_LT(chrono::steady_clock::now() - start, chrono::seconds(15));
+
+	EXPECT_EQ(ReadLog(log_path), R"(Session
+ArtifactInstall
+ArtifactCommit
+)");
+}
+
+TEST_F(UpdateModuleTests, PluginStates) {
+	conf::MenderConfig config;
+	context::MenderContext ctx(config);
+	auto exp_update_module = update_module::UpdateModule::Create(ctx, "test-type");
+	ASSERT_TRUE(exp_update_module) << exp_update_module.error();
+	auto &update_module = *exp_update_module.value();
+
+	// The plugin takes precedence over the executable module.
+	auto ok = PrepareUpdateModuleScript(update_module, R"(#!/bin/bash
+exit 1
+)");
+	ASSERT_TRUE(ok);
+	std::filesystem::copy_file(TEST_PLUGIN_PATH, GetUpdateModulePath() + ".so");
+
+	auto log_path = path::Join(temp_dir_.Path(), "calls.log");
+	setenv("TEST_PLUGIN_LOG", log_path.c_str(), 1);
+
+	auto trace_path = path::Join(temp_dir_.Path(), "trace.json");
+	ASSERT_EQ(tracing::Start(trace_path), error::NoError);
+
+	auto sizes = update_module.ProvidePayloadFileSizes();
+	ASSERT_TRUE(sizes) << sizes.error();
+	EXPECT_TRUE(sizes.value());
+	EXPECT_EQ(update_module.ArtifactInstall(), error::NoError);
+	auto reboot = update_module.NeedsReboot();
+	ASSERT_TRUE(reboot) << reboot.error();
+	EXPECT_EQ(reboot.value(), update_module::RebootAction::Yes);
+	auto rollback = update_module.SupportsRollback();
+	ASSERT_TRUE(rollback) << rollback.error();
+	EXPECT_FALSE(rollback.value());
+	auto err = update_module.ArtifactRollback();
+	EXPECT_EQ(err.code, processes::MakeError(processes::NonZeroExitStatusError, "").code)
+		<< err.String();
+	EXPECT_THAT(err.String(), testing::HasSubstr(" 2"));
+	EXPECT_EQ(update_module.Cleanup(), error::NoError);
+
+	tracing::Stop();
+	unsetenv("TEST_PLUGIN_LOG");
+
+	// Plugin calls are traced like process calls.
+	auto trace = ReadLog(trace_path);
+	for (auto state : {"ArtifactInstall", "ArtifactRollback", "Cleanup"}) {
+		for (auto phase : {"b", "e"}) {
+			EXPECT_THAT(
+				trace,
+				testing::HasSubstr(
+					string("{\"ph\":\"") + phase + "\",\"cat\":\"update_module\",\"name\":\""
+					+ state + "\""));
+		}
+	}
+
+	EXPECT_EQ(ReadLog(log_path), R"(open
+ArtifactInstall
+NeedsArtifactReboot
+SupportsRollback
+ArtifactRollback
+Cleanup
+close
+)");
+	EXPECT_FALSE(path::FileExists(GetUpdateModuleWorkDir()));
+}
+
+TEST_F(UpdateModuleTests, PluginStateTimesOut) {
+	TestEventLoop loop;
+	conf::MenderConfig config;
+	config.module_timeout_seconds = 1;
+	context::MenderContext ctx(config);
+	auto exp_update_module = update_module::UpdateModule::Create(ctx, "test-type");
+	ASSERT_TRUE(exp_update_module) << exp_update_module.error();
+	auto update_module = std::move(exp_update_module.value());
+
+	auto ok = PrepareUpdateModuleScript(*update_module);
+	ASSERT_TRUE(ok);
+	std::filesystem::copy_file(TEST_PLUGIN_PATH, GetUpdateModulePath() + ".so");
+
+	auto log_path = path::Join(temp_dir_.Path(), "calls.log");
+	setenv("TEST_PLUGIN_LOG", log_path.c_str(), 1);
+	setenv("TEST_PLUGIN_HANG", "ArtifactInstall", 1);
+
+	// The event loop keeps running while the plugin is busy.
+	bool ticked {false};
+	events::Timer tick(loop);
+	tick.AsyncWait(chrono::milliseconds {200}, [&ticked](error::Error err) { ticked = true; });
+
+	error::Error install_err;
+	auto err = update_module->AsyncArtifactInstall(loop, [&](error::Error err) {
+		install_err = err;
+		loop.Stop();
+	});
+	ASSERT_EQ(err, error::NoError);
+	loop.Run();
+	EXPECT_TRUE(ticked);
+	EXPECT_EQ(install_err.code, make_error_condition(errc::timed_out)) << install_err.String();
+
+	// Doesn't wait for the plugin to return.
+	auto start = chrono::steady_clock::now();
+	update_module.reset();
+	EXPECT_LT(chrono::steady_clock::now() - start, chrono::seconds(1));
+
+	// Once it does, it is closed from its own thread.
+	this_thread::sleep_for(chrono::seconds(3));
+	unsetenv("TEST_PLUGIN_HANG");
+	unsetenv("TEST_PLUGIN_LOG");
+
+	EXPECT_EQ(ReadLog(log_path), R"(open
+ArtifactInstall
+ArtifactInstall returned
+close
+)");
+}
+
+TEST_F(UpdateModuleTests, BuiltinModuleStates) {
+	conf::MenderConfig config;
+	config.builtin_update_modules = {"single-file"};
+	context::MenderContext ctx(config);
+	auto exp_update_module = update_module::UpdateModule::Create(ctx, "single-file");
+	ASSERT_TRUE(exp_update_module) << exp_update_module.error();
+	auto &update_module = *exp_update_module.value();
+
+	// The built-in module takes precedence over the installed one.
+	auto ok = PrepareUpdateModuleScript(update_module, R"(#!/bin/bash
+exit 1
+)");
+	ASSERT_TRUE(ok);
+
+	// What the download would have left behind.
+	auto files = path::Join(GetUpdateModuleWorkDir(), "files");
+	ASSERT_EQ(path::CreateDirectories(files), error::NoError);
+	auto dest_dir = path::Join(temp_dir_.Path(), "dest");
+	ofstream(path::Join(files, "filename")) << "file.txt\n";
+	ofstream(path::Join(files, "dest_dir")) << dest_dir << "\n";
+	ofstream(path::Join(files, "file.txt")) << "content";
+
+	auto sizes = update_module.ProvidePayloadFileSizes();
+	ASSERT_TRUE(sizes) << sizes.error();
+	EXPECT_TRUE(sizes.value());
+	auto err = update_module.ArtifactInstall();
+	ASSERT_EQ(err, error::NoError) << err.String();
+	EXPECT_TRUE(path::FileExists(path::Join(dest_dir, "file.txt")));
+	auto reboot = update_module.NeedsReboot();
+	ASSERT_TRUE(reboot) << reboot.error();
+	EXPECT_EQ(reboot.value(), update_module::RebootAction::No);
+	auto rollback = update_module.SupportsRollback();
+	ASSERT_TRUE(rollback) << rollback.error();
+	EXPECT_TRUE(rollback.value());
+	EXPECT_EQ(update_module.Cleanup(), error::NoError);
+	EXPECT_FALSE(path::FileExists(GetUpdateModuleWorkDir()));
+}
+
+TEST_F(UpdateModuleTests, PluginDownload) {
+	UpdateModuleTestWithDefaultArtifact art(*this);
+
+	auto maybe_script = PrepareUpdateModuleScript(*art.update_module);
+	ASSERT_TRUE(maybe_script) << maybe_script.error();
+	std::filesystem::copy_file(TEST_PLUGIN_PATH, maybe_script.value() + ".so");
+
+	auto log_path = path::Join(temp_dir_.Path(), "calls.log");
+	setenv("TEST_PLUGIN_LOG", log_path.c_str(), 1);
+
+	auto err = art.update_module->Download(*art.payload);
+	EXPECT_EQ(err, error::NoError) << err.String();
+
+	unsetenv("TEST_PLUGIN_LOG");
+
+	EXPECT_EQ(ReadLog(log_path), R"(open
+begin rootfs 1048576
+end
+)");
+	EXPECT_TRUE(
+		FilesEqual(path::Join(work_dir_, "payload"), path::Join(temp_dir_.Path(), "rootfs")));
+}
+
+TEST_F(UpdateModuleTests, PluginLoadError) {
+	conf::MenderConfig config;
+	context::MenderContext ctx(config);
+	auto exp_update_module = update_module::UpdateModule::Create(ctx, "test-type");
+	ASSERT_TRUE(exp_update_module) << exp_update_module.error();
+	auto &update_module = *exp_update_module.value();
+
+	auto ok = PrepareUpdateModuleScript(update_module);
+	ASSERT_TRUE(ok);
+	ASSERT_TRUE(PrepareTestFile("update-module.so", false, "Not a shared object"));
+
+	auto err = update_module.ArtifactInstall();
+	EXPECT_EQ(err.code, make_error_condition(errc::executable_format_error)) << err.String();
+}
+
 TEST(AsyncFifoOpener, Open) {
 	TestEventLoop loop;
 	TemporaryDirectory tmpdir;